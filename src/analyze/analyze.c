@@ -117,6 +117,16 @@ struct unit_times {
         usec_t time;
 };
 
+struct unit_phases {
+        char *name;
+        char *path;
+        usec_t queued;
+        usec_t running;
+        usec_t forked;
+        usec_t ready;
+        usec_t active;
+};
+
 struct host_info {
         char *hostname;
         char *kernel_name;
@@ -154,6 +164,33 @@ static int bus_get_uint64_property(sd_bus *bus, const char *path, const char *in
         return 0;
 }
 
+static int bus_get_unsigned_property(sd_bus *bus, const char *path, const char *interface, const char *property, uint32_t *val) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(interface);
+        assert(property);
+        assert(val);
+
+        r = sd_bus_get_property_trivial(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        interface,
+                        property,
+                        &error,
+                        'u', val);
+
+        if (r < 0) {
+                log_error("Failed to parse reply: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        return 0;
+}
+
 static int bus_get_unit_property_strv(sd_bus *bus, const char *path, const char *property, char ***strv) {
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         int r;
@@ -1016,6 +1053,41 @@ static int analyze_time(sd_bus *bus) {
         return 0;
 }
 
+static int analyze_unit_cache(sd_bus *bus) {
+        char ts1[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX];
+        uint64_t hit_usec, miss_usec;
+        uint32_t hits, misses;
+
+        if (bus_get_unsigned_property(bus,
+                                      "/org/freedesktop/systemd1",
+                                      "org.freedesktop.systemd1.Manager",
+                                      "UnitCacheHits",
+                                      &hits) < 0 ||
+            bus_get_unsigned_property(bus,
+                                      "/org/freedesktop/systemd1",
+                                      "org.freedesktop.systemd1.Manager",
+                                      "UnitCacheMisses",
+                                      &misses) < 0 ||
+            bus_get_uint64_property(bus,
+                                    "/org/freedesktop/systemd1",
+                                    "org.freedesktop.systemd1.Manager",
+                                    "UnitCacheHitUSec",
+                                    &hit_usec) < 0 ||
+            bus_get_uint64_property(bus,
+                                    "/org/freedesktop/systemd1",
+                                    "org.freedesktop.systemd1.Manager",
+                                    "UnitCacheMissUSec",
+                                    &miss_usec) < 0)
+                return -EIO;
+
+        printf("Unit files loaded from cache: %u in %s\n"
+               "Unit files parsed from disk: %u in %s\n",
+               hits, format_timespan(ts1, sizeof(ts1), hit_usec, 1),
+               misses, format_timespan(ts2, sizeof(ts2), miss_usec, 1));
+
+        return 0;
+}
+
 static int graph_one_property(sd_bus *bus, const UnitInfo *u, const char* prop, const char *color, char* patterns[], char* from_patterns[], char* to_patterns[]) {
         _cleanup_strv_free_ char **units = NULL;
         char **unit;
@@ -1337,6 +1409,241 @@ static int dump_syscall_filters(char** names) {
 }
 #endif
 
+static int compare_unit_queued(const void *a, const void *b) {
+        return compare(((struct unit_phases *)a)->queued,
+                       ((struct unit_phases *)b)->queued);
+}
+
+static void free_unit_phases(struct unit_phases *t, unsigned n) {
+        struct unit_phases *p;
+
+        for (p = t; p < t + n; p++) {
+                free(p->name);
+                free(p->path);
+        }
+
+        free(t);
+}
+
+static int acquire_phase_data(sd_bus *bus, struct unit_phases **out) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        struct unit_phases *unit_phases = NULL;
+        size_t size = 0;
+        int r, c = 0;
+        UnitInfo u;
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "ListUnits",
+                        &error, &reply,
+                        NULL);
+        if (r < 0) {
+                log_error("Failed to list units: %s", bus_error_message(&error, -r));
+                goto fail;
+        }
+
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(ssssssouso)");
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
+
+        while ((r = bus_parse_unit_info(reply, &u)) > 0) {
+                struct unit_phases *t;
+
+                if (!GREEDY_REALLOC(unit_phases, size, c+1)) {
+                        r = log_oom();
+                        goto fail;
+                }
+
+                t = unit_phases+c;
+                t->name = t->path = NULL;
+
+                if (bus_get_uint64_property(bus, u.unit_path,
+                                            "org.freedesktop.systemd1.Unit",
+                                            "JobQueuedTimestampMonotonic",
+                                            &t->queued) < 0 ||
+                    bus_get_uint64_property(bus, u.unit_path,
+                                            "org.freedesktop.systemd1.Unit",
+                                            "JobRunningTimestampMonotonic",
+                                            &t->running) < 0 ||
+                    bus_get_uint64_property(bus, u.unit_path,
+                                            "org.freedesktop.systemd1.Unit",
+                                            "FirstForkTimestampMonotonic",
+                                            &t->forked) < 0 ||
+                    bus_get_uint64_property(bus, u.unit_path,
+                                            "org.freedesktop.systemd1.Unit",
+                                            "ReadyTimestampMonotonic",
+                                            &t->ready) < 0 ||
+                    bus_get_uint64_property(bus, u.unit_path,
+                                            "org.freedesktop.systemd1.Unit",
+                                            "ActiveEnterTimestampMonotonic",
+                                            &t->active) < 0) {
+                        r = -EIO;
+                        goto fail;
+                }
+
+                /* Only units that were started by a job */
+                if (t->queued == 0)
+                        continue;
+
+                t->name = strdup(u.id);
+                t->path = strdup(u.unit_path);
+                if (!t->name || !t->path) {
+                        c++;
+                        r = log_oom();
+                        goto fail;
+                }
+                c++;
+        }
+        if (r < 0) {
+                bus_log_parse_error(r);
+                goto fail;
+        }
+
+        qsort_safe(unit_phases, c, sizeof(struct unit_phases), compare_unit_queued);
+
+        *out = unit_phases;
+        return c;
+
+fail:
+        if (unit_phases)
+                free_unit_phases(unit_phases, (unsigned) c);
+        return r;
+}
+
+static struct unit_phases *find_unit_phases(struct unit_phases *phases, unsigned n, const char *name) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                if (streq(phases[i].name, name))
+                        return phases + i;
+
+        return NULL;
+}
+
+static usec_t phase_span(usec_t from, usec_t to) {
+        return from > 0 && to >= from ? to - from : USEC_INFINITY;
+}
+
+static const char *format_phase(char *buf, size_t l, usec_t t) {
+        if (t == USEC_INFINITY)
+                return "-";
+
+        return format_timespan(buf, l, t, USEC_PER_MSEC);
+}
+
+static int analyze_start_phases(sd_bus *bus, char *names[]) {
+        char ts1[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX], ts3[FORMAT_TIMESPAN_MAX],
+             ts4[FORMAT_TIMESPAN_MAX], ts5[FORMAT_TIMESPAN_MAX];
+        struct unit_phases *phases, *p, *first;
+        usec_t base, working = 0;
+        const char *end;
+        unsigned i;
+        int n, r = 0;
+
+        n = acquire_phase_data(bus, &phases);
+        if (n <= 0)
+                return n;
+
+        base = phases[0].queued;
+
+        pager_open(arg_no_pager, false);
+
+        puts("For the most recent start job of each unit: when it was queued (\"@\"), how long it waited for its\n"
+             "dependencies, and how long it took from then on to fork, to report readiness and to become active.\n");
+
+        printf("%16s %10s %10s %10s %10s  %s\n", "QUEUED", "WAITING", "FORK", "READY", "ACTIVE", "UNIT");
+
+        for (i = 0; i < (unsigned) n; i++) {
+                p = phases + i;
+
+                if (!strv_isempty(names) && !strv_fnmatch(names, p->name, 0))
+                        continue;
+
+                printf("%15s%s %10s %10s %10s %10s  %s\n",
+                       "@", format_timespan(ts1, sizeof(ts1), p->queued - base, USEC_PER_MSEC),
+                       format_phase(ts2, sizeof(ts2), phase_span(p->queued, p->running)),
+                       format_phase(ts3, sizeof(ts3), phase_span(p->running, p->forked)),
+                       format_phase(ts4, sizeof(ts4), phase_span(p->forked ?: p->running, p->ready)),
+                       format_phase(ts5, sizeof(ts5), phase_span(p->ready ?: p->running, p->active)),
+                       p->name);
+        }
+
+        /* Now follow the critical path backwards from the end unit: at each step go to the unit we were ordered
+         * after that became active last before our job could run, i.e. the one that held us up. Time spent by
+         * the units on this path between being dispatched and becoming active is working time, everything else
+         * on the path was spent waiting. */
+
+        end = strv_isempty(names) ? SPECIAL_DEFAULT_TARGET : names[0];
+        p = find_unit_phases(phases, n, end);
+        if (!p || p->active < p->queued) {
+                log_info("No complete start job recorded for %s, not showing critical path.", end);
+                goto finish;
+        }
+
+        printf("\nCritical path to %s:\n", end);
+        printf("%16s %10s %10s  %s\n", "ACTIVE", "WAITING", "WORKING", "UNIT");
+
+        /* Bail out after n steps, in case of ordering cycles */
+        first = p;
+        for (i = 0; i < (unsigned) n; i++) {
+                _cleanup_strv_free_ char **after = NULL;
+                struct unit_phases *next = NULL;
+                char **a;
+
+                first = p;
+
+                if (p->running > 0 && p->active >= p->running)
+                        working += p->active - p->running;
+
+                printf("%15s%s %10s %10s  %s\n",
+                       "@", format_timespan(ts1, sizeof(ts1), p->active - base, USEC_PER_MSEC),
+                       format_phase(ts2, sizeof(ts2), phase_span(p->queued, p->running)),
+                       format_phase(ts3, sizeof(ts3), phase_span(p->running, p->active)),
+                       p->name);
+
+                if (p->running == 0)
+                        break;
+
+                r = bus_get_unit_property_strv(bus, p->path, "After", &after);
+                if (r < 0)
+                        goto finish;
+
+                STRV_FOREACH(a, after) {
+                        struct unit_phases *q;
+
+                        q = find_unit_phases(phases, n, *a);
+                        if (!q || q->active == 0 || q->active > p->running)
+                                continue;
+
+                        if (!next || q->active > next->active)
+                                next = q;
+                }
+
+                if (!next)
+                        break;
+
+                p = next;
+        }
+
+        p = find_unit_phases(phases, n, end);
+        printf("\nTotal %s, of which %s working and %s waiting.\n",
+               format_timespan(ts1, sizeof(ts1), p->active - first->queued, USEC_PER_MSEC),
+               format_timespan(ts2, sizeof(ts2), MIN(working, p->active - first->queued), USEC_PER_MSEC),
+               format_timespan(ts3, sizeof(ts3), p->active - first->queued - MIN(working, p->active - first->queued), USEC_PER_MSEC));
+
+        r = 0;
+
+finish:
+        free_unit_phases(phases, (unsigned) n);
+        return r < 0 ? r : 0;
+}
+
 static void help(void) {
 
         pager_open(arg_no_pager, false);
@@ -1366,6 +1673,8 @@ static void help(void) {
                "  set-log-level LEVEL      Set logging threshold for manager\n"
                "  set-log-target TARGET    Set logging target for manager\n"
                "  dump                     Output state serialization of service manager\n"
+               "  unit-cache               Print statistics of the unit file cache\n"
+               "  start-phases [UNIT...]   Print where time went while starting units\n"
                "  syscall-filter [NAME...] Print list of syscalls in seccomp filter\n"
                "  verify FILE...           Check unit files for correctness\n"
                , program_invocation_short_name);
@@ -1530,6 +1839,10 @@ int main(int argc, char *argv[]) {
                         r = dot(bus, argv+optind+1);
                 else if (streq(argv[optind], "dump"))
                         r = dump(bus, argv+optind+1);
+                else if (streq(argv[optind], "unit-cache"))
+                        r = analyze_unit_cache(bus);
+                else if (streq(argv[optind], "start-phases"))
+                        r = analyze_start_phases(bus, argv+optind+1);
                 else if (streq(argv[optind], "set-log-level"))
                         r = set_log_level(bus, argv+optind+1);
                 else if (streq(argv[optind], "set-log-target"))
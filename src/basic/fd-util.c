@@ -22,6 +22,7 @@
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "dirent-util.h"
@@ -205,6 +206,28 @@ _pure_ static bool fd_in_set(int fd, const int fdset[], unsigned n_fdset) {
         return false;
 }
 
+static int close_all_fds_brute(const int except[], unsigned n_except) {
+        struct rlimit rl;
+        int fd, r = 0;
+
+        /* When /proc isn't available (for example in chroots)
+         * the fallback is brute forcing through the fd
+         * table */
+
+        assert_se(getrlimit(RLIMIT_NOFILE, &rl) >= 0);
+        for (fd = 3; fd < (int) rl.rlim_max; fd ++) {
+
+                if (fd_in_set(fd, except, n_except))
+                        continue;
+
+                if (close_nointr(fd) < 0)
+                        if (errno != EBADF && r == 0)
+                                r = -errno;
+        }
+
+        return r;
+}
+
 int close_all_fds(const int except[], unsigned n_except) {
         _cleanup_closedir_ DIR *d = NULL;
         struct dirent *de;
@@ -213,27 +236,8 @@ int close_all_fds(const int except[], unsigned n_except) {
         assert(n_except == 0 || except);
 
         d = opendir("/proc/self/fd");
-        if (!d) {
-                int fd;
-                struct rlimit rl;
-
-                /* When /proc isn't available (for example in chroots)
-                 * the fallback is brute forcing through the fd
-                 * table */
-
-                assert_se(getrlimit(RLIMIT_NOFILE, &rl) >= 0);
-                for (fd = 3; fd < (int) rl.rlim_max; fd ++) {
-
-                        if (fd_in_set(fd, except, n_except))
-                                continue;
-
-                        if (close_nointr(fd) < 0)
-                                if (errno != EBADF && r == 0)
-                                        r = -errno;
-                }
-
-                return r;
-        }
+        if (!d)
+                return close_all_fds_brute(except, n_except);
 
         FOREACH_DIRENT(de, d, return -errno) {
                 int fd = -1;
@@ -261,6 +265,60 @@ int close_all_fds(const int except[], unsigned n_except) {
         return r;
 }
 
+int close_all_fds_nomalloc(const int except[], unsigned n_except) {
+        union {
+                struct dirent64 de;
+                uint8_t raw[4096];
+        } buffer;
+        int dfd, r = 0;
+
+        assert(n_except == 0 || except);
+
+        /* Same as close_all_fds(), but doesn't allocate memory, hence is safe to call in a child that shares the
+         * address space with its (multi-threaded) parent, i.e. after clone(CLONE_VM|CLONE_VFORK). opendir() would
+         * malloc() and might deadlock on an allocator lock some other thread of the parent held at clone() time.
+         * Hence, read the directory with getdents64() into a buffer on the stack. */
+
+        dfd = open("/proc/self/fd", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dfd < 0)
+                return close_all_fds_brute(except, n_except);
+
+        for (;;) {
+                ssize_t n, offset;
+
+                n = syscall(__NR_getdents64, dfd, buffer.raw, sizeof(buffer.raw));
+                if (n < 0) {
+                        r = -errno;
+                        break;
+                }
+                if (n == 0)
+                        break;
+
+                for (offset = 0; offset < n;) {
+                        struct dirent64 *de = (struct dirent64*) (buffer.raw + offset);
+                        int fd = -1;
+
+                        offset += de->d_reclen;
+
+                        if (safe_atoi(de->d_name, &fd) < 0)
+                                continue;
+
+                        if (fd < 3 || fd == dfd)
+                                continue;
+
+                        if (fd_in_set(fd, except, n_except))
+                                continue;
+
+                        if (close_nointr(fd) < 0)
+                                if (errno != EBADF && r == 0)
+                                        r = -errno;
+                }
+        }
+
+        safe_close(dfd);
+        return r;
+}
+
 int same_fd(int a, int b) {
         struct stat sta, stb;
         pid_t pid;
@@ -66,6 +66,7 @@ int fd_cloexec(int fd, bool cloexec);
 void stdio_unset_cloexec(void);
 
 int close_all_fds(const int except[], unsigned n_except);
+int close_all_fds_nomalloc(const int except[], unsigned n_except);
 
 int same_fd(int a, int b);
 
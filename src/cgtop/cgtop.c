@@ -19,6 +19,7 @@
 
 #include <alloca.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <signal.h>
 #include <stdint.h>
@@ -36,14 +37,37 @@
 #include "fd-util.h"
 #include "fileio.h"
 #include "hashmap.h"
+#include "logs-show.h"
 #include "parse-util.h"
 #include "path-util.h"
 #include "process-util.h"
+#include "rlimit-util.h"
 #include "stdio-util.h"
 #include "terminal-util.h"
 #include "unit-name.h"
 #include "util.h"
 
+typedef enum Controller {
+        CONTROLLER_SYSTEMD,
+        CONTROLLER_CPU,
+        CONTROLLER_CPUACCT,
+        CONTROLLER_MEMORY,
+        CONTROLLER_IO,
+        CONTROLLER_BLKIO,
+        CONTROLLER_PIDS,
+        _CONTROLLER_MAX,
+} Controller;
+
+static const char* const controller_table[_CONTROLLER_MAX] = {
+        [CONTROLLER_SYSTEMD] = SYSTEMD_CGROUP_CONTROLLER,
+        [CONTROLLER_CPU]     = "cpu",
+        [CONTROLLER_CPUACCT] = "cpuacct",
+        [CONTROLLER_MEMORY]  = "memory",
+        [CONTROLLER_IO]      = "io",
+        [CONTROLLER_BLKIO]   = "blkio",
+        [CONTROLLER_PIDS]    = "pids",
+};
+
 typedef struct Group {
         char *path;
 
@@ -51,6 +75,7 @@ typedef struct Group {
         bool cpu_valid:1;
         bool memory_valid:1;
         bool io_valid:1;
+        bool stale:1;
 
         uint64_t n_tasks;
 
@@ -65,12 +90,18 @@ typedef struct Group {
         uint64_t io_input, io_output;
         nsec_t io_timestamp;
         uint64_t io_input_bps, io_output_bps;
+
+        /* The cgroup directory and the attribute file we read, per controller, kept open across
+         * iterations. On the unified hierarchy only the directory of the first controller is used. */
+        DIR *dirs[_CONTROLLER_MAX];
+        int fds[_CONTROLLER_MAX];
 } Group;
 
 static unsigned arg_depth = 3;
 static unsigned arg_iterations = (unsigned) -1;
 static bool arg_batch = false;
 static bool arg_raw = false;
+static bool arg_json = false;
 static usec_t arg_delay = 1*USEC_PER_SEC;
 static char* arg_machine = NULL;
 static char* arg_root = NULL;
@@ -96,9 +127,37 @@ static enum {
         CPU_TIME,
 } arg_cpu_type = CPU_PERCENT;
 
+/* How many directories and files we may keep open, derived from RLIMIT_NOFILE */
+static unsigned n_cached = 0, max_cached = 0;
+
+static char *read_buffer = NULL;
+static size_t read_buffer_allocated = 0;
+
+static void group_close_handles(Group *g) {
+        unsigned k;
+
+        assert(g);
+
+        for (k = 0; k < _CONTROLLER_MAX; k++) {
+                if (g->dirs[k]) {
+                        g->dirs[k] = safe_closedir(g->dirs[k]);
+                        n_cached--;
+                }
+
+                if (g->fds[k] >= 0) {
+                        g->fds[k] = safe_close(g->fds[k]);
+                        n_cached--;
+                }
+        }
+
+        g->stale = false;
+}
+
 static void group_free(Group *g) {
         assert(g);
 
+        group_close_handles(g);
+
         free(g->path);
         free(g);
 }
@@ -125,24 +184,168 @@ static const char *maybe_format_bytes(char *buf, size_t l, bool is_valid, uint64
         return format_bytes(buf, l, t);
 }
 
-static int process(
-                const char *controller,
+static const char *controller_attribute(Controller k, bool all_unified) {
+
+        /* Returns the attribute file we read for the controller, or NULL if there's nothing to read for it
+         * in the current mode */
+
+        switch (k) {
+
+        case CONTROLLER_SYSTEMD:
+                return IN_SET(arg_count, COUNT_ALL_PROCESSES, COUNT_USERSPACE_PROCESSES) ? "cgroup.procs" : NULL;
+
+        case CONTROLLER_PIDS:
+                return arg_count == COUNT_PIDS ? "pids.current" : NULL;
+
+        case CONTROLLER_CPU:
+                return all_unified ? "cpu.stat" : NULL;
+
+        case CONTROLLER_CPUACCT:
+                return all_unified ? NULL : "cpuacct.usage";
+
+        case CONTROLLER_MEMORY:
+                return all_unified ? "memory.current" : "memory.usage_in_bytes";
+
+        case CONTROLLER_IO:
+                return all_unified ? "io.stat" : NULL;
+
+        case CONTROLLER_BLKIO:
+                return all_unified ? NULL : "blkio.io_service_bytes";
+
+        default:
+                assert_not_reached("Unknown controller");
+        }
+}
+
+static int group_get_dir(Group *g, Controller k, DIR **ret, DIR **ret_uncached) {
+        _cleanup_free_ char *p = NULL;
+        DIR *d;
+        int r;
+
+        assert(g);
+        assert(ret);
+        assert(ret_uncached);
+
+        if (g->dirs[k]) {
+                /* Start over, so that we see subgroups created since the last iteration */
+                rewinddir(g->dirs[k]);
+
+                *ret = g->dirs[k];
+                *ret_uncached = NULL;
+                return 0;
+        }
+
+        r = cg_get_path(controller_table[k], g->path, NULL, &p);
+        if (r < 0)
+                return r;
+
+        d = opendir(p);
+        if (!d)
+                return -errno;
+
+        if (n_cached < max_cached) {
+                g->dirs[k] = d;
+                n_cached++;
+                *ret_uncached = NULL;
+        } else
+                *ret_uncached = d;
+
+        *ret = d;
+        return 0;
+}
+
+static int group_get_fd(Group *g, Controller k, DIR *d, const char *attribute, int *ret, int *ret_uncached) {
+        int fd;
+
+        assert(g);
+        assert(d);
+        assert(attribute);
+        assert(ret);
+        assert(ret_uncached);
+
+        if (g->fds[k] >= 0) {
+                *ret = g->fds[k];
+                *ret_uncached = -1;
+                return 0;
+        }
+
+        fd = openat(dirfd(d), attribute, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        if (n_cached < max_cached) {
+                g->fds[k] = fd;
+                n_cached++;
+                *ret_uncached = -1;
+        } else
+                *ret_uncached = fd;
+
+        *ret = fd;
+        return 0;
+}
+
+static int read_attribute(int fd, char **ret) {
+        size_t n = 0;
+
+        assert(fd >= 0);
+        assert(ret);
+
+        /* cgroupfs regenerates the contents when read from the beginning, hence we can simply pread() the
+         * same fd again in each iteration. The returned buffer is only valid until the next call. */
+
+        for (;;) {
+                ssize_t l;
+
+                if (!GREEDY_REALLOC(read_buffer, read_buffer_allocated, n + LINE_MAX + 1))
+                        return -ENOMEM;
+
+                l = pread(fd, read_buffer + n, read_buffer_allocated - n - 1, n);
+                if (l < 0)
+                        return -errno;
+                if (l == 0)
+                        break;
+
+                n += l;
+        }
+
+        read_buffer[n] = 0;
+
+        *ret = read_buffer;
+        return 0;
+}
+
+static char *next_line(char **p) {
+        char *l, *e;
+
+        assert(p);
+
+        l = *p;
+        if (isempty(l))
+                return NULL;
+
+        e = strchr(l, '\n');
+        if (e) {
+                *e = 0;
+                *p = e + 1;
+        } else
+                *p = NULL;
+
+        return l;
+}
+
+static int group_acquire(
                 const char *path,
                 Hashmap *a,
                 Hashmap *b,
-                unsigned iteration,
                 Group **ret) {
 
         Group *g;
-        int r, all_unified;
+        unsigned k;
+        int r;
 
-        assert(controller);
         assert(path);
         assert(a);
-
-        all_unified = cg_all_unified();
-        if (all_unified < 0)
-                return all_unified;
+        assert(ret);
 
         g = hashmap_get(a, path);
         if (!g) {
@@ -152,6 +355,9 @@ static int process(
                         if (!g)
                                 return -ENOMEM;
 
+                        for (k = 0; k < _CONTROLLER_MAX; k++)
+                                g->fds[k] = -1;
+
                         g->path = strdup(path);
                         if (!g->path) {
                                 group_free(g);
@@ -172,18 +378,53 @@ static int process(
                 }
         }
 
-        if (streq(controller, SYSTEMD_CGROUP_CONTROLLER) && IN_SET(arg_count, COUNT_ALL_PROCESSES, COUNT_USERSPACE_PROCESSES)) {
-                _cleanup_fclose_ FILE *f = NULL;
-                pid_t pid;
+        *ret = g;
+        return 0;
+}
 
-                r = cg_enumerate_processes(controller, path, &f);
-                if (r == -ENOENT)
-                        return 0;
-                if (r < 0)
-                        return r;
+static int process(
+                Controller k,
+                Group *g,
+                DIR *d,
+                bool all_unified,
+                unsigned iteration) {
+
+        _cleanup_close_ int uncached = -1;
+        const char *attribute;
+        char *buf, *l;
+        int fd, r;
+
+        assert(g);
+        assert(d);
+
+        attribute = controller_attribute(k, all_unified);
+        if (!attribute)
+                return 0;
+
+        r = group_get_fd(g, k, d, attribute, &fd, &uncached);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        r = read_attribute(fd, &buf);
+        if (r == -ENODEV) {
+                /* The cgroup was removed, and maybe created anew under the same name, since we opened it.
+                 * Let's reopen everything on the next iteration. */
+                g->stale = true;
+                return 0;
+        }
+        if (r < 0)
+                return r;
+
+        if (k == CONTROLLER_SYSTEMD) {
+                pid_t pid;
 
                 g->n_tasks = 0;
-                while (cg_read_pid(f, &pid) > 0) {
+                while ((l = next_line(&buf))) {
+
+                        if (parse_pid(l, &pid) < 0)
+                                continue;
 
                         if (arg_count == COUNT_USERSPACE_PROCESSES && is_kernel_thread(pid) > 0)
                                 continue;
@@ -194,64 +435,37 @@ static int process(
                 if (g->n_tasks > 0)
                         g->n_tasks_valid = true;
 
-        } else if (streq(controller, "pids") && arg_count == COUNT_PIDS) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
-
-                r = cg_get_path(controller, path, "pids.current", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
-                if (r == -ENOENT)
-                        return 0;
-                if (r < 0)
-                        return r;
+        } else if (k == CONTROLLER_PIDS) {
 
-                r = safe_atou64(v, &g->n_tasks);
+                r = safe_atou64(strstrip(buf), &g->n_tasks);
                 if (r < 0)
                         return r;
 
                 if (g->n_tasks > 0)
                         g->n_tasks_valid = true;
 
-        } else if (streq(controller, "cpu") || streq(controller, "cpuacct")) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
-                uint64_t new_usage;
+        } else if (IN_SET(k, CONTROLLER_CPU, CONTROLLER_CPUACCT)) {
+                uint64_t new_usage = 0;
                 nsec_t timestamp;
 
-                if (all_unified) {
-                        const char *keys[] = { "usage_usec", NULL };
-                        _cleanup_free_ char *val = NULL;
+                if (k == CONTROLLER_CPU) {
+                        const char *v = NULL;
 
-                        if (!streq(controller, "cpu"))
-                                return 0;
-
-                        r = cg_get_keyed_attribute("cpu", path, "cpu.stat", keys, &val);
-                        if (r == -ENOENT)
+                        while ((l = next_line(&buf))) {
+                                v = startswith(l, "usage_usec ");
+                                if (v)
+                                        break;
+                        }
+                        if (!v)
                                 return 0;
-                        if (r < 0)
-                                return r;
 
-                        r = safe_atou64(val, &new_usage);
+                        r = safe_atou64(v, &new_usage);
                         if (r < 0)
                                 return r;
 
                         new_usage *= NSEC_PER_USEC;
                 } else {
-                        if (!streq(controller, "cpuacct"))
-                                return 0;
-
-                        r = cg_get_path(controller, path, "cpuacct.usage", &p);
-                        if (r < 0)
-                                return r;
-
-                        r = read_one_line_file(p, &v);
-                        if (r == -ENOENT)
-                                return 0;
-                        if (r < 0)
-                                return r;
-
-                        r = safe_atou64(v, &new_usage);
+                        r = safe_atou64(strstrip(buf), &new_usage);
                         if (r < 0)
                                 return r;
                 }
@@ -276,65 +490,33 @@ static int process(
                 g->cpu_timestamp = timestamp;
                 g->cpu_iteration = iteration;
 
-        } else if (streq(controller, "memory")) {
-                _cleanup_free_ char *p = NULL, *v = NULL;
+        } else if (k == CONTROLLER_MEMORY) {
 
-                if (all_unified)
-                        r = cg_get_path(controller, path, "memory.current", &p);
-                else
-                        r = cg_get_path(controller, path, "memory.usage_in_bytes", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
-                if (r == -ENOENT)
-                        return 0;
-                if (r < 0)
-                        return r;
-
-                r = safe_atou64(v, &g->memory);
+                r = safe_atou64(strstrip(buf), &g->memory);
                 if (r < 0)
                         return r;
 
                 if (g->memory > 0)
                         g->memory_valid = true;
 
-        } else if ((streq(controller, "io") && all_unified) ||
-                   (streq(controller, "blkio") && !all_unified)) {
-                _cleanup_fclose_ FILE *f = NULL;
-                _cleanup_free_ char *p = NULL;
+        } else if (IN_SET(k, CONTROLLER_IO, CONTROLLER_BLKIO)) {
                 uint64_t wr = 0, rd = 0;
                 nsec_t timestamp;
 
-                r = cg_get_path(controller, path, all_unified ? "io.stat" : "blkio.io_service_bytes", &p);
-                if (r < 0)
-                        return r;
-
-                f = fopen(p, "re");
-                if (!f) {
-                        if (errno == ENOENT)
-                                return 0;
-                        return -errno;
-                }
-
-                for (;;) {
-                        char line[LINE_MAX], *l;
-                        uint64_t k, *q;
-
-                        if (!fgets(line, sizeof(line), f))
-                                break;
+                while ((l = next_line(&buf))) {
+                        uint64_t v, *q;
 
                         /* Trim and skip the device */
-                        l = strstrip(line);
+                        l = strstrip(l);
                         l += strcspn(l, WHITESPACE);
                         l += strspn(l, WHITESPACE);
 
                         if (all_unified) {
                                 while (!isempty(l)) {
-                                        if (sscanf(l, "rbytes=%" SCNu64, &k))
-                                                rd += k;
-                                        else if (sscanf(l, "wbytes=%" SCNu64, &k))
-                                                wr += k;
+                                        if (sscanf(l, "rbytes=%" SCNu64, &v))
+                                                rd += v;
+                                        else if (sscanf(l, "wbytes=%" SCNu64, &v))
+                                                wr += v;
 
                                         l += strcspn(l, WHITESPACE);
                                         l += strspn(l, WHITESPACE);
@@ -350,11 +532,11 @@ static int process(
                                         continue;
 
                                 l += strspn(l, WHITESPACE);
-                                r = safe_atou64(l, &k);
+                                r = safe_atou64(l, &v);
                                 if (r < 0)
                                         continue;
 
-                                *q += k;
+                                *q += v;
                         }
                 }
 
@@ -390,14 +572,12 @@ static int process(
                 g->io_iteration = iteration;
         }
 
-        if (ret)
-                *ret = g;
-
         return 0;
 }
 
 static int refresh_one(
-                const char *controller,
+                unsigned mask,
+                bool all_unified,
                 const char *path,
                 Hashmap *a,
                 Hashmap *b,
@@ -405,27 +585,47 @@ static int refresh_one(
                 unsigned depth,
                 Group **ret) {
 
-        _cleanup_closedir_ DIR *d = NULL;
+        _cleanup_closedir_ DIR *uncached = NULL;
         Group *ours = NULL;
+        Controller k, walk = _CONTROLLER_MAX;
+        DIR *d;
         int r;
 
-        assert(controller);
+        assert(mask != 0);
         assert(path);
         assert(a);
 
+        /* Processes all controllers in the mask for this cgroup and its children. The controllers must share
+         * one hierarchy, which is walked via the first of them. */
+
         if (depth > arg_depth)
                 return 0;
 
-        r = process(controller, path, a, b, iteration, &ours);
+        r = group_acquire(path, a, b, &ours);
         if (r < 0)
                 return r;
 
-        r = cg_enumerate_subgroups(controller, path, &d);
+        for (k = 0; k < _CONTROLLER_MAX; k++)
+                if (mask & (1U << k)) {
+                        walk = k;
+                        break;
+                }
+
+        r = group_get_dir(ours, walk, &d, &uncached);
         if (r == -ENOENT)
                 return 0;
         if (r < 0)
                 return r;
 
+        for (k = 0; k < _CONTROLLER_MAX; k++) {
+                if (!(mask & (1U << k)))
+                        continue;
+
+                r = process(k, ours, d, all_unified, iteration);
+                if (r < 0)
+                        return r;
+        }
+
         for (;;) {
                 _cleanup_free_ char *fn = NULL, *p = NULL;
                 Group *child = NULL;
@@ -442,7 +642,7 @@ static int refresh_one(
 
                 path_kill_slashes(p);
 
-                r = refresh_one(controller, p, a, b, iteration, depth + 1, &child);
+                r = refresh_one(mask, all_unified, p, a, b, iteration, depth + 1, &child);
                 if (r < 0)
                         return r;
 
@@ -450,7 +650,7 @@ static int refresh_one(
                     IN_SET(arg_count, COUNT_ALL_PROCESSES, COUNT_USERSPACE_PROCESSES) &&
                     child &&
                     child->n_tasks_valid &&
-                    streq(controller, SYSTEMD_CGROUP_CONTROLLER)) {
+                    (mask & (1U << CONTROLLER_SYSTEMD))) {
 
                         /* Recursively sum up processes */
 
@@ -463,6 +663,9 @@ static int refresh_one(
                 }
         }
 
+        if (ours->stale)
+                group_close_handles(ours);
+
         if (ret)
                 *ret = ours;
 
@@ -470,31 +673,27 @@ static int refresh_one(
 }
 
 static int refresh(const char *root, Hashmap *a, Hashmap *b, unsigned iteration) {
-        int r;
+        Controller k;
+        int r, all_unified;
 
         assert(a);
 
-        r = refresh_one(SYSTEMD_CGROUP_CONTROLLER, root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("cpu", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("cpuacct", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("memory", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("io", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("blkio", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
-        r = refresh_one("pids", root, a, b, iteration, 0, NULL);
-        if (r < 0)
-                return r;
+        all_unified = cg_all_unified();
+        if (all_unified < 0)
+                return all_unified;
+
+        /* On the unified hierarchy all controllers share one tree, hence walk it only once */
+        if (all_unified)
+                return refresh_one((1U << _CONTROLLER_MAX) - 1, true, root, a, b, iteration, 0, NULL);
+
+        for (k = 0; k < _CONTROLLER_MAX; k++) {
+                if (!controller_attribute(k, false))
+                        continue;
+
+                r = refresh_one(1U << k, false, root, a, b, iteration, 0, NULL);
+                if (r < 0)
+                        return r;
+        }
 
         return 0;
 }
@@ -580,6 +779,39 @@ static int group_compare(const void*a, const void *b) {
         return path_compare(x->path, y->path);
 }
 
+static void display_json(Group **array, unsigned n) {
+        unsigned j;
+
+        /* One line per iteration, with one object per control group, in the selected order */
+
+        printf("{ \"timestamp\" : %" PRIu64 ", \"groups\" : [", now(CLOCK_REALTIME));
+
+        for (j = 0; j < n; j++) {
+                Group *g = array[j];
+                const char *path;
+
+                path = isempty(g->path) ? "/" : g->path;
+
+                fputs(j > 0 ? ", { \"path\" : " : " { \"path\" : ", stdout);
+                json_escape(stdout, path, strlen(path), 0);
+
+                if (g->n_tasks_valid)
+                        printf(", \"%s\" : %" PRIu64, arg_count == COUNT_PIDS ? "tasks" : "processes", g->n_tasks);
+                printf(", \"cpu_usage_nsec\" : %" PRIu64, (uint64_t) g->cpu_usage);
+                if (g->cpu_valid)
+                        printf(", \"cpu_percent\" : %.1f", g->cpu_fraction*100);
+                if (g->memory_valid)
+                        printf(", \"memory_bytes\" : %" PRIu64, g->memory);
+                if (g->io_valid)
+                        printf(", \"io_input_bps\" : %" PRIu64 ", \"io_output_bps\" : %" PRIu64,
+                               g->io_input_bps, g->io_output_bps);
+
+                fputs(" }", stdout);
+        }
+
+        fputs(" ] }\n", stdout);
+}
+
 static void display(Hashmap *a) {
         Iterator i;
         Group *g;
@@ -590,9 +822,6 @@ static void display(Hashmap *a) {
 
         assert(a);
 
-        if (!terminal_is_dumb())
-                fputs(ANSI_HOME_CLEAR, stdout);
-
         array = alloca(sizeof(Group*) * hashmap_size(a));
 
         HASHMAP_FOREACH(g, a, i)
@@ -601,6 +830,14 @@ static void display(Hashmap *a) {
 
         qsort_safe(array, n, sizeof(Group*), group_compare);
 
+        if (arg_json) {
+                display_json(array, n);
+                return;
+        }
+
+        if (!terminal_is_dumb())
+                fputs(ANSI_HOME_CLEAR, stdout);
+
         /* Find the longest names in one run */
         for (j = 0; j < n; j++) {
                 unsigned cputlen, pathtlen;
@@ -703,6 +940,7 @@ static void help(void) {
                "  -d --delay=DELAY    Delay between updates\n"
                "  -n --iterations=N   Run for N iterations before exiting\n"
                "  -b --batch          Run in batch mode, accepting no input\n"
+               "     --json           Write one line of JSON per iteration (implies --batch)\n"
                "     --depth=DEPTH    Maximum traversal depth (default: %u)\n"
                "  -M --machine=       Show container\n"
                , program_invocation_short_name, arg_depth);
@@ -716,6 +954,7 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CPU_TYPE,
                 ARG_ORDER,
                 ARG_RECURSIVE,
+                ARG_JSON,
         };
 
         static const struct option options[] = {
@@ -724,6 +963,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "delay",        required_argument, NULL, 'd'           },
                 { "iterations",   required_argument, NULL, 'n'           },
                 { "batch",        no_argument,       NULL, 'b'           },
+                { "json",         no_argument,       NULL, ARG_JSON      },
                 { "raw",          no_argument,       NULL, 'r'           },
                 { "depth",        required_argument, NULL, ARG_DEPTH     },
                 { "cpu",          optional_argument, NULL, ARG_CPU_TYPE  },
@@ -795,6 +1035,11 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_batch = true;
                         break;
 
+                case ARG_JSON:
+                        arg_json = true;
+                        arg_batch = true;
+                        break;
+
                 case 'r':
                         arg_raw = true;
                         break;
@@ -893,6 +1138,7 @@ int main(int argc, char *argv[]) {
         bool quit = false, immediate_refresh = false;
         _cleanup_free_ char *root = NULL;
         CGroupMask mask;
+        struct rlimit rl;
 
         log_parse_environment();
         log_open();
@@ -930,6 +1176,16 @@ int main(int argc, char *argv[]) {
 
         signal(SIGWINCH, columns_lines_cache_reset);
 
+        /* We keep the directories and attribute files of all control groups open, let's make room for that,
+         * but leave some headroom for everything else. */
+        (void) setrlimit_closest(RLIMIT_NOFILE, &RLIMIT_MAKE_CONST(65536));
+        if (getrlimit(RLIMIT_NOFILE, &rl) >= 0) {
+                if (rl.rlim_cur == RLIM_INFINITY)
+                        max_cached = UINT_MAX;
+                else if (rl.rlim_cur > 128)
+                        max_cached = (unsigned) MIN(rl.rlim_cur - 128, (rlim_t) UINT_MAX);
+        }
+
         if (arg_iterations == (unsigned) -1)
                 arg_iterations = on_tty() ? 0 : 1;
 
@@ -964,7 +1220,7 @@ int main(int argc, char *argv[]) {
                 if (arg_iterations && iteration >= arg_iterations)
                         break;
 
-                if (!on_tty()) /* non-TTY: Empty newline as delimiter between polls */
+                if (!on_tty() && !arg_json) /* non-TTY: Empty newline as delimiter between polls */
                         fputs("\n", stdout);
                 fflush(stdout);
 
@@ -1102,6 +1358,7 @@ int main(int argc, char *argv[]) {
 finish:
         group_hashmap_free(a);
         group_hashmap_free(b);
+        free(read_buffer);
 
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -36,6 +36,10 @@
 
 #define CGROUP_CPU_QUOTA_PERIOD_USEC ((usec_t) 100 * USEC_PER_MSEC)
 
+/* Sample accounting data every 10s, and keep the last 10min of it */
+#define ACCOUNTING_SAMPLE_USEC (10 * USEC_PER_SEC)
+#define ACCOUNTING_SAMPLES_MAX 60U
+
 static void cgroup_compat_warn(void) {
         static bool cgroup_compat_warned = false;
 
@@ -284,13 +288,136 @@ static int lookup_block_device(const char *p, dev_t *dev) {
         return 0;
 }
 
-static int whitelist_device(const char *path, const char *node, const char *acc) {
+typedef enum CGroupAttributeCache {
+        CGROUP_ATTRIBUTE_NO_CACHE,      /* every write is a command, e.g. devices.allow */
+        CGROUP_ATTRIBUTE_CACHE,         /* the file holds a single value */
+        CGROUP_ATTRIBUTE_CACHE_KEYED,   /* the file holds one line per key, the first word of what we write */
+} CGroupAttributeCache;
+
+static int unit_get_cgroup_fd(Unit *u) {
+        _cleanup_free_ char *p = NULL;
+        int r;
+
+        assert(u);
+
+        if (u->cgroup_fd >= 0)
+                return u->cgroup_fd;
+
+        r = cg_get_path(SYSTEMD_CGROUP_CONTROLLER, u->cgroup_path, NULL, &p);
+        if (r < 0)
+                return r;
+
+        u->cgroup_fd = open(p, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOCTTY);
+        if (u->cgroup_fd < 0)
+                return -errno;
+
+        return u->cgroup_fd;
+}
+
+static int unit_write_cgroup_attribute(Unit *u, const char *controller, const char *attribute, const char *value) {
+        _cleanup_close_ int fd = -1;
+        int dir_fd;
+        size_t l;
+        ssize_t n;
+
+        assert(u);
+
+        /* On the unified hierarchy all attributes live in the same
+         * directory, hence keep that open instead of resolving the
+         * full path for every single write. */
+        if (cg_all_unified() <= 0)
+                return cg_set_attribute(controller, u->cgroup_path, attribute, value);
+
+        dir_fd = unit_get_cgroup_fd(u);
+        if (dir_fd < 0)
+                return dir_fd;
+
+        fd = openat(dir_fd, attribute, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        l = strlen(value);
+        n = write(fd, value, l);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n != l)
+                return -EIO;
+
+        return 0;
+}
+
+static void unit_forget_cgroup_attribute(Unit *u, const char *key) {
+        char *k;
+
+        free(hashmap_remove2(u->cgroup_attributes, key, (void**) &k));
+        free(k);
+}
+
+static void unit_flush_cgroup_attributes(Unit *u) {
+        assert(u);
+
+        u->cgroup_attributes = hashmap_free_free_free(u->cgroup_attributes);
+        u->cgroup_fd = safe_close(u->cgroup_fd);
+}
+
+static int unit_set_cgroup_attribute(
+                Unit *u,
+                const char *controller,
+                const char *attribute,
+                const char *value,
+                CGroupAttributeCache cache) {
+
+        _cleanup_free_ char *key = NULL, *v = NULL;
+        int r;
+
+        assert(u);
+        assert(attribute);
+        assert(value);
+
+        if (cache == CGROUP_ATTRIBUTE_NO_CACHE)
+                return unit_write_cgroup_attribute(u, controller, attribute, value);
+
+        if (cache == CGROUP_ATTRIBUTE_CACHE_KEYED)
+                key = strjoin(attribute, " ", strndupa(value, strcspn(value, WHITESPACE)));
+        else
+                key = strdup(attribute);
+        if (!key)
+                return -ENOMEM;
+
+        /* Skip the write if the kernel already has exactly this value
+         * from us. Realizing a slice re-applies the attributes of all
+         * its members, most of which have not changed. */
+        if (streq_ptr(hashmap_get(u->cgroup_attributes, key), value))
+                return 0;
+
+        unit_forget_cgroup_attribute(u, key);
+
+        r = unit_write_cgroup_attribute(u, controller, attribute, value);
+        if (r < 0)
+                return r;
+
+        /* Remembering the value is only an optimization, hence ignore failures */
+        v = strdup(value);
+        if (!v)
+                return 0;
+
+        if (hashmap_ensure_allocated(&u->cgroup_attributes, &string_hash_ops) < 0)
+                return 0;
+
+        if (hashmap_put(u->cgroup_attributes, key, v) < 0)
+                return 0;
+
+        key = v = NULL;
+        return 0;
+}
+
+static int whitelist_device(Unit *u, const char *node, const char *acc) {
         char buf[2+DECIMAL_STR_MAX(dev_t)*2+2+4];
         struct stat st;
         bool ignore_notfound;
         int r;
 
-        assert(path);
+        assert(u);
         assert(acc);
 
         if (node[0] == '-') {
@@ -318,21 +445,21 @@ static int whitelist_device(const char *path, const char *node, const char *acc)
                 major(st.st_rdev), minor(st.st_rdev),
                 acc);
 
-        r = cg_set_attribute("devices", path, "devices.allow", buf);
+        r = unit_set_cgroup_attribute(u, "devices", "devices.allow", buf, CGROUP_ATTRIBUTE_NO_CACHE);
         if (r < 0)
                 log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
-                               "Failed to set devices.allow on %s: %m", path);
+                               "Failed to set devices.allow on %s: %m", u->cgroup_path);
 
         return r;
 }
 
-static int whitelist_major(const char *path, const char *name, char type, const char *acc) {
+static int whitelist_major(Unit *u, const char *name, char type, const char *acc) {
         _cleanup_fclose_ FILE *f = NULL;
         char line[LINE_MAX];
         bool good = false;
         int r;
 
-        assert(path);
+        assert(u);
         assert(acc);
         assert(type == 'b' || type == 'c');
 
@@ -389,10 +516,10 @@ static int whitelist_major(const char *path, const char *name, char type, const
                         maj,
                         acc);
 
-                r = cg_set_attribute("devices", path, "devices.allow", buf);
+                r = unit_set_cgroup_attribute(u, "devices", "devices.allow", buf, CGROUP_ATTRIBUTE_NO_CACHE);
                 if (r < 0)
                         log_full_errno(IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
-                                       "Failed to set devices.allow on %s: %m", path);
+                                       "Failed to set devices.allow on %s: %m", u->cgroup_path);
         }
 
         return 0;
@@ -436,7 +563,7 @@ static void cgroup_apply_unified_cpu_config(Unit *u, uint64_t weight, uint64_t q
         int r;
 
         xsprintf(buf, "%" PRIu64 "\n", weight);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.weight", buf);
+        r = unit_set_cgroup_attribute(u, "cpu", "cpu.weight", buf, CGROUP_ATTRIBUTE_CACHE);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.weight: %m");
@@ -447,7 +574,7 @@ static void cgroup_apply_unified_cpu_config(Unit *u, uint64_t weight, uint64_t q
         else
                 xsprintf(buf, "max " USEC_FMT "\n", CGROUP_CPU_QUOTA_PERIOD_USEC);
 
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.max", buf);
+        r = unit_set_cgroup_attribute(u, "cpu", "cpu.max", buf, CGROUP_ATTRIBUTE_CACHE);
 
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
@@ -459,22 +586,22 @@ static void cgroup_apply_legacy_cpu_config(Unit *u, uint64_t shares, uint64_t qu
         int r;
 
         xsprintf(buf, "%" PRIu64 "\n", shares);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.shares", buf);
+        r = unit_set_cgroup_attribute(u, "cpu", "cpu.shares", buf, CGROUP_ATTRIBUTE_CACHE);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.shares: %m");
 
         xsprintf(buf, USEC_FMT "\n", CGROUP_CPU_QUOTA_PERIOD_USEC);
-        r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_period_us", buf);
+        r = unit_set_cgroup_attribute(u, "cpu", "cpu.cfs_period_us", buf, CGROUP_ATTRIBUTE_CACHE);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.cfs_period_us: %m");
 
         if (quota != USEC_INFINITY) {
                 xsprintf(buf, USEC_FMT "\n", quota * CGROUP_CPU_QUOTA_PERIOD_USEC / USEC_PER_SEC);
-                r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_quota_us", buf);
+                r = unit_set_cgroup_attribute(u, "cpu", "cpu.cfs_quota_us", buf, CGROUP_ATTRIBUTE_CACHE);
         } else
-                r = cg_set_attribute("cpu", u->cgroup_path, "cpu.cfs_quota_us", "-1");
+                r = unit_set_cgroup_attribute(u, "cpu", "cpu.cfs_quota_us", "-1", CGROUP_ATTRIBUTE_CACHE);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set cpu.cfs_quota_us: %m");
@@ -546,7 +673,7 @@ static void cgroup_apply_io_device_weight(Unit *u, const char *dev_path, uint64_
                 return;
 
         xsprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), io_weight);
-        r = cg_set_attribute("io", u->cgroup_path, "io.weight", buf);
+        r = unit_set_cgroup_attribute(u, "io", "io.weight", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set io.weight: %m");
@@ -562,7 +689,7 @@ static void cgroup_apply_blkio_device_weight(Unit *u, const char *dev_path, uint
                 return;
 
         xsprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), blkio_weight);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.weight_device", buf);
+        r = unit_set_cgroup_attribute(u, "blkio", "blkio.weight_device", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.weight_device: %m");
@@ -592,7 +719,7 @@ static unsigned cgroup_apply_io_device_limit(Unit *u, const char *dev_path, uint
         xsprintf(buf, "%u:%u rbps=%s wbps=%s riops=%s wiops=%s\n", major(dev), minor(dev),
                  limit_bufs[CGROUP_IO_RBPS_MAX], limit_bufs[CGROUP_IO_WBPS_MAX],
                  limit_bufs[CGROUP_IO_RIOPS_MAX], limit_bufs[CGROUP_IO_WIOPS_MAX]);
-        r = cg_set_attribute("io", u->cgroup_path, "io.max", buf);
+        r = unit_set_cgroup_attribute(u, "io", "io.max", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set io.max: %m");
@@ -612,7 +739,7 @@ static unsigned cgroup_apply_blkio_device_limit(Unit *u, const char *dev_path, u
         if (rbps != CGROUP_LIMIT_MAX)
                 n++;
         sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), rbps);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.throttle.read_bps_device", buf);
+        r = unit_set_cgroup_attribute(u, "blkio", "blkio.throttle.read_bps_device", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.throttle.read_bps_device: %m");
@@ -620,7 +747,7 @@ static unsigned cgroup_apply_blkio_device_limit(Unit *u, const char *dev_path, u
         if (wbps != CGROUP_LIMIT_MAX)
                 n++;
         sprintf(buf, "%u:%u %" PRIu64 "\n", major(dev), minor(dev), wbps);
-        r = cg_set_attribute("blkio", u->cgroup_path, "blkio.throttle.write_bps_device", buf);
+        r = unit_set_cgroup_attribute(u, "blkio", "blkio.throttle.write_bps_device", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set blkio.throttle.write_bps_device: %m");
@@ -639,7 +766,7 @@ static void cgroup_apply_unified_memory_limit(Unit *u, const char *file, uint64_
         if (v != CGROUP_LIMIT_MAX)
                 xsprintf(buf, "%" PRIu64 "\n", v);
 
-        r = cg_set_attribute("memory", u->cgroup_path, file, buf);
+        r = unit_set_cgroup_attribute(u, "memory", file, buf, CGROUP_ATTRIBUTE_CACHE);
         if (r < 0)
                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                               "Failed to set %s: %m", file);
@@ -733,7 +860,7 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                                 weight = CGROUP_WEIGHT_DEFAULT;
 
                         xsprintf(buf, "default %" PRIu64 "\n", weight);
-                        r = cg_set_attribute("io", path, "io.weight", buf);
+                        r = unit_set_cgroup_attribute(u, "io", "io.weight", buf, CGROUP_ATTRIBUTE_CACHE_KEYED);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set io.weight: %m");
@@ -810,7 +937,7 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                                 weight = CGROUP_BLKIO_WEIGHT_DEFAULT;
 
                         xsprintf(buf, "%" PRIu64 "\n", weight);
-                        r = cg_set_attribute("blkio", path, "blkio.weight", buf);
+                        r = unit_set_cgroup_attribute(u, "blkio", "blkio.weight", buf, CGROUP_ATTRIBUTE_CACHE);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set blkio.weight: %m");
@@ -889,7 +1016,7 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                         else
                                 xsprintf(buf, "%" PRIu64 "\n", val);
 
-                        r = cg_set_attribute("memory", path, "memory.limit_in_bytes", buf);
+                        r = unit_set_cgroup_attribute(u, "memory", "memory.limit_in_bytes", buf, CGROUP_ATTRIBUTE_CACHE);
                         if (r < 0)
                                 log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                               "Failed to set memory.limit_in_bytes: %m");
@@ -904,9 +1031,9 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                  * here. */
 
                 if (c->device_allow || c->device_policy != CGROUP_AUTO)
-                        r = cg_set_attribute("devices", path, "devices.deny", "a");
+                        r = unit_set_cgroup_attribute(u, "devices", "devices.deny", "a", CGROUP_ATTRIBUTE_NO_CACHE);
                 else
-                        r = cg_set_attribute("devices", path, "devices.allow", "a");
+                        r = unit_set_cgroup_attribute(u, "devices", "devices.allow", "a", CGROUP_ATTRIBUTE_NO_CACHE);
                 if (r < 0)
                         log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EINVAL, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
                                       "Failed to reset devices.list: %m");
@@ -928,11 +1055,11 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                         const char *x, *y;
 
                         NULSTR_FOREACH_PAIR(x, y, auto_devices)
-                                whitelist_device(path, x, y);
+                                whitelist_device(u, x, y);
 
-                        whitelist_major(path, "pts", 'c', "rw");
-                        whitelist_major(path, "kdbus", 'c', "rw");
-                        whitelist_major(path, "kdbus/*", 'c', "rw");
+                        whitelist_major(u, "pts", 'c', "rw");
+                        whitelist_major(u, "kdbus", 'c', "rw");
+                        whitelist_major(u, "kdbus/*", 'c', "rw");
                 }
 
                 LIST_FOREACH(device_allow, a, c->device_allow) {
@@ -952,11 +1079,11 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                         acc[k++] = 0;
 
                         if (startswith(a->path, "/dev/"))
-                                whitelist_device(path, a->path, acc);
+                                whitelist_device(u, a->path, acc);
                         else if ((val = startswith(a->path, "block-")))
-                                whitelist_major(path, val, 'b', acc);
+                                whitelist_major(u, val, 'b', acc);
                         else if ((val = startswith(a->path, "char-")))
-                                whitelist_major(path, val, 'c', acc);
+                                whitelist_major(u, val, 'c', acc);
                         else
                                 log_unit_debug(u, "Ignoring device %s while writing cgroup attribute.", a->path);
                 }
@@ -968,9 +1095,9 @@ static void cgroup_context_apply(Unit *u, CGroupMask mask, ManagerState state) {
                         char buf[DECIMAL_STR_MAX(uint64_t) + 2];
 
                         sprintf(buf, "%" PRIu64 "\n", c->tasks_max);
-                        r = cg_set_attribute("pids", path, "pids.max", buf);
+                        r = unit_set_cgroup_attribute(u, "pids", "pids.max", buf, CGROUP_ATTRIBUTE_CACHE);
                 } else
-                        r = cg_set_attribute("pids", path, "pids.max", "max");
+                        r = unit_set_cgroup_attribute(u, "pids", "pids.max", "max", CGROUP_ATTRIBUTE_CACHE);
 
                 if (r < 0)
                         log_unit_full(u, IN_SET(r, -ENOENT, -EROFS, -EACCES) ? LOG_DEBUG : LOG_WARNING, r,
@@ -1053,7 +1180,7 @@ CGroupMask unit_get_members_mask(Unit *u) {
                 Unit *member;
                 Iterator i;
 
-                SET_FOREACH(member, u->dependencies[UNIT_BEFORE], i) {
+                UNIT_FOREACH_DEPENDENCY(member, u, UNIT_BEFORE, i) {
 
                         if (member == u)
                                 continue;
@@ -1327,6 +1454,12 @@ static int unit_create_cgroup(
         if (r < 0)
                 return log_unit_error_errno(u, r, "Failed to create cgroup %s: %m", u->cgroup_path);
 
+        /* A new cgroup, or a controller that wasn't realized so far,
+         * comes with the kernel defaults, not with what we wrote
+         * before. */
+        if (r > 0 || !u->cgroup_realized || (target_mask & ~u->cgroup_realized_mask) != 0)
+                unit_flush_cgroup_attributes(u);
+
         /* Start watching it */
         (void) unit_watch_cgroup(u);
 
@@ -1433,6 +1566,9 @@ static int unit_realize_cgroup_now(Unit *u, ManagerState state) {
         cgroup_context_apply(u, target_mask, state);
         cgroup_xattr_apply(u);
 
+        if (target_mask & (CGROUP_MASK_CPU|CGROUP_MASK_CPUACCT|CGROUP_MASK_MEMORY|CGROUP_MASK_PIDS))
+                manager_schedule_accounting_sample(u->manager);
+
         return 0;
 }
 
@@ -1453,6 +1589,9 @@ unsigned manager_dispatch_cgroup_queue(Manager *m) {
 
         state = manager_state(m);
 
+        /* Everything queued from now on is a new batch */
+        m->cgroup_queue_generation++;
+
         while ((i = m->cgroup_queue)) {
                 assert(i->in_cgroup_queue);
 
@@ -1474,10 +1613,25 @@ static void unit_queue_siblings(Unit *u) {
          * neither the specified unit itself nor the parents.) */
 
         while ((slice = UNIT_DEREF(u->slice))) {
+                CGroupMask members_mask;
                 Iterator i;
                 Unit *m;
 
-                SET_FOREACH(m, slice->dependencies[UNIT_BEFORE], i) {
+                /* When many units of a slice are started at once, the
+                 * members were queued already by the first one, and
+                 * nothing was realized since. Don't walk them again
+                 * for each of the others. */
+                members_mask = unit_get_members_mask(slice);
+                if (slice->cgroup_members_queued_generation == slice->manager->cgroup_queue_generation &&
+                    slice->cgroup_members_queued_mask == members_mask) {
+                        u = slice;
+                        continue;
+                }
+
+                slice->cgroup_members_queued_generation = slice->manager->cgroup_queue_generation;
+                slice->cgroup_members_queued_mask = members_mask;
+
+                UNIT_FOREACH_DEPENDENCY(m, slice, UNIT_BEFORE, i) {
                         if (m == u)
                                 continue;
 
@@ -1545,6 +1699,11 @@ void unit_release_cgroup(Unit *u) {
                 (void) hashmap_remove(u->manager->cgroup_inotify_wd_unit, INT_TO_PTR(u->cgroup_inotify_wd));
                 u->cgroup_inotify_wd = -1;
         }
+
+        unit_flush_cgroup_attributes(u);
+
+        u->accounting_samples = mfree(u->accounting_samples);
+        u->accounting_samples_head = u->n_accounting_samples = 0;
 }
 
 void unit_prune_cgroup(Unit *u) {
@@ -1712,6 +1871,44 @@ int unit_notify_cgroup_empty(Unit *u) {
         return 0;
 }
 
+static int on_cgroup_empty_event(sd_event_source *s, void *userdata) {
+        Manager *m = userdata;
+        Unit *u;
+
+        assert(s);
+        assert(m);
+
+        /* Check each unit once, however many notifications arrived
+         * for it since the last time we got here. */
+
+        while ((u = m->cgroup_empty_queue)) {
+                assert(u->in_cgroup_empty_queue);
+
+                LIST_REMOVE(cgroup_empty_queue, m->cgroup_empty_queue, u);
+                u->in_cgroup_empty_queue = false;
+
+                (void) unit_notify_cgroup_empty(u);
+        }
+
+        return 0;
+}
+
+void unit_add_to_cgroup_empty_queue(Unit *u) {
+        int r;
+
+        assert(u);
+
+        if (u->in_cgroup_empty_queue)
+                return;
+
+        LIST_PREPEND(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+        u->in_cgroup_empty_queue = true;
+
+        r = sd_event_source_set_enabled(u->manager->cgroup_empty_event_source, SD_EVENT_ONESHOT);
+        if (r < 0)
+                log_debug_errno(r, "Failed to enable cgroup empty event source: %m");
+}
+
 static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
         Manager *m = userdata;
 
@@ -1751,7 +1948,7 @@ static int on_cgroup_inotify_event(sd_event_source *s, int fd, uint32_t revents,
                                  * this here safely. */
                                 continue;
 
-                        (void) unit_notify_cgroup_empty(u);
+                        unit_add_to_cgroup_empty_queue(u);
                 }
         }
 }
@@ -1815,10 +2012,30 @@ int manager_setup_cgroup(Manager *m) {
                         log_debug("Using cgroup controller " SYSTEMD_CGROUP_CONTROLLER_LEGACY ". File system hierarchy is at %s.", path);
         }
 
+        /* 3. Allocate the queue for empty notifications. It is
+         * dispatched after the inotify and cgroups agent event sources
+         * (which run at NORMAL-5), so that everything they have
+         * pending is coalesced into one pass. */
+        if (!m->cgroup_empty_event_source) {
+                r = sd_event_add_defer(m->event, &m->cgroup_empty_event_source, on_cgroup_empty_event, m);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to create cgroup empty event source: %m");
+
+                r = sd_event_source_set_priority(m->cgroup_empty_event_source, SD_EVENT_PRIORITY_NORMAL-4);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to set priority of cgroup empty event source: %m");
+
+                r = sd_event_source_set_enabled(m->cgroup_empty_event_source, SD_EVENT_OFF);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to disable cgroup empty event source: %m");
+
+                (void) sd_event_source_set_description(m->cgroup_empty_event_source, "cgroup-empty");
+        }
+
         if (!m->test_run) {
                 const char *scope_path;
 
-                /* 3. Install agent */
+                /* 4. Install agent */
                 if (cg_unified_controller(SYSTEMD_CGROUP_CONTROLLER) > 0) {
 
                         /* In the unified hierarchy we can get
@@ -1860,7 +2077,7 @@ int manager_setup_cgroup(Manager *m) {
                                 log_debug("Release agent already installed.");
                 }
 
-                /* 4. Make sure we are in the special "init.scope" unit in the root slice. */
+                /* 5. Make sure we are in the special "init.scope" unit in the root slice. */
                 scope_path = strjoina(m->cgroup_root, "/" SPECIAL_INIT_SCOPE);
                 r = cg_create_and_attach(SYSTEMD_CGROUP_CONTROLLER, scope_path, 0);
                 if (r < 0)
@@ -1872,18 +2089,18 @@ int manager_setup_cgroup(Manager *m) {
                 if (r < 0)
                         log_warning_errno(r, "Couldn't move remaining userspace processes, ignoring: %m");
 
-                /* 5. And pin it, so that it cannot be unmounted */
+                /* 6. And pin it, so that it cannot be unmounted */
                 safe_close(m->pin_cgroupfs_fd);
                 m->pin_cgroupfs_fd = open(path, O_RDONLY|O_CLOEXEC|O_DIRECTORY|O_NOCTTY|O_NONBLOCK);
                 if (m->pin_cgroupfs_fd < 0)
                         return log_error_errno(errno, "Failed to open pin file: %m");
 
-                /* 6.  Always enable hierarchical support if it exists... */
+                /* 7.  Always enable hierarchical support if it exists... */
                 if (!all_unified)
                         (void) cg_set_attribute("memory", "/", "memory.use_hierarchy", "1");
         }
 
-        /* 7. Figure out which controllers are supported */
+        /* 8. Figure out which controllers are supported */
         r = cg_mask_supported(&m->cgroup_supported);
         if (r < 0)
                 return log_error_errno(r, "Failed to determine supported controllers: %m");
@@ -1907,6 +2124,9 @@ void manager_shutdown_cgroup(Manager *m, bool delete) {
         m->cgroup_inotify_event_source = sd_event_source_unref(m->cgroup_inotify_event_source);
         m->cgroup_inotify_fd = safe_close(m->cgroup_inotify_fd);
 
+        m->cgroup_empty_event_source = sd_event_source_unref(m->cgroup_empty_event_source);
+        m->accounting_event_source = sd_event_source_unref(m->accounting_event_source);
+
         m->pin_cgroupfs_fd = safe_close(m->pin_cgroupfs_fd);
 
         m->cgroup_root = mfree(m->cgroup_root);
@@ -1989,7 +2209,8 @@ int manager_notify_cgroup_empty(Manager *m, const char *cgroup) {
         if (!u)
                 return 0;
 
-        return unit_notify_cgroup_empty(u);
+        unit_add_to_cgroup_empty_queue(u);
+        return 1;
 }
 
 int unit_get_memory_current(Unit *u, uint64_t *ret) {
@@ -2144,6 +2365,205 @@ int unit_reset_cpu_usage(Unit *u) {
         return 0;
 }
 
+static bool unit_sample_accounting(Unit *u, usec_t ts) {
+        UnitAccountingSample *s;
+        CGroupContext *c;
+        uint64_t v;
+
+        assert(u);
+
+        c = unit_get_cgroup_context(u);
+        if (!c)
+                return false;
+
+        if (!u->cgroup_path || !(c->cpu_accounting || c->memory_accounting || c->tasks_accounting))
+                return false;
+
+        if (!u->accounting_samples) {
+                u->accounting_samples = new(UnitAccountingSample, ACCOUNTING_SAMPLES_MAX);
+                if (!u->accounting_samples) {
+                        log_oom();
+                        return false;
+                }
+        }
+
+        /* Overwrite the oldest sample once the ring is full */
+        s = u->accounting_samples + (u->accounting_samples_head + u->n_accounting_samples) % ACCOUNTING_SAMPLES_MAX;
+        if (u->n_accounting_samples < ACCOUNTING_SAMPLES_MAX)
+                u->n_accounting_samples++;
+        else
+                u->accounting_samples_head = (u->accounting_samples_head + 1) % ACCOUNTING_SAMPLES_MAX;
+
+        *s = (UnitAccountingSample) {
+                .timestamp = ts,
+                .cpu_usage = NSEC_INFINITY,
+                .memory = UINT64_MAX,
+                .tasks = UINT64_MAX,
+        };
+
+        if (c->cpu_accounting && unit_get_cpu_usage(u, &v) >= 0)
+                s->cpu_usage = v;
+        if (c->memory_accounting && unit_get_memory_current(u, &v) >= 0)
+                s->memory = v;
+        if (c->tasks_accounting && unit_get_tasks_current(u, &v) >= 0)
+                s->tasks = v;
+
+        return true;
+}
+
+static int on_accounting_sample(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *m = userdata;
+        bool any = false;
+        const char *k;
+        Iterator i;
+        usec_t ts;
+        Unit *u;
+        int r;
+
+        assert(s);
+        assert(m);
+
+        /* Take one sample of all units with accounting turned on in one go, so that monitoring tools can query the
+         * history of all of them with a single bus call, instead of having us read cgroupfs for each property they
+         * poll. If no unit needs sampling we stop the timer, it is started again when the next cgroup is realized. */
+
+        ts = now(CLOCK_MONOTONIC);
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                if (k != u->id)
+                        continue;
+
+                if (unit_sample_accounting(u, ts))
+                        any = true;
+        }
+
+        if (!any)
+                return 0;
+
+        r = sd_event_source_set_time(s, usec + ACCOUNTING_SAMPLE_USEC);
+        if (r < 0)
+                return log_error_errno(r, "Failed to reschedule accounting timer: %m");
+
+        r = sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+        if (r < 0)
+                return log_error_errno(r, "Failed to enable accounting timer: %m");
+
+        return 0;
+}
+
+void manager_schedule_accounting_sample(Manager *m) {
+        int enabled, r;
+
+        assert(m);
+
+        if (m->test_run)
+                return;
+
+        if (m->accounting_event_source) {
+                r = sd_event_source_get_enabled(m->accounting_event_source, &enabled);
+                if (r >= 0 && enabled != SD_EVENT_OFF)
+                        return;
+
+                r = sd_event_source_set_time(m->accounting_event_source, now(CLOCK_MONOTONIC) + ACCOUNTING_SAMPLE_USEC);
+                if (r >= 0)
+                        r = sd_event_source_set_enabled(m->accounting_event_source, SD_EVENT_ONESHOT);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to enable accounting timer, ignoring: %m");
+
+                return;
+        }
+
+        r = sd_event_add_time(m->event, &m->accounting_event_source, CLOCK_MONOTONIC,
+                              now(CLOCK_MONOTONIC) + ACCOUNTING_SAMPLE_USEC, USEC_PER_SEC,
+                              on_accounting_sample, m);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to create accounting timer, ignoring: %m");
+                return;
+        }
+
+        (void) sd_event_source_set_priority(m->accounting_event_source, SD_EVENT_PRIORITY_IDLE);
+        (void) sd_event_source_set_description(m->accounting_event_source, "accounting-sample");
+}
+
+static int uint64_compare(const void *a, const void *b) {
+        const uint64_t *x = a, *y = b;
+
+        if (*x < *y)
+                return -1;
+        if (*x > *y)
+                return 1;
+        return 0;
+}
+
+static uint64_t percentile(uint64_t *v, unsigned n, unsigned p) {
+        assert(v);
+        assert(p > 0 && p <= 100);
+
+        /* Nearest rank method, sorts the array in place */
+
+        if (n <= 0)
+                return UINT64_MAX;
+
+        qsort(v, n, sizeof(uint64_t), uint64_compare);
+
+        return v[DIV_ROUND_UP(n * p, 100U) - 1];
+}
+
+int unit_get_accounting_stats(Unit *u, UnitAccountingStats *ret) {
+        uint64_t cpu_rates[ACCOUNTING_SAMPLES_MAX], memory[ACCOUNTING_SAMPLES_MAX];
+        const UnitAccountingSample *first = NULL, *last = NULL, *prev_cpu = NULL;
+        unsigned i, n_cpu_rates = 0, n_memory = 0;
+        UnitAccountingStats stats;
+
+        assert(u);
+        assert(ret);
+
+        if (u->n_accounting_samples <= 0)
+                return -ENODATA;
+
+        stats = (UnitAccountingStats) {
+                .cpu_rate = UINT64_MAX,
+                .memory_current = UINT64_MAX,
+                .memory_max = UINT64_MAX,
+        };
+
+        for (i = 0; i < u->n_accounting_samples; i++) {
+                const UnitAccountingSample *s = u->accounting_samples + (u->accounting_samples_head + i) % ACCOUNTING_SAMPLES_MAX;
+
+                if (s->cpu_usage != NSEC_INFINITY) {
+                        /* The counter is reset when the unit is started again, skip the interval then */
+                        if (prev_cpu && s->timestamp > prev_cpu->timestamp && s->cpu_usage >= prev_cpu->cpu_usage)
+                                cpu_rates[n_cpu_rates++] = (uint64_t) ((double) (s->cpu_usage - prev_cpu->cpu_usage) * USEC_PER_SEC / (s->timestamp - prev_cpu->timestamp));
+
+                        if (!first)
+                                first = s;
+                        last = prev_cpu = s;
+                }
+
+                if (s->memory != UINT64_MAX) {
+                        memory[n_memory++] = s->memory;
+                        stats.memory_current = s->memory;
+                }
+
+                stats.tasks_current = s->tasks;
+        }
+
+        if (first && last->timestamp > first->timestamp && last->cpu_usage >= first->cpu_usage)
+                stats.cpu_rate = (uint64_t) ((double) (last->cpu_usage - first->cpu_usage) * USEC_PER_SEC / (last->timestamp - first->timestamp));
+
+        stats.window = u->accounting_samples[(u->accounting_samples_head + u->n_accounting_samples - 1) % ACCOUNTING_SAMPLES_MAX].timestamp -
+                       u->accounting_samples[u->accounting_samples_head].timestamp;
+
+        stats.cpu_rate_p95 = percentile(cpu_rates, n_cpu_rates, 95);
+        stats.memory_p50 = percentile(memory, n_memory, 50);
+        stats.memory_p95 = percentile(memory, n_memory, 95);
+        if (n_memory > 0)
+                stats.memory_max = memory[n_memory - 1];
+
+        *ret = stats;
+        return 0;
+}
+
 bool unit_cgroup_delegate(Unit *u) {
         CGroupContext *c;
 
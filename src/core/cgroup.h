@@ -174,9 +174,13 @@ int unit_get_tasks_current(Unit *u, uint64_t *ret);
 int unit_get_cpu_usage(Unit *u, nsec_t *ret);
 int unit_reset_cpu_usage(Unit *u);
 
+int unit_get_accounting_stats(Unit *u, UnitAccountingStats *ret);
+void manager_schedule_accounting_sample(Manager *m);
+
 bool unit_cgroup_delegate(Unit *u);
 
 int unit_notify_cgroup_empty(Unit *u);
+void unit_add_to_cgroup_empty_queue(Unit *u);
 int manager_notify_cgroup_empty(Manager *m, const char *group);
 
 void unit_invalidate_cgroup(Unit *u, CGroupMask m);
@@ -974,6 +974,10 @@ int bus_exec_context_set_transient_property(
         assert(name);
         assert(message);
 
+        /* Any of the settings might affect the cached mount namespace plan, recompute it on next use */
+        if (mode != UNIT_CHECK)
+                exec_context_flush_namespace_plans(c);
+
         if (streq(name, "User")) {
                 const char *uu;
 
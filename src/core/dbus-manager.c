@@ -264,6 +264,54 @@ static int property_get_n_names(
         return sd_bus_message_append(reply, "u", (uint32_t) hashmap_size(m->units));
 }
 
+static int property_get_unit_cache_count(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        const UnitCacheStats *s;
+
+        assert(bus);
+        assert(reply);
+        assert(m);
+
+        if (!m->unit_cache)
+                return sd_bus_message_append(reply, "u", (uint32_t) 0);
+
+        s = unit_cache_get_stats(m->unit_cache);
+
+        return sd_bus_message_append(reply, "u", (uint32_t) (streq(property, "UnitCacheHits") ? s->n_hits : s->n_misses));
+}
+
+static int property_get_unit_cache_usec(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const char *property,
+                sd_bus_message *reply,
+                void *userdata,
+                sd_bus_error *error) {
+
+        Manager *m = userdata;
+        const UnitCacheStats *s;
+
+        assert(bus);
+        assert(reply);
+        assert(m);
+
+        if (!m->unit_cache)
+                return sd_bus_message_append(reply, "t", (uint64_t) 0);
+
+        s = unit_cache_get_stats(m->unit_cache);
+
+        return sd_bus_message_append(reply, "t", (uint64_t) (streq(property, "UnitCacheHitUSec") ? s->hit_usec : s->miss_usec));
+}
+
 static int property_get_n_failed_units(
                 sd_bus *bus,
                 const char *path,
@@ -1086,27 +1134,15 @@ static int method_reset_failed(sd_bus_message *message, void *userdata, sd_bus_e
         return sd_bus_reply_method_return(message, NULL);
 }
 
-static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error, char **states, char **patterns) {
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
-        Manager *m = userdata;
+static int append_units_filtered(sd_bus_message *reply, Manager *m, char **states, char **patterns, uint64_t since) {
         const char *k;
         Iterator i;
         Unit *u;
         int r;
 
-        assert(message);
+        assert(reply);
         assert(m);
 
-        /* Anyone can call this method */
-
-        r = mac_selinux_access_check(message, "status", error);
-        if (r < 0)
-                return r;
-
-        r = sd_bus_message_new_method_return(message, &reply);
-        if (r < 0)
-                return r;
-
         r = sd_bus_message_open_container(reply, 'a', "(ssssssouso)");
         if (r < 0)
                 return r;
@@ -1115,7 +1151,14 @@ static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_e
                 if (k != u->id)
                         continue;
 
-                if (!strv_isempty(states) &&
+                if (u->changed_generation <= since)
+                        continue;
+
+                /* When listing changes, the state filter is not applied: a unit that changed into a state
+                 * not asked for is listed too, so that the caller learns it left its view. The patterns
+                 * only look at the name, which doesn't change. */
+                if (since == 0 &&
+                    !strv_isempty(states) &&
                     !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
                     !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
                     !strv_contains(states, unit_sub_state_to_string(u)))
@@ -1130,7 +1173,28 @@ static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_e
                         return r;
         }
 
-        r = sd_bus_message_close_container(reply);
+        return sd_bus_message_close_container(reply);
+}
+
+static int list_units_filtered(sd_bus_message *message, void *userdata, sd_bus_error *error, char **states, char **patterns) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        Manager *m = userdata;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = append_units_filtered(reply, m, states, patterns, 0);
         if (r < 0)
                 return r;
 
@@ -1168,6 +1232,126 @@ static int method_list_units_by_patterns(sd_bus_message *message, void *userdata
         return list_units_filtered(message, userdata, error, states, patterns);
 }
 
+static int method_list_units_changed_since(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **states = NULL;
+        _cleanup_strv_free_ char **patterns = NULL;
+        Manager *m = userdata;
+        uint64_t epoch, since;
+        bool complete;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read(message, "tt", &epoch, &since);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &states);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &patterns);
+        if (r < 0)
+                return r;
+
+        /* If units went away since the specified generation, or if the generation is from another boot or
+         * another incarnation of the manager, we can't express the difference, hence return everything and
+         * tell the client so, so that it can replace its view instead of updating it. */
+        complete = epoch != m->units_epoch ||
+                   since == 0 ||
+                   since > m->units_generation ||
+                   since < m->units_removed_generation;
+        if (complete)
+                since = 0;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_append(reply, "ttb", m->units_epoch, m->units_generation, complete);
+        if (r < 0)
+                return r;
+
+        r = append_units_filtered(reply, m, states, patterns, since);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
+static int method_list_unit_accounting_by_patterns(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_strv_free_ char **patterns = NULL;
+        Manager *m = userdata;
+        const char *k;
+        Iterator i;
+        Unit *u;
+        int r;
+
+        assert(message);
+        assert(m);
+
+        /* Anyone can call this method */
+
+        r = mac_selinux_access_check(message, "status", error);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_read_strv(message, &patterns);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_new_method_return(message, &reply);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_message_open_container(reply, 'a', "(stttttttt)");
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                UnitAccountingStats stats;
+
+                if (k != u->id)
+                        continue;
+
+                if (!strv_isempty(patterns) &&
+                    !strv_fnmatch_or_empty(patterns, u->id, FNM_NOESCAPE))
+                        continue;
+
+                if (unit_get_accounting_stats(u, &stats) < 0)
+                        continue;
+
+                r = sd_bus_message_append(
+                                reply, "(stttttttt)",
+                                u->id,
+                                stats.window,
+                                stats.cpu_rate,
+                                stats.cpu_rate_p95,
+                                stats.memory_current,
+                                stats.memory_p50,
+                                stats.memory_p95,
+                                stats.memory_max,
+                                stats.tasks_current);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_close_container(reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(NULL, reply, NULL);
+}
+
 static int method_list_jobs(sd_bus_message *message, void *userdata, sd_bus_error *error) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
         Manager *m = userdata;
@@ -2423,6 +2607,10 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_PROPERTY("NNames", "u", property_get_n_names, 0, 0),
         SD_BUS_PROPERTY("NFailedUnits", "u", property_get_n_failed_units, 0, SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
         SD_BUS_PROPERTY("NJobs", "u", property_get_n_jobs, 0, 0),
+        SD_BUS_PROPERTY("UnitCacheHits", "u", property_get_unit_cache_count, 0, 0),
+        SD_BUS_PROPERTY("UnitCacheMisses", "u", property_get_unit_cache_count, 0, 0),
+        SD_BUS_PROPERTY("UnitCacheHitUSec", "t", property_get_unit_cache_usec, 0, 0),
+        SD_BUS_PROPERTY("UnitCacheMissUSec", "t", property_get_unit_cache_usec, 0, 0),
         SD_BUS_PROPERTY("NInstalledJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_installed_jobs), 0),
         SD_BUS_PROPERTY("NFailedJobs", "u", bus_property_get_unsigned, offsetof(Manager, n_failed_jobs), 0),
         SD_BUS_PROPERTY("Progress", "d", property_get_progress, 0, 0),
@@ -2512,6 +2700,8 @@ const sd_bus_vtable bus_manager_vtable[] = {
         SD_BUS_METHOD("ListUnitsFiltered", "as", "a(ssssssouso)", method_list_units_filtered, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsByPatterns", "asas", "a(ssssssouso)", method_list_units_by_patterns, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListUnitsByNames", "as", "a(ssssssouso)", method_list_units_by_names, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitsChangedSince", "ttasas", "ttba(ssssssouso)", method_list_units_changed_since, SD_BUS_VTABLE_UNPRIVILEGED),
+        SD_BUS_METHOD("ListUnitAccountingByPatterns", "as", "a(stttttttt)", method_list_unit_accounting_by_patterns, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("ListJobs", NULL, "a(usssoo)", method_list_jobs, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Subscribe", NULL, NULL, method_subscribe, SD_BUS_VTABLE_UNPRIVILEGED),
         SD_BUS_METHOD("Unsubscribe", NULL, NULL, method_unsubscribe, SD_BUS_VTABLE_UNPRIVILEGED),
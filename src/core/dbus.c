@@ -1176,7 +1176,7 @@ int bus_foreach_bus(
         return ret;
 }
 
-void bus_track_serialize(sd_bus_track *t, FILE *f, const char *prefix) {
+void bus_track_serialize(sd_bus_track *t, Serializer *s, FILE *f, const char *prefix) {
         const char *n;
 
         assert(f);
@@ -1187,12 +1187,8 @@ void bus_track_serialize(sd_bus_track *t, FILE *f, const char *prefix) {
 
                 c = sd_bus_track_count_name(t, n);
 
-                for (j = 0; j < c; j++) {
-                        fputs(prefix, f);
-                        fputc('=', f);
-                        fputs(n, f);
-                        fputc('\n', f);
-                }
+                for (j = 0; j < c; j++)
+                        (void) serialize_item(s, f, prefix, n);
         }
 }
 
@@ -41,6 +41,12 @@ static const UnitActiveState state_translation_table[_DEVICE_STATE_MAX] = {
         [DEVICE_PLUGGED] = UNIT_ACTIVE,
 };
 
+/* How long to collect uevents before processing them, so that bursts for the same device coalesce */
+#define DEVICE_COALESCE_USEC (50*USEC_PER_MSEC)
+
+/* How many uevents to read from the monitor per wakeup */
+#define DEVICE_RECEIVE_MAX 256U
+
 static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 
 static void device_unset_sysfs(Device *d) {
@@ -305,7 +311,7 @@ static int device_upgrade_mount_deps(Unit *u) {
         Iterator i;
         int r;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRED_BY, i) {
                 if (other->type != UNIT_MOUNT)
                         continue;
 
@@ -626,10 +632,17 @@ fail:
 }
 
 static void device_shutdown(Manager *m) {
+        struct udev_device *dev;
+
         assert(m);
 
         m->udev_event_source = sd_event_source_unref(m->udev_event_source);
 
+        m->udev_pending_event_source = sd_event_source_unref(m->udev_pending_event_source);
+        while ((dev = ordered_hashmap_steal_first(m->udev_pending)))
+                udev_device_unref(dev);
+        m->udev_pending = ordered_hashmap_free(m->udev_pending);
+
         if (m->udev_monitor) {
                 udev_monitor_unref(m->udev_monitor);
                 m->udev_monitor = NULL;
@@ -729,42 +742,33 @@ fail:
         device_shutdown(m);
 }
 
-static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
-        Manager *m = userdata;
-        const char *action, *sysfs;
+static void device_event_prepare(Manager *m, struct udev_device *dev) {
+        const char *action;
         int r;
 
         assert(m);
+        assert(dev);
 
-        if (revents != EPOLLIN) {
-                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
+        action = udev_device_get_action(dev);
+        if (streq(action, "remove") || !device_is_ready(dev))
+                return;
 
-                if (!ratelimit_test(&limit))
-                        log_error_errno(errno, "Failed to get udev event: %m");
-                if (!(revents & EPOLLIN))
-                        return 0;
-        }
+        (void) device_process_new(m, dev);
 
-        /*
-         * libudev might filter-out devices which pass the bloom
-         * filter, so getting NULL here is not necessarily an error.
-         */
-        dev = udev_monitor_receive_device(m->udev_monitor);
-        if (!dev)
-                return 0;
+        r = swap_process_device_new(m, dev);
+        if (r < 0)
+                log_error_errno(r, "Failed to process swap device new event: %m");
+}
 
-        sysfs = udev_device_get_syspath(dev);
-        if (!sysfs) {
-                log_error("Failed to get udev sys path.");
-                return 0;
-        }
+static void device_event_apply(Manager *m, struct udev_device *dev) {
+        const char *action, *sysfs;
+        int r;
+
+        assert(m);
+        assert(dev);
 
+        sysfs = udev_device_get_syspath(dev);
         action = udev_device_get_action(dev);
-        if (!action) {
-                log_error("Failed to get udev action string.");
-                return 0;
-        }
 
         if (streq(action, "remove"))  {
                 r = swap_process_device_remove(m, dev);
@@ -776,25 +780,171 @@ static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                  * found bits */
                 device_update_found_by_sysfs(m, sysfs, false, DEVICE_FOUND_UDEV|DEVICE_FOUND_MOUNT|DEVICE_FOUND_SWAP, true);
 
-        } else if (device_is_ready(dev)) {
-
-                (void) device_process_new(m, dev);
-
-                r = swap_process_device_new(m, dev);
-                if (r < 0)
-                        log_error_errno(r, "Failed to process swap device new event: %m");
-
-                manager_dispatch_load_queue(m);
-
+        } else if (device_is_ready(dev))
                 /* The device is found now, set the udev found bit */
                 device_update_found_by_sysfs(m, sysfs, true, DEVICE_FOUND_UDEV, true);
 
-        } else {
+        else
                 /* The device is nominally around, but not ready for
                  * us. Hence unset the udev bit, but leave the rest
                  * around. */
-
                 device_update_found_by_sysfs(m, sysfs, false, DEVICE_FOUND_UDEV, true);
+}
+
+static void device_flush_pending(Manager *m) {
+        struct udev_device *dev;
+        Iterator i;
+
+        assert(m);
+
+        if (m->udev_pending_event_source)
+                (void) sd_event_source_set_enabled(m->udev_pending_event_source, SD_EVENT_OFF);
+
+        if (ordered_hashmap_isempty(m->udev_pending))
+                return;
+
+        /* First create all units, then load them in one go, and only then update their state */
+        ORDERED_HASHMAP_FOREACH(dev, m->udev_pending, i)
+                device_event_prepare(m, dev);
+
+        manager_dispatch_load_queue(m);
+
+        ORDERED_HASHMAP_FOREACH(dev, m->udev_pending, i)
+                device_event_apply(m, dev);
+
+        while ((dev = ordered_hashmap_steal_first(m->udev_pending)))
+                udev_device_unref(dev);
+}
+
+static int device_dispatch_pending(sd_event_source *source, uint64_t usec, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        device_flush_pending(m);
+        return 0;
+}
+
+static int device_schedule_pending(Manager *m) {
+        int enabled, r;
+
+        assert(m);
+
+        if (m->udev_pending_event_source) {
+                r = sd_event_source_get_enabled(m->udev_pending_event_source, &enabled);
+                if (r < 0)
+                        return r;
+                if (enabled != SD_EVENT_OFF)
+                        return 0;
+
+                r = sd_event_source_set_time(m->udev_pending_event_source, now(CLOCK_MONOTONIC) + DEVICE_COALESCE_USEC);
+                if (r < 0)
+                        return r;
+
+                return sd_event_source_set_enabled(m->udev_pending_event_source, SD_EVENT_ONESHOT);
+        }
+
+        r = sd_event_add_time(m->event, &m->udev_pending_event_source, CLOCK_MONOTONIC,
+                              now(CLOCK_MONOTONIC) + DEVICE_COALESCE_USEC, 0,
+                              device_dispatch_pending, m);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(m->udev_pending_event_source, "device-pending");
+        return 0;
+}
+
+static int device_queue_event(Manager *m, struct udev_device *dev) {
+        struct udev_device *old;
+        const char *sysfs;
+        int r;
+
+        assert(m);
+        assert(dev);
+
+        sysfs = udev_device_get_syspath(dev);
+
+        old = ordered_hashmap_get(m->udev_pending, sysfs);
+        if (old) {
+                /* A burst of events for the same device collapses into the last one, but we never coalesce
+                 * away a removal: if the device went away in between, we process what we have first. */
+                if (streq(udev_device_get_action(old), "remove") != streq(udev_device_get_action(dev), "remove"))
+                        device_flush_pending(m);
+                else {
+                        ordered_hashmap_remove(m->udev_pending, sysfs);
+                        udev_device_unref(old);
+                }
+        }
+
+        r = ordered_hashmap_ensure_allocated(&m->udev_pending, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        r = ordered_hashmap_put(m->udev_pending, sysfs, dev);
+        if (r < 0)
+                return r;
+
+        udev_device_ref(dev);
+
+        r = device_schedule_pending(m);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to schedule processing of udev events, processing them right away: %m");
+                device_flush_pending(m);
+        }
+
+        return 0;
+}
+
+static int device_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        unsigned n;
+        int r;
+
+        assert(m);
+
+        if (revents != EPOLLIN) {
+                static RATELIMIT_DEFINE(limit, 10*USEC_PER_SEC, 5);
+
+                if (!ratelimit_test(&limit))
+                        log_error_errno(errno, "Failed to get udev event: %m");
+                if (!(revents & EPOLLIN))
+                        return 0;
+        }
+
+        /* Read a batch of events, and queue them for processing after a short delay, so that bursts (for
+         * example caused by "udevadm trigger") are coalesced per device and handled in one go. */
+        for (n = 0; n < DEVICE_RECEIVE_MAX; n++) {
+                _cleanup_udev_device_unref_ struct udev_device *dev = NULL;
+
+                /*
+                 * libudev might filter-out devices which pass the bloom
+                 * filter, so getting NULL here is not necessarily an error.
+                 */
+                dev = udev_monitor_receive_device(m->udev_monitor);
+                if (!dev)
+                        break;
+
+                if (!udev_device_get_syspath(dev)) {
+                        log_error("Failed to get udev sys path.");
+                        continue;
+                }
+
+                if (!udev_device_get_action(dev)) {
+                        log_error("Failed to get udev action string.");
+                        continue;
+                }
+
+                r = device_queue_event(m, dev);
+                if (r < 0) {
+                        /* Can't queue it? Then let's handle everything right away. */
+                        log_debug_errno(r, "Failed to queue udev event, processing it right away: %m");
+
+                        device_flush_pending(m);
+
+                        device_event_prepare(m, dev);
+                        manager_dispatch_load_queue(m);
+                        device_event_apply(m, dev);
+                }
         }
 
         return 0;
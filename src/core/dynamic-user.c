@@ -34,13 +34,173 @@
 /* Takes a value generated randomly or by hashing and turns it into a UID in the right range */
 #define UID_CLAMP_INTO_RANGE(rnd) (((uid_t) (rnd) % (DYNAMIC_UID_MAX - DYNAMIC_UID_MIN + 1)) + DYNAMIC_UID_MIN)
 
+static uid_t uid_hash_name(const char *name) {
+
+        static const uint8_t hash_key[] = {
+                0x37, 0x53, 0x7e, 0x31, 0xcf, 0xce, 0x48, 0xf5,
+                0x8a, 0xbb, 0x39, 0x57, 0x8d, 0xd9, 0xec, 0x59
+        };
+
+        return UID_CLAMP_INTO_RANGE(siphash24(name, strlen(name), hash_key));
+}
+
+static int dynamic_uid_map_set(Manager *m, uid_t uid) {
+        int r;
+
+        assert(m);
+
+        if (!uid_is_dynamic(uid))
+                return 0;
+
+        r = bitmap_ensure_allocated(&m->dynamic_uids);
+        if (r < 0)
+                return r;
+
+        return bitmap_set(m->dynamic_uids, uid - DYNAMIC_UID_MIN);
+}
+
+static bool dynamic_uid_map_source_changed(const char *path, const struct stat *old) {
+        struct stat st = {};
+
+        assert(path);
+        assert(old);
+
+        /* A missing file is recorded as all zeroes */
+        if (stat(path, &st) < 0 && errno != ENOENT)
+                return true;
+
+        return st.st_dev != old->st_dev ||
+                st.st_ino != old->st_ino ||
+                st.st_size != old->st_size ||
+                timespec_load_nsec(&st.st_mtim) != timespec_load_nsec(&old->st_mtim);
+}
+
+static int dynamic_uid_map_load(Manager *m) {
+        _cleanup_fclose_ FILE *p = NULL, *g = NULL;
+        struct passwd *pw;
+        struct group *gr;
+        DynamicUser *d;
+        Iterator i;
+        int r;
+
+        assert(m);
+
+        /* Mark all UIDs and GIDs of the dynamic range that are used by static users or groups. This reads the files
+         * directly rather than going through NSS, as NSS is not OK to use from PID 1. Other NSS modules are not
+         * supposed to hand out UIDs from the dynamic range in the first place, and the child checks the UID it
+         * ends up with against NSS anyway. */
+
+        if (m->dynamic_uids_loaded &&
+            !dynamic_uid_map_source_changed("/etc/passwd", &m->dynamic_uids_passwd_stat) &&
+            !dynamic_uid_map_source_changed("/etc/group", &m->dynamic_uids_group_stat))
+                return 0;
+
+        /* Start from scratch, so that UIDs of removed users may be picked again, but keep the ones we picked
+         * for our own dynamic users */
+        m->dynamic_uids_loaded = false;
+        bitmap_clear(m->dynamic_uids);
+        zero(m->dynamic_uids_passwd_stat);
+        zero(m->dynamic_uids_group_stat);
+
+        HASHMAP_FOREACH(d, m->dynamic_users, i) {
+                r = dynamic_uid_map_set(m, d->uid_hint);
+                if (r < 0)
+                        return r;
+        }
+
+        p = fopen("/etc/passwd", "re");
+        if (!p) {
+                if (errno != ENOENT)
+                        return -errno;
+        } else {
+                if (fstat(fileno(p), &m->dynamic_uids_passwd_stat) < 0)
+                        return -errno;
+
+                errno = 0;
+                while ((pw = fgetpwent(p))) {
+                        r = dynamic_uid_map_set(m, pw->pw_uid);
+                        if (r < 0)
+                                return r;
+
+                        errno = 0;
+                }
+                if (!IN_SET(errno, 0, ENOENT))
+                        return -errno;
+        }
+
+        g = fopen("/etc/group", "re");
+        if (!g) {
+                if (errno != ENOENT)
+                        return -errno;
+        } else {
+                if (fstat(fileno(g), &m->dynamic_uids_group_stat) < 0)
+                        return -errno;
+
+                errno = 0;
+                while ((gr = fgetgrent(g))) {
+                        r = dynamic_uid_map_set(m, (uid_t) gr->gr_gid);
+                        if (r < 0)
+                                return r;
+
+                        errno = 0;
+                }
+                if (!IN_SET(errno, 0, ENOENT))
+                        return -errno;
+        }
+
+        m->dynamic_uids_loaded = true;
+        return 0;
+}
+
+static void dynamic_user_reserve_uid(DynamicUser *d) {
+        uid_t candidate;
+        unsigned n;
+        int r;
+
+        assert(d);
+        assert(d->manager);
+
+        /* Pick a UID for the user in PID 1, so that the child that realizes the user doesn't have to probe the lock
+         * files and NSS for random UIDs. We start with the UID hashed from the name, so that the same user name
+         * usually ends up with the same UID, and take the next free one if it is taken already. This is only a hint:
+         * the lock file taken by the child remains authoritative. */
+
+        d->uid_hint = UID_INVALID;
+
+        r = dynamic_uid_map_load(d->manager);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to read static users and groups, not picking a UID for %s in advance: %m", d->name);
+                return;
+        }
+
+        candidate = uid_hash_name(d->name);
+
+        for (n = 0; n <= DYNAMIC_UID_MAX - DYNAMIC_UID_MIN; n++) {
+                if (!bitmap_isset(d->manager->dynamic_uids, candidate - DYNAMIC_UID_MIN))
+                        break;
+
+                candidate = candidate >= DYNAMIC_UID_MAX ? DYNAMIC_UID_MIN : candidate + 1;
+        }
+        if (n > DYNAMIC_UID_MAX - DYNAMIC_UID_MIN)
+                return; /* All taken, let the child probe for itself. */
+
+        if (dynamic_uid_map_set(d->manager, candidate) < 0)
+                return;
+
+        d->uid_hint = candidate;
+}
+
 static DynamicUser* dynamic_user_free(DynamicUser *d) {
         if (!d)
                 return NULL;
 
-        if (d->manager)
+        if (d->manager) {
                 (void) hashmap_remove(d->manager->dynamic_users, d->name);
 
+                if (uid_is_dynamic(d->uid_hint))
+                        bitmap_unset(d->manager->dynamic_uids, d->uid_hint - DYNAMIC_UID_MIN);
+        }
+
         safe_close_pair(d->storage_socket);
         return mfree(d);
 }
@@ -63,6 +223,7 @@ static int dynamic_user_add(Manager *m, const char *name, int storage_socket[2],
 
         strcpy(d->name, name);
 
+        d->uid_hint = UID_INVALID;
         d->storage_socket[0] = storage_socket[0];
         d->storage_socket[1] = storage_socket[1];
 
@@ -134,6 +295,8 @@ int dynamic_user_acquire(Manager *m, const char *name, DynamicUser** ret) {
 
         storage_socket[0] = storage_socket[1] = -1;
 
+        dynamic_user_reserve_uid(d);
+
         if (ret) {
                 d->n_ref++;
                 *ret = d;
@@ -181,20 +344,16 @@ static int make_uid_symlinks(uid_t uid, const char *name, bool b) {
         return r;
 }
 
-static int pick_uid(const char *name, uid_t *ret_uid) {
-
-        static const uint8_t hash_key[] = {
-                0x37, 0x53, 0x7e, 0x31, 0xcf, 0xce, 0x48, 0xf5,
-                0x8a, 0xbb, 0x39, 0x57, 0x8d, 0xd9, 0xec, 0x59
-        };
+static int pick_uid(const char *name, uid_t hint, uid_t *ret_uid) {
 
         unsigned n_tries = 100;
         uid_t candidate;
         int r;
 
-        /* A static user by this name does not exist yet. Let's find a free ID then, and use that. We start with a UID
-         * generated as hash from the user name. */
-        candidate = UID_CLAMP_INTO_RANGE(siphash24(name, strlen(name), hash_key));
+        /* A static user by this name does not exist yet. Let's find a free ID then, and use that. We start with the
+         * UID PID 1 picked for us, which it already checked against the static users and groups and the UIDs of its
+         * other dynamic users. If there's none we start with a UID generated as hash from the user name. */
+        candidate = uid_is_dynamic(hint) ? hint : uid_hash_name(name);
 
         (void) mkdir("/run/systemd/dynamic-uid", 0755);
 
@@ -236,7 +395,9 @@ static int pick_uid(const char *name, uid_t *ret_uid) {
                         lock_fd = safe_close(lock_fd);
                 }
 
-                /* Some superficial check whether this UID/GID might already be taken by some static user */
+                /* Some superficial check whether this UID/GID might already be taken by some static user. PID 1
+                 * checked the UID it picked only against /etc/passwd and /etc/group, hence check that one too:
+                 * other NSS modules might know it, or the files changed in the meantime. */
                 if (getpwuid(candidate) || getgrgid((gid_t) candidate)) {
                         (void) unlink(lock_path);
                         goto next;
@@ -426,7 +587,7 @@ int dynamic_user_realize(DynamicUser *d, uid_t *ret) {
                 if (uid == UID_INVALID) {
                         /* No static UID assigned yet, excellent. Let's pick a new dynamic one, and lock it. */
 
-                        uid_lock_fd = pick_uid(d->name, &uid);
+                        uid_lock_fd = pick_uid(d->name, d->uid_hint, &uid);
                         if (uid_lock_fd < 0)
                                 return uid_lock_fd;
                 }
@@ -594,7 +755,7 @@ int dynamic_user_serialize(Manager *m, FILE *f, FDSet *fds) {
                 if (copy1 < 0)
                         return copy1;
 
-                fprintf(f, "dynamic-user=%s %i %i\n", d->name, copy0, copy1);
+                (void) serialize_item_format(m->serializer, f, "dynamic-user", "%s %i %i", d->name, copy0, copy1);
         }
 
         return 0;
@@ -602,6 +763,8 @@ int dynamic_user_serialize(Manager *m, FILE *f, FDSet *fds) {
 
 void dynamic_user_deserialize_one(Manager *m, const char *value, FDSet *fds) {
         _cleanup_free_ char *name = NULL, *s0 = NULL, *s1 = NULL;
+        DynamicUser *d;
+        uid_t uid;
         int r, fd0, fd1;
 
         assert(m);
@@ -626,7 +789,7 @@ void dynamic_user_deserialize_one(Manager *m, const char *value, FDSet *fds) {
                 return;
         }
 
-        r = dynamic_user_add(m, name, (int[]) { fd0, fd1 }, NULL);
+        r = dynamic_user_add(m, name, (int[]) { fd0, fd1 }, &d);
         if (r < 0) {
                 log_debug_errno(r, "Failed to add dynamic user: %m");
                 return;
@@ -634,6 +797,10 @@ void dynamic_user_deserialize_one(Manager *m, const char *value, FDSet *fds) {
 
         (void) fdset_remove(fds, fd0);
         (void) fdset_remove(fds, fd1);
+
+        /* If the user is realized already, make sure we don't hand out its UID again */
+        if (dynamic_user_current(d, &uid) >= 0 && uid_is_dynamic(uid) && dynamic_uid_map_set(m, uid) >= 0)
+                d->uid_hint = uid;
 }
 
 void dynamic_user_vacuum(Manager *m, bool close_user) {
@@ -40,6 +40,10 @@ struct DynamicUser {
          * file fd locking the user ID we picked. */
         int storage_socket[2];
 
+        /* The UID PID 1 picked for this user from its map of taken UIDs, which the child realizing the user tries
+         * first. UID_INVALID if there's none. */
+        uid_t uid_hint;
+
         char name[];
 };
 
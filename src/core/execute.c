@@ -22,6 +22,7 @@
 #include <glob.h>
 #include <grp.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/capability.h>
@@ -32,6 +33,7 @@
 #include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -84,6 +86,7 @@
 #include "parse-util.h"
 #include "path-util.h"
 #include "process-util.h"
+#include "raw-clone.h"
 #include "rlimit-util.h"
 #include "rm-rf.h"
 #ifdef HAVE_SECCOMP
@@ -93,6 +96,7 @@
 #include "selinux-util.h"
 #include "signal-util.h"
 #include "smack-util.h"
+#include "socket-util.h"
 #include "special.h"
 #include "string-table.h"
 #include "string-util.h"
@@ -1944,24 +1948,125 @@ static int compile_read_write_paths(
         return 0;
 }
 
-static int apply_mount_namespace(
-                Unit *u,
-                ExecCommand *command,
+static void exec_namespace_root(
                 const ExecContext *context,
                 const ExecParameters *params,
-                ExecRuntime *runtime) {
+                const char **root_dir,
+                const char **root_image) {
 
-        _cleanup_strv_free_ char **rw = NULL;
-        char *tmp = NULL, *var = NULL;
-        const char *root_dir = NULL, *root_image = NULL;
-        NameSpaceInfo ns_info = {
-                .ignore_protect_paths = false,
+        *root_dir = *root_image = NULL;
+
+        if (params->flags & EXEC_APPLY_CHROOT) {
+                *root_image = context->root_image;
+
+                if (!*root_image)
+                        *root_dir = context->root_directory;
+        }
+}
+
+static NameSpaceInfo exec_namespace_info(const ExecContext *context, const char *root_dir) {
+        return (NameSpaceInfo) {
+                /*
+                 * If DynamicUser=no and RootDirectory= is set then lets pass a relaxed
+                 * sandbox info, otherwise enforce it, don't ignore protected paths and
+                 * fail if we are enable to apply the sandbox inside the mount namespace.
+                 */
+                .ignore_protect_paths = !context->dynamic_user && root_dir,
                 .private_dev = context->private_devices,
                 .protect_control_groups = context->protect_control_groups,
                 .protect_kernel_tunables = context->protect_kernel_tunables,
                 .protect_kernel_modules = context->protect_kernel_modules,
                 .mount_apivfs = context->mount_apivfs,
         };
+}
+
+typedef enum ExecNamespacePlanFlags {
+        EXEC_NAMESPACE_PLAN_CHROOT      = 1U << 0,
+        EXEC_NAMESPACE_PLAN_TMP         = 1U << 1,
+        EXEC_NAMESPACE_PLAN_VAR_TMP     = 1U << 2,
+} ExecNamespacePlanFlags;
+
+static int exec_context_get_namespace_plan(
+                ExecContext *context,
+                ExecCommand *command,
+                const ExecParameters *params,
+                ExecRuntime *runtime,
+                NamespacePlan **ret) {
+
+        _cleanup_(namespace_plan_freep) NamespacePlan *plan = NULL;
+        _cleanup_strv_free_ char **rw = NULL;
+        const char *root_dir, *root_image;
+        NameSpaceInfo ns_info;
+        bool apply_restrictions, tmp, var;
+        unsigned flags;
+        int r;
+
+        assert(context);
+        assert(command);
+        assert(params);
+        assert(ret);
+
+        /* The list of mounts to apply only depends on the context and on a few bits of the parameters and the
+         * runtime, hence compute it here once, instead of in every forked off child. The result is cached in the
+         * context until its settings change. */
+
+        apply_restrictions = (params->flags & EXEC_APPLY_PERMISSIONS) && !command->privileged;
+        tmp = context->private_tmp && runtime && runtime->tmp_dir;
+        var = context->private_tmp && runtime && runtime->var_tmp_dir;
+
+        flags = ((params->flags & EXEC_APPLY_CHROOT) ? EXEC_NAMESPACE_PLAN_CHROOT : 0) |
+                (tmp ? EXEC_NAMESPACE_PLAN_TMP : 0) |
+                (var ? EXEC_NAMESPACE_PLAN_VAR_TMP : 0);
+
+        if (context->namespace_plan[apply_restrictions] &&
+            context->namespace_plan_flags[apply_restrictions] == flags) {
+                *ret = context->namespace_plan[apply_restrictions];
+                return 0;
+        }
+
+        r = compile_read_write_paths(context, params, &rw);
+        if (r < 0)
+                return r;
+
+        exec_namespace_root(context, params, &root_dir, &root_image);
+        ns_info = exec_namespace_info(context, root_dir);
+
+        r = namespace_plan_new(root_dir, root_image,
+                               &ns_info, rw,
+                               apply_restrictions ? context->read_only_paths : NULL,
+                               apply_restrictions ? context->inaccessible_paths : NULL,
+                               context->bind_mounts,
+                               context->n_bind_mounts,
+                               tmp,
+                               var,
+                               apply_restrictions ? context->protect_home : PROTECT_HOME_NO,
+                               apply_restrictions ? context->protect_system : PROTECT_SYSTEM_NO,
+                               &plan);
+        if (r < 0)
+                return r;
+
+        namespace_plan_free(context->namespace_plan[apply_restrictions]);
+        context->namespace_plan[apply_restrictions] = plan;
+        context->namespace_plan_flags[apply_restrictions] = flags;
+
+        *ret = plan;
+        plan = NULL;
+
+        return 0;
+}
+
+static int apply_mount_namespace(
+                Unit *u,
+                ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                ExecRuntime *runtime,
+                const NamespacePlan *plan) {
+
+        _cleanup_strv_free_ char **rw = NULL;
+        char *tmp = NULL, *var = NULL;
+        const char *root_dir, *root_image;
+        NameSpaceInfo ns_info;
         bool apply_restrictions;
         int r;
 
@@ -1982,20 +2087,8 @@ static int apply_mount_namespace(
         if (r < 0)
                 return r;
 
-        if (params->flags & EXEC_APPLY_CHROOT) {
-                root_image = context->root_image;
-
-                if (!root_image)
-                        root_dir = context->root_directory;
-        }
-
-        /*
-         * If DynamicUser=no and RootDirectory= is set then lets pass a relaxed
-         * sandbox info, otherwise enforce it, don't ignore protected paths and
-         * fail if we are enable to apply the sandbox inside the mount namespace.
-         */
-        if (!context->dynamic_user && root_dir)
-                ns_info.ignore_protect_paths = true;
+        exec_namespace_root(context, params, &root_dir, &root_image);
+        ns_info = exec_namespace_info(context, root_dir);
 
         apply_restrictions = (params->flags & EXEC_APPLY_PERMISSIONS) && !command->privileged;
 
@@ -2010,7 +2103,8 @@ static int apply_mount_namespace(
                             apply_restrictions ? context->protect_home : PROTECT_HOME_NO,
                             apply_restrictions ? context->protect_system : PROTECT_SYSTEM_NO,
                             context->mount_flags,
-                            DISSECT_IMAGE_DISCARD_ON_LOOP);
+                            DISSECT_IMAGE_DISCARD_ON_LOOP,
+                            plan);
 
         /* If we couldn't set up the namespace this is probably due to a
          * missing capability. In this case, silently proceeed. */
@@ -2250,6 +2344,7 @@ static int exec_child(
                 unsigned n_socket_fds,
                 char **files_env,
                 int user_lookup_fd,
+                const NamespacePlan *namespace_plan,
                 int *exit_status,
                 char **error_message) {
 
@@ -2623,7 +2718,7 @@ static int exec_child(
 
         needs_mount_namespace = exec_needs_mount_namespace(context, params, runtime);
         if (needs_mount_namespace) {
-                r = apply_mount_namespace(unit, command, context, params, runtime);
+                r = apply_mount_namespace(unit, command, context, params, runtime, namespace_plan);
                 if (r < 0) {
                         *exit_status = EXIT_NAMESPACE;
                         return r;
@@ -2908,203 +3003,1805 @@ static int exec_child(
         return -errno;
 }
 
-int exec_spawn(Unit *unit,
-               ExecCommand *command,
-               const ExecContext *context,
-               const ExecParameters *params,
-               ExecRuntime *runtime,
-               DynamicCreds *dcreds,
-               pid_t *ret) {
+static void log_spawn_failure(
+                const char *unit_log_field,
+                const char *unit_id,
+                const ExecCommand *command,
+                int error,
+                int exit_status,
+                const char *error_message) {
+
+        /* Takes the unit's name and log field rather than the unit, so that the exec helper can use it too */
+
+        if (error_message)
+                log_struct_errno(LOG_ERR, error,
+                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
+                                 "%s%s", unit_log_field, unit_id,
+                                 "MESSAGE=%s: %s: %m", unit_id, error_message,
+                                 "EXECUTABLE=%s", command->path,
+                                 NULL);
+        else if (error == -ENOENT && command->ignore)
+                log_struct_errno(LOG_INFO, error,
+                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
+                                 "%s%s", unit_log_field, unit_id,
+                                 "MESSAGE=%s: Skipped spawning %s: %m", unit_id, command->path,
+                                 "EXECUTABLE=%s", command->path,
+                                 NULL);
+        else
+                log_struct_errno(LOG_ERR, error,
+                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
+                                 "%s%s", unit_log_field, unit_id,
+                                 "MESSAGE=%s: Failed at step %s spawning %s: %m", unit_id,
+                                 exit_status_to_string(exit_status, EXIT_STATUS_SYSTEMD),
+                                 command->path,
+                                 "EXECUTABLE=%s", command->path,
+                                 NULL);
+}
 
-        _cleanup_strv_free_ char **files_env = NULL;
-        int *fds = NULL;
-        unsigned n_storage_fds = 0, n_socket_fds = 0;
-        _cleanup_free_ char *line = NULL;
-        int socket_fd, r;
-        int named_iofds[3] = { -1, -1, -1 };
+/* Stack size for processes spawned with clone(CLONE_VM|CLONE_VFORK). They only run exec_vfork_child() on it, which
+ * neither recurses nor keeps large buffers on the stack. */
+#define EXEC_VFORK_STACK_SIZE (128U*1024U)
+
+/* exec_spawn_child_setup() keeps the list of fds to pass on the stack, services with more are forked */
+#define EXEC_VFORK_FDS_MAX 1024U
+
+typedef struct ExecSpawnStdio {
+        int fd;                 /* What to install as the stdio fd, or -1 to leave it as it is */
+        bool journal;           /* If true, fd is an unconnected socket to connect to the journal first */
+        char *header;           /* The stream header to send to the journal */
+        char *journal_stream;   /* "JOURNAL_STREAM=…" for this socket */
+        int error;              /* Set by the child if connecting to the journal failed */
+} ExecSpawnStdio;
+
+typedef struct ExecSpawnPlan {
+        Unit *unit;             /* NULL in the exec helper */
+        const char *unit_id;
+        const char *unit_log_field;
+        sd_id128_t invocation_id;
+        const ExecCommand *command;
+        const ExecContext *context;
+        const ExecParameters *params;
+
+        char **env;
         char **argv;
-        pid_t pid;
+        char **envp;            /* What is passed to execve(), with the strings borrowed from env */
+        char *listen_pid;       /* Where to write the child's PID into env, if $LISTEN_PID is set */
+        char *watchdog_pid;     /* Same, for $WATCHDOG_PID */
+        int journal_stream_index; /* Index of $JOURNAL_STREAM in envp, or -1 */
+
+        ExecSpawnStdio stdio[3];
+        int socket_fd;
+        int *fds;
+        unsigned n_storage_fds;
+        unsigned n_socket_fds;
+        int cgroup_fd;
+        char oom_score_adjust[DECIMAL_STR_MAX(int)];
+
+        int owned_fds[6];       /* fds opened by us for the child, to be closed by us again */
+        unsigned n_owned_fds;
+
+        /* If true, the child logs itself, otherwise it leaves that to the parent */
+        bool may_log;
+
+        /* Written by the child before it exits, if it failed to execute the command */
+        int error;
+        int exit_status;
+        const char *error_message;
+        int oom_error;
+} ExecSpawnPlan;
+
+#define log_spawn_plan_errno(plan, level, error, ...)                   \
+        log_object_internal(level, error, __FILE__, __LINE__, __func__, \
+                            (plan)->unit_log_field, (plan)->unit_id, NULL, NULL, ##__VA_ARGS__)
+
+static void exec_spawn_plan_done(ExecSpawnPlan *plan) {
+        unsigned k;
+
+        assert(plan);
+
+        for (k = 0; k < ELEMENTSOF(plan->stdio); k++) {
+                plan->stdio[k].header = mfree(plan->stdio[k].header);
+                plan->stdio[k].journal_stream = mfree(plan->stdio[k].journal_stream);
+        }
+
+        for (k = 0; k < plan->n_owned_fds; k++)
+                safe_close(plan->owned_fds[k]);
+        plan->n_owned_fds = 0;
+
+        plan->env = strv_free(plan->env);
+        plan->argv = strv_free(plan->argv);
+        plan->envp = mfree(plan->envp);
+        plan->fds = mfree(plan->fds);
+}
+
+static bool exec_spawn_is_simple(
+                Unit *unit,
+                const ExecContext *c,
+                const ExecParameters *p,
+                ExecRuntime *runtime,
+                DynamicCreds *dcreds,
+                char **argv) {
+
+        char **i;
 
         assert(unit);
-        assert(command);
-        assert(context);
-        assert(ret);
-        assert(params);
-        assert(params->fds || (params->n_storage_fds + params->n_socket_fds <= 0));
+        assert(c);
+        assert(p);
 
-        if (context->std_input == EXEC_INPUT_SOCKET ||
-            context->std_output == EXEC_OUTPUT_SOCKET ||
-            context->std_error == EXEC_OUTPUT_SOCKET) {
+        /* A process spawned with clone(CLONE_VM|CLONE_VFORK) shares our memory until it called execve(), and we are
+         * suspended until then. Hence, setting it up must not require anything beyond plain system calls on data we
+         * prepared beforehand: no memory allocations that aren't freed again, no logging, no NSS lookups, and no
+         * changes to our global state. That's the case for root services without any sandboxing, which we hence
+         * spawn this way, avoiding the cost of copying our page tables. Everything else is forked. */
 
-                if (params->n_socket_fds > 1) {
-                        log_unit_error(unit, "Got more than one socket.");
-                        return -EINVAL;
-                }
+#if defined(__hppa__) || defined(__ia64__)
+        /* The stack grows upwards on these, or clone() takes different parameters */
+        return false;
+#endif
 
-                if (params->n_socket_fds == 0) {
-                        log_unit_error(unit, "Got no socket.");
-                        return -EINVAL;
-                }
+        if (c->user || c->group || c->dynamic_user || dcreds || !strv_isempty(c->supplementary_groups) || c->pam_name)
+                return false;
 
-                socket_fd = params->fds[0];
-        } else {
-                socket_fd = -1;
-                fds = params->fds;
-                n_storage_fds = params->n_storage_fds;
-                n_socket_fds = params->n_socket_fds;
-        }
+        if (exec_context_needs_term(c) || c->tty_reset || c->tty_vhangup || c->tty_vt_disallocate || c->utmp_id)
+                return false;
 
-        r = exec_context_named_iofds(unit, context, params, named_iofds);
-        if (r < 0)
-                return log_unit_error_errno(unit, r, "Failed to load a named file descriptor: %m");
+        if (p->idle_pipe || p->stdin_fd >= 0 || unit_shall_confirm_spawn(unit))
+                return false;
 
-        r = exec_context_load_environment(unit, context, &files_env);
-        if (r < 0)
-                return log_unit_error_errno(unit, r, "Failed to load environment files: %m");
+        if (!IN_SET(c->std_input, EXEC_INPUT_NULL, EXEC_INPUT_SOCKET))
+                return false;
 
-        argv = params->argv ?: command->argv;
-        line = exec_command_line(argv);
-        if (!line)
-                return log_oom();
+        if (!IN_SET(c->std_output, EXEC_OUTPUT_INHERIT, EXEC_OUTPUT_NULL, EXEC_OUTPUT_SOCKET,
+                    EXEC_OUTPUT_SYSLOG, EXEC_OUTPUT_KMSG, EXEC_OUTPUT_JOURNAL) ||
+            !IN_SET(c->std_error, EXEC_OUTPUT_INHERIT, EXEC_OUTPUT_NULL, EXEC_OUTPUT_SOCKET,
+                    EXEC_OUTPUT_SYSLOG, EXEC_OUTPUT_KMSG, EXEC_OUTPUT_JOURNAL))
+                return false;
 
-        log_struct(LOG_DEBUG,
-                   LOG_UNIT_MESSAGE(unit, "About to execute: %s", line),
-                   "EXECUTABLE=%s", command->path,
-                   LOG_UNIT_ID(unit),
-                   NULL);
-        pid = fork();
-        if (pid < 0)
-                return log_unit_error_errno(unit, errno, "Failed to fork: %m");
+        if (c->working_directory_home || c->root_directory || c->root_image || !strv_isempty(c->runtime_directory))
+                return false;
 
-        if (pid == 0) {
-                int exit_status;
-                _cleanup_free_ char *error_message = NULL;
+        if (c->private_network || c->private_users || exec_needs_mount_namespace(c, p, runtime))
+                return false;
 
-                r = exec_child(unit,
-                               command,
-                               context,
-                               params,
-                               runtime,
-                               dcreds,
-                               argv,
-                               socket_fd,
-                               named_iofds,
-                               fds,
-                               n_storage_fds,
-                               n_socket_fds,
-                               files_env,
-                               unit->manager->user_lookup_fds[1],
-                               &exit_status,
-                               &error_message);
-                if (r < 0) {
-                        log_open();
-                        if (error_message)
-                                log_struct_errno(LOG_ERR, r,
-                                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
-                                                 LOG_UNIT_ID(unit),
-                                                 LOG_UNIT_MESSAGE(unit, "%s: %m",
-                                                                  error_message),
-                                                 "EXECUTABLE=%s", command->path,
-                                                 NULL);
-                        else if (r == -ENOENT && command->ignore)
-                                log_struct_errno(LOG_INFO, r,
-                                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
-                                                 LOG_UNIT_ID(unit),
-                                                 LOG_UNIT_MESSAGE(unit, "Skipped spawning %s: %m",
-                                                                  command->path),
-                                                 "EXECUTABLE=%s", command->path,
-                                                 NULL);
-                        else
-                                log_struct_errno(LOG_ERR, r,
-                                                 "MESSAGE_ID=" SD_MESSAGE_SPAWN_FAILED_STR,
-                                                 LOG_UNIT_ID(unit),
-                                                 LOG_UNIT_MESSAGE(unit, "Failed at step %s spawning %s: %m",
-                                                                  exit_status_to_string(exit_status, EXIT_STATUS_SYSTEMD),
-                                                                  command->path),
-                                                 "EXECUTABLE=%s", command->path,
-                                                 NULL);
-                }
+        if (!cap_test_all(c->capability_bounding_set) || c->capability_ambient_set != 0 || c->secure_bits != 0)
+                return false;
 
-                _exit(exit_status);
-        }
+        if (context_has_address_families(c) ||
+            context_has_syscall_filters(c) ||
+            !set_isempty(c->syscall_archs) ||
+            c->memory_deny_write_execute ||
+            c->restrict_realtime ||
+            exec_context_restrict_namespaces_set(c) ||
+            c->protect_kernel_tunables ||
+            c->protect_kernel_modules ||
+            c->private_devices)
+                return false;
 
-        log_unit_debug(unit, "Forked %s as "PID_FMT, command->path, pid);
+        if (c->selinux_context || p->selinux_context_net || c->apparmor_profile || c->smack_process_label || mac_smack_use())
+                return false;
 
-        /* We add the new process to the cgroup both in the child (so
-         * that we can be sure that no user code is ever executed
-         * outside of the cgroup) and in the parent (so that we can be
-         * sure that when we kill the cgroup the process will be
-         * killed too). */
-        if (params->cgroup_path)
-                (void) cg_attach(SYSTEMD_CGROUP_CONTROLLER, params->cgroup_path, pid);
+        if (p->n_storage_fds + p->n_socket_fds > EXEC_VFORK_FDS_MAX)
+                return false;
 
-        exec_status_start(&command->exec_status, pid);
+        /* The child can't attach itself to a cgroup in the legacy hierarchies without allocating memory */
+        if (p->cgroup_path && cg_all_unified() <= 0)
+                return false;
 
-        *ret = pid;
-        return 0;
+        /* These are only known after the child was spawned, and we'd have to resolve the command line again */
+        STRV_FOREACH(i, argv)
+                if (strstr(*i, "LISTEN_PID") || strstr(*i, "WATCHDOG_PID"))
+                        return false;
+
+        return true;
 }
 
-void exec_context_init(ExecContext *c) {
-        assert(c);
+static int exec_spawn_plan_own_fd(ExecSpawnPlan *plan, int fd) {
+        assert(plan);
+        assert(plan->n_owned_fds < ELEMENTSOF(plan->owned_fds));
 
-        c->umask = 0022;
-        c->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 0);
-        c->cpu_sched_policy = SCHED_OTHER;
-        c->syslog_priority = LOG_DAEMON|LOG_INFO;
-        c->syslog_level_prefix = true;
-        c->ignore_sigpipe = true;
-        c->timer_slack_nsec = NSEC_INFINITY;
-        c->personality = PERSONALITY_INVALID;
-        c->runtime_directory_mode = 0755;
-        c->capability_bounding_set = CAP_ALL;
-        c->restrict_namespaces = NAMESPACE_FLAGS_ALL;
+        if (fd < 0)
+                return -errno;
+
+        plan->owned_fds[plan->n_owned_fds++] = fd;
+        return fd;
 }
 
-void exec_context_done(ExecContext *c) {
-        unsigned l;
+static int exec_spawn_plan_output(ExecSpawnPlan *plan, int fileno, ExecOutput o, const char *ident) {
+        ExecSpawnStdio *s;
+        struct stat st;
+        int fd;
 
-        assert(c);
+        assert(plan);
+        assert(IN_SET(fileno, STDOUT_FILENO, STDERR_FILENO));
+        assert(ident);
 
-        c->environment = strv_free(c->environment);
-        c->environment_files = strv_free(c->environment_files);
-        c->pass_environment = strv_free(c->pass_environment);
+        s = plan->stdio + fileno;
 
-        for (l = 0; l < ELEMENTSOF(c->rlimit); l++)
-                c->rlimit[l] = mfree(c->rlimit[l]);
+        switch (o) {
 
-        for (l = 0; l < 3; l++)
-                c->stdio_fdname[l] = mfree(c->stdio_fdname[l]);
+        case EXEC_OUTPUT_NULL:
+                fd = exec_spawn_plan_own_fd(plan, open("/dev/null", O_WRONLY|O_NOCTTY|O_CLOEXEC));
+                if (fd < 0)
+                        return fd;
 
-        c->working_directory = mfree(c->working_directory);
-        c->root_directory = mfree(c->root_directory);
-        c->root_image = mfree(c->root_image);
-        c->tty_path = mfree(c->tty_path);
-        c->syslog_identifier = mfree(c->syslog_identifier);
-        c->user = mfree(c->user);
-        c->group = mfree(c->group);
+                s->fd = fd;
+                return 0;
 
-        c->supplementary_groups = strv_free(c->supplementary_groups);
+        case EXEC_OUTPUT_SOCKET:
+                assert(plan->socket_fd >= 0);
+                s->fd = plan->socket_fd;
+                return 0;
 
-        c->pam_name = mfree(c->pam_name);
+        case EXEC_OUTPUT_SYSLOG:
+        case EXEC_OUTPUT_KMSG:
+        case EXEC_OUTPUT_JOURNAL:
+                /* The socket is created here, but only connected in the child, exactly like connect_logger_as()
+                 * does it. Its inode won't change by that, hence we know $JOURNAL_STREAM already. */
+                fd = exec_spawn_plan_own_fd(plan, socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0));
+                if (fd < 0)
+                        return fd;
 
-        c->read_only_paths = strv_free(c->read_only_paths);
-        c->read_write_paths = strv_free(c->read_write_paths);
-        c->inaccessible_paths = strv_free(c->inaccessible_paths);
+                if (fstat(fd, &st) < 0)
+                        return -errno;
 
-        bind_mount_free_many(c->bind_mounts, c->n_bind_mounts);
+                if (asprintf(&s->journal_stream, "JOURNAL_STREAM=" DEV_FMT ":" INO_FMT, st.st_dev, st.st_ino) < 0)
+                        return -ENOMEM;
 
-        if (c->cpuset)
-                CPU_FREE(c->cpuset);
+                if (asprintf(&s->header,
+                             "%s\n"
+                             "%s\n"
+                             "%i\n"
+                             "%i\n"
+                             "%i\n"
+                             "%i\n"
+                             "%i\n",
+                             plan->context->syslog_identifier ? plan->context->syslog_identifier : ident,
+                             plan->unit_id,
+                             plan->context->syslog_priority,
+                             !!plan->context->syslog_level_prefix,
+                             o == EXEC_OUTPUT_SYSLOG,
+                             o == EXEC_OUTPUT_KMSG,
+                             false) < 0)
+                        return -ENOMEM;
 
-        c->utmp_id = mfree(c->utmp_id);
-        c->selinux_context = mfree(c->selinux_context);
-        c->apparmor_profile = mfree(c->apparmor_profile);
+                s->fd = fd;
+                s->journal = true;
+                return 0;
 
-        c->syscall_filter = set_free(c->syscall_filter);
-        c->syscall_archs = set_free(c->syscall_archs);
-        c->address_families = set_free(c->address_families);
+        default:
+                assert_not_reached("Unexpected output type");
+        }
+}
 
-        c->runtime_directory = strv_free(c->runtime_directory);
+static int exec_spawn_plan_reserve_pid(char **env, const char *field, char **ret) {
+        char **i, *t;
+        const char *e;
+        size_t l;
+
+        assert(field);
+        assert(ret);
+
+        /* build_environment() filled in our own PID, make room for the child's, which the child writes in itself */
+
+        e = strjoina(field, "=");
+        l = strlen(e);
+
+        STRV_FOREACH(i, env) {
+                const char *v;
+                pid_t pid;
+
+                v = startswith(*i, e);
+                if (!v || parse_pid(v, &pid) < 0 || pid != getpid())
+                        continue;
+
+                t = malloc(l + DECIMAL_STR_MAX(pid_t));
+                if (!t)
+                        return -ENOMEM;
+
+                strcpy(t, *i);
+                free(*i);
+                *i = t;
+
+                *ret = t + l;
+                return 0;
+        }
+
+        *ret = NULL;
+        return 0;
+}
+
+static int exec_spawn_plan_prepare(
+                ExecSpawnPlan *plan,
+                Unit *unit,
+                const ExecCommand *command,
+                const ExecContext *context,
+                const ExecParameters *params,
+                char **argv,
+                int socket_fd,
+                int *fds,
+                unsigned n_storage_fds,
+                unsigned n_socket_fds,
+                char **files_env) {
+
+        _cleanup_strv_free_ char **our_env = NULL, **pass_env = NULL;
+        const char *ident, *journal_stream = NULL;
+        ExecOutput o, e;
+        ExecInput i;
+        unsigned n_fds;
+        bool from_pid1;
+        int fd, r;
+        char **p;
+
+        assert(plan);
+        assert(unit);
+        assert(command);
+        assert(context);
+        assert(params);
+
+        *plan = (ExecSpawnPlan) {
+                .unit = unit,
+                .unit_id = unit->id,
+                .unit_log_field = unit->manager->unit_log_field,
+                .invocation_id = unit->invocation_id,
+                .command = command,
+                .context = context,
+                .params = params,
+                .journal_stream_index = -1,
+                .stdio = {
+                        { .fd = -1 },
+                        { .fd = -1 },
+                        { .fd = -1 },
+                },
+                .socket_fd = socket_fd,
+                .n_storage_fds = n_storage_fds,
+                .n_socket_fds = n_socket_fds,
+                .cgroup_fd = -1,
+        };
+
+        /* The child shifts the fds around in this array, hence it needs its own copy */
+        n_fds = n_storage_fds + n_socket_fds;
+        if (n_fds > 0) {
+                plan->fds = newdup(int, fds, n_fds);
+                if (!plan->fds)
+                        return -ENOMEM;
+        }
+
+        /* This follows setup_input() and setup_output(), with the child's "getppid() != 1" checks evaluated here
+         * as "getpid() != 1". */
+        from_pid1 = getpid() == 1;
+        ident = basename(command->path);
+        i = fixup_input(context->std_input, socket_fd, params->flags & EXEC_APPLY_TTY_STDIN);
+        o = fixup_output(context->std_output, socket_fd);
+        e = fixup_output(context->std_error, socket_fd);
+
+        if (i == EXEC_INPUT_SOCKET)
+                plan->stdio[STDIN_FILENO].fd = socket_fd;
+        else {
+                fd = exec_spawn_plan_own_fd(plan, open("/dev/null", O_RDONLY|O_NOCTTY|O_CLOEXEC));
+                if (fd < 0)
+                        return fd;
+
+                plan->stdio[STDIN_FILENO].fd = fd;
+        }
+
+        if (params->stdout_fd >= 0)
+                plan->stdio[STDOUT_FILENO].fd = params->stdout_fd;
+        else if (o == EXEC_OUTPUT_INHERIT) {
+                if (i != EXEC_INPUT_NULL)
+                        plan->stdio[STDOUT_FILENO].fd = STDIN_FILENO;
+                else if (from_pid1) {
+                        r = exec_spawn_plan_output(plan, STDOUT_FILENO, EXEC_OUTPUT_NULL, ident);
+                        if (r < 0)
+                                return r;
+                }
+        } else {
+                r = exec_spawn_plan_output(plan, STDOUT_FILENO, o, ident);
+                if (r < 0)
+                        return r;
+        }
+
+        if (params->stderr_fd >= 0)
+                plan->stdio[STDERR_FILENO].fd = params->stderr_fd;
+        else if (e == EXEC_OUTPUT_INHERIT && o == EXEC_OUTPUT_INHERIT && i == EXEC_INPUT_NULL && !from_pid1)
+                ;
+        else if (e == o || e == EXEC_OUTPUT_INHERIT)
+                plan->stdio[STDERR_FILENO].fd = STDOUT_FILENO;
+        else {
+                r = exec_spawn_plan_output(plan, STDERR_FILENO, e, ident);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Like in exec_child(), stderr's stream wins if both are connected to the journal */
+        journal_stream = plan->stdio[STDERR_FILENO].journal_stream ?: plan->stdio[STDOUT_FILENO].journal_stream;
+
+        if (params->cgroup_path) {
+                _cleanup_free_ char *path = NULL;
+
+                r = cg_get_path_and_check(SYSTEMD_CGROUP_CONTROLLER, params->cgroup_path, "cgroup.procs", &path);
+                if (r < 0)
+                        return r;
+
+                fd = exec_spawn_plan_own_fd(plan, open(path, O_WRONLY|O_NOCTTY|O_CLOEXEC));
+                if (fd < 0)
+                        return fd;
+
+                plan->cgroup_fd = fd;
+        }
+
+        if (context->oom_score_adjust_set)
+                sprintf(plan->oom_score_adjust, "%i", context->oom_score_adjust);
+
+        r = build_environment(unit, context, params, n_fds, NULL, NULL, NULL, 0, 0, &our_env);
+        if (r < 0)
+                return r;
+
+        if (journal_stream) {
+                r = strv_extend(&our_env, journal_stream);
+                if (r < 0)
+                        return r;
+        }
+
+        r = build_pass_environment(context, &pass_env);
+        if (r < 0)
+                return r;
+
+        plan->env = strv_env_merge(5,
+                                   params->environment,
+                                   our_env,
+                                   pass_env,
+                                   context->environment,
+                                   files_env,
+                                   NULL);
+        if (!plan->env)
+                return -ENOMEM;
+        plan->env = strv_env_clean(plan->env);
+
+        r = exec_spawn_plan_reserve_pid(plan->env, "LISTEN_PID", &plan->listen_pid);
+        if (r < 0)
+                return r;
+
+        r = exec_spawn_plan_reserve_pid(plan->env, "WATCHDOG_PID", &plan->watchdog_pid);
+        if (r < 0)
+                return r;
+
+        plan->argv = replace_env_argv(argv, plan->env);
+        if (!plan->argv)
+                return -ENOMEM;
+
+        plan->envp = newdup(char*, plan->env, strv_length(plan->env) + 1);
+        if (!plan->envp)
+                return -ENOMEM;
+
+        /* The child drops or replaces $JOURNAL_STREAM if it fails to connect to the journal */
+        if (journal_stream)
+                STRV_FOREACH(p, plan->envp)
+                        if (streq(*p, journal_stream)) {
+                                plan->journal_stream_index = p - plan->envp;
+                                break;
+                        }
+
+        return 0;
+}
+
+static int exec_spawn_child_stdio(ExecSpawnPlan *plan, int fileno) {
+        ExecSpawnStdio *s;
+        int fd, r;
+
+        assert(plan);
+
+        s = plan->stdio + fileno;
+
+        if (s->fd < 0)
+                return 0;
+
+        if (s->journal) {
+                r = connect_journal_socket(s->fd, UID_INVALID, GID_INVALID);
+                if (r >= 0 && shutdown(s->fd, SHUT_RD) < 0)
+                        r = -errno;
+                if (r < 0) {
+                        /* Like setup_output(), fall back to /dev/null */
+                        s->error = r;
+
+                        if (plan->may_log) {
+                                log_open();
+                                log_spawn_plan_errno(plan, LOG_ERR, r, "Failed to connect %s to the journal socket, ignoring: %m",
+                                                     fileno == STDOUT_FILENO ? "stdout" : "stderr");
+                                log_close();
+                        }
+
+                        fd = open("/dev/null", O_WRONLY|O_NOCTTY|O_CLOEXEC);
+                        if (fd < 0)
+                                return -errno;
+
+                        r = dup2(fd, fileno) < 0 ? -errno : 0;
+                        safe_close(fd);
+                        return r;
+                }
+
+                (void) fd_inc_sndbuf(s->fd, SNDBUF_SIZE);
+                (void) loop_write(s->fd, s->header, strlen(s->header), false);
+        }
+
+        return dup2(s->fd, fileno) < 0 ? -errno : 0;
+}
+
+static void exec_spawn_child_fix_journal_stream(ExecSpawnPlan *plan) {
+        ExecSpawnStdio *out, *err;
+        char **p;
+
+        assert(plan);
+
+        if (plan->journal_stream_index < 0)
+                return;
+
+        out = plan->stdio + STDOUT_FILENO;
+        err = plan->stdio + STDERR_FILENO;
+        p = plan->envp + plan->journal_stream_index;
+
+        if (err->journal && err->error >= 0)
+                return;
+
+        if (out->journal && out->error >= 0) {
+                *p = out->journal_stream;
+                return;
+        }
+
+        /* Neither is connected, drop the variable, moving the rest of the array down */
+        for (; *p; p++)
+                *p = *(p + 1);
+}
+
+static int exec_spawn_child_keyring(ExecSpawnPlan *plan) {
+        key_serial_t keyring, key;
+
+        assert(plan);
+
+        /* Same as setup_keyring(), minus the logging and the chown() */
+
+        keyring = keyctl(KEYCTL_JOIN_SESSION_KEYRING, 0, 0, 0, 0);
+        if (keyring == -1)
+                return IN_SET(errno, ENOSYS, EACCES, EPERM, EDQUOT) ? 0 : -errno;
+
+        if (sd_id128_is_null(plan->invocation_id))
+                return 0;
+
+        key = add_key("user", "invocation_id", &plan->invocation_id, sizeof(plan->invocation_id), KEY_SPEC_SESSION_KEYRING);
+        if (key == -1)
+                return 0;
+
+        if (keyctl(KEYCTL_SETPERM, key,
+                   KEY_POS_VIEW|KEY_POS_READ|KEY_POS_SEARCH|
+                   KEY_USR_VIEW|KEY_USR_READ|KEY_USR_SEARCH, 0, 0) < 0)
+                return -errno;
+
+        return 0;
+}
+
+static int exec_spawn_child_setup(ExecSpawnPlan *plan) {
+        const ExecContext *context = plan->context;
+        const ExecParameters *params = plan->params;
+        unsigned n_fds = plan->n_storage_fds + plan->n_socket_fds, n_keep = 0, k;
+        int keep[ELEMENTSOF(plan->stdio) + 2 + n_fds];
+        int fileno, i, r;
+        pid_t pid;
+
+        for (k = 0; k < ELEMENTSOF(plan->stdio); k++)
+                if (plan->stdio[k].fd >= 0)
+                        keep[n_keep++] = plan->stdio[k].fd;
+        if (plan->socket_fd >= 0)
+                keep[n_keep++] = plan->socket_fd;
+        if (plan->cgroup_fd >= 0)
+                keep[n_keep++] = plan->cgroup_fd;
+        for (k = 0; k < n_fds; k++)
+                keep[n_keep++] = plan->fds[k];
+
+        /* Not getpid(), as older glibc caches the PID, and the cache is shared with our parent */
+        pid = (pid_t) syscall(SYS_getpid);
+        if (plan->listen_pid)
+                sprintf(plan->listen_pid, PID_FMT, pid);
+        if (plan->watchdog_pid)
+                sprintf(plan->watchdog_pid, PID_FMT, pid);
+
+        (void) default_signals(SIGNALS_CRASH_HANDLER,
+                               SIGNALS_IGNORE, -1);
+
+        if (context->ignore_sigpipe)
+                (void) ignore_signals(SIGPIPE, -1);
+
+        r = reset_signal_mask();
+        if (r < 0) {
+                plan->exit_status = EXIT_SIGNAL_MASK;
+                plan->error_message = "Failed to reset signal mask";
+                return r;
+        }
+
+        r = close_all_fds_nomalloc(keep, n_keep);
+        if (r < 0) {
+                plan->exit_status = EXIT_FDS;
+                plan->error_message = "Failed to close remaining fds";
+                return r;
+        }
+
+        if (!context->same_pgrp)
+                if (setsid() < 0) {
+                        plan->exit_status = EXIT_SETSID;
+                        return -errno;
+                }
+
+        if (plan->socket_fd >= 0)
+                (void) fd_nonblock(plan->socket_fd, false);
+
+        for (fileno = STDIN_FILENO; fileno <= STDERR_FILENO; fileno++) {
+                r = exec_spawn_child_stdio(plan, fileno);
+                if (r < 0) {
+                        plan->exit_status = fileno == STDIN_FILENO ? EXIT_STDIN :
+                                            fileno == STDOUT_FILENO ? EXIT_STDOUT : EXIT_STDERR;
+                        plan->error_message = fileno == STDIN_FILENO ? "Failed to set up stdin" :
+                                              fileno == STDOUT_FILENO ? "Failed to set up stdout" : "Failed to set up stderr";
+                        return r;
+                }
+        }
+
+        exec_spawn_child_fix_journal_stream(plan);
+
+        if (plan->cgroup_fd >= 0)
+                if (write(plan->cgroup_fd, "0\n", 2) < 0) {
+                        plan->exit_status = EXIT_CGROUP;
+                        plan->error_message = "Failed to attach to cgroup";
+                        return -errno;
+                }
+
+        if (context->oom_score_adjust_set) {
+                int fd;
+
+                fd = open("/proc/self/oom_score_adj", O_WRONLY|O_NOCTTY|O_CLOEXEC);
+                r = fd < 0 ? -errno : loop_write(fd, plan->oom_score_adjust, strlen(plan->oom_score_adjust), false);
+                safe_close(fd);
+                if (r == -EPERM || r == -EACCES) {
+                        plan->oom_error = r;
+
+                        if (plan->may_log) {
+                                log_open();
+                                log_spawn_plan_errno(plan, LOG_DEBUG, r, "Failed to adjust OOM setting, assuming containerized execution, ignoring: %m");
+                                log_close();
+                        }
+                } else if (r < 0) {
+                        plan->exit_status = EXIT_OOM_ADJUST;
+                        plan->error_message = "Failed to write /proc/self/oom_score_adj";
+                        return r;
+                }
+        }
+
+        if (context->nice_set)
+                if (setpriority(PRIO_PROCESS, 0, context->nice) < 0) {
+                        plan->exit_status = EXIT_NICE;
+                        return -errno;
+                }
+
+        if (context->cpu_sched_set) {
+                struct sched_param param = {
+                        .sched_priority = context->cpu_sched_priority,
+                };
+
+                r = sched_setscheduler(0,
+                                       context->cpu_sched_policy |
+                                       (context->cpu_sched_reset_on_fork ?
+                                        SCHED_RESET_ON_FORK : 0),
+                                       &param);
+                if (r < 0) {
+                        plan->exit_status = EXIT_SETSCHEDULER;
+                        return -errno;
+                }
+        }
+
+        if (context->cpuset)
+                if (sched_setaffinity(0, CPU_ALLOC_SIZE(context->cpuset_ncpus), context->cpuset) < 0) {
+                        plan->exit_status = EXIT_CPUAFFINITY;
+                        return -errno;
+                }
+
+        if (context->ioprio_set)
+                if (ioprio_set(IOPRIO_WHO_PROCESS, 0, context->ioprio) < 0) {
+                        plan->exit_status = EXIT_IOPRIO;
+                        return -errno;
+                }
+
+        if (context->timer_slack_nsec != NSEC_INFINITY)
+                if (prctl(PR_SET_TIMERSLACK, context->timer_slack_nsec) < 0) {
+                        plan->exit_status = EXIT_TIMERSLACK;
+                        return -errno;
+                }
+
+        if (context->personality != PERSONALITY_INVALID)
+                if (personality(context->personality) < 0) {
+                        plan->exit_status = EXIT_PERSONALITY;
+                        return -errno;
+                }
+
+        (void) umask(context->umask);
+
+        if (params->flags & EXEC_NEW_KEYRING) {
+                r = exec_spawn_child_keyring(plan);
+                if (r < 0) {
+                        plan->exit_status = EXIT_KEYRING;
+                        return r;
+                }
+        }
+
+        r = apply_working_directory(context, params, NULL, false, &plan->exit_status);
+        if (r < 0)
+                return r;
+
+        r = close_all_fds_nomalloc(plan->fds, n_fds);
+        if (r >= 0)
+                r = shift_fds(plan->fds, n_fds);
+        if (r >= 0)
+                r = flags_fds(plan->fds, plan->n_storage_fds, plan->n_socket_fds, context->non_blocking);
+        if (r < 0) {
+                plan->exit_status = EXIT_FDS;
+                return r;
+        }
+
+        if ((params->flags & EXEC_APPLY_PERMISSIONS) && !plan->command->privileged) {
+
+                for (i = 0; i < _RLIMIT_MAX; i++) {
+
+                        if (!context->rlimit[i])
+                                continue;
+
+                        r = setrlimit_closest(i, context->rlimit[i]);
+                        if (r < 0) {
+                                plan->exit_status = EXIT_LIMITS;
+                                return r;
+                        }
+                }
+
+                if (prctl(PR_GET_SECUREBITS) != 0)
+                        if (prctl(PR_SET_SECUREBITS, 0) < 0) {
+                                plan->exit_status = EXIT_SECUREBITS;
+                                plan->error_message = "Failed to set secure bits";
+                                return -errno;
+                        }
+
+                if (context->no_new_privileges)
+                        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+                                plan->exit_status = EXIT_NO_NEW_PRIVILEGES;
+                                plan->error_message = "Failed to disable new privileges";
+                                return -errno;
+                        }
+        }
+
+        execve(plan->command->path, plan->argv, plan->envp);
+        plan->exit_status = EXIT_EXEC;
+        return -errno;
+}
+
+static int exec_vfork_child(void *userdata) {
+        ExecSpawnPlan *plan = userdata;
+
+        /* Runs on its own stack, but in our address space. Everything it does is reported back through the plan. */
+
+        plan->error = exec_spawn_child_setup(plan);
+        _exit(plan->exit_status);
+}
+
+static int exec_spawn_vfork(ExecSpawnPlan *plan, pid_t *ret) {
+        sigset_t all, saved;
+        uint8_t *stack;
+        unsigned k;
+        pid_t pid;
+        int r;
+
+        assert(plan);
+        assert(ret);
+        assert(plan->n_storage_fds + plan->n_socket_fds <= EXEC_VFORK_FDS_MAX);
+
+        stack = mmap(NULL, EXEC_VFORK_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED)
+                return -errno;
+
+        /* Block all signals, so that none of our handlers runs in the child before it reset them. This is undone
+         * once the child called execve() or exited, as we are suspended until then. */
+        assert_se(sigfillset(&all) >= 0);
+        assert_se(sigprocmask(SIG_SETMASK, &all, &saved) >= 0);
+
+        pid = clone(exec_vfork_child, stack + EXEC_VFORK_STACK_SIZE, CLONE_VM|CLONE_VFORK|SIGCHLD, plan);
+        r = pid < 0 ? -errno : 0;
+
+        assert_se(sigprocmask(SIG_SETMASK, &saved, NULL) >= 0);
+        (void) munmap(stack, EXEC_VFORK_STACK_SIZE);
+
+        if (r < 0)
+                return r;
+
+        /* The child can't log itself, hence do so on its behalf */
+        for (k = STDOUT_FILENO; k <= STDERR_FILENO; k++)
+                if (plan->stdio[k].error < 0)
+                        log_unit_error_errno(plan->unit, plan->stdio[k].error,
+                                             "Failed to connect %s to the journal socket, ignoring: %m",
+                                             k == STDOUT_FILENO ? "stdout" : "stderr");
+
+        if (plan->oom_error < 0)
+                log_unit_debug_errno(plan->unit, plan->oom_error,
+                                     "Failed to adjust OOM setting, assuming containerized execution, ignoring: %m");
+
+        if (plan->error < 0)
+                log_spawn_failure(plan->unit_log_field, plan->unit_id, plan->command, plan->error, plan->exit_status, plan->error_message);
+
+        *ret = pid;
+        return 0;
+}
+
+/* How long to wait for the exec helper to report the PID of a process it spawned for us. All it does in between is
+ * clone(), hence if it takes longer than this it is stuck, and we stop using it. */
+#define EXEC_HELPER_TIMEOUT_USEC (1 * USEC_PER_SEC)
+
+/* The maximum number of fds that can be passed in one message */
+#define EXEC_HELPER_FDS_MAX 253
+
+/* A small process we fork off early, while we are still small ourselves, and which then spawns simple services on
+ * our behalf with fork(). The services are created with CLONE_PARENT, so that they are our children rather than
+ * the helper's, and we get SIGCHLD for them as usual. */
+struct ExecHelper {
+        pid_t pid;
+        int fd;
+        bool broken;
+};
+
+/* A request to the exec helper is one SOCK_SEQPACKET message, consisting of this fixed part followed by
+ * NUL-terminated strings: the command path, the unit name, the unit log field, the working directory (if
+ * has_working_directory is set), argv, the environment, and for each stdio fd connected to the journal its stream
+ * header and $JOURNAL_STREAM assignment. The CPU affinity mask, if any, is appended as is. The fds are passed in
+ * this order: the socket, the cgroup.procs fd, the stdio fds marked as EXEC_HELPER_STDIO_PASSED, and the fds to pass
+ * to the process. */
+#define EXEC_HELPER_STDIO_PASSED (-2)
+
+typedef struct ExecHelperRequest {
+        sd_id128_t invocation_id;
+        struct rlimit rlimit[_RLIMIT_MAX];
+        uint64_t rlimit_set;
+        uint64_t timer_slack_nsec;
+        uint64_t cpuset_size;
+        uint64_t personality;
+        uint32_t n_argv;
+        uint32_t n_envp;
+        int32_t journal_stream_index;
+        int32_t listen_pid_index;
+        int32_t watchdog_pid_index;
+        uint32_t n_storage_fds;
+        uint32_t n_socket_fds;
+        int32_t stdio[3];       /* -1 to leave alone, 0…2 to duplicate that stdio fd, or EXEC_HELPER_STDIO_PASSED */
+        uint32_t flags;
+        int32_t nice;
+        int32_t cpu_sched_policy;
+        int32_t cpu_sched_priority;
+        int32_t ioprio;
+        int32_t oom_score_adjust;
+        uint32_t umask;
+        bool stdio_journal[3];
+        bool has_socket_fd;
+        bool has_cgroup_fd;
+        bool has_working_directory;
+        bool privileged;
+        bool ignore;
+        bool ignore_sigpipe;
+        bool same_pgrp;
+        bool oom_score_adjust_set;
+        bool nice_set;
+        bool cpu_sched_set;
+        bool cpu_sched_reset_on_fork;
+        bool ioprio_set;
+        bool working_directory_missing_ok;
+        bool non_blocking;
+        bool no_new_privileges;
+} ExecHelperRequest;
+
+typedef struct ExecHelperReply {
+        int32_t error;
+        int32_t pid;
+} ExecHelperReply;
+
+static int exec_helper_env_index(char **envp, const char *field, const char *value) {
+        char **i;
+
+        /* Returns the index of the assignment to field whose value starts at value in memory */
+
+        if (!value)
+                return -1;
+
+        STRV_FOREACH(i, envp)
+                if (startswith(*i, field) == value)
+                        return (int) (i - envp);
+
+        return -1;
+}
+
+static void *exec_helper_put_string(void *p, const char *s) {
+        return mempcpy(p, s, strlen(s) + 1);
+}
+
+static int exec_helper_send(ExecHelper *h, const ExecSpawnPlan *plan) {
+        const ExecContext *c = plan->context;
+        ExecHelperRequest req = {
+                .invocation_id = plan->invocation_id,
+                .timer_slack_nsec = c->timer_slack_nsec,
+                .cpuset_size = c->cpuset ? CPU_ALLOC_SIZE(c->cpuset_ncpus) : 0,
+                .personality = c->personality,
+                .n_argv = strv_length(plan->argv),
+                .n_envp = strv_length(plan->envp),
+                .journal_stream_index = plan->journal_stream_index,
+                .listen_pid_index = exec_helper_env_index(plan->envp, "LISTEN_PID=", plan->listen_pid),
+                .watchdog_pid_index = exec_helper_env_index(plan->envp, "WATCHDOG_PID=", plan->watchdog_pid),
+                .n_storage_fds = plan->n_storage_fds,
+                .n_socket_fds = plan->n_socket_fds,
+                .flags = plan->params->flags,
+                .nice = c->nice,
+                .cpu_sched_policy = c->cpu_sched_policy,
+                .cpu_sched_priority = c->cpu_sched_priority,
+                .ioprio = c->ioprio,
+                .oom_score_adjust = c->oom_score_adjust,
+                .umask = c->umask,
+                .has_socket_fd = plan->socket_fd >= 0,
+                .has_cgroup_fd = plan->cgroup_fd >= 0,
+                .has_working_directory = !!c->working_directory,
+                .privileged = plan->command->privileged,
+                .ignore = plan->command->ignore,
+                .ignore_sigpipe = c->ignore_sigpipe,
+                .same_pgrp = c->same_pgrp,
+                .oom_score_adjust_set = c->oom_score_adjust_set,
+                .nice_set = c->nice_set,
+                .cpu_sched_set = c->cpu_sched_set,
+                .cpu_sched_reset_on_fork = c->cpu_sched_reset_on_fork,
+                .ioprio_set = c->ioprio_set,
+                .working_directory_missing_ok = c->working_directory_missing_ok,
+                .non_blocking = c->non_blocking,
+                .no_new_privileges = c->no_new_privileges,
+        };
+        unsigned n_fds = plan->n_storage_fds + plan->n_socket_fds, n_passed = 0, k;
+        int passed[2 + ELEMENTSOF(plan->stdio) + n_fds];
+        _cleanup_free_ void *buf = NULL;
+        struct msghdr mh = {};
+        struct iovec iov;
+        char **i;
+        size_t size;
+        void *p;
+
+        if (plan->socket_fd >= 0)
+                passed[n_passed++] = plan->socket_fd;
+        if (plan->cgroup_fd >= 0)
+                passed[n_passed++] = plan->cgroup_fd;
+
+        size = sizeof(req) + strlen(plan->command->path) + 1 + strlen(plan->unit_id) + 1 + strlen(plan->unit_log_field) + 1;
+        if (c->working_directory)
+                size += strlen(c->working_directory) + 1;
+        STRV_FOREACH(i, plan->argv)
+                size += strlen(*i) + 1;
+        STRV_FOREACH(i, plan->envp)
+                size += strlen(*i) + 1;
+
+        for (k = 0; k < ELEMENTSOF(plan->stdio); k++) {
+                const ExecSpawnStdio *s = plan->stdio + k;
+
+                if (s->fd < 0)
+                        req.stdio[k] = -1;
+                else if (s->fd <= STDERR_FILENO)
+                        req.stdio[k] = s->fd;
+                else {
+                        req.stdio[k] = EXEC_HELPER_STDIO_PASSED;
+                        passed[n_passed++] = s->fd;
+                }
+
+                if (s->journal) {
+                        req.stdio_journal[k] = true;
+                        size += strlen(s->header) + 1 + strlen(s->journal_stream) + 1;
+                }
+        }
+
+        for (k = 0; k < n_fds; k++)
+                passed[n_passed++] = plan->fds[k];
+
+        if (n_passed > EXEC_HELPER_FDS_MAX)
+                return -EMSGSIZE;
+
+        for (k = 0; k < _RLIMIT_MAX; k++)
+                if (c->rlimit[k]) {
+                        req.rlimit[k] = *c->rlimit[k];
+                        req.rlimit_set |= UINT64_C(1) << k;
+                }
+
+        size += req.cpuset_size;
+
+        buf = malloc(size);
+        if (!buf)
+                return -ENOMEM;
+
+        p = mempcpy(buf, &req, sizeof(req));
+        p = exec_helper_put_string(p, plan->command->path);
+        p = exec_helper_put_string(p, plan->unit_id);
+        p = exec_helper_put_string(p, plan->unit_log_field);
+        if (c->working_directory)
+                p = exec_helper_put_string(p, c->working_directory);
+        STRV_FOREACH(i, plan->argv)
+                p = exec_helper_put_string(p, *i);
+        STRV_FOREACH(i, plan->envp)
+                p = exec_helper_put_string(p, *i);
+        for (k = 0; k < ELEMENTSOF(plan->stdio); k++)
+                if (plan->stdio[k].journal) {
+                        p = exec_helper_put_string(p, plan->stdio[k].header);
+                        p = exec_helper_put_string(p, plan->stdio[k].journal_stream);
+                }
+        if (req.cpuset_size > 0)
+                p = mempcpy(p, c->cpuset, req.cpuset_size);
+
+        assert((uint8_t*) p == (uint8_t*) buf + size);
+
+        iov.iov_base = buf;
+        iov.iov_len = size;
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+
+        if (n_passed > 0) {
+                struct cmsghdr *cmsg;
+
+                mh.msg_controllen = CMSG_SPACE(sizeof(int) * n_passed);
+                mh.msg_control = alloca0(mh.msg_controllen);
+
+                cmsg = CMSG_FIRSTHDR(&mh);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_passed);
+                memcpy(CMSG_DATA(cmsg), passed, sizeof(int) * n_passed);
+        }
+
+        if (sendmsg(h->fd, &mh, MSG_NOSIGNAL) < 0) {
+                /* Too large requests are our problem, not the helper's */
+                if (errno != EMSGSIZE)
+                        h->broken = true;
+
+                return -errno;
+        }
+
+        return 0;
+}
+
+static int exec_helper_spawn(ExecHelper *h, const ExecSpawnPlan *plan, bool *ret_sent, pid_t *ret) {
+        ExecHelperReply reply;
+        ssize_t n;
+        int r;
+
+        assert(h);
+        assert(plan);
+        assert(ret_sent);
+        assert(ret);
+
+        /* Sets *ret_sent once the request was handed to the helper. From then on the process might have been
+         * spawned even if we fail, hence the caller must not try to spawn it again. */
+
+        *ret_sent = false;
+
+        if (h->broken)
+                return -ENOTCONN;
+
+        r = exec_helper_send(h, plan);
+        if (r < 0)
+                return r;
+
+        *ret_sent = true;
+
+        r = fd_wait_for_event(h->fd, POLLIN, EXEC_HELPER_TIMEOUT_USEC);
+        if (r <= 0) {
+                h->broken = true;
+                return r < 0 ? r : -ETIMEDOUT;
+        }
+
+        n = recv(h->fd, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (n < 0) {
+                h->broken = true;
+                return -errno;
+        }
+        if (n != sizeof(reply)) {
+                h->broken = true;
+                return -EIO;
+        }
+
+        if (reply.error < 0) {
+                /* The helper reports errors only if it didn't spawn anything */
+                *ret_sent = false;
+                return reply.error;
+        }
+
+        *ret = reply.pid;
+        return 0;
+}
+
+typedef struct ExecHelperReceived {
+        void *buf;
+        int *fds;
+        unsigned n_fds;
+        char **argv;
+        char **envp;
+        char *listen_pid;
+        char *watchdog_pid;
+        ExecCommand command;
+        ExecContext context;
+        ExecParameters params;
+        ExecSpawnPlan plan;
+} ExecHelperReceived;
+
+static void exec_helper_received_done(ExecHelperReceived *rcv) {
+        assert(rcv);
+
+        close_many(rcv->fds, rcv->n_fds);
+        rcv->fds = mfree(rcv->fds);
+        rcv->n_fds = 0;
+
+        rcv->buf = mfree(rcv->buf);
+        rcv->argv = mfree(rcv->argv);
+        rcv->envp = mfree(rcv->envp);
+        rcv->listen_pid = mfree(rcv->listen_pid);
+        rcv->watchdog_pid = mfree(rcv->watchdog_pid);
+
+        /* We borrowed the strings from the buffer, but the context owns what we allocated for it */
+        exec_context_done(&rcv->context);
+}
+
+static const char *exec_helper_get_string(const char **p, const char *end) {
+        const char *s = *p, *e;
+
+        if (s >= end)
+                return NULL;
+
+        e = memchr(s, 0, end - s);
+        if (!e)
+                return NULL;
+
+        *p = e + 1;
+        return s;
+}
+
+static char **exec_helper_get_strv(const char **p, const char *end, uint32_t n) {
+        _cleanup_free_ char **l = NULL;
+        char **r;
+        uint32_t k;
+
+        l = new(char*, n + 1);
+        if (!l)
+                return NULL;
+
+        for (k = 0; k < n; k++) {
+                l[k] = (char*) exec_helper_get_string(p, end);
+                if (!l[k])
+                        return NULL;
+        }
+        l[n] = NULL;
+
+        r = l;
+        l = NULL;
+        return r;
+}
+
+static int exec_helper_make_pid_field(char **envp, uint32_t n_envp, int32_t index, const char *field, char **buffer, char **ret) {
+        size_t l;
+
+        /* Copies the assignment into a buffer large enough to hold any PID, see exec_spawn_plan_reserve_pid() */
+
+        if (index < 0) {
+                *ret = NULL;
+                return 0;
+        }
+
+        if ((uint32_t) index >= n_envp || !startswith(envp[index], field))
+                return -EBADMSG;
+
+        l = strlen(field);
+        *buffer = malloc(l + DECIMAL_STR_MAX(pid_t));
+        if (!*buffer)
+                return -ENOMEM;
+
+        strcpy(stpcpy(*buffer, field), "1");
+        envp[index] = *buffer;
+
+        *ret = *buffer + l;
+        return 0;
+}
+
+static int exec_helper_parse(ExecHelperReceived *rcv, size_t size) {
+        const char *p, *end, *path, *unit_id, *unit_log_field;
+        unsigned n_fds, n_passed = 0, k;
+        ExecHelperRequest req;
+        int r;
+
+        assert(rcv);
+
+        if (size < sizeof(req))
+                return -EBADMSG;
+
+        memcpy(&req, rcv->buf, sizeof(req));
+        if (req.cpuset_size > size - sizeof(req))
+                return -EBADMSG;
+
+        p = (const char*) rcv->buf + sizeof(req);
+        end = (const char*) rcv->buf + size - req.cpuset_size;
+
+        path = exec_helper_get_string(&p, end);
+        unit_id = exec_helper_get_string(&p, end);
+        unit_log_field = exec_helper_get_string(&p, end);
+        if (!path || !unit_id || !unit_log_field)
+                return -EBADMSG;
+
+        rcv->command = (ExecCommand) {
+                .path = (char*) path,
+                .privileged = req.privileged,
+                .ignore = req.ignore,
+        };
+
+        exec_context_init(&rcv->context);
+
+        if (req.has_working_directory) {
+                const char *wd;
+
+                wd = exec_helper_get_string(&p, end);
+                if (!wd)
+                        return -EBADMSG;
+
+                rcv->context.working_directory = strdup(wd);
+                if (!rcv->context.working_directory)
+                        return -ENOMEM;
+        }
+
+        rcv->argv = exec_helper_get_strv(&p, end, req.n_argv);
+        if (!rcv->argv)
+                return -EBADMSG;
+
+        rcv->envp = exec_helper_get_strv(&p, end, req.n_envp);
+        if (!rcv->envp)
+                return -EBADMSG;
+
+        rcv->plan = (ExecSpawnPlan) {
+                .unit_id = unit_id,
+                .unit_log_field = unit_log_field,
+                .invocation_id = req.invocation_id,
+                .command = &rcv->command,
+                .context = &rcv->context,
+                .params = &rcv->params,
+                .argv = rcv->argv,
+                .envp = rcv->envp,
+                .journal_stream_index = req.journal_stream_index,
+                .socket_fd = -1,
+                .n_storage_fds = req.n_storage_fds,
+                .n_socket_fds = req.n_socket_fds,
+                .cgroup_fd = -1,
+                .may_log = true,
+        };
+
+        if (req.journal_stream_index >= (int32_t) req.n_envp)
+                return -EBADMSG;
+
+        r = exec_helper_make_pid_field(rcv->envp, req.n_envp, req.listen_pid_index, "LISTEN_PID=", &rcv->listen_pid, &rcv->plan.listen_pid);
+        if (r < 0)
+                return r;
+
+        r = exec_helper_make_pid_field(rcv->envp, req.n_envp, req.watchdog_pid_index, "WATCHDOG_PID=", &rcv->watchdog_pid, &rcv->plan.watchdog_pid);
+        if (r < 0)
+                return r;
+
+        for (k = 0; k < ELEMENTSOF(rcv->plan.stdio); k++) {
+                ExecSpawnStdio *s = rcv->plan.stdio + k;
+
+                s->fd = -1;
+
+                if (!req.stdio_journal[k])
+                        continue;
+
+                s->journal = true;
+                s->header = (char*) exec_helper_get_string(&p, end);
+                s->journal_stream = (char*) exec_helper_get_string(&p, end);
+                if (!s->header || !s->journal_stream)
+                        return -EBADMSG;
+        }
+
+        if (p != end)
+                return -EBADMSG;
+
+        if (req.cpuset_size > 0) {
+                rcv->context.cpuset = memdup(end, req.cpuset_size);
+                if (!rcv->context.cpuset)
+                        return -ENOMEM;
+
+                rcv->context.cpuset_ncpus = req.cpuset_size * 8;
+        }
+
+        for (k = 0; k < _RLIMIT_MAX; k++)
+                if (req.rlimit_set & (UINT64_C(1) << k)) {
+                        rcv->context.rlimit[k] = newdup(struct rlimit, req.rlimit + k, 1);
+                        if (!rcv->context.rlimit[k])
+                                return -ENOMEM;
+                }
+
+        rcv->context.timer_slack_nsec = req.timer_slack_nsec;
+        rcv->context.personality = req.personality;
+        rcv->context.nice = req.nice;
+        rcv->context.nice_set = req.nice_set;
+        rcv->context.cpu_sched_policy = req.cpu_sched_policy;
+        rcv->context.cpu_sched_priority = req.cpu_sched_priority;
+        rcv->context.cpu_sched_set = req.cpu_sched_set;
+        rcv->context.cpu_sched_reset_on_fork = req.cpu_sched_reset_on_fork;
+        rcv->context.ioprio = req.ioprio;
+        rcv->context.ioprio_set = req.ioprio_set;
+        rcv->context.oom_score_adjust = req.oom_score_adjust;
+        rcv->context.oom_score_adjust_set = req.oom_score_adjust_set;
+        rcv->context.umask = req.umask;
+        rcv->context.ignore_sigpipe = req.ignore_sigpipe;
+        rcv->context.same_pgrp = req.same_pgrp;
+        rcv->context.working_directory_missing_ok = req.working_directory_missing_ok;
+        rcv->context.non_blocking = req.non_blocking;
+        rcv->context.no_new_privileges = req.no_new_privileges;
+
+        if (req.oom_score_adjust_set)
+                sprintf(rcv->plan.oom_score_adjust, "%i", req.oom_score_adjust);
+
+        rcv->params = (ExecParameters) {
+                .flags = req.flags,
+                .stdin_fd = -1,
+                .stdout_fd = -1,
+                .stderr_fd = -1,
+        };
+
+        /* Finally, hand out the fds in the order they were passed */
+        n_fds = req.n_storage_fds + req.n_socket_fds;
+
+        if (req.has_socket_fd) {
+                if (n_passed >= rcv->n_fds)
+                        return -EBADMSG;
+                rcv->plan.socket_fd = rcv->fds[n_passed++];
+        }
+
+        if (req.has_cgroup_fd) {
+                if (n_passed >= rcv->n_fds)
+                        return -EBADMSG;
+                rcv->plan.cgroup_fd = rcv->fds[n_passed++];
+        }
+
+        for (k = 0; k < ELEMENTSOF(rcv->plan.stdio); k++) {
+                if (req.stdio[k] == EXEC_HELPER_STDIO_PASSED) {
+                        if (n_passed >= rcv->n_fds)
+                                return -EBADMSG;
+                        rcv->plan.stdio[k].fd = rcv->fds[n_passed++];
+                } else if (req.stdio[k] >= (int32_t) k || req.stdio[k] < -1)
+                        /* Only earlier stdio fds may be duplicated */
+                        return -EBADMSG;
+                else
+                        rcv->plan.stdio[k].fd = req.stdio[k];
+        }
+
+        if (rcv->n_fds - n_passed != n_fds)
+                return -EBADMSG;
+
+        rcv->plan.fds = rcv->fds + n_passed;
+
+        return 0;
+}
+
+static int exec_helper_process_one(int fd) {
+        _cleanup_(exec_helper_received_done) ExecHelperReceived rcv = {};
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int) * EXEC_HELPER_FDS_MAX)];
+        } control = {};
+        struct msghdr mh = {
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        ExecHelperReply reply = {};
+        struct cmsghdr *cmsg;
+        struct iovec iov;
+        ssize_t l, n;
+        pid_t pid;
+        int r;
+
+        l = next_datagram_size_fd(fd);
+        if (l < 0)
+                return (int) l;
+        if (l == 0)
+                return 0; /* PID 1 closed the connection */
+
+        rcv.buf = malloc(l);
+        if (!rcv.buf)
+                return -ENOMEM;
+
+        iov.iov_base = rcv.buf;
+        iov.iov_len = l;
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+
+        n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+        if (n < 0)
+                return -errno;
+
+        CMSG_FOREACH(cmsg, &mh)
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                        assert(!rcv.fds);
+
+                        rcv.n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        rcv.fds = newdup(int, CMSG_DATA(cmsg), rcv.n_fds);
+                        if (!rcv.fds) {
+                                close_many((int*) CMSG_DATA(cmsg), rcv.n_fds);
+                                rcv.n_fds = 0;
+                                return -ENOMEM;
+                        }
+                }
+
+        if (mh.msg_flags & (MSG_TRUNC|MSG_CTRUNC))
+                r = -EBADMSG;
+        else
+                r = exec_helper_parse(&rcv, n);
+        if (r < 0) {
+                log_error_errno(r, "Failed to parse exec request: %m");
+                reply.error = r;
+        } else {
+                pid = raw_clone(CLONE_PARENT|SIGCHLD);
+                if (pid < 0)
+                        reply.error = -errno;
+                else if (pid == 0) {
+                        /* The fds are closed by the child, make sure the log doesn't reuse them */
+                        log_forget_fds();
+
+                        rcv.plan.error = exec_spawn_child_setup(&rcv.plan);
+
+                        log_open();
+                        log_spawn_failure(rcv.plan.unit_log_field, rcv.plan.unit_id, rcv.plan.command,
+                                          rcv.plan.error, rcv.plan.exit_status, rcv.plan.error_message);
+                        _exit(rcv.plan.exit_status);
+                } else
+                        reply.pid = pid;
+        }
+
+        if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        return 1;
+}
+
+noreturn static void exec_helper_run(int fd) {
+        int r;
+
+        rename_process("(sd-exec)");
+
+        (void) default_signals(SIGNALS_CRASH_HANDLER, SIGNALS_IGNORE, -1);
+        (void) reset_signal_mask();
+
+        log_forget_fds();
+        (void) close_all_fds(&fd, 1);
+        log_open();
+
+        for (;;) {
+                r = exec_helper_process_one(fd);
+                if (r == 0)
+                        break;
+                if (r < 0 && !IN_SET(r, -ENOMEM, -EBADMSG)) {
+                        log_error_errno(r, "Failed to process exec request, exiting: %m");
+                        _exit(EXIT_FAILURE);
+                }
+        }
+
+        _exit(EXIT_SUCCESS);
+}
+
+int exec_helper_new(ExecHelper **ret) {
+        _cleanup_close_pair_ int pair[2] = { -1, -1 };
+        ExecHelper *h;
+        pid_t pid;
+
+        assert(ret);
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, pair) < 0)
+                return -errno;
+
+        /* The environment of a process may be large, make sure it fits into one message */
+        (void) fd_inc_sndbuf(pair[0], SNDBUF_SIZE);
+        (void) fd_inc_rcvbuf(pair[1], SNDBUF_SIZE);
+
+        h = new0(ExecHelper, 1);
+        if (!h)
+                return -ENOMEM;
+
+        pid = fork();
+        if (pid < 0) {
+                free(h);
+                return -errno;
+        }
+
+        if (pid == 0) {
+                pair[0] = safe_close(pair[0]);
+                exec_helper_run(pair[1]);
+        }
+
+        h->pid = pid;
+        h->fd = pair[0];
+        pair[0] = -1;
+
+        log_debug("Started exec helper as " PID_FMT ".", pid);
+
+        *ret = h;
+        return 0;
+}
+
+ExecHelper *exec_helper_free(ExecHelper *h) {
+        if (!h)
+                return NULL;
+
+        safe_close(h->fd);
+
+        /* It would exit on its own now, but let's not wait for it to notice. If the manager already reaped it the
+         * PID is reset to 0 and we must not touch it anymore. As long as it is set the child is ours and unreaped,
+         * hence the PID cannot have been recycled, it's at worst a zombie. */
+        if (h->pid > 0) {
+                (void) kill(h->pid, SIGKILL);
+                (void) wait_for_terminate(h->pid, NULL);
+        }
+
+        return mfree(h);
+}
+
+bool exec_helper_child_exited(ExecHelper *h, pid_t pid) {
+        assert(h);
+
+        if (pid <= 0 || h->pid != pid)
+                return false;
+
+        log_debug("Exec helper process "PID_FMT" died.", pid);
+
+        h->pid = 0;
+        h->broken = true;
+
+        return true;
+}
+
+pid_t exec_helper_get_pid(ExecHelper *h) {
+        assert(h);
+
+        return h->pid;
+}
+
+int exec_spawn(Unit *unit,
+               ExecCommand *command,
+               ExecContext *context,
+               const ExecParameters *params,
+               ExecRuntime *runtime,
+               DynamicCreds *dcreds,
+               pid_t *ret) {
+
+        _cleanup_strv_free_ char **files_env = NULL;
+        NamespacePlan *namespace_plan = NULL;
+        int *fds = NULL;
+        unsigned n_storage_fds = 0, n_socket_fds = 0;
+        _cleanup_free_ char *line = NULL;
+        int socket_fd, r;
+        int named_iofds[3] = { -1, -1, -1 };
+        char **argv;
+        pid_t pid;
+
+        assert(unit);
+        assert(command);
+        assert(context);
+        assert(ret);
+        assert(params);
+        assert(params->fds || (params->n_storage_fds + params->n_socket_fds <= 0));
+
+        if (context->std_input == EXEC_INPUT_SOCKET ||
+            context->std_output == EXEC_OUTPUT_SOCKET ||
+            context->std_error == EXEC_OUTPUT_SOCKET) {
+
+                if (params->n_socket_fds > 1) {
+                        log_unit_error(unit, "Got more than one socket.");
+                        return -EINVAL;
+                }
+
+                if (params->n_socket_fds == 0) {
+                        log_unit_error(unit, "Got no socket.");
+                        return -EINVAL;
+                }
+
+                socket_fd = params->fds[0];
+        } else {
+                socket_fd = -1;
+                fds = params->fds;
+                n_storage_fds = params->n_storage_fds;
+                n_socket_fds = params->n_socket_fds;
+        }
+
+        r = exec_context_named_iofds(unit, context, params, named_iofds);
+        if (r < 0)
+                return log_unit_error_errno(unit, r, "Failed to load a named file descriptor: %m");
+
+        r = exec_context_load_environment(unit, context, &files_env);
+        if (r < 0)
+                return log_unit_error_errno(unit, r, "Failed to load environment files: %m");
+
+        argv = params->argv ?: command->argv;
+        line = exec_command_line(argv);
+        if (!line)
+                return log_oom();
+
+        log_struct(LOG_DEBUG,
+                   LOG_UNIT_MESSAGE(unit, "About to execute: %s", line),
+                   "EXECUTABLE=%s", command->path,
+                   LOG_UNIT_ID(unit),
+                   NULL);
+
+        if (exec_spawn_is_simple(unit, context, params, runtime, dcreds, argv)) {
+                _cleanup_(exec_spawn_plan_done) ExecSpawnPlan plan = {};
+
+                r = exec_spawn_plan_prepare(&plan, unit, command, context, params, argv,
+                                            socket_fd, fds, n_storage_fds, n_socket_fds, files_env);
+                if (r >= 0) {
+                        ExecHelper *helper = unit->manager->exec_helper;
+
+                        if (helper) {
+                                bool sent;
+
+                                r = exec_helper_spawn(helper, &plan, &sent, &pid);
+                                if (r >= 0)
+                                        goto spawned;
+
+                                if (helper->broken) {
+                                        log_unit_warning(unit, "Exec helper stopped responding, not using it anymore.");
+                                        unit->manager->exec_helper = exec_helper_free(helper);
+                                }
+
+                                /* The helper might have spawned the process before it failed to tell us. Don't
+                                 * spawn it a second time. If it exists, it was placed in the unit's cgroup, and
+                                 * is hence cleaned up with the failed unit. */
+                                if (sent)
+                                        return log_unit_error_errno(unit, r, "Failed to spawn %s through the exec helper: %m", command->path);
+
+                                log_unit_debug_errno(unit, r, "Failed to spawn %s through the exec helper, spawning it ourselves: %m", command->path);
+                        }
+
+                        r = exec_spawn_vfork(&plan, &pid);
+                        if (r < 0)
+                                return log_unit_error_errno(unit, r, "Failed to spawn: %m");
+
+                        goto spawned;
+                }
+
+                log_unit_debug_errno(unit, r, "Failed to prepare spawning %s without fork(), forking: %m", command->path);
+        }
+
+        if (exec_needs_mount_namespace(context, params, runtime)) {
+                r = exec_context_get_namespace_plan(context, command, params, runtime, &namespace_plan);
+                if (r < 0)
+                        log_unit_debug_errno(unit, r, "Failed to compute mount namespace plan, leaving it to the child: %m");
+        }
+
+        pid = fork();
+        if (pid < 0)
+                return log_unit_error_errno(unit, errno, "Failed to fork: %m");
+
+        if (pid == 0) {
+                int exit_status;
+                _cleanup_free_ char *error_message = NULL;
+
+                r = exec_child(unit,
+                               command,
+                               context,
+                               params,
+                               runtime,
+                               dcreds,
+                               argv,
+                               socket_fd,
+                               named_iofds,
+                               fds,
+                               n_storage_fds,
+                               n_socket_fds,
+                               files_env,
+                               unit->manager->user_lookup_fds[1],
+                               namespace_plan,
+                               &exit_status,
+                               &error_message);
+                if (r < 0) {
+                        log_open();
+                        log_spawn_failure(unit->manager->unit_log_field, unit->id, command, r, exit_status, error_message);
+                }
+
+                _exit(exit_status);
+        }
+
+spawned:
+        log_unit_debug(unit, "Forked %s as "PID_FMT, command->path, pid);
+
+        /* We add the new process to the cgroup both in the child (so
+         * that we can be sure that no user code is ever executed
+         * outside of the cgroup) and in the parent (so that we can be
+         * sure that when we kill the cgroup the process will be
+         * killed too). */
+        if (params->cgroup_path)
+                (void) cg_attach(SYSTEMD_CGROUP_CONTROLLER, params->cgroup_path, pid);
+
+        exec_status_start(&command->exec_status, pid);
+
+        if (unit->job && unit->job->type == JOB_START && !dual_timestamp_is_set(&unit->first_fork_timestamp))
+                dual_timestamp_get(&unit->first_fork_timestamp);
+
+        *ret = pid;
+        return 0;
+}
+
+void exec_context_init(ExecContext *c) {
+        assert(c);
+
+        c->umask = 0022;
+        c->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, 0);
+        c->cpu_sched_policy = SCHED_OTHER;
+        c->syslog_priority = LOG_DAEMON|LOG_INFO;
+        c->syslog_level_prefix = true;
+        c->ignore_sigpipe = true;
+        c->timer_slack_nsec = NSEC_INFINITY;
+        c->personality = PERSONALITY_INVALID;
+        c->runtime_directory_mode = 0755;
+        c->capability_bounding_set = CAP_ALL;
+        c->restrict_namespaces = NAMESPACE_FLAGS_ALL;
+}
+
+void exec_context_done(ExecContext *c) {
+        unsigned l;
+
+        assert(c);
+
+        c->environment = strv_free(c->environment);
+        c->environment_files = strv_free(c->environment_files);
+        c->pass_environment = strv_free(c->pass_environment);
+
+        for (l = 0; l < ELEMENTSOF(c->rlimit); l++)
+                c->rlimit[l] = mfree(c->rlimit[l]);
+
+        for (l = 0; l < 3; l++)
+                c->stdio_fdname[l] = mfree(c->stdio_fdname[l]);
+
+        c->working_directory = mfree(c->working_directory);
+        c->root_directory = mfree(c->root_directory);
+        c->root_image = mfree(c->root_image);
+        c->tty_path = mfree(c->tty_path);
+        c->syslog_identifier = mfree(c->syslog_identifier);
+        c->user = mfree(c->user);
+        c->group = mfree(c->group);
+
+        c->supplementary_groups = strv_free(c->supplementary_groups);
+
+        c->pam_name = mfree(c->pam_name);
+
+        c->read_only_paths = strv_free(c->read_only_paths);
+        c->read_write_paths = strv_free(c->read_write_paths);
+        c->inaccessible_paths = strv_free(c->inaccessible_paths);
+
+        bind_mount_free_many(c->bind_mounts, c->n_bind_mounts);
+
+        if (c->cpuset)
+                CPU_FREE(c->cpuset);
+
+        c->utmp_id = mfree(c->utmp_id);
+        c->selinux_context = mfree(c->selinux_context);
+        c->apparmor_profile = mfree(c->apparmor_profile);
+
+        c->syscall_filter = set_free(c->syscall_filter);
+        c->syscall_archs = set_free(c->syscall_archs);
+        c->address_families = set_free(c->address_families);
+
+        c->runtime_directory = strv_free(c->runtime_directory);
+
+        exec_context_flush_namespace_plans(c);
+}
+
+void exec_context_flush_namespace_plans(ExecContext *c) {
+        unsigned i;
+
+        assert(c);
+
+        for (i = 0; i < ELEMENTSOF(c->namespace_plan); i++) {
+                c->namespace_plan[i] = namespace_plan_free(c->namespace_plan[i]);
+                c->namespace_plan_flags[i] = 0;
+        }
 }
 
 int exec_context_destroy_runtime_directory(ExecContext *c, const char *runtime_prefix) {
@@ -24,6 +24,7 @@ typedef struct ExecCommand ExecCommand;
 typedef struct ExecContext ExecContext;
 typedef struct ExecRuntime ExecRuntime;
 typedef struct ExecParameters ExecParameters;
+typedef struct ExecHelper ExecHelper;
 
 #include <sched.h>
 #include <stdbool.h>
@@ -164,6 +165,12 @@ struct ExecContext {
         BindMount *bind_mounts;
         unsigned n_bind_mounts;
 
+        /* The mount plans computed by exec_spawn() from the settings
+         * above, for commands with and without restrictions applied,
+         * and the ExecNamespacePlanFlags they were computed with */
+        NamespacePlan *namespace_plan[2];
+        unsigned namespace_plan_flags[2];
+
         uint64_t capability_bounding_set;
         uint64_t capability_ambient_set;
         int secure_bits;
@@ -274,7 +281,7 @@ struct ExecParameters {
 
 int exec_spawn(Unit *unit,
                ExecCommand *command,
-               const ExecContext *context,
+               ExecContext *context,
                const ExecParameters *exec_params,
                ExecRuntime *runtime,
                DynamicCreds *dynamic_creds,
@@ -296,6 +303,7 @@ int exec_command_append(ExecCommand *c, const char *path, ...);
 
 void exec_context_init(ExecContext *c);
 void exec_context_done(ExecContext *c);
+void exec_context_flush_namespace_plans(ExecContext *c);
 void exec_context_dump(ExecContext *c, FILE* f, const char *prefix);
 
 int exec_context_destroy_runtime_directory(ExecContext *c, const char *runtime_root);
@@ -322,6 +330,11 @@ int exec_runtime_deserialize_item(Unit *unit, ExecRuntime **rt, const char *key,
 
 void exec_runtime_destroy(ExecRuntime *rt);
 
+int exec_helper_new(ExecHelper **ret);
+ExecHelper *exec_helper_free(ExecHelper *h);
+bool exec_helper_child_exited(ExecHelper *h, pid_t pid);
+pid_t exec_helper_get_pid(ExecHelper *h);
+
 const char* exec_output_to_string(ExecOutput i) _const_;
 ExecOutput exec_output_from_string(const char *s) _pure_;
 
@@ -145,6 +145,7 @@ void job_uninstall(Job *j) {
 
         *pj = NULL;
 
+        unit_bump_generation(j->unit);
         unit_add_to_gc_queue(j->unit);
 
         hashmap_remove(j->manager->jobs, UINT32_TO_PTR(j->id));
@@ -225,6 +226,13 @@ Job* job_install(Job *j) {
         *pj = j;
         j->installed = true;
 
+        if (IN_SET(j->type, JOB_START, JOB_RESTART)) {
+                dual_timestamp_get(&j->unit->job_queued_timestamp);
+                j->unit->job_running_timestamp = DUAL_TIMESTAMP_NULL;
+                j->unit->first_fork_timestamp = DUAL_TIMESTAMP_NULL;
+                j->unit->ready_timestamp = DUAL_TIMESTAMP_NULL;
+        }
+
         j->manager->n_installed_jobs++;
         log_unit_debug(j->unit,
                        "Installed new job %s/%s as %u",
@@ -471,7 +479,7 @@ static bool job_is_runnable(Job *j) {
                  * dependencies, regardless whether they are
                  * starting or stopping something. */
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i)
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i)
                         if (other->job)
                                 return false;
         }
@@ -479,7 +487,7 @@ static bool job_is_runnable(Job *j) {
         /* Also, if something else is being stopped and we should
          * change state after it, then let's wait. */
 
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i)
                 if (other->job &&
                     IN_SET(other->job->type, JOB_STOP, JOB_RESTART))
                         return false;
@@ -580,6 +588,9 @@ int job_run_and_invalidate(Job *j) {
         job_set_state(j, JOB_RUNNING);
         job_add_to_dbus_queue(j);
 
+        if (j->type == JOB_START)
+                dual_timestamp_get(&j->unit->job_running_timestamp);
+
 
         switch (j->type) {
 
@@ -832,7 +843,7 @@ static void job_fail_dependencies(Unit *u, UnitDependency d) {
 
         assert(u);
 
-        SET_FOREACH(other, u->dependencies[d], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, d, i) {
                 Job *j = other->job;
 
                 if (!j)
@@ -917,12 +928,12 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive, bool alr
 
 finish:
         /* Try to start the next jobs that can be started */
-        SET_FOREACH(other, u->dependencies[UNIT_AFTER], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER, i)
                 if (other->job) {
                         job_add_to_run_queue(other->job);
                         job_add_to_gc_queue(other->job);
                 }
-        SET_FOREACH(other, u->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BEFORE, i)
                 if (other->job) {
                         job_add_to_run_queue(other->job);
                         job_add_to_gc_queue(other->job);
@@ -1017,6 +1028,9 @@ void job_add_to_dbus_queue(Job *j) {
         assert(j);
         assert(j->installed);
 
+        /* The job is part of what ListUnits() returns about the unit */
+        unit_bump_generation(j->unit);
+
         if (j->in_dbus_queue)
                 return;
 
@@ -1040,61 +1054,55 @@ char *job_dbus_path(Job *j) {
 }
 
 int job_serialize(Job *j, FILE *f) {
+        Serializer *s;
+
         assert(j);
         assert(f);
 
-        fprintf(f, "job-id=%u\n", j->id);
-        fprintf(f, "job-type=%s\n", job_type_to_string(j->type));
-        fprintf(f, "job-state=%s\n", job_state_to_string(j->state));
-        fprintf(f, "job-irreversible=%s\n", yes_no(j->irreversible));
-        fprintf(f, "job-sent-dbus-new-signal=%s\n", yes_no(j->sent_dbus_new_signal));
-        fprintf(f, "job-ignore-order=%s\n", yes_no(j->ignore_order));
+        s = j->manager->serializer;
+
+        (void) serialize_item_uint64(s, f, "job-id", j->id);
+        (void) serialize_item(s, f, "job-type", job_type_to_string(j->type));
+        (void) serialize_item(s, f, "job-state", job_state_to_string(j->state));
+        (void) serialize_item_boolean(s, f, "job-irreversible", j->irreversible);
+        (void) serialize_item_boolean(s, f, "job-sent-dbus-new-signal", j->sent_dbus_new_signal);
+        (void) serialize_item_boolean(s, f, "job-ignore-order", j->ignore_order);
 
         if (j->begin_usec > 0)
-                fprintf(f, "job-begin="USEC_FMT"\n", j->begin_usec);
+                (void) serialize_item_uint64(s, f, "job-begin", j->begin_usec);
         if (j->begin_running_usec > 0)
-                fprintf(f, "job-begin-running="USEC_FMT"\n", j->begin_running_usec);
+                (void) serialize_item_uint64(s, f, "job-begin-running", j->begin_running_usec);
 
-        bus_track_serialize(j->bus_track, f, "subscribed");
+        bus_track_serialize(j->bus_track, s, f, "subscribed");
 
         /* End marker */
-        fputc('\n', f);
+        (void) serialize_end(s, f);
         return 0;
 }
 
-int job_deserialize(Job *j, FILE *f) {
+int job_deserialize(Job *j, Deserializer *d) {
         assert(j);
-        assert(f);
+        assert(d);
 
         for (;;) {
-                char line[LINE_MAX], *l, *v;
-                size_t k;
+                SerializedItem i;
+                const char *l, *v;
+                int r;
 
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                return 0;
-                        return -errno;
-                }
-
-                char_array_0(line);
-                l = strstrip(line);
-
-                /* End marker */
-                if (l[0] == 0)
-                        return 0;
-
-                k = strcspn(l, "=");
+                r = deserializer_read_item(d, &i);
+                if (r <= 0)
+                        return r;
 
-                if (l[k] == '=') {
-                        l[k] = 0;
-                        v = l+k+1;
-                } else
-                        v = l+k;
+                l = i.key;
+                v = serialized_item_string(&i);
 
                 if (streq(l, "job-id")) {
+                        uint64_t id;
 
-                        if (safe_atou32(v, &j->id) < 0)
+                        if (serialized_item_get_uint64(&i, &id) < 0 || id > UINT32_MAX)
                                 log_debug("Failed to parse job id value %s", v);
+                        else
+                                j->id = id;
 
                 } else if (streq(l, "job-type")) {
                         JobType t;
@@ -1117,47 +1125,38 @@ int job_deserialize(Job *j, FILE *f) {
                                 job_set_state(j, s);
 
                 } else if (streq(l, "job-irreversible")) {
-                        int b;
+                        bool b;
 
-                        b = parse_boolean(v);
-                        if (b < 0)
+                        if (serialized_item_get_boolean(&i, &b) < 0)
                                 log_debug("Failed to parse job irreversible flag %s", v);
                         else
                                 j->irreversible = j->irreversible || b;
 
                 } else if (streq(l, "job-sent-dbus-new-signal")) {
-                        int b;
+                        bool b;
 
-                        b = parse_boolean(v);
-                        if (b < 0)
+                        if (serialized_item_get_boolean(&i, &b) < 0)
                                 log_debug("Failed to parse job sent_dbus_new_signal flag %s", v);
                         else
                                 j->sent_dbus_new_signal = j->sent_dbus_new_signal || b;
 
                 } else if (streq(l, "job-ignore-order")) {
-                        int b;
+                        bool b;
 
-                        b = parse_boolean(v);
-                        if (b < 0)
+                        if (serialized_item_get_boolean(&i, &b) < 0)
                                 log_debug("Failed to parse job ignore_order flag %s", v);
                         else
                                 j->ignore_order = j->ignore_order || b;
 
                 } else if (streq(l, "job-begin")) {
-                        unsigned long long ull;
 
-                        if (sscanf(v, "%llu", &ull) != 1)
+                        if (serialized_item_get_uint64(&i, &j->begin_usec) < 0)
                                 log_debug("Failed to parse job-begin value %s", v);
-                        else
-                                j->begin_usec = ull;
 
                 } else if (streq(l, "job-begin-running")) {
-                        unsigned long long ull;
 
-                        if (sscanf(v, "%llu", &ull) != 1)
+                        if (serialized_item_get_uint64(&i, &j->begin_running_usec) < 0)
                                 log_debug("Failed to parse job-begin-running value %s", v);
-                        else
-                                j->begin_running_usec = ull;
 
                 } else if (streq(l, "subscribed")) {
 
@@ -1299,7 +1298,7 @@ bool job_check_gc(Job *j) {
 
         /* If a job is ordered after ours, and is to be started, then it needs to wait for us, regardless if we stop or
          * start, hence let's not GC in that case. */
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i) {
                 if (!other->job)
                         continue;
 
@@ -1313,7 +1312,7 @@ bool job_check_gc(Job *j) {
         /* If we are going down, but something else is orederd After= us, then it needs to wait for us */
         if (IN_SET(j->type, JOB_STOP, JOB_RESTART)) {
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i) {
                         if (!other->job)
                                 continue;
 
@@ -1405,7 +1404,7 @@ int job_get_before(Job *j, Job*** ret) {
 
         if (IN_SET(j->type, JOB_START, JOB_VERIFY_ACTIVE, JOB_RELOAD)) {
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i) {
                         if (!other->job)
                                 continue;
 
@@ -1415,7 +1414,7 @@ int job_get_before(Job *j, Job*** ret) {
                 }
         }
 
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i) {
                 if (!other->job)
                         continue;
 
@@ -1446,7 +1445,7 @@ int job_get_after(Job *j, Job*** ret) {
 
         /* Returns a list of all pending jobs that are waiting for this job to finish. */
 
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i) {
                 if (!other->job)
                         continue;
 
@@ -1463,7 +1462,7 @@ int job_get_after(Job *j, Job*** ret) {
 
         if (IN_SET(j->type, JOB_STOP, JOB_RESTART)) {
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i) {
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i) {
                         if (!other->job)
                                 continue;
 
@@ -1531,7 +1531,7 @@ int config_parse_trigger_unit(
         assert(rvalue);
         assert(data);
 
-        if (!set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+        if (UNIT_TRIGGER(u)) {
                 log_syntax(unit, LOG_ERR, filename, line, 0, "Multiple units to trigger specified, ignoring: %s", rvalue);
                 return 0;
         }
@@ -1615,7 +1615,6 @@ int config_parse_path_spec(const char *unit,
         s->path = path_kill_slashes(k);
         k = NULL;
         s->type = b;
-        s->inotify_fd = -1;
 
         LIST_PREPEND(spec, p->specs, s);
 
@@ -4377,10 +4376,11 @@ static int load_from_path(Unit *u, const char *path) {
                 u->fragment_mtime = timespec_load(&st.st_mtim);
 
                 /* Now, parse the file contents */
-                r = config_parse(u->id, filename, f,
-                                 UNIT_VTABLE(u)->sections,
-                                 config_item_perf_lookup, load_fragment_gperf_lookup,
-                                 false, true, false, u);
+                r = unit_cache_parse(u->manager->unit_cache,
+                                     u->id, filename, f,
+                                     UNIT_VTABLE(u)->sections,
+                                     config_item_perf_lookup, load_fragment_gperf_lookup,
+                                     false, true, false, u);
                 if (r < 0)
                         return r;
         }
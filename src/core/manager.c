@@ -26,6 +26,7 @@
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/reboot.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -69,8 +70,10 @@
 #include "path-lookup.h"
 #include "path-util.h"
 #include "process-util.h"
+#include "random-util.h"
 #include "ratelimit.h"
 #include "rm-rf.h"
+#include "serialize.h"
 #include "signal-util.h"
 #include "special.h"
 #include "stat-util.h"
@@ -88,6 +91,7 @@
 #include "watchdog.h"
 
 #define NOTIFY_RCVBUF_SIZE (8*1024*1024)
+#define NOTIFY_BATCH_MAX 64U
 #define CGROUPS_AGENT_RCVBUF_SIZE (8*1024*1024)
 
 /* Initial delay and the interval for printing status messages about running jobs */
@@ -95,6 +99,17 @@
 #define JOBS_IN_PROGRESS_PERIOD_USEC (USEC_PER_SEC / 3)
 #define JOBS_IN_PROGRESS_PERIOD_DIVISOR 3
 
+/* How long to keep freshly created transient unit files in memory before writing them out */
+#define TRANSIENT_PERSIST_DELAY_USEC (10*USEC_PER_SEC)
+
+/* Where the system instance persists its unit cache across daemon-reexec */
+#define UNIT_CACHE_PATH "/run/systemd/unit-cache"
+
+/* Spend at most this much time per event loop iteration on collecting and freeing units, so that churn of large
+ * numbers of short-lived units doesn't show up as event loop latency. The clock is checked only every so many units. */
+#define GC_BUDGET_USEC (5 * USEC_PER_MSEC)
+#define GC_BUDGET_CHECK_INTERVAL 64U
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_cgroups_agent_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_signal_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
@@ -597,11 +612,13 @@ int manager_new(UnitFileScope scope, bool test_run, Manager **_m) {
 
         m->pin_cgroupfs_fd = m->notify_fd = m->cgroups_agent_fd = m->signal_fd = m->time_change_fd =
                 m->dev_autofs_fd = m->private_listen_fd = m->cgroup_inotify_fd =
-                m->ask_password_inotify_fd = -1;
+                m->ask_password_inotify_fd = m->path_inotify_fd = -1;
 
         m->user_lookup_fds[0] = m->user_lookup_fds[1] = -1;
 
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
+        m->cgroup_queue_generation = 1; /* units start out with generation #0, i.e. never queued */
+        m->units_epoch = random_u64() ?: 1; /* never 0, so that clients may pass that if they have none */
 
         m->have_ask_password = -EINVAL; /* we don't know */
         m->first_boot = -1;
@@ -672,6 +689,14 @@ int manager_new(UnitFileScope scope, bool test_run, Manager **_m) {
 
         m->taint_usr = dir_is_empty("/usr") > 0;
 
+        /* Fork off the exec helper now, while we are still small, so that this is cheap, and so is every fork()
+         * the helper does later on. */
+        if (MANAGER_IS_SYSTEM(m) && !m->test_run) {
+                r = exec_helper_new(&m->exec_helper);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to start exec helper, ignoring: %m");
+        }
+
         *_m = m;
         return 0;
 
@@ -894,15 +919,27 @@ static int manager_connect_bus(Manager *m, bool reexecuting) {
         return bus_init(m, try_bus_connect);
 }
 
-static unsigned manager_dispatch_cleanup_queue(Manager *m) {
+static bool gc_budget_exhausted(unsigned n, usec_t deadline) {
+        return deadline != USEC_INFINITY &&
+                n > 0 && n % GC_BUDGET_CHECK_INTERVAL == 0 &&
+                now(CLOCK_MONOTONIC) >= deadline;
+}
+
+static unsigned manager_dispatch_cleanup_queue(Manager *m, usec_t budget) {
+        usec_t deadline;
         Unit *u;
         unsigned n = 0;
 
         assert(m);
 
+        deadline = budget == USEC_INFINITY ? USEC_INFINITY : usec_add(now(CLOCK_MONOTONIC), budget);
+
         while ((u = m->cleanup_queue)) {
                 assert(u->in_cleanup_queue);
 
+                if (gc_budget_exhausted(n, deadline))
+                        break;
+
                 unit_free(u);
                 n++;
         }
@@ -925,7 +962,7 @@ static void unit_gc_mark_good(Unit *u, unsigned gc_marker) {
         u->gc_marker = gc_marker + GC_OFFSET_GOOD;
 
         /* Recursively mark referenced units as GOOD as well */
-        SET_FOREACH(other, u->dependencies[UNIT_REFERENCES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCES, i)
                 if (other->gc_marker == gc_marker + GC_OFFSET_UNSURE)
                         unit_gc_mark_good(other, gc_marker);
 }
@@ -953,7 +990,7 @@ static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
 
         is_bad = true;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REFERENCED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCED_BY, i) {
                 unit_gc_sweep(other, gc_marker);
 
                 if (other->gc_marker == gc_marker + GC_OFFSET_GOOD)
@@ -985,21 +1022,46 @@ good:
 
 static unsigned manager_dispatch_gc_unit_queue(Manager *m) {
         unsigned n = 0, gc_marker;
+        usec_t deadline;
         Unit *u;
 
         assert(m);
 
         /* log_debug("Running GC..."); */
 
+        /* Each invocation uses a new marker, hence it is safe to stop in the middle of the queue when we ran out of
+         * time, and continue with the rest in the next event loop iteration. */
         m->gc_marker += _GC_OFFSET_MAX;
         if (m->gc_marker + _GC_OFFSET_MAX <= _GC_OFFSET_MAX)
                 m->gc_marker = 1;
 
         gc_marker = m->gc_marker;
+        deadline = usec_add(now(CLOCK_MONOTONIC), GC_BUDGET_USEC);
 
         while ((u = m->gc_unit_queue)) {
                 assert(u->in_gc_queue);
 
+                if (gc_budget_exhausted(n, deadline))
+                        break;
+
+                /* Units nobody refers to, which is the common case for short-lived transient units such as scopes,
+                 * can be judged on their own: no need to sweep the graph for them. */
+                if (!unit_dependencies_first(&u->dependencies, UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY))) {
+                        LIST_REMOVE(gc_queue, m->gc_unit_queue, u);
+                        u->in_gc_queue = false;
+
+                        n++;
+
+                        if (!unit_check_gc(u)) {
+                                if (u->id)
+                                        log_unit_debug(u, "Collecting.");
+                                u->gc_marker = gc_marker + GC_OFFSET_BAD;
+                                unit_add_to_cleanup_queue(u);
+                        }
+
+                        continue;
+                }
+
                 unit_gc_sweep(u, gc_marker);
 
                 LIST_REMOVE(gc_queue, m->gc_unit_queue, u);
@@ -1051,7 +1113,7 @@ static void manager_clear_jobs_and_units(Manager *m) {
         while ((u = hashmap_first(m->units)))
                 unit_free(u);
 
-        manager_dispatch_cleanup_queue(m);
+        manager_dispatch_cleanup_queue(m, USEC_INFINITY);
 
         assert(!m->load_queue);
         assert(!m->run_queue);
@@ -1091,6 +1153,9 @@ Manager* manager_free(Manager *m) {
 
         dynamic_user_vacuum(m, false);
         hashmap_free(m->dynamic_users);
+        bitmap_free(m->dynamic_uids);
+
+        m->exec_helper = exec_helper_free(m->exec_helper);
 
         hashmap_free(m->units);
         hashmap_free(m->units_by_invocation_id);
@@ -1109,6 +1174,7 @@ Manager* manager_free(Manager *m) {
         sd_event_source_unref(m->jobs_in_progress_event_source);
         sd_event_source_unref(m->run_queue_event_source);
         sd_event_source_unref(m->user_lookup_event_source);
+        sd_event_source_unref(m->transient_event_source);
 
         safe_close(m->signal_fd);
         safe_close(m->notify_fd);
@@ -1130,6 +1196,7 @@ Manager* manager_free(Manager *m) {
 
         hashmap_free(m->cgroup_unit);
         set_free_free(m->unit_path_cache);
+        unit_cache_free(m->unit_cache);
 
         free(m->switch_root);
         free(m->switch_root_init);
@@ -1239,6 +1306,113 @@ fail:
         m->unit_path_cache = set_free_free(m->unit_path_cache);
 }
 
+static void manager_start_unit_cache(Manager *m) {
+        int r;
+
+        assert(m);
+
+        /* Only the system instance keeps a unit cache, in /run, so that it survives daemon-reexec */
+        if (!MANAGER_IS_SYSTEM(m) || m->test_run)
+                return;
+
+        if (!m->unit_cache) {
+                r = unit_cache_new(&m->unit_cache);
+                if (r < 0) {
+                        log_warning_errno(r, "Failed to allocate unit cache, proceeding without: %m");
+                        return;
+                }
+
+                r = unit_cache_load(m->unit_cache, UNIT_CACHE_PATH);
+                if (r < 0)
+                        log_warning_errno(r, "Failed to load unit cache, ignoring: %m");
+        }
+
+        unit_cache_start(m->unit_cache);
+}
+
+static void manager_prefetch_unit_files(Manager *m) {
+        _cleanup_free_ UnitCachePrefetch *files = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        size_t n_files = 0, allocated = 0;
+        const char *p;
+        Iterator i;
+        usec_t begin;
+        int r;
+
+        assert(m);
+
+        if (!m->unit_cache || !m->unit_path_cache)
+                return;
+
+        /* Read and tokenize all unit files and drop-ins in parallel, so that loading units afterwards only
+         * has to apply the assignments from the cache */
+
+        SET_FOREACH(p, m->unit_path_cache, i) {
+                _cleanup_free_ char *name = NULL;
+                const char *fn, *e;
+                UnitType t;
+
+                fn = basename(p);
+
+                e = endswith(fn, ".d");
+                if (e) {
+                        name = strndup(fn, e - fn);
+                        if (!name) {
+                                log_oom();
+                                return;
+                        }
+
+                        t = unit_name_to_type(name);
+                } else
+                        t = unit_name_to_type(fn);
+                if (t < 0)
+                        continue;
+
+                if (!GREEDY_REALLOC(files, allocated, n_files + 1)) {
+                        log_oom();
+                        return;
+                }
+
+                files[n_files++] = (UnitCachePrefetch) {
+                        .path = p,
+                        .sections = unit_vtable[t]->sections,
+                        .dropin_dir = !!e,
+                };
+        }
+
+        begin = now(CLOCK_MONOTONIC);
+
+        r = unit_cache_prefetch(m->unit_cache, files, n_files);
+        if (r < 0)
+                log_warning_errno(r, "Failed to prefetch unit files, ignoring: %m");
+        else if (r > 0)
+                log_debug("Prefetched %i unit files in %s.", r,
+                          format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - begin, USEC_PER_MSEC));
+}
+
+static void manager_flush_unit_cache(Manager *m) {
+        char ts1[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX];
+        const UnitCacheStats *s;
+        int r;
+
+        assert(m);
+
+        if (!m->unit_cache)
+                return;
+
+        /* Forget about everything we didn't need this time */
+        unit_cache_vacuum(m->unit_cache);
+
+        r = unit_cache_save(m->unit_cache, UNIT_CACHE_PATH);
+        if (r < 0)
+                log_warning_errno(r, "Failed to write unit cache, ignoring: %m");
+
+        s = unit_cache_get_stats(m->unit_cache);
+        log_debug("Unit cache: %u hits in %s, %u misses in %s.",
+                  s->n_hits, format_timespan(ts1, sizeof(ts1), s->hit_usec, 1),
+                  s->n_misses, format_timespan(ts2, sizeof(ts2), s->miss_usec, 1));
+}
+
 static void manager_distribute_fds(Manager *m, FDSet *fds) {
         Iterator i;
         Unit *u;
@@ -1285,6 +1459,7 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
 
         lookup_paths_reduce(&m->lookup_paths);
         manager_build_unit_path_cache(m);
+        manager_start_unit_cache(m);
 
         /* If we will deserialize make sure that during enumeration
          * this is already known, so we increase the counter here
@@ -1294,6 +1469,7 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
 
         /* First, enumerate what we can from all config files */
         dual_timestamp_get(&m->units_load_start_timestamp);
+        manager_prefetch_unit_files(m);
         manager_enumerate(m);
         dual_timestamp_get(&m->units_load_finish_timestamp);
 
@@ -1337,6 +1513,9 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
         manager_vacuum_uid_refs(m);
         manager_vacuum_gid_refs(m);
 
+        /* Persist what we learnt about the unit files */
+        manager_flush_unit_cache(m);
+
         if (serialization) {
                 assert(m->n_reloading > 0);
                 m->n_reloading--;
@@ -1671,28 +1850,36 @@ static int manager_dispatch_cgroups_agent_fd(sd_event_source *source, int fd, ui
         char buf[PATH_MAX+1];
         ssize_t n;
 
-        n = recv(fd, buf, sizeof(buf), 0);
-        if (n < 0)
-                return log_error_errno(errno, "Failed to read cgroups agent message: %m");
-        if (n == 0) {
-                log_error("Got zero-length cgroups agent message, ignoring.");
-                return 0;
-        }
-        if ((size_t) n >= sizeof(buf)) {
-                log_error("Got overly long cgroups agent message, ignoring.");
-                return 0;
-        }
+        /* Read everything that is queued, when many cgroups run empty
+         * at once the actual checks are coalesced in the cgroup empty
+         * queue anyway. */
 
-        if (memchr(buf, 0, n)) {
-                log_error("Got cgroups agent message with embedded NUL byte, ignoring.");
-                return 0;
-        }
-        buf[n] = 0;
+        for (;;) {
+                n = recv(fd, buf, sizeof(buf), 0);
+                if (n < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                return 0;
 
-        manager_notify_cgroup_empty(m, buf);
-        bus_forward_agent_released(m, buf);
+                        return log_error_errno(errno, "Failed to read cgroups agent message: %m");
+                }
+                if (n == 0) {
+                        log_error("Got zero-length cgroups agent message, ignoring.");
+                        continue;
+                }
+                if ((size_t) n >= sizeof(buf)) {
+                        log_error("Got overly long cgroups agent message, ignoring.");
+                        continue;
+                }
 
-        return 0;
+                if (memchr(buf, 0, n)) {
+                        log_error("Got cgroups agent message with embedded NUL byte, ignoring.");
+                        continue;
+                }
+                buf[n] = 0;
+
+                manager_notify_cgroup_empty(m, buf);
+                bus_forward_agent_released(m, buf);
+        }
 }
 
 static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, const char *buf, FDSet *fds) {
@@ -1720,10 +1907,22 @@ static void manager_invoke_notify_message(Manager *m, Unit *u, pid_t pid, const
         }
 }
 
-static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+typedef struct NotifyMessage {
+        pid_t pid;
+        char *buf;
+        FDSet *fds;
+} NotifyMessage;
+
+typedef struct NotifyPidCache {
+        pid_t pid;
+        Unit *unit;
+} NotifyPidCache;
+
+/* Returns 0 if there's nothing left to read, > 0 if a datagram was consumed (in which case *ret->buf is only set if it
+ * was a valid message), < 0 on error. */
+static int manager_receive_notify_message(Manager *m, NotifyMessage *ret) {
 
         _cleanup_fdset_free_ FDSet *fds = NULL;
-        Manager *m = userdata;
         char buf[NOTIFY_BUFFER_MAX+1];
         struct iovec iovec = {
                 .iov_base = buf,
@@ -1743,23 +1942,17 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
 
         struct cmsghdr *cmsg;
         struct ucred *ucred = NULL;
-        Unit *u1, *u2, *u3;
         int r, *fd_array = NULL;
         unsigned n_fds = 0;
         ssize_t n;
 
         assert(m);
-        assert(m->notify_fd == fd);
-
-        if (revents != EPOLLIN) {
-                log_warning("Got unexpected poll event for notify fd.");
-                return 0;
-        }
+        assert(ret);
 
         n = recvmsg(m->notify_fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC|MSG_TRUNC);
         if (n < 0) {
                 if (IN_SET(errno, EAGAIN, EINTR))
-                        return 0; /* Spurious wakeup, try again */
+                        return 0; /* Spurious wakeup, or everything read */
 
                 /* If this is any other, real error, then let's stop processing this socket. This of course means we
                  * won't take notification messages anymore, but that's still better than busy looping around this:
@@ -1788,51 +1981,173 @@ static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t
                 if (r < 0) {
                         close_many(fd_array, n_fds);
                         log_oom();
-                        return 0;
+                        return 1;
                 }
         }
 
         if (!ucred || ucred->pid <= 0) {
                 log_warning("Received notify message without valid credentials. Ignoring.");
-                return 0;
+                return 1;
         }
 
         if ((size_t) n >= sizeof(buf) || (msghdr.msg_flags & MSG_TRUNC)) {
                 log_warning("Received notify message exceeded maximum size. Ignoring.");
-                return 0;
+                return 1;
         }
 
         /* As extra safety check, let's make sure the string we get doesn't contain embedded NUL bytes. We permit one
          * trailing NUL byte in the message, but don't expect it. */
         if (n > 1 && memchr(buf, 0, n-1)) {
                 log_warning("Received notify message with embedded NUL bytes. Ignoring.");
+                return 1;
+        }
+
+        ret->buf = strndup(buf, n);
+        if (!ret->buf) {
+                log_oom();
+                return 1;
+        }
+
+        ret->pid = ucred->pid;
+        ret->fds = fds;
+        fds = NULL;
+
+        return 1;
+}
+
+static bool notify_message_only_status(const char *buf, bool *ret_has_status) {
+        bool has_status = false, only_status = true;
+        const char *p = buf;
+
+        /* Checks whether the message consists of STATUS= lines only, and whether it has one at all. */
+
+        while (*p) {
+                size_t l;
+
+                l = strcspn(p, "\n\r");
+                if (l > 0) {
+                        if (l >= strlen("STATUS=") && startswith(p, "STATUS="))
+                                has_status = true;
+                        else
+                                only_status = false;
+                }
+
+                p += l;
+                p += strspn(p, "\n\r");
+        }
+
+        *ret_has_status = has_status;
+        return only_status && has_status;
+}
+
+static bool notify_message_superseded(NotifyMessage *batch, unsigned n, unsigned i) {
+        bool has_status;
+        unsigned j;
+
+        /* A message that only updates the status text is pointless if the same process sends another status text
+         * later in the same batch. Units would apply both, and announce the change twice. */
+
+        if (fdset_size(batch[i].fds) > 0)
+                return false;
+
+        if (!notify_message_only_status(batch[i].buf, &has_status))
+                return false;
+
+        for (j = i + 1; j < n; j++) {
+                if (batch[j].pid != batch[i].pid)
+                        continue;
+
+                (void) notify_message_only_status(batch[j].buf, &has_status);
+                if (has_status)
+                        return true;
+        }
+
+        return false;
+}
+
+static Unit *manager_get_unit_by_pid_cgroup_cached(Manager *m, NotifyPidCache *cache, unsigned *n_cache, pid_t pid) {
+        unsigned i;
+        Unit *u;
+
+        /* The cgroup lookup means reading /proc/$PID/cgroup, hence do it only once per sender and batch. */
+
+        for (i = 0; i < *n_cache; i++)
+                if (cache[i].pid == pid)
+                        return cache[i].unit;
+
+        u = manager_get_unit_by_pid_cgroup(m, pid);
+
+        cache[*n_cache] = (NotifyPidCache) {
+                .pid = pid,
+                .unit = u,
+        };
+        (*n_cache)++;
+
+        return u;
+}
+
+static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        NotifyMessage batch[NOTIFY_BATCH_MAX] = {};
+        NotifyPidCache cache[NOTIFY_BATCH_MAX];
+        unsigned n = 0, n_cache = 0, n_read, i;
+        Manager *m = userdata;
+        int r = 0;
+
+        assert(m);
+        assert(m->notify_fd == fd);
+
+        if (revents != EPOLLIN) {
+                log_warning("Got unexpected poll event for notify fd.");
                 return 0;
         }
 
-        /* Make sure it's NUL-terminated. */
-        buf[n] = 0;
+        /* Read all that's queued, up to a limit so that other event sources are not starved, and only then process
+         * it, so that senders are resolved only once and redundant status updates can be dropped. */
+        for (n_read = 0; n_read < NOTIFY_BATCH_MAX; n_read++) {
+                r = manager_receive_notify_message(m, batch + n);
+                if (r <= 0)
+                        break;
+
+                if (batch[n].buf)
+                        n++;
+        }
+
+        for (i = 0; i < n; i++) {
+                NotifyMessage *msg = batch + i;
+                Unit *u1, *u2, *u3;
 
-        /* Notify every unit that might be interested, but try
-         * to avoid notifying the same one multiple times. */
-        u1 = manager_get_unit_by_pid_cgroup(m, ucred->pid);
-        if (u1)
-                manager_invoke_notify_message(m, u1, ucred->pid, buf, fds);
+                if (notify_message_superseded(batch, n, i)) {
+                        log_debug("Dropping status update of PID "PID_FMT", superseded by a later one.", msg->pid);
+                        continue;
+                }
 
-        u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(ucred->pid));
-        if (u2 && u2 != u1)
-                manager_invoke_notify_message(m, u2, ucred->pid, buf, fds);
+                /* Notify every unit that might be interested, but try
+                 * to avoid notifying the same one multiple times. */
+                u1 = manager_get_unit_by_pid_cgroup_cached(m, cache, &n_cache, msg->pid);
+                if (u1)
+                        manager_invoke_notify_message(m, u1, msg->pid, msg->buf, msg->fds);
 
-        u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(ucred->pid));
-        if (u3 && u3 != u2 && u3 != u1)
-                manager_invoke_notify_message(m, u3, ucred->pid, buf, fds);
+                u2 = hashmap_get(m->watch_pids1, PID_TO_PTR(msg->pid));
+                if (u2 && u2 != u1)
+                        manager_invoke_notify_message(m, u2, msg->pid, msg->buf, msg->fds);
 
-        if (!u1 && !u2 && !u3)
-                log_warning("Cannot find unit for notify message of PID "PID_FMT".", ucred->pid);
+                u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(msg->pid));
+                if (u3 && u3 != u2 && u3 != u1)
+                        manager_invoke_notify_message(m, u3, msg->pid, msg->buf, msg->fds);
 
-        if (fdset_size(fds) > 0)
-                log_warning("Got extra auxiliary fds with notification message, closing them.");
+                if (!u1 && !u2 && !u3)
+                        log_warning("Cannot find unit for notify message of PID "PID_FMT".", msg->pid);
 
-        return 0;
+                if (fdset_size(msg->fds) > 0)
+                        log_warning("Got extra auxiliary fds with notification message, closing them.");
+        }
+
+        for (i = 0; i < n; i++) {
+                free(batch[i].buf);
+                fdset_free(batch[i].fds);
+        }
+
+        return r < 0 ? r : 0;
 }
 
 static void invoke_sigchld_event(Manager *m, Unit *u, const siginfo_t *si) {
@@ -1908,6 +2223,11 @@ static int manager_dispatch_sigchld(Manager *m) {
                         u3 = hashmap_get(m->watch_pids2, PID_TO_PTR(si.si_pid));
                         if (u3 && u3 != u2 && u3 != u1)
                                 invoke_sigchld_event(m, u3, &si);
+
+                        /* The exec helper is reaped here like any other child of ours, make sure nobody kills or
+                         * waits for its PID after that, it might already have been reused. */
+                        if (m->exec_helper)
+                                exec_helper_child_exited(m->exec_helper, si.si_pid);
                 }
 
                 /* And now, we actually reap the zombie. */
@@ -2264,10 +2584,12 @@ int manager_loop(Manager *m) {
                 if (manager_dispatch_gc_job_queue(m) > 0)
                         continue;
 
-                if (manager_dispatch_gc_unit_queue(m) > 0)
+                /* These two stop when they exceed their time budget, let's process events then before
+                 * continuing with them */
+                if (manager_dispatch_gc_unit_queue(m) > 0 && !m->gc_unit_queue)
                         continue;
 
-                if (manager_dispatch_cleanup_queue(m) > 0)
+                if (manager_dispatch_cleanup_queue(m, GC_BUDGET_USEC) > 0 && !m->cleanup_queue)
                         continue;
 
                 if (manager_dispatch_cgroup_queue(m) > 0)
@@ -2284,6 +2606,10 @@ int manager_loop(Manager *m) {
                 } else
                         wait_usec = USEC_INFINITY;
 
+                /* More garbage left to collect? Then only process what's pending, don't wait */
+                if (m->gc_unit_queue || m->cleanup_queue)
+                        wait_usec = 0;
+
                 r = sd_event_run(m->event, wait_usec);
                 if (r < 0)
                         return log_error_errno(r, "Failed to run event loop: %m");
@@ -2467,41 +2793,108 @@ int manager_open_serialization(Manager *m, FILE **_f) {
         return 0;
 }
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+int manager_persist_transient_units(Manager *m) {
+        Unit *u, *n;
+        int r = 0, q;
+
+        assert(m);
+
+        /* Units whose file couldn't be written stay in the queue, and we return the first error */
+        LIST_FOREACH_SAFE(transient_queue, u, n, m->transient_queue) {
+                q = unit_persist_transient(u);
+                if (q < 0 && r >= 0)
+                        r = q;
+        }
+
+        return r;
+}
+
+static int on_transient_persist(sd_event_source *s, uint64_t usec, void *userdata) {
+        Manager *m = userdata;
+
+        assert(m);
+
+        if (manager_persist_transient_units(m) < 0)
+                manager_schedule_transient_persist(m);
+
+        return 0;
+}
+
+void manager_schedule_transient_persist(Manager *m) {
+        int enabled, r;
+
+        assert(m);
+
+        if (m->transient_event_source) {
+                r = sd_event_source_get_enabled(m->transient_event_source, &enabled);
+                if (r >= 0 && enabled != SD_EVENT_OFF)
+                        return;
+
+                r = sd_event_source_set_time(m->transient_event_source, now(CLOCK_MONOTONIC) + TRANSIENT_PERSIST_DELAY_USEC);
+                if (r >= 0)
+                        r = sd_event_source_set_enabled(m->transient_event_source, SD_EVENT_ONESHOT);
+                if (r < 0)
+                        goto fail;
+
+                return;
+        }
+
+        r = sd_event_add_time(m->event, &m->transient_event_source, CLOCK_MONOTONIC,
+                              now(CLOCK_MONOTONIC) + TRANSIENT_PERSIST_DELAY_USEC, USEC_PER_SEC,
+                              on_transient_persist, m);
+        if (r < 0)
+                goto fail;
+
+        (void) sd_event_source_set_priority(m->transient_event_source, SD_EVENT_PRIORITY_IDLE);
+        (void) sd_event_source_set_description(m->transient_event_source, "transient-persist");
+        return;
+
+fail:
+        /* If we can't defer the write, do it right away */
+        log_debug_errno(r, "Failed to schedule writing of transient unit files, writing them now: %m");
+        (void) manager_persist_transient_units(m);
+}
+
+static int manager_serialize_internal(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+        Serializer *s = m->serializer;
         Iterator i;
         Unit *u;
         const char *t;
+        char **e;
         int r;
 
-        assert(m);
-        assert(f);
-        assert(fds);
-
-        m->n_reloading++;
+        r = serialize_header(s, f);
+        if (r < 0)
+                return r;
 
-        fprintf(f, "current-job-id=%"PRIu32"\n", m->current_job_id);
-        fprintf(f, "taint-usr=%s\n", yes_no(m->taint_usr));
-        fprintf(f, "n-installed-jobs=%u\n", m->n_installed_jobs);
-        fprintf(f, "n-failed-jobs=%u\n", m->n_failed_jobs);
+        (void) serialize_item_uint64(s, f, "current-job-id", m->current_job_id);
+        (void) serialize_item_boolean(s, f, "taint-usr", m->taint_usr);
+        (void) serialize_item_uint64(s, f, "n-installed-jobs", m->n_installed_jobs);
+        (void) serialize_item_uint64(s, f, "n-failed-jobs", m->n_failed_jobs);
+        (void) serialize_item_uint64(s, f, "units-generation", m->units_generation);
 
-        dual_timestamp_serialize(f, "firmware-timestamp", &m->firmware_timestamp);
-        dual_timestamp_serialize(f, "loader-timestamp", &m->loader_timestamp);
-        dual_timestamp_serialize(f, "kernel-timestamp", &m->kernel_timestamp);
-        dual_timestamp_serialize(f, "initrd-timestamp", &m->initrd_timestamp);
+        (void) serialize_dual_timestamp(s, f, "firmware-timestamp", &m->firmware_timestamp);
+        (void) serialize_dual_timestamp(s, f, "loader-timestamp", &m->loader_timestamp);
+        (void) serialize_dual_timestamp(s, f, "kernel-timestamp", &m->kernel_timestamp);
+        (void) serialize_dual_timestamp(s, f, "initrd-timestamp", &m->initrd_timestamp);
 
         if (!in_initrd()) {
-                dual_timestamp_serialize(f, "userspace-timestamp", &m->userspace_timestamp);
-                dual_timestamp_serialize(f, "finish-timestamp", &m->finish_timestamp);
-                dual_timestamp_serialize(f, "security-start-timestamp", &m->security_start_timestamp);
-                dual_timestamp_serialize(f, "security-finish-timestamp", &m->security_finish_timestamp);
-                dual_timestamp_serialize(f, "generators-start-timestamp", &m->generators_start_timestamp);
-                dual_timestamp_serialize(f, "generators-finish-timestamp", &m->generators_finish_timestamp);
-                dual_timestamp_serialize(f, "units-load-start-timestamp", &m->units_load_start_timestamp);
-                dual_timestamp_serialize(f, "units-load-finish-timestamp", &m->units_load_finish_timestamp);
+                (void) serialize_dual_timestamp(s, f, "userspace-timestamp", &m->userspace_timestamp);
+                (void) serialize_dual_timestamp(s, f, "finish-timestamp", &m->finish_timestamp);
+                (void) serialize_dual_timestamp(s, f, "security-start-timestamp", &m->security_start_timestamp);
+                (void) serialize_dual_timestamp(s, f, "security-finish-timestamp", &m->security_finish_timestamp);
+                (void) serialize_dual_timestamp(s, f, "generators-start-timestamp", &m->generators_start_timestamp);
+                (void) serialize_dual_timestamp(s, f, "generators-finish-timestamp", &m->generators_finish_timestamp);
+                (void) serialize_dual_timestamp(s, f, "units-load-start-timestamp", &m->units_load_start_timestamp);
+                (void) serialize_dual_timestamp(s, f, "units-load-finish-timestamp", &m->units_load_finish_timestamp);
         }
 
         if (!switching_root)
-                (void) serialize_environment(f, m->environment);
+                STRV_FOREACH(e, m->environment) {
+                        r = serialize_item_escaped(s, f, "env", *e);
+                        if (r < 0)
+                                return r;
+                }
 
         if (m->notify_fd >= 0) {
                 int copy;
@@ -2510,8 +2903,8 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                 if (copy < 0)
                         return copy;
 
-                fprintf(f, "notify-fd=%i\n", copy);
-                fprintf(f, "notify-socket=%s\n", m->notify_socket);
+                (void) serialize_item_fd(s, f, "notify-fd", copy);
+                (void) serialize_item(s, f, "notify-socket", m->notify_socket);
         }
 
         if (m->cgroups_agent_fd >= 0) {
@@ -2521,7 +2914,7 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                 if (copy < 0)
                         return copy;
 
-                fprintf(f, "cgroups-agent-fd=%i\n", copy);
+                (void) serialize_item_fd(s, f, "cgroups-agent-fd", copy);
         }
 
         if (m->user_lookup_fds[0] >= 0) {
@@ -2535,10 +2928,10 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                 if (copy1 < 0)
                         return copy1;
 
-                fprintf(f, "user-lookup=%i %i\n", copy0, copy1);
+                (void) serialize_item_format(s, f, "user-lookup", "%i %i", copy0, copy1);
         }
 
-        bus_track_serialize(m->subscribed, f, "subscribed");
+        bus_track_serialize(m->subscribed, s, f, "subscribed");
 
         r = dynamic_user_serialize(m, f, fds);
         if (r < 0)
@@ -2547,26 +2940,81 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         manager_serialize_uid_refs(m, f);
         manager_serialize_gid_refs(m, f);
 
-        fputc('\n', f);
+        (void) serialize_end(s, f);
 
         HASHMAP_FOREACH_KEY(u, t, m->units, i) {
                 if (u->id != t)
                         continue;
 
                 /* Start marker */
-                fputs(u->id, f);
-                fputc('\n', f);
+                (void) serialize_section(s, f, u->id);
 
                 r = unit_serialize(u, f, fds, !switching_root);
-                if (r < 0) {
-                        m->n_reloading--;
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static bool manager_serialize_binary(Manager *m, bool switching_root) {
+        struct stat a, b;
+
+        assert(m);
+
+        /* The binary format is only understood by versions that write it. Use it only if we know the
+         * deserializing side is one of them, and the text format otherwise. */
+
+        /* The systemd binary in the new root might be an older version */
+        if (switching_root)
+                return false;
+
+        /* On reload we deserialize it ourselves */
+        if (m->exit_code != MANAGER_REEXECUTE)
+                return true;
+
+        /* On reexecution we execute SYSTEMD_BINARY_PATH, which might have been replaced by an older
+         * version in the meantime, e.g. by a package downgrade. Only if it still is the very binary we are
+         * running we know what we are talking to. */
+        if (stat("/proc/self/exe", &a) < 0 || stat(SYSTEMD_BINARY_PATH, &b) < 0)
+                return false;
+
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+        _cleanup_(serializer_freep) Serializer *s = NULL;
+        int r;
+
+        assert(m);
+        assert(f);
+        assert(fds);
+
+        if (manager_serialize_binary(m, switching_root)) {
+                r = serializer_new(&s);
+                if (r < 0)
                         return r;
-                }
         }
 
+        /* The new instance loads transient units from disk, hence flush out what we kept in memory so far. If
+         * that fails, the new instance would lose those units, hence refuse. */
+        r = manager_persist_transient_units(m);
+        if (r < 0)
+                return r;
+
+        m->n_reloading++;
+        m->serializer = s;
+
+        r = manager_serialize_internal(m, f, fds, switching_root);
+
+        m->serializer = NULL;
+
         assert(m->n_reloading > 0);
         m->n_reloading--;
 
+        if (r < 0)
+                return r;
+
         if (ferror(f))
                 return -EIO;
 
@@ -2577,181 +3025,196 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         return 0;
 }
 
-int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
-        int r = 0;
+static int manager_deserialize_item(Manager *m, SerializedItem *i, FDSet *fds) {
+        const char *l = i->key;
+        int r;
 
-        assert(m);
-        assert(f);
+        if (streq(l, "current-job-id")) {
+                uint64_t id;
 
-        log_debug("Deserializing state...");
+                if (serialized_item_get_uint64(i, &id) < 0 || id > UINT32_MAX)
+                        log_notice("Failed to parse current job id value %s", serialized_item_string(i));
+                else
+                        m->current_job_id = MAX(m->current_job_id, (uint32_t) id);
 
-        m->n_reloading++;
+        } else if (streq(l, "n-installed-jobs")) {
+                uint64_t n;
 
-        for (;;) {
-                char line[LINE_MAX];
-                const char *val, *l;
+                if (serialized_item_get_uint64(i, &n) < 0 || n > UINT32_MAX)
+                        log_notice("Failed to parse installed jobs counter %s", serialized_item_string(i));
+                else
+                        m->n_installed_jobs += n;
 
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
+        } else if (streq(l, "n-failed-jobs")) {
+                uint64_t n;
 
-                        goto finish;
-                }
+                if (serialized_item_get_uint64(i, &n) < 0 || n > UINT32_MAX)
+                        log_notice("Failed to parse failed jobs counter %s", serialized_item_string(i));
+                else
+                        m->n_failed_jobs += n;
 
-                char_array_0(line);
-                l = strstrip(line);
+        } else if (streq(l, "units-generation")) {
+                uint64_t g;
 
-                if (l[0] == 0)
-                        break;
+                if (serialized_item_get_uint64(i, &g) < 0)
+                        log_notice("Failed to parse units generation %s", serialized_item_string(i));
+                else
+                        m->units_generation = MAX(m->units_generation, g);
 
-                if ((val = startswith(l, "current-job-id="))) {
-                        uint32_t id;
+        } else if (streq(l, "taint-usr")) {
+                bool b;
 
-                        if (safe_atou32(val, &id) < 0)
-                                log_notice("Failed to parse current job id value %s", val);
-                        else
-                                m->current_job_id = MAX(m->current_job_id, id);
+                if (serialized_item_get_boolean(i, &b) < 0)
+                        log_notice("Failed to parse taint /usr flag %s", serialized_item_string(i));
+                else
+                        m->taint_usr = m->taint_usr || b;
+
+        } else if (streq(l, "firmware-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->firmware_timestamp);
+        else if (streq(l, "loader-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->loader_timestamp);
+        else if (streq(l, "kernel-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->kernel_timestamp);
+        else if (streq(l, "initrd-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->initrd_timestamp);
+        else if (streq(l, "userspace-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->userspace_timestamp);
+        else if (streq(l, "finish-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->finish_timestamp);
+        else if (streq(l, "security-start-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->security_start_timestamp);
+        else if (streq(l, "security-finish-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->security_finish_timestamp);
+        else if (streq(l, "generators-start-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->generators_start_timestamp);
+        else if (streq(l, "generators-finish-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->generators_finish_timestamp);
+        else if (streq(l, "units-load-start-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->units_load_start_timestamp);
+        else if (streq(l, "units-load-finish-timestamp"))
+                (void) serialized_item_get_timestamp(i, &m->units_load_finish_timestamp);
+        else if (streq(l, "env")) {
+                const char *e;
 
-                } else if ((val = startswith(l, "n-installed-jobs="))) {
-                        uint32_t n;
+                e = strjoina("env=", serialized_item_string(i));
+                r = deserialize_environment(&m->environment, e);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0)
+                        log_notice_errno(r, "Failed to parse environment entry: \"%s\": %m", e);
 
-                        if (safe_atou32(val, &n) < 0)
-                                log_notice("Failed to parse installed jobs counter %s", val);
-                        else
-                                m->n_installed_jobs += n;
+        } else if (streq(l, "notify-fd")) {
+                int fd;
 
-                } else if ((val = startswith(l, "n-failed-jobs="))) {
-                        uint32_t n;
+                if (serialized_item_get_fd(i, &fd) < 0 || !fdset_contains(fds, fd))
+                        log_notice("Failed to parse notify fd: \"%s\"", serialized_item_string(i));
+                else {
+                        m->notify_event_source = sd_event_source_unref(m->notify_event_source);
+                        safe_close(m->notify_fd);
+                        m->notify_fd = fdset_remove(fds, fd);
+                }
 
-                        if (safe_atou32(val, &n) < 0)
-                                log_notice("Failed to parse failed jobs counter %s", val);
-                        else
-                                m->n_failed_jobs += n;
+        } else if (streq(l, "notify-socket")) {
+                char *n;
 
-                } else if ((val = startswith(l, "taint-usr="))) {
-                        int b;
+                n = strdup(serialized_item_string(i));
+                if (!n)
+                        return -ENOMEM;
 
-                        b = parse_boolean(val);
-                        if (b < 0)
-                                log_notice("Failed to parse taint /usr flag %s", val);
-                        else
-                                m->taint_usr = m->taint_usr || b;
-
-                } else if ((val = startswith(l, "firmware-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->firmware_timestamp);
-                else if ((val = startswith(l, "loader-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->loader_timestamp);
-                else if ((val = startswith(l, "kernel-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->kernel_timestamp);
-                else if ((val = startswith(l, "initrd-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->initrd_timestamp);
-                else if ((val = startswith(l, "userspace-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->userspace_timestamp);
-                else if ((val = startswith(l, "finish-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->finish_timestamp);
-                else if ((val = startswith(l, "security-start-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->security_start_timestamp);
-                else if ((val = startswith(l, "security-finish-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->security_finish_timestamp);
-                else if ((val = startswith(l, "generators-start-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->generators_start_timestamp);
-                else if ((val = startswith(l, "generators-finish-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->generators_finish_timestamp);
-                else if ((val = startswith(l, "units-load-start-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->units_load_start_timestamp);
-                else if ((val = startswith(l, "units-load-finish-timestamp=")))
-                        dual_timestamp_deserialize(val, &m->units_load_finish_timestamp);
-                else if (startswith(l, "env=")) {
-                        r = deserialize_environment(&m->environment, l);
-                        if (r == -ENOMEM)
-                                goto finish;
-                        if (r < 0)
-                                log_notice_errno(r, "Failed to parse environment entry: \"%s\": %m", l);
+                free(m->notify_socket);
+                m->notify_socket = n;
 
-                } else if ((val = startswith(l, "notify-fd="))) {
-                        int fd;
+        } else if (streq(l, "cgroups-agent-fd")) {
+                int fd;
 
-                        if (safe_atoi(val, &fd) < 0 || fd < 0 || !fdset_contains(fds, fd))
-                                log_notice("Failed to parse notify fd: \"%s\"", val);
-                        else {
-                                m->notify_event_source = sd_event_source_unref(m->notify_event_source);
-                                safe_close(m->notify_fd);
-                                m->notify_fd = fdset_remove(fds, fd);
-                        }
+                if (serialized_item_get_fd(i, &fd) < 0 || !fdset_contains(fds, fd))
+                        log_notice("Failed to parse cgroups agent fd: %s", serialized_item_string(i));
+                else {
+                        m->cgroups_agent_event_source = sd_event_source_unref(m->cgroups_agent_event_source);
+                        safe_close(m->cgroups_agent_fd);
+                        m->cgroups_agent_fd = fdset_remove(fds, fd);
+                }
 
-                } else if ((val = startswith(l, "notify-socket="))) {
-                        char *n;
+        } else if (streq(l, "user-lookup")) {
+                const char *val = serialized_item_string(i);
+                int fd0, fd1;
+
+                if (sscanf(val, "%i %i", &fd0, &fd1) != 2 || fd0 < 0 || fd1 < 0 || fd0 == fd1 || !fdset_contains(fds, fd0) || !fdset_contains(fds, fd1))
+                        log_notice("Failed to parse user lookup fd: %s", val);
+                else {
+                        m->user_lookup_event_source = sd_event_source_unref(m->user_lookup_event_source);
+                        safe_close_pair(m->user_lookup_fds);
+                        m->user_lookup_fds[0] = fdset_remove(fds, fd0);
+                        m->user_lookup_fds[1] = fdset_remove(fds, fd1);
+                }
 
-                        n = strdup(val);
-                        if (!n) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        } else if (streq(l, "dynamic-user"))
+                dynamic_user_deserialize_one(m, serialized_item_string(i), fds);
+        else if (streq(l, "destroy-ipc-uid"))
+                manager_deserialize_uid_refs_one(m, serialized_item_string(i));
+        else if (streq(l, "destroy-ipc-gid"))
+                manager_deserialize_gid_refs_one(m, serialized_item_string(i));
+        else if (streq(l, "subscribed")) {
 
-                        free(m->notify_socket);
-                        m->notify_socket = n;
+                if (strv_extend(&m->deserialized_subscribed, serialized_item_string(i)) < 0)
+                        log_oom();
 
-                } else if ((val = startswith(l, "cgroups-agent-fd="))) {
-                        int fd;
+        } else if (!streq(l, "kdbus-fd")) /* ignore this one */
+                log_notice("Unknown serialization item '%s'", l);
 
-                        if (safe_atoi(val, &fd) < 0 || fd < 0 || !fdset_contains(fds, fd))
-                                log_notice("Failed to parse cgroups agent fd: %s", val);
-                        else {
-                                m->cgroups_agent_event_source = sd_event_source_unref(m->cgroups_agent_event_source);
-                                safe_close(m->cgroups_agent_fd);
-                                m->cgroups_agent_fd = fdset_remove(fds, fd);
-                        }
+        return 0;
+}
 
-                } else if ((val = startswith(l, "user-lookup="))) {
-                        int fd0, fd1;
+int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
+        _cleanup_(deserializer_freep) Deserializer *d = NULL;
+        int r = 0;
 
-                        if (sscanf(val, "%i %i", &fd0, &fd1) != 2 || fd0 < 0 || fd1 < 0 || fd0 == fd1 || !fdset_contains(fds, fd0) || !fdset_contains(fds, fd1))
-                                log_notice("Failed to parse user lookup fd: %s", val);
-                        else {
-                                m->user_lookup_event_source = sd_event_source_unref(m->user_lookup_event_source);
-                                safe_close_pair(m->user_lookup_fds);
-                                m->user_lookup_fds[0] = fdset_remove(fds, fd0);
-                                m->user_lookup_fds[1] = fdset_remove(fds, fd1);
-                        }
+        assert(m);
+        assert(f);
 
-                } else if ((val = startswith(l, "dynamic-user=")))
-                        dynamic_user_deserialize_one(m, val, fds);
-                else if ((val = startswith(l, "destroy-ipc-uid=")))
-                        manager_deserialize_uid_refs_one(m, val);
-                else if ((val = startswith(l, "destroy-ipc-gid=")))
-                        manager_deserialize_gid_refs_one(m, val);
-                else if ((val = startswith(l, "subscribed="))) {
+        log_debug("Deserializing state...");
 
-                        if (strv_extend(&m->deserialized_subscribed, val) < 0)
-                                log_oom();
+        m->n_reloading++;
+
+        r = deserializer_new(f, &d);
+        if (r < 0)
+                goto finish;
+
+        log_debug("Serialization is in %s format.", deserializer_is_binary(d) ? "binary" : "text");
 
-                } else if (!startswith(l, "kdbus-fd=")) /* ignore this one */
-                        log_notice("Unknown serialization item '%s'", l);
+        for (;;) {
+                SerializedItem i;
+
+                r = deserializer_read_item(d, &i);
+                if (r < 0)
+                        goto finish;
+                if (r == 0)
+                        break;
+
+                r = manager_deserialize_item(m, &i, fds);
+                if (r < 0)
+                        goto finish;
         }
 
+        /* Generations handed out by the previous incarnation don't describe our unit set, hence continue
+         * counting above them, and treat them all as predating a removal, so that clients get a complete
+         * list instead of a partial update. */
+        m->units_removed_generation = ++m->units_generation;
+
         for (;;) {
+                const char *name;
                 Unit *u;
-                char name[UNIT_NAME_MAX+2];
 
                 /* Start marker */
-                if (!fgets(name, sizeof(name), f)) {
-                        if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
-
+                r = deserializer_read_section(d, &name);
+                if (r <= 0)
                         goto finish;
-                }
 
-                char_array_0(name);
-
-                r = manager_load_unit(m, strstrip(name), NULL, NULL, &u);
+                r = manager_load_unit(m, name, NULL, NULL, &u);
                 if (r < 0)
                         goto finish;
 
-                r = unit_deserialize(u, f, fds);
+                r = unit_deserialize(u, d, fds);
                 if (r < 0)
                         goto finish;
         }
@@ -2820,6 +3283,8 @@ int manager_reload(Manager *m) {
 
         lookup_paths_reduce(&m->lookup_paths);
         manager_build_unit_path_cache(m);
+        manager_start_unit_cache(m);
+        manager_prefetch_unit_files(m);
 
         /* First, enumerate what we can from all config files */
         manager_enumerate(m);
@@ -2855,6 +3320,9 @@ int manager_reload(Manager *m) {
         manager_vacuum_uid_refs(m);
         manager_vacuum_gid_refs(m);
 
+        /* Persist what we learnt about the unit files */
+        manager_flush_unit_cache(m);
+
         /* Sync current state of bus names with our set of listening units */
         if (m->api_bus)
                 manager_sync_bus_names(m, m->api_bus);
@@ -3555,7 +4023,7 @@ static void manager_serialize_uid_refs_internal(
                 if (!(c & DESTROY_IPC_FLAG))
                         continue;
 
-                fprintf(f, "%s=" UID_FMT "\n", field_name, uid);
+                (void) serialize_item_format(m->serializer, f, field_name, UID_FMT, uid);
         }
 }
 
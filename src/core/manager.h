@@ -22,10 +22,12 @@
 #include <libmount.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "sd-bus.h"
 #include "sd-event.h"
 
+#include "bitmap.h"
 #include "cgroup-util.h"
 #include "fdset.h"
 #include "hashmap.h"
@@ -71,7 +73,9 @@ typedef enum StatusType {
 #include "execute.h"
 #include "job.h"
 #include "path-lookup.h"
+#include "serialize.h"
 #include "show-status.h"
+#include "unit-cache.h"
 #include "unit-name.h"
 
 struct Manager {
@@ -110,6 +114,19 @@ struct Manager {
 
         /* Units that should be realized */
         LIST_HEAD(Unit, cgroup_queue);
+        unsigned cgroup_queue_generation;
+
+        /* Units whose cgroup ran empty, according to inotify or the
+         * cgroups agent, but which we didn't check yet */
+        LIST_HEAD(Unit, cgroup_empty_queue);
+        sd_event_source *cgroup_empty_event_source;
+
+        /* Transient units whose unit file is only kept in memory so far */
+        LIST_HEAD(Unit, transient_queue);
+        sd_event_source *transient_event_source;
+
+        /* Periodically samples the accounting data of units with accounting enabled */
+        sd_event_source *accounting_event_source;
 
         sd_event *event;
 
@@ -148,10 +165,16 @@ struct Manager {
         int user_lookup_fds[2];
         sd_event_source *user_lookup_event_source;
 
+        /* The process spawning simple services for us, see exec_spawn() */
+        ExecHelper *exec_helper;
+
         UnitFileScope unit_file_scope;
         LookupPaths lookup_paths;
         Set *unit_path_cache;
 
+        /* Cache of the parsed contents of unit files and drop-ins */
+        UnitCache *unit_cache;
+
         char **environment;
 
         usec_t runtime_watchdog;
@@ -178,10 +201,37 @@ struct Manager {
         sd_event_source *udev_event_source;
         Hashmap *devices_by_sysfs;
 
+        /* uevents received but not processed yet, at most one per sysfs path */
+        OrderedHashmap *udev_pending;
+        sd_event_source *udev_pending_event_source;
+
+        /* Data specific to the timer subsystem */
+        Hashmap *timer_queues;
+        Hashmap *timer_calendars;
+
+        /* Data specific to the path subsystem: one inotify fd shared by all path specs, indexed by
+         * watch descriptor */
+        int path_inotify_fd;
+        sd_event_source *path_inotify_event_source;
+        Hashmap *path_inotify_wd_specs; /* wd => Set of PathSpec objects */
+        LIST_HEAD(struct PathSpec, path_inotify_pending);
+
         /* Data specific to the mount subsystem */
         struct libmnt_monitor *mount_monitor;
         sd_event_source *mount_event_source;
 
+        /* Snapshot of /proc/self/mountinfo as of the last rescan,
+         * indexed by mount ID, so that we only need to process
+         * entries that actually changed */
+        Hashmap *mountinfo_by_id;
+        Hashmap *mountinfo_unit_refs;
+        Hashmap *mountinfo_what_refs;
+        unsigned mountinfo_generation;
+
+        /* Used to coalesce bursts of mount table changes */
+        sd_event_source *mount_rescan_event_source;
+        RateLimit mount_rescan_ratelimit;
+
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
         sd_event_source *swap_event_source;
@@ -231,6 +281,21 @@ struct Manager {
 
         int gc_marker;
 
+        /* Incrementally maintained topological order of all units, see unit-order.h */
+        uint64_t unit_order_next;
+        unsigned unit_order_generation;
+        bool unit_order_cyclic;
+        bool unit_order_recheck;
+
+        /* Bumped whenever a unit changes or is removed, so that clients can ask for what changed since
+         * they last looked */
+        uint64_t units_generation;
+        uint64_t units_removed_generation;
+
+        /* Random value identifying this instance, so that generations handed out by another boot or another
+         * manager process are not taken for ours */
+        uint64_t units_epoch;
+
         /* Flags */
         ManagerExitCode exit_code:5;
 
@@ -270,6 +335,9 @@ struct Manager {
         /* non-zero if we are reloading or reexecuting, */
         int n_reloading;
 
+        /* Set while serializing in the binary format, NULL for the text format */
+        Serializer *serializer;
+
         unsigned n_installed_jobs;
         unsigned n_failed_jobs;
 
@@ -301,6 +369,13 @@ struct Manager {
         /* Dynamic users/groups, indexed by their name */
         Hashmap *dynamic_users;
 
+        /* UIDs of the dynamic range we know are taken, either by static users or groups listed in /etc/passwd and
+         * /etc/group (read when the first dynamic user is acquired, and again whenever the files changed since), or
+         * because we picked them for one of our dynamic users. Indexed by UID minus DYNAMIC_UID_MIN. */
+        Bitmap *dynamic_uids;
+        bool dynamic_uids_loaded;
+        struct stat dynamic_uids_passwd_stat, dynamic_uids_group_stat;
+
         /* Keep track of all UIDs and GIDs any of our services currently use. This is useful for the RemoveIPC= logic. */
         Hashmap *uid_refs;
         Hashmap *gid_refs;
@@ -357,6 +432,8 @@ int manager_loop(Manager *m);
 int manager_open_serialization(Manager *m, FILE **_f);
 
 int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root);
+int manager_persist_transient_units(Manager *m);
+void manager_schedule_transient_persist(Manager *m);
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds);
 
 int manager_reload(Manager *m);
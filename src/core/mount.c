@@ -48,6 +48,11 @@
 
 #define RETRY_UMOUNT_MAX 32
 
+/* If the mount table changes more often than this, defer and coalesce rescans */
+#define MOUNT_RESCAN_INTERVAL_USEC (1 * USEC_PER_SEC)
+#define MOUNT_RESCAN_BURST 5
+#define MOUNT_RESCAN_DEFER_USEC (50 * USEC_PER_MSEC)
+
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_table*, mnt_free_table);
 DEFINE_TRIVIAL_CLEANUP_FUNC(struct libmnt_iter*, mnt_free_iter);
 
@@ -69,6 +74,7 @@ static const UnitActiveState state_translation_table[_MOUNT_STATE_MAX] = {
 
 static int mount_dispatch_timer(sd_event_source *source, usec_t usec, void *userdata);
 static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+static void mount_flush_deferred_rescan(Manager *m);
 
 static bool mount_needs_network(const char *options, const char *fstype) {
         if (fstab_test_option(options, "_netdev\0"))
@@ -1199,6 +1205,9 @@ static void mount_sigchld_event(Unit *u, pid_t pid, int code, int status) {
         if (pid != m->control_pid)
                 return;
 
+        /* Make sure we see the effect of the mount command on the mount table */
+        mount_flush_deferred_rescan(u->manager);
+
         m->control_pid = 0;
 
         if (is_clean_exit(code, status, EXIT_CLEAN_COMMAND, NULL))
@@ -1516,7 +1525,8 @@ static int mount_setup_unit(
                 const char *where,
                 const char *options,
                 const char *fstype,
-                bool set_flags) {
+                bool set_flags,
+                Unit **ret) {
 
         _cleanup_free_ char *e = NULL;
         MountSetupFlags flags;
@@ -1528,6 +1538,9 @@ static int mount_setup_unit(
         assert(where);
         assert(options);
         assert(fstype);
+        assert(ret);
+
+        *ret = NULL;
 
         /* Ignore API mount points. They should never be referenced in
          * dependencies ever. */
@@ -1572,15 +1585,259 @@ static int mount_setup_unit(
         if (flags.just_changed)
                 unit_add_to_dbus_queue(u);
 
+        *ret = u;
         return 0;
 fail:
         log_warning_errno(r, "Failed to set up mount unit: %m");
         return r;
 }
 
-static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
+typedef struct MountInfoEntry {
+        int id;
+        unsigned generation;
+
+        /* The fields as read from /proc/self/mountinfo, used to detect changes */
+        char *device;
+        char *path;
+        char *options;
+        char *fstype;
+
+        /* The unit this entry was applied to, and the unescaped device
+         * path, or NULL if the entry is not covered by a mount unit */
+        char *unit;
+        char *what;
+} MountInfoEntry;
+
+static MountInfoEntry* mountinfo_entry_free(MountInfoEntry *e) {
+        if (!e)
+                return NULL;
+
+        free(e->device);
+        free(e->path);
+        free(e->options);
+        free(e->fstype);
+        free(e->unit);
+        free(e->what);
+
+        return mfree(e);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(MountInfoEntry*, mountinfo_entry_free);
+
+static bool mountinfo_entry_matches(
+                const MountInfoEntry *e,
+                const char *device,
+                const char *path,
+                const char *options,
+                const char *fstype) {
+
+        assert(e);
+
+        return streq(e->device, device) &&
+                streq(e->path, path) &&
+                streq_ptr(e->options, options) &&
+                streq_ptr(e->fstype, fstype);
+}
+
+static int mountinfo_ref(Hashmap **h, const char *key) {
+        _cleanup_free_ char *k = NULL;
+        unsigned n;
+        int r;
+
+        assert(h);
+        assert(key);
+
+        n = PTR_TO_UINT(hashmap_get(*h, key));
+        if (n > 0)
+                return hashmap_update(*h, key, UINT_TO_PTR(n + 1));
+
+        r = hashmap_ensure_allocated(h, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        k = strdup(key);
+        if (!k)
+                return -ENOMEM;
+
+        r = hashmap_put(*h, k, UINT_TO_PTR(1));
+        if (r < 0)
+                return r;
+
+        k = NULL;
+        return 0;
+}
+
+static unsigned mountinfo_unref(Hashmap *h, const char *key) {
+        void *k = NULL;
+        unsigned n;
+
+        assert(key);
+
+        /* Returns the number of references left */
+
+        n = PTR_TO_UINT(hashmap_get2(h, key, &k));
+        if (n > 1) {
+                (void) hashmap_update(h, key, UINT_TO_PTR(n - 1));
+                return n - 1;
+        }
+
+        if (n == 1) {
+                (void) hashmap_remove(h, key);
+                free(k);
+        }
+
+        return 0;
+}
+
+static void mountinfo_refs_flush(Hashmap *h) {
+        char *k;
+
+        while ((k = hashmap_steal_first_key(h)))
+                free(k);
+}
+
+static void mountinfo_flush(Manager *m) {
+        MountInfoEntry *e;
+
+        assert(m);
+
+        while ((e = hashmap_steal_first(m->mountinfo_by_id)))
+                mountinfo_entry_free(e);
+
+        mountinfo_refs_flush(m->mountinfo_unit_refs);
+        mountinfo_refs_flush(m->mountinfo_what_refs);
+}
+
+static int mountinfo_add(
+                Manager *m,
+                int id,
+                const char *device,
+                const char *path,
+                const char *options,
+                const char *fstype,
+                const char *what,
+                Unit *u) {
+
+        _cleanup_(mountinfo_entry_freep) MountInfoEntry *e = NULL;
+        int r;
+
+        assert(m);
+        assert(device);
+        assert(path);
+
+        e = new0(MountInfoEntry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->id = id;
+        e->generation = m->mountinfo_generation;
+
+        e->device = strdup(device);
+        e->path = strdup(path);
+        if (!e->device || !e->path)
+                return -ENOMEM;
+
+        if (options) {
+                e->options = strdup(options);
+                if (!e->options)
+                        return -ENOMEM;
+        }
+
+        if (fstype) {
+                e->fstype = strdup(fstype);
+                if (!e->fstype)
+                        return -ENOMEM;
+        }
+
+        if (u) {
+                e->unit = strdup(u->id);
+                e->what = strdup(what);
+                if (!e->unit || !e->what)
+                        return -ENOMEM;
+        }
+
+        r = hashmap_ensure_allocated(&m->mountinfo_by_id, NULL);
+        if (r < 0)
+                return r;
+
+        /* Take the references first, the entry must not be in the table unless they are accounted for */
+        if (e->unit) {
+                r = mountinfo_ref(&m->mountinfo_unit_refs, e->unit);
+                if (r < 0)
+                        return r;
+
+                r = mountinfo_ref(&m->mountinfo_what_refs, e->what);
+                if (r < 0) {
+                        (void) mountinfo_unref(m->mountinfo_unit_refs, e->unit);
+                        return r;
+                }
+        }
+
+        r = hashmap_put(m->mountinfo_by_id, INT_TO_PTR(id), e);
+        if (r < 0) {
+                if (e->unit) {
+                        (void) mountinfo_unref(m->mountinfo_what_refs, e->what);
+                        (void) mountinfo_unref(m->mountinfo_unit_refs, e->unit);
+                }
+                return r;
+        }
+
+        e = NULL;
+        return 0;
+}
+
+static int mountinfo_parse(struct libmnt_table *t, const char *path) {
+        assert(t);
+
+        /* path is only set by tests, which feed their own mount tables to us */
+        if (path)
+                return mnt_table_parse_file(t, path);
+
+        return mnt_table_parse_mtab(t, NULL);
+}
+
+static int mountinfo_apply(
+                Manager *m,
+                const char *device,
+                const char *path,
+                const char *options,
+                const char *fstype,
+                bool set_flags,
+                char **ret_what,
+                Unit **ret_unit) {
+
+        _cleanup_free_ char *d = NULL, *p = NULL;
+        int r;
+
+        assert(m);
+        assert(device);
+        assert(path);
+        assert(ret_unit);
+
+        if (cunescape(device, UNESCAPE_RELAX, &d) < 0)
+                return log_oom();
+
+        if (cunescape(path, UNESCAPE_RELAX, &p) < 0)
+                return log_oom();
+
+        (void) device_found_node(m, d, true, DEVICE_FOUND_MOUNT, set_flags);
+
+        r = mount_setup_unit(m, d, p, options, fstype, set_flags, ret_unit);
+        if (r < 0)
+                return r;
+
+        if (ret_what) {
+                *ret_what = d;
+                d = NULL;
+        }
+
+        return 0;
+}
+
+static int mount_load_proc_self_mountinfo(Manager *m, const char *path, bool set_flags) {
         _cleanup_(mnt_free_tablep) struct libmnt_table *t = NULL;
         _cleanup_(mnt_free_iterp) struct libmnt_iter *i = NULL;
+        bool snapshot = true;
         int r = 0;
 
         assert(m);
@@ -1593,16 +1850,21 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
         if (!i)
                 return log_oom();
 
-        r = mnt_table_parse_mtab(t, NULL);
+        r = mountinfo_parse(t, path);
         if (r < 0)
                 return log_error_errno(r, "Failed to parse /proc/self/mountinfo: %m");
 
+        /* This is the full rescan, hence start with a fresh snapshot */
+        mountinfo_flush(m);
+        m->mountinfo_generation++;
+
         r = 0;
         for (;;) {
                 const char *device, *path, *options, *fstype;
-                _cleanup_free_ char *d = NULL, *p = NULL;
+                _cleanup_free_ char *d = NULL;
                 struct libmnt_fs *fs;
-                int k;
+                Unit *u;
+                int k, id;
 
                 k = mnt_table_next_fs(t, i, &fs);
                 if (k == 1)
@@ -1614,23 +1876,236 @@ static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
                 path = mnt_fs_get_target(fs);
                 options = mnt_fs_get_options(fs);
                 fstype = mnt_fs_get_fstype(fs);
+                id = mnt_fs_get_id(fs);
+
+                if (!device || !path)
+                        continue;
+
+                k = mountinfo_apply(m, device, path, options, fstype, set_flags, &d, &u);
+                if (k == -ENOMEM)
+                        return k;
+                if (k < 0) {
+                        if (r == 0)
+                                r = k;
+                        continue;
+                }
+
+                /* Without mount IDs (e.g. when libmount fell back to
+                 * /etc/mtab) we cannot keep track of changes incrementally */
+                if (!snapshot)
+                        continue;
+                if (id <= 0 || mountinfo_add(m, id, device, path, options, fstype, d, u) < 0)
+                        snapshot = false;
+        }
+
+        if (!snapshot)
+                mountinfo_flush(m);
+
+        return r;
+}
+
+static int mountinfo_release(Manager *m, MountInfoEntry *e, Set **touched, Set **reapply) {
+        _cleanup_(mountinfo_entry_freep) MountInfoEntry *f = e;
+        Unit *u;
+        int r;
+
+        assert(m);
+        assert(e);
+        assert(touched);
+        assert(reapply);
+
+        if (!e->unit)
+                return 0;
+
+        (void) mountinfo_unref(m->mountinfo_what_refs, e->what);
+
+        u = manager_get_unit(m, e->unit);
+        if (mountinfo_unref(m->mountinfo_unit_refs, e->unit) > 0 && u) {
+                /* Another entry still refers to this unit (e.g. an
+                 * overmount), so make sure it is considered mounted
+                 * again. */
+                r = set_ensure_allocated(reapply, &string_hash_ops);
+                if (r < 0)
+                        return r;
+
+                r = set_put(*reapply, u->id);
+                if (r < 0)
+                        return r;
+        }
+
+        if (!u)
+                return 0;
+
+        r = set_ensure_allocated(touched, NULL);
+        if (r < 0)
+                return r;
+
+        return set_put(*touched, u);
+}
+
+static int mount_load_proc_self_mountinfo_incremental(Manager *m, const char *path, Set **touched) {
+        _cleanup_(mnt_free_tablep) struct libmnt_table *t = NULL;
+        _cleanup_(mnt_free_iterp) struct libmnt_iter *i = NULL;
+        _cleanup_set_free_ Set *reapply = NULL;
+        MountInfoEntry **replaced = NULL, *e;
+        size_t n_replaced = 0, n_allocated = 0, k;
+        Iterator j;
+        int r;
+
+        assert(m);
+        assert(touched);
+
+        /* Processes only those entries of /proc/self/mountinfo that
+         * changed since the last rescan, and collects the mount units
+         * affected by this in 'touched'. Returns -ESTALE if we have no
+         * usable snapshot and a full rescan is necessary. */
+
+        if (hashmap_isempty(m->mountinfo_by_id))
+                return -ESTALE;
+
+        t = mnt_new_table();
+        if (!t)
+                return log_oom();
+
+        i = mnt_new_iter(MNT_ITER_FORWARD);
+        if (!i)
+                return log_oom();
+
+        r = mountinfo_parse(t, path);
+        if (r < 0)
+                return log_error_errno(r, "Failed to parse /proc/self/mountinfo: %m");
+
+        m->mountinfo_generation++;
+
+        r = 0;
+        for (;;) {
+                const char *device, *path, *options, *fstype;
+                _cleanup_free_ char *d = NULL;
+                struct libmnt_fs *fs;
+                MountInfoEntry *old;
+                Unit *u;
+                int q, id;
+
+                q = mnt_table_next_fs(t, i, &fs);
+                if (q == 1)
+                        break;
+                if (q < 0) {
+                        r = log_error_errno(q, "Failed to get next entry from /proc/self/mountinfo: %m");
+                        goto finish;
+                }
+
+                device = mnt_fs_get_source(fs);
+                path = mnt_fs_get_target(fs);
+                options = mnt_fs_get_options(fs);
+                fstype = mnt_fs_get_fstype(fs);
+                id = mnt_fs_get_id(fs);
 
                 if (!device || !path)
                         continue;
 
-                if (cunescape(device, UNESCAPE_RELAX, &d) < 0)
-                        return log_oom();
+                if (id <= 0) {
+                        r = -ESTALE;
+                        goto finish;
+                }
+
+                old = hashmap_get(m->mountinfo_by_id, INT_TO_PTR(id));
+                if (old) {
+                        old->generation = m->mountinfo_generation;
 
-                if (cunescape(path, UNESCAPE_RELAX, &p) < 0)
-                        return log_oom();
+                        if (mountinfo_entry_matches(old, device, path, options, fstype))
+                                continue;
+                }
 
-                (void) device_found_node(m, d, true, DEVICE_FOUND_MOUNT, set_flags);
+                q = mountinfo_apply(m, device, path, options, fstype, true, &d, &u);
+                if (q == -ENOMEM) {
+                        r = q;
+                        goto finish;
+                }
+                if (q < 0) {
+                        /* Leave the old entry in place, so that we retry on the next rescan */
+                        if (r == 0)
+                                r = q;
+                        continue;
+                }
 
-                k = mount_setup_unit(m, d, p, options, fstype, set_flags);
-                if (r == 0 && k < 0)
-                        r = k;
+                if (u) {
+                        q = set_ensure_allocated(touched, NULL);
+                        if (q >= 0)
+                                q = set_put(*touched, u);
+                        if (q < 0) {
+                                r = q;
+                                goto finish;
+                        }
+                }
+
+                if (old) {
+                        /* The entry was changed (e.g. remounted or moved). Add the
+                         * new one first, so that the unit does not lose its last
+                         * reference in between, and release the old one below. */
+                        if (!GREEDY_REALLOC(replaced, n_allocated, n_replaced + 1)) {
+                                r = -ENOMEM;
+                                goto finish;
+                        }
+
+                        replaced[n_replaced++] = hashmap_remove(m->mountinfo_by_id, INT_TO_PTR(id));
+                }
+
+                q = mountinfo_add(m, id, device, path, options, fstype, d, u);
+                if (q < 0) {
+                        r = q;
+                        goto finish;
+                }
         }
 
+        /* Now release everything that vanished or was replaced */
+        HASHMAP_FOREACH(e, m->mountinfo_by_id, j) {
+                int q;
+
+                if (e->generation == m->mountinfo_generation)
+                        continue;
+
+                (void) hashmap_remove(m->mountinfo_by_id, INT_TO_PTR(e->id));
+
+                q = mountinfo_release(m, e, touched, &reapply);
+                if (q < 0) {
+                        r = q;
+                        goto finish;
+                }
+        }
+
+        for (k = 0; k < n_replaced; k++) {
+                int q;
+
+                q = mountinfo_release(m, replaced[k], touched, &reapply);
+                replaced[k] = NULL;
+                if (q < 0) {
+                        r = q;
+                        goto finish;
+                }
+        }
+
+        if (!set_isempty(reapply))
+                HASHMAP_FOREACH(e, m->mountinfo_by_id, j) {
+                        Unit *u;
+                        int q;
+
+                        if (!e->unit || !set_remove(reapply, e->unit))
+                                continue;
+
+                        q = mountinfo_apply(m, e->device, e->path, e->options, e->fstype, true, NULL, &u);
+                        if (q == -ENOMEM) {
+                                r = q;
+                                goto finish;
+                        }
+                        if (q < 0 && r == 0)
+                                r = q;
+                }
+
+finish:
+        for (k = 0; k < n_replaced; k++)
+                mountinfo_entry_free(replaced[k]);
+        free(replaced);
+
         return r;
 }
 
@@ -1639,9 +2114,15 @@ static void mount_shutdown(Manager *m) {
         assert(m);
 
         m->mount_event_source = sd_event_source_unref(m->mount_event_source);
+        m->mount_rescan_event_source = sd_event_source_unref(m->mount_rescan_event_source);
 
         mnt_unref_monitor(m->mount_monitor);
         m->mount_monitor = NULL;
+
+        mountinfo_flush(m);
+        m->mountinfo_by_id = hashmap_free(m->mountinfo_by_id);
+        m->mountinfo_unit_refs = hashmap_free(m->mountinfo_unit_refs);
+        m->mountinfo_what_refs = hashmap_free(m->mountinfo_what_refs);
 }
 
 static int mount_get_timeout(Unit *u, usec_t *timeout) {
@@ -1745,9 +2226,11 @@ static void mount_enumerate(Manager *m) {
                 }
 
                 (void) sd_event_source_set_description(m->mount_event_source, "mount-monitor-dispatch");
+
+                RATELIMIT_INIT(m->mount_rescan_ratelimit, MOUNT_RESCAN_INTERVAL_USEC, MOUNT_RESCAN_BURST);
         }
 
-        r = mount_load_proc_self_mountinfo(m, false);
+        r = mount_load_proc_self_mountinfo(m, NULL, false);
         if (r < 0)
                 goto fail;
 
@@ -1757,41 +2240,103 @@ fail:
         mount_shutdown(m);
 }
 
-static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        _cleanup_set_free_ Set *around = NULL, *gone = NULL;
-        Manager *m = userdata;
+static void mount_process_proc_self_mountinfo_one(Mount *mount, Set **around, Set **gone) {
+        assert(mount);
+        assert(around);
+        assert(gone);
+
+        if (!mount_is_mounted(mount)) {
+
+                /* A mount point is not around right now. It
+                 * might be gone, or might never have
+                 * existed. */
+
+                if (mount->from_proc_self_mountinfo &&
+                    mount->parameters_proc_self_mountinfo.what) {
+
+                        /* Remember that this device might just have disappeared */
+                        if (set_ensure_allocated(gone, &string_hash_ops) < 0 ||
+                            set_put(*gone, mount->parameters_proc_self_mountinfo.what) < 0)
+                                log_oom(); /* we don't care too much about OOM here... */
+                }
+
+                mount->from_proc_self_mountinfo = false;
+
+                switch (mount->state) {
+
+                case MOUNT_MOUNTED:
+                        /* This has just been unmounted by
+                         * somebody else, follow the state
+                         * change. */
+                        mount->result = MOUNT_SUCCESS; /* make sure we forget any earlier umount failures */
+                        mount_enter_dead(mount, MOUNT_SUCCESS);
+                        break;
+
+                default:
+                        break;
+                }
+
+        } else if (mount->just_mounted || mount->just_changed) {
+
+                /* A mount point was added or changed */
+
+                switch (mount->state) {
+
+                case MOUNT_DEAD:
+                case MOUNT_FAILED:
+
+                        /* This has just been mounted by somebody else, follow the state change, but let's
+                         * generate a new invocation ID for this implicitly and automatically. */
+                        (void) unit_acquire_invocation_id(UNIT(mount));
+                        mount_enter_mounted(mount, MOUNT_SUCCESS);
+                        break;
+
+                case MOUNT_MOUNTING:
+                        mount_set_state(mount, MOUNT_MOUNTING_DONE);
+                        break;
+
+                default:
+                        /* Nothing really changed, but let's
+                         * issue an notification call
+                         * nonetheless, in case somebody is
+                         * waiting for this. (e.g. file system
+                         * ro/rw remounts.) */
+                        mount_set_state(mount, mount->state);
+                        break;
+                }
+        }
+
+        if (mount_is_mounted(mount) &&
+            mount->from_proc_self_mountinfo &&
+            mount->parameters_proc_self_mountinfo.what) {
+
+                if (set_ensure_allocated(around, &string_hash_ops) < 0 ||
+                    set_put(*around, mount->parameters_proc_self_mountinfo.what) < 0)
+                        log_oom();
+        }
+
+        /* Reset the flags for later calls */
+        mount->is_mounted = mount->just_mounted = mount->just_changed = false;
+}
+
+int mount_process_mountinfo(Manager *m, const char *path) {
+        _cleanup_set_free_ Set *around = NULL, *gone = NULL, *touched = NULL;
         const char *what;
         Iterator i;
         Unit *u;
         int r;
 
         assert(m);
-        assert(revents & EPOLLIN);
 
-        if (fd == mnt_monitor_get_fd(m->mount_monitor)) {
-                bool rescan = false;
+        /* We are rescanning right now, hence any deferred rescan is obsolete */
+        if (m->mount_rescan_event_source)
+                (void) sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_OFF);
 
-                /* Drain all events and verify that the event is valid.
-                 *
-                 * Note that libmount also monitors /run/mount mkdir if the
-                 * directory does not exist yet. The mkdir may generate event
-                 * which is irrelevant for us.
-                 *
-                 * error: r < 0; valid: r == 0, false positive: rc == 1 */
-                do {
-                        r = mnt_monitor_next_change(m->mount_monitor, NULL, NULL);
-                        if (r == 0)
-                                rescan = true;
-                        else if (r < 0)
-                                return log_error_errno(r, "Failed to drain libmount events");
-                } while (r == 0);
-
-                log_debug("libmount event [rescan: %s]", yes_no(rescan));
-                if (!rescan)
-                        return 0;
+        r = mount_load_proc_self_mountinfo_incremental(m, path, &touched);
+        if (r == -ESTALE) {
+                touched = set_free(touched);
+                r = mount_load_proc_self_mountinfo(m, path, true);
         }
-
-        r = mount_load_proc_self_mountinfo(m, true);
         if (r < 0) {
                 /* Reset flags, just in case, for later calls */
                 LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
@@ -1800,97 +2345,151 @@ static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents,
                         mount->is_mounted = mount->just_mounted = mount->just_changed = false;
                 }
 
+                /* And do a full rescan next time */
+                mountinfo_flush(m);
+
                 return 0;
         }
 
         manager_dispatch_load_queue(m);
 
-        LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
-                Mount *mount = MOUNT(u);
+        if (touched)
+                /* Only the units whose entries changed need to be looked at,
+                 * all others retain their state */
+                SET_FOREACH(u, touched, i)
+                        mount_process_proc_self_mountinfo_one(MOUNT(u), &around, &gone);
+        else
+                LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT])
+                        mount_process_proc_self_mountinfo_one(MOUNT(u), &around, &gone);
 
-                if (!mount_is_mounted(mount)) {
+        SET_FOREACH(what, gone, i) {
+                if (set_contains(around, what))
+                        continue;
 
-                        /* A mount point is not around right now. It
-                         * might be gone, or might never have
-                         * existed. */
+                /* Some mount unit not looked at above might still use it */
+                if (hashmap_contains(m->mountinfo_what_refs, what))
+                        continue;
 
-                        if (mount->from_proc_self_mountinfo &&
-                            mount->parameters_proc_self_mountinfo.what) {
+                /* Let the device units know that the device is no longer mounted */
+                (void) device_found_node(m, what, false, DEVICE_FOUND_MOUNT, true);
+        }
 
-                                /* Remember that this device might just have disappeared */
-                                if (set_ensure_allocated(&gone, &string_hash_ops) < 0 ||
-                                    set_put(gone, mount->parameters_proc_self_mountinfo.what) < 0)
-                                        log_oom(); /* we don't care too much about OOM here... */
-                        }
+        return 0;
+}
 
-                        mount->from_proc_self_mountinfo = false;
+static int mount_process_proc_self_mountinfo(Manager *m) {
+        return mount_process_mountinfo(m, NULL);
+}
 
-                        switch (mount->state) {
+static int mount_dispatch_rescan(sd_event_source *source, usec_t usec, void *userdata) {
+        Manager *m = userdata;
 
-                        case MOUNT_MOUNTED:
-                                /* This has just been unmounted by
-                                 * somebody else, follow the state
-                                 * change. */
-                                mount->result = MOUNT_SUCCESS; /* make sure we forget any earlier umount failures */
-                                mount_enter_dead(mount, MOUNT_SUCCESS);
-                                break;
+        assert(m);
 
-                        default:
-                                break;
-                        }
+        return mount_process_proc_self_mountinfo(m);
+}
 
-                } else if (mount->just_mounted || mount->just_changed) {
+static int mount_defer_rescan(Manager *m) {
+        usec_t usec;
+        int r, enabled;
 
-                        /* A mount point was added or changed */
+        assert(m);
 
-                        switch (mount->state) {
+        usec = usec_add(now(CLOCK_MONOTONIC), MOUNT_RESCAN_DEFER_USEC);
 
-                        case MOUNT_DEAD:
-                        case MOUNT_FAILED:
+        if (m->mount_rescan_event_source) {
+                r = sd_event_source_get_enabled(m->mount_rescan_event_source, &enabled);
+                if (r < 0)
+                        return r;
 
-                                /* This has just been mounted by somebody else, follow the state change, but let's
-                                 * generate a new invocation ID for this implicitly and automatically. */
-                                (void) unit_acquire_invocation_id(UNIT(mount));
-                                mount_enter_mounted(mount, MOUNT_SUCCESS);
-                                break;
+                /* Already pending, it will pick up this change too */
+                if (enabled != SD_EVENT_OFF)
+                        return 0;
 
-                        case MOUNT_MOUNTING:
-                                mount_set_state(mount, MOUNT_MOUNTING_DONE);
-                                break;
+                r = sd_event_source_set_time(m->mount_rescan_event_source, usec);
+                if (r < 0)
+                        return r;
 
-                        default:
-                                /* Nothing really changed, but let's
-                                 * issue an notification call
-                                 * nonetheless, in case somebody is
-                                 * waiting for this. (e.g. file system
-                                 * ro/rw remounts.) */
-                                mount_set_state(mount, mount->state);
-                                break;
-                        }
-                }
+                return sd_event_source_set_enabled(m->mount_rescan_event_source, SD_EVENT_ONESHOT);
+        }
 
-                if (mount_is_mounted(mount) &&
-                    mount->from_proc_self_mountinfo &&
-                    mount->parameters_proc_self_mountinfo.what) {
+        r = sd_event_add_time(
+                        m->event,
+                        &m->mount_rescan_event_source,
+                        CLOCK_MONOTONIC,
+                        usec, 0,
+                        mount_dispatch_rescan, m);
+        if (r < 0)
+                return r;
 
-                        if (set_ensure_allocated(&around, &string_hash_ops) < 0 ||
-                            set_put(around, mount->parameters_proc_self_mountinfo.what) < 0)
-                                log_oom();
-                }
+        r = sd_event_source_set_priority(m->mount_rescan_event_source, -10);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(m->mount_rescan_event_source, "mount-rescan");
+
+        return 0;
+}
+
+static void mount_flush_deferred_rescan(Manager *m) {
+        int enabled;
 
-                /* Reset the flags for later calls */
-                mount->is_mounted = mount->just_mounted = mount->just_changed = false;
+        assert(m);
+
+        /* The SIGCHLD handling for mount/umount relies on the mount table
+         * being up-to-date, hence process a deferred rescan right away */
+
+        if (!m->mount_rescan_event_source)
+                return;
+
+        if (sd_event_source_get_enabled(m->mount_rescan_event_source, &enabled) < 0 ||
+            enabled == SD_EVENT_OFF)
+                return;
+
+        (void) mount_process_proc_self_mountinfo(m);
+}
+
+static int mount_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        int r;
+
+        assert(m);
+        assert(revents & EPOLLIN);
+
+        if (fd == mnt_monitor_get_fd(m->mount_monitor)) {
+                bool rescan = false;
+
+                /* Drain all events and verify that the event is valid.
+                 *
+                 * Note that libmount also monitors /run/mount mkdir if the
+                 * directory does not exist yet. The mkdir may generate event
+                 * which is irrelevant for us.
+                 *
+                 * error: r < 0; valid: r == 0, false positive: rc == 1 */
+                do {
+                        r = mnt_monitor_next_change(m->mount_monitor, NULL, NULL);
+                        if (r == 0)
+                                rescan = true;
+                        else if (r < 0)
+                                return log_error_errno(r, "Failed to drain libmount events");
+                } while (r == 0);
+
+                log_debug("libmount event [rescan: %s]", yes_no(rescan));
+                if (!rescan)
+                        return 0;
         }
 
-        SET_FOREACH(what, gone, i) {
-                if (set_contains(around, what))
-                        continue;
+        /* If the mount table changes too often, coalesce the changes
+         * and rescan only after a short delay. */
+        if (!ratelimit_test(&m->mount_rescan_ratelimit)) {
+                r = mount_defer_rescan(m);
+                if (r >= 0)
+                        return 0;
 
-                /* Let the device units know that the device is no longer mounted */
-                (void) device_found_node(m, what, false, DEVICE_FOUND_MOUNT, true);
+                log_warning_errno(r, "Failed to defer mount table rescan, rescanning immediately: %m");
         }
 
-        return 0;
+        return mount_process_proc_self_mountinfo(m);
 }
 
 static void mount_reset_failed(Unit *u) {
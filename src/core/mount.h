@@ -105,6 +105,9 @@ extern const UnitVTable mount_vtable;
 
 void mount_fd_event(Manager *m, int events);
 
+/* Applies the changes in the mount table since the last call, path is NULL for /proc/self/mountinfo */
+int mount_process_mountinfo(Manager *m, const char *path);
+
 const char* mount_exec_command_to_string(MountExecCommand i) _const_;
 MountExecCommand mount_exec_command_from_string(const char *s) _pure_;
 
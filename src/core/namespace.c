@@ -75,6 +75,12 @@ typedef struct MountEntry {
         char *source_malloc;
 } MountEntry;
 
+struct NamespacePlan {
+        MountEntry *mounts;       /* Sorted, deduplicated, and owning all strings */
+        unsigned n_mounts;
+        bool make_slave;
+};
+
 /* If MountAPIVFS= is used, let's mount /sys and /proc into the it, but only as a fallback if the user hasn't mounted
  * something there already. These mounts are hence overriden by any other explicitly configured mounts. */
 static const MountEntry apivfs_table[] = {
@@ -841,8 +847,8 @@ static unsigned namespace_calculate_mounts(
                 char** inaccessible_paths,
                 const BindMount *bind_mounts,
                 unsigned n_bind_mounts,
-                const char* tmp_dir,
-                const char* var_tmp_dir,
+                bool private_tmp,
+                bool private_var_tmp,
                 ProtectHome protect_home,
                 ProtectSystem protect_system) {
 
@@ -861,7 +867,7 @@ static unsigned namespace_calculate_mounts(
                  ((protect_home == PROTECT_HOME_READ_ONLY) ?
                   ELEMENTSOF(protect_home_read_only_table) : 0));
 
-        return !!tmp_dir + !!var_tmp_dir +
+        return private_tmp + private_var_tmp +
                 strv_length(read_write_paths) +
                 strv_length(read_only_paths) +
                 strv_length(inaccessible_paths) +
@@ -874,7 +880,17 @@ static unsigned namespace_calculate_mounts(
                 (namespace_info_mount_apivfs(root_directory, ns_info) ? ELEMENTSOF(apivfs_table) : 0);
 }
 
-int setup_namespace(
+static const char *namespace_root_directory(const char *root_directory, const char *root_image) {
+
+        /* For images we use the same mount point for all of them, which is safe, since they all live in their own
+         * namespaces after all, and hence won't see each other. */
+        if (root_image && !root_directory)
+                return "/run/systemd/unit-root";
+
+        return root_directory;
+}
+
+int namespace_plan_new(
                 const char* root_directory,
                 const char* root_image,
                 const NameSpaceInfo *ns_info,
@@ -883,101 +899,72 @@ int setup_namespace(
                 char** inaccessible_paths,
                 const BindMount *bind_mounts,
                 unsigned n_bind_mounts,
-                const char* tmp_dir,
-                const char* var_tmp_dir,
+                bool private_tmp,
+                bool private_var_tmp,
                 ProtectHome protect_home,
                 ProtectSystem protect_system,
-                unsigned long mount_flags,
-                DissectImageFlags dissect_image_flags) {
+                NamespacePlan **ret) {
 
-        _cleanup_(loop_device_unrefp) LoopDevice *loop_device = NULL;
-        _cleanup_(decrypted_image_unrefp) DecryptedImage *decrypted_image = NULL;
-        _cleanup_(dissected_image_unrefp) DissectedImage *dissected_image = NULL;
-        _cleanup_free_ void *root_hash = NULL;
-        MountEntry *m, *mounts = NULL;
-        size_t root_hash_size = 0;
-        bool make_slave = false;
-        unsigned n_mounts;
-        int r = 0;
+        _cleanup_(namespace_plan_freep) NamespacePlan *plan = NULL;
+        MountEntry *m;
+        unsigned n, i;
+        int r;
 
         assert(ns_info);
+        assert(ret);
 
-        if (mount_flags == 0)
-                mount_flags = MS_SHARED;
-
-        if (root_image) {
-                dissect_image_flags |= DISSECT_IMAGE_REQUIRE_ROOT;
-
-                if (protect_system == PROTECT_SYSTEM_STRICT && strv_isempty(read_write_paths))
-                        dissect_image_flags |= DISSECT_IMAGE_READ_ONLY;
-
-                r = loop_device_make_by_path(root_image,
-                                             dissect_image_flags & DISSECT_IMAGE_READ_ONLY ? O_RDONLY : O_RDWR,
-                                             &loop_device);
-                if (r < 0)
-                        return r;
-
-                r = root_hash_load(root_image, &root_hash, &root_hash_size);
-                if (r < 0)
-                        return r;
-
-                r = dissect_image(loop_device->fd, root_hash, root_hash_size, dissect_image_flags, &dissected_image);
-                if (r < 0)
-                        return r;
-
-                r = dissected_image_decrypt(dissected_image, NULL, root_hash, root_hash_size, dissect_image_flags, &decrypted_image);
-                if (r < 0)
-                        return r;
+        /* Computes the list of mounts setup_namespace() needs to apply. This only depends on the settings, not on the
+         * state of the file system, hence may be computed once and used for many invocations. */
 
-                if (!root_directory) {
-                        /* Create a mount point for the image, if it's still missing. We use the same mount point for
-                         * all images, which is safe, since they all live in their own namespaces after all, and hence
-                         * won't see each other. */
-                        root_directory = "/run/systemd/unit-root";
-                        (void) mkdir(root_directory, 0700);
-                }
-        }
+        root_directory = namespace_root_directory(root_directory, root_image);
 
-        n_mounts = namespace_calculate_mounts(
+        n = namespace_calculate_mounts(
                         root_directory,
                         ns_info,
                         read_write_paths,
                         read_only_paths,
                         inaccessible_paths,
                         bind_mounts, n_bind_mounts,
-                        tmp_dir, var_tmp_dir,
+                        private_tmp, private_var_tmp,
                         protect_home, protect_system);
 
+        plan = new0(NamespacePlan, 1);
+        if (!plan)
+                return -ENOMEM;
+
         /* Set mount slave mode */
-        if (root_directory || n_mounts > 0)
-                make_slave = true;
+        plan->make_slave = root_directory || n > 0;
+
+        if (n > 0) {
+                plan->mounts = m = new0(MountEntry, n);
+                if (!plan->mounts)
+                        return -ENOMEM;
+                plan->n_mounts = n;
 
-        if (n_mounts > 0) {
-                m = mounts = (MountEntry *) alloca0(n_mounts * sizeof(MountEntry));
                 r = append_access_mounts(&m, read_write_paths, READWRITE);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 r = append_access_mounts(&m, read_only_paths, READONLY);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 r = append_access_mounts(&m, inaccessible_paths, INACCESSIBLE);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 r = append_bind_mounts(&m, bind_mounts, n_bind_mounts);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
-                if (tmp_dir) {
+                if (private_tmp) {
                         *(m++) = (MountEntry) {
                                 .path_const = "/tmp",
                                 .mode = PRIVATE_TMP,
                         };
                 }
 
-                if (var_tmp_dir) {
+                if (private_var_tmp) {
                         *(m++) = (MountEntry) {
                                 .path_const = "/var/tmp",
                                 .mode = PRIVATE_VAR_TMP,
@@ -994,13 +981,13 @@ int setup_namespace(
                 if (ns_info->protect_kernel_tunables) {
                         r = append_static_mounts(&m, protect_kernel_tunables_table, ELEMENTSOF(protect_kernel_tunables_table), ns_info->ignore_protect_paths);
                         if (r < 0)
-                                goto finish;
+                                return r;
                 }
 
                 if (ns_info->protect_kernel_modules) {
                         r = append_static_mounts(&m, protect_kernel_modules_table, ELEMENTSOF(protect_kernel_modules_table), ns_info->ignore_protect_paths);
                         if (r < 0)
-                                goto finish;
+                                return r;
                 }
 
                 if (ns_info->protect_control_groups) {
@@ -1012,31 +999,175 @@ int setup_namespace(
 
                 r = append_protect_home(&m, protect_home, ns_info->ignore_protect_paths);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 r = append_protect_system(&m, protect_system, false);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 if (namespace_info_mount_apivfs(root_directory, ns_info)) {
                         r = append_static_mounts(&m, apivfs_table, ELEMENTSOF(apivfs_table), ns_info->ignore_protect_paths);
                         if (r < 0)
-                                goto finish;
+                                return r;
                 }
 
-                assert(mounts + n_mounts == m);
+                assert(plan->mounts + n == m);
 
                 /* Prepend the root directory where that's necessary */
-                r = prefix_where_needed(mounts, n_mounts, root_directory);
+                r = prefix_where_needed(plan->mounts, plan->n_mounts, root_directory);
                 if (r < 0)
-                        goto finish;
+                        return r;
+
+                qsort(plan->mounts, plan->n_mounts, sizeof(MountEntry), mount_path_compare);
 
-                qsort(mounts, n_mounts, sizeof(MountEntry), mount_path_compare);
+                drop_duplicates(plan->mounts, &plan->n_mounts);
+                drop_outside_root(root_directory, plan->mounts, &plan->n_mounts);
+                drop_inaccessible(plan->mounts, &plan->n_mounts);
+                drop_nop(plan->mounts, &plan->n_mounts);
 
-                drop_duplicates(mounts, &n_mounts);
-                drop_outside_root(root_directory, mounts, &n_mounts);
-                drop_inaccessible(mounts, &n_mounts);
-                drop_nop(mounts, &n_mounts);
+                /* Finally, make the plan independent of the settings it was computed from */
+                for (i = 0; i < plan->n_mounts; i++) {
+                        MountEntry *e = plan->mounts + i;
+
+                        if (!e->path_malloc) {
+                                e->path_malloc = strdup(e->path_const);
+                                if (!e->path_malloc)
+                                        return -ENOMEM;
+                        }
+
+                        if (e->source_const && !e->source_malloc) {
+                                e->source_malloc = strdup(e->source_const);
+                                if (!e->source_malloc)
+                                        return -ENOMEM;
+                        }
+                }
+        }
+
+        *ret = plan;
+        plan = NULL;
+
+        return 0;
+}
+
+NamespacePlan *namespace_plan_free(NamespacePlan *plan) {
+        unsigned i;
+
+        if (!plan)
+                return NULL;
+
+        for (i = 0; i < plan->n_mounts; i++)
+                mount_entry_done(plan->mounts + i);
+
+        free(plan->mounts);
+        return mfree(plan);
+}
+
+unsigned namespace_plan_n_mounts(const NamespacePlan *plan) {
+        assert(plan);
+
+        return plan->n_mounts;
+}
+
+int setup_namespace(
+                const char* root_directory,
+                const char* root_image,
+                const NameSpaceInfo *ns_info,
+                char** read_write_paths,
+                char** read_only_paths,
+                char** inaccessible_paths,
+                const BindMount *bind_mounts,
+                unsigned n_bind_mounts,
+                const char* tmp_dir,
+                const char* var_tmp_dir,
+                ProtectHome protect_home,
+                ProtectSystem protect_system,
+                unsigned long mount_flags,
+                DissectImageFlags dissect_image_flags,
+                const NamespacePlan *plan) {
+
+        _cleanup_(loop_device_unrefp) LoopDevice *loop_device = NULL;
+        _cleanup_(decrypted_image_unrefp) DecryptedImage *decrypted_image = NULL;
+        _cleanup_(dissected_image_unrefp) DissectedImage *dissected_image = NULL;
+        _cleanup_(namespace_plan_freep) NamespacePlan *own_plan = NULL;
+        _cleanup_free_ void *root_hash = NULL;
+        MountEntry *m, *mounts = NULL;
+        size_t root_hash_size = 0;
+        unsigned n_mounts = 0, i;
+        int r = 0;
+
+        assert(ns_info);
+
+        /* If the caller computed the plan ahead of time (and hopefully reuses it), it must have done so from the
+         * same settings as passed here. */
+        if (!plan) {
+                r = namespace_plan_new(
+                                root_directory,
+                                root_image,
+                                ns_info,
+                                read_write_paths,
+                                read_only_paths,
+                                inaccessible_paths,
+                                bind_mounts, n_bind_mounts,
+                                !!tmp_dir, !!var_tmp_dir,
+                                protect_home, protect_system,
+                                &own_plan);
+                if (r < 0)
+                        return r;
+
+                plan = own_plan;
+        }
+
+        if (mount_flags == 0)
+                mount_flags = MS_SHARED;
+
+        if (root_image) {
+                dissect_image_flags |= DISSECT_IMAGE_REQUIRE_ROOT;
+
+                if (protect_system == PROTECT_SYSTEM_STRICT && strv_isempty(read_write_paths))
+                        dissect_image_flags |= DISSECT_IMAGE_READ_ONLY;
+
+                r = loop_device_make_by_path(root_image,
+                                             dissect_image_flags & DISSECT_IMAGE_READ_ONLY ? O_RDONLY : O_RDWR,
+                                             &loop_device);
+                if (r < 0)
+                        return r;
+
+                r = root_hash_load(root_image, &root_hash, &root_hash_size);
+                if (r < 0)
+                        return r;
+
+                r = dissect_image(loop_device->fd, root_hash, root_hash_size, dissect_image_flags, &dissected_image);
+                if (r < 0)
+                        return r;
+
+                r = dissected_image_decrypt(dissected_image, NULL, root_hash, root_hash_size, dissect_image_flags, &decrypted_image);
+                if (r < 0)
+                        return r;
+
+                if (!root_directory) {
+                        /* Create a mount point for the image, if it's still missing. */
+                        root_directory = namespace_root_directory(root_directory, root_image);
+                        (void) mkdir(root_directory, 0700);
+                }
+        }
+
+        /* Work on a copy of the plan, as following symlinks below replaces the paths */
+        if (plan->n_mounts > 0) {
+                n_mounts = plan->n_mounts;
+                mounts = (MountEntry *) alloca0(n_mounts * sizeof(MountEntry));
+
+                for (i = 0; i < n_mounts; i++) {
+                        const MountEntry *e = plan->mounts + i;
+
+                        mounts[i] = (MountEntry) {
+                                .path_const = mount_entry_path(e),
+                                .mode = e->mode,
+                                .ignore = e->ignore,
+                                .has_prefix = e->has_prefix,
+                                .read_only = e->read_only,
+                                .source_const = mount_entry_source(e),
+                        };
+                }
         }
 
         if (unshare(CLONE_NEWNS) < 0) {
@@ -1044,7 +1175,7 @@ int setup_namespace(
                 goto finish;
         }
 
-        if (make_slave) {
+        if (plan->make_slave) {
                 /* Remount / as SLAVE so that nothing now mounted in the namespace
                    shows up in the parent */
                 if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0) {
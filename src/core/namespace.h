@@ -22,6 +22,7 @@
 
 typedef struct NameSpaceInfo NameSpaceInfo;
 typedef struct BindMount BindMount;
+typedef struct NamespacePlan NamespacePlan;
 
 #include <stdbool.h>
 
@@ -62,6 +63,25 @@ struct BindMount {
         bool ignore_enoent:1;
 };
 
+int namespace_plan_new(
+                const char *root_directory,
+                const char *root_image,
+                const NameSpaceInfo *ns_info,
+                char **read_write_paths,
+                char **read_only_paths,
+                char **inaccessible_paths,
+                const BindMount *bind_mounts,
+                unsigned n_bind_mounts,
+                bool private_tmp,
+                bool private_var_tmp,
+                ProtectHome protect_home,
+                ProtectSystem protect_system,
+                NamespacePlan **ret);
+NamespacePlan *namespace_plan_free(NamespacePlan *plan);
+unsigned namespace_plan_n_mounts(const NamespacePlan *plan);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(NamespacePlan*, namespace_plan_free);
+
 int setup_namespace(
                 const char *root_directory,
                 const char *root_image,
@@ -76,7 +96,8 @@ int setup_namespace(
                 ProtectHome protect_home,
                 ProtectSystem protect_system,
                 unsigned long mount_flags,
-                DissectImageFlags dissected_image_flags);
+                DissectImageFlags dissected_image_flags,
+                const NamespacePlan *plan);
 
 int setup_tmp_dirs(
                 const char *id,
@@ -28,9 +28,11 @@
 #include "fd-util.h"
 #include "fs-util.h"
 #include "glob-util.h"
+#include "hashmap.h"
 #include "macro.h"
 #include "mkdir.h"
 #include "path.h"
+#include "set.h"
 #include "special.h"
 #include "stat-util.h"
 #include "string-table.h"
@@ -45,9 +47,186 @@ static const UnitActiveState state_translation_table[_PATH_STATE_MAX] = {
         [PATH_FAILED] = UNIT_FAILED
 };
 
-static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata);
+static int path_dispatch_io(PathSpec *s, bool changed);
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
+static void path_spec_enqueue(PathSpec *s, bool changed) {
+        assert(s);
+
+        s->pending_changed = s->pending_changed || changed;
+
+        if (s->in_pending_queue)
+                return;
+
+        LIST_APPEND(pending, s->unit->manager->path_inotify_pending, s);
+        s->in_pending_queue = true;
+}
+
+static void path_spec_handle_event(PathSpec *s, const struct inotify_event *e) {
+        size_t i;
+
+        assert(s);
+        assert(e);
+
+        for (i = 0; i < s->n_wds; i++)
+                if (s->wds[i] == e->wd)
+                        break;
+        if (i >= s->n_wds)
+                return;
+
+        /* The watch might be shared with other specs that asked for more events than we did */
+        if (!(e->mask & (s->masks[i]|IN_IGNORED|IN_UNMOUNT)))
+                return;
+
+        path_spec_enqueue(s, IN_SET(s->type, PATH_CHANGED, PATH_MODIFIED) && s->primary_wd == e->wd);
+}
+
+static int path_inotify_dispatch(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
+        Manager *m = userdata;
+        PathSpec *s;
+
+        assert(m);
+        assert(fd == m->path_inotify_fd);
+
+        for (;;) {
+                union inotify_event_buffer buffer;
+                struct inotify_event *e;
+                ssize_t l;
+
+                l = read(fd, &buffer, sizeof(buffer));
+                if (l < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN)
+                                log_error_errno(errno, "Failed to read path inotify event: %m");
+
+                        break;
+                }
+
+                FOREACH_INOTIFY_EVENT(e, buffer, l) {
+                        Iterator i;
+                        Set *specs;
+
+                        if (e->mask & IN_Q_OVERFLOW) {
+                                /* We lost events, let everybody recheck */
+                                log_debug("Path inotify queue overflowed, rechecking all paths.");
+
+                                HASHMAP_FOREACH(specs, m->path_inotify_wd_specs, i) {
+                                        Iterator j;
+
+                                        SET_FOREACH(s, specs, j)
+                                                path_spec_enqueue(s, false);
+                                }
+
+                                continue;
+                        }
+
+                        specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(e->wd));
+                        SET_FOREACH(s, specs, i)
+                                path_spec_handle_event(s, e);
+                }
+        }
+
+        /* Dispatch each affected spec only once per wakeup. Handlers usually rewatch (and thus modify the
+         * wd index) or might free their spec, which takes it off the queue, hence pop one at a time. */
+        while ((s = m->path_inotify_pending)) {
+                bool changed = s->pending_changed;
+
+                LIST_REMOVE(pending, m->path_inotify_pending, s);
+                s->in_pending_queue = false;
+                s->pending_changed = false;
+
+                (void) s->handler(s, changed);
+        }
+
+        return 0;
+}
+
+static int path_inotify_setup(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->path_inotify_fd >= 0)
+                return 0;
+
+        m->path_inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (m->path_inotify_fd < 0)
+                return -errno;
+
+        r = sd_event_add_io(m->event, &m->path_inotify_event_source, m->path_inotify_fd, EPOLLIN, path_inotify_dispatch, m);
+        if (r < 0) {
+                m->path_inotify_fd = safe_close(m->path_inotify_fd);
+                return r;
+        }
+
+        (void) sd_event_source_set_description(m->path_inotify_event_source, "path");
+
+        return 0;
+}
+
+static int path_spec_add_wd(PathSpec *s, int wd, uint32_t mask, size_t *ret) {
+        Manager *m;
+        Set *specs;
+        size_t i;
+        int r;
+
+        assert(s);
+        assert(wd >= 0);
+        assert(ret);
+
+        m = s->unit->manager;
+
+        /* Different components of our path might resolve to the same inode */
+        for (i = 0; i < s->n_wds; i++)
+                if (s->wds[i] == wd) {
+                        s->masks[i] |= mask;
+                        *ret = i;
+                        return 0;
+                }
+
+        specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(wd));
+        if (!specs) {
+                r = hashmap_ensure_allocated(&m->path_inotify_wd_specs, &trivial_hash_ops);
+                if (r < 0)
+                        goto fail;
+
+                specs = set_new(NULL);
+                if (!specs) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                r = hashmap_put(m->path_inotify_wd_specs, INT_TO_PTR(wd), specs);
+                if (r < 0) {
+                        set_free(specs);
+                        goto fail;
+                }
+        }
+
+        r = set_put(specs, s);
+        if (r < 0) {
+                if (set_isempty(specs)) {
+                        hashmap_remove(m->path_inotify_wd_specs, INT_TO_PTR(wd));
+                        set_free(specs);
+                }
+                goto fail;
+        }
+
+        s->wds[s->n_wds] = wd;
+        s->masks[s->n_wds] = mask;
+        *ret = s->n_wds++;
+
+        return 0;
+
+fail:
+        /* Don't leave a watch around that nobody knows about */
+        if (!hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(wd)))
+                (void) inotify_rm_watch(m->path_inotify_fd, wd);
+
+        return r;
+}
+
+int path_spec_watch(PathSpec *s, path_spec_handler_t handler) {
 
         static const int flags_table[_PATH_TYPE_MAX] = {
                 [PATH_EXISTS] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB,
@@ -57,34 +236,45 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 [PATH_DIRECTORY_NOT_EMPTY] = IN_DELETE_SELF|IN_MOVE_SELF|IN_ATTRIB|IN_CREATE|IN_MOVED_TO
         };
 
-        bool exists = false;
-        char *slash, *oldslash = NULL;
+        bool exists = false, have_parent = false;
+        size_t n = 1, parent = 0;
+        char *slash;
+        Manager *m;
         int r;
 
         assert(s);
         assert(s->unit);
         assert(handler);
 
+        m = s->unit->manager;
+
         path_spec_unwatch(s);
 
-        s->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-        if (s->inotify_fd < 0) {
-                r = -errno;
+        r = path_inotify_setup(m);
+        if (r < 0)
                 goto fail;
-        }
 
-        r = sd_event_add_io(s->unit->manager->event, &s->event_source, s->inotify_fd, EPOLLIN, handler, s);
-        if (r < 0)
+        /* We watch at most one inode per path component */
+        for (slash = strchr(s->path, '/'); slash; slash = strchr(slash+1, '/'))
+                n++;
+
+        s->wds = new(int, n);
+        s->masks = new(uint32_t, n);
+        if (!s->wds || !s->masks) {
+                r = -ENOMEM;
                 goto fail;
+        }
 
-        (void) sd_event_source_set_description(s->event_source, "path");
+        s->handler = handler;
 
         /* This assumes the path was passed through path_kill_slashes()! */
 
         for (slash = strchr(s->path, '/'); ; slash = strchr(slash+1, '/')) {
                 char *cut = NULL;
-                int flags;
+                uint32_t flags;
+                size_t idx;
                 char tmp;
+                int wd;
 
                 if (slash) {
                         cut = slash + (slash == s->path);
@@ -95,42 +285,41 @@ int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler) {
                 } else
                         flags = flags_table[s->type];
 
-                r = inotify_add_watch(s->inotify_fd, s->path, flags);
-                if (r < 0) {
+                /* The watch might already exist for another spec, hence only ever extend its mask */
+                wd = inotify_add_watch(m->path_inotify_fd, s->path, flags|IN_MASK_ADD);
+                if (wd < 0) {
                         if (errno == EACCES || errno == ENOENT) {
                                 if (cut)
                                         *cut = tmp;
                                 break;
                         }
 
-                        r = log_warning_errno(errno, "Failed to add watch on %s: %s", s->path, errno == ENOSPC ? "too many watches" : strerror(-r));
+                        r = log_warning_errno(errno, "Failed to add watch on %s: %s", s->path, errno == ENOSPC ? "too many watches" : strerror(errno));
                         if (cut)
                                 *cut = tmp;
                         goto fail;
-                } else {
-                        exists = true;
-
-                        /* Path exists, we don't need to watch parent too closely. */
-                        if (oldslash) {
-                                char *cut2 = oldslash + (oldslash == s->path);
-                                char tmp2 = *cut2;
-                                *cut2 = '\0';
-
-                                (void) inotify_add_watch(s->inotify_fd, s->path, IN_MOVE_SELF);
-                                /* Error is ignored, the worst can happen is we get spurious events. */
-
-                                *cut2 = tmp2;
-                        }
                 }
 
                 if (cut)
                         *cut = tmp;
 
-                if (slash)
-                        oldslash = slash;
-                else {
+                exists = true;
+
+                /* Path exists, we don't need to watch parent too closely. We can't narrow the watch itself
+                 * as it might be shared, but we ignore anything but moves on it from now on. */
+                if (have_parent && s->wds[parent] != wd)
+                        s->masks[parent] = IN_MOVE_SELF;
+
+                r = path_spec_add_wd(s, wd, flags, &idx);
+                if (r < 0)
+                        goto fail;
+
+                if (slash) {
+                        parent = idx;
+                        have_parent = true;
+                } else {
                         /* whole path has been iterated over */
-                        s->primary_wd = r;
+                        s->primary_wd = wd;
                         break;
                 }
         }
@@ -149,38 +338,40 @@ fail:
 }
 
 void path_spec_unwatch(PathSpec *s) {
+        Manager *m;
+        size_t i;
+
         assert(s);
 
-        s->event_source = sd_event_source_unref(s->event_source);
-        s->inotify_fd = safe_close(s->inotify_fd);
-}
+        m = s->unit->manager;
 
-int path_spec_fd_event(PathSpec *s, uint32_t revents) {
-        union inotify_event_buffer buffer;
-        struct inotify_event *e;
-        ssize_t l;
-        int r = 0;
+        for (i = 0; i < s->n_wds; i++) {
+                Set *specs;
 
-        if (revents != EPOLLIN) {
-                log_error("Got invalid poll event on inotify.");
-                return -EINVAL;
-        }
+                specs = hashmap_get(m->path_inotify_wd_specs, INT_TO_PTR(s->wds[i]));
+                if (!specs)
+                        continue;
 
-        l = read(s->inotify_fd, &buffer, sizeof(buffer));
-        if (l < 0) {
-                if (errno == EAGAIN || errno == EINTR)
-                        return 0;
+                set_remove(specs, s);
+                if (!set_isempty(specs))
+                        continue;
 
-                return log_error_errno(errno, "Failed to read inotify event: %m");
-        }
+                /* We were the last user of this watch */
+                hashmap_remove(m->path_inotify_wd_specs, INT_TO_PTR(s->wds[i]));
+                set_free(specs);
 
-        FOREACH_INOTIFY_EVENT(e, buffer, l) {
-                if ((s->type == PATH_CHANGED || s->type == PATH_MODIFIED) &&
-                    s->primary_wd == e->wd)
-                        r = 1;
+                (void) inotify_rm_watch(m->path_inotify_fd, s->wds[i]);
         }
 
-        return r;
+        s->wds = mfree(s->wds);
+        s->masks = mfree(s->masks);
+        s->n_wds = 0;
+
+        if (s->in_pending_queue) {
+                LIST_REMOVE(pending, m->path_inotify_pending, s);
+                s->in_pending_queue = false;
+        }
+        s->pending_changed = false;
 }
 
 static bool path_spec_check_good(PathSpec *s, bool initial) {
@@ -242,7 +433,8 @@ static void path_spec_dump(PathSpec *s, FILE *f, const char *prefix) {
 
 void path_spec_done(PathSpec *s) {
         assert(s);
-        assert(s->inotify_fd == -1);
+        assert(!s->wds);
+        assert(!s->in_pending_queue);
 
         free(s->path);
 }
@@ -340,7 +532,7 @@ static int path_load(Unit *u) {
 
         if (u->load_state == UNIT_LOADED) {
 
-                if (set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+                if (!UNIT_TRIGGER(u)) {
                         Unit *x;
 
                         r = unit_load_related_unit(u, ".service", &x);
@@ -656,14 +848,11 @@ _pure_ static const char *path_sub_state_to_string(Unit *u) {
         return path_state_to_string(PATH(u)->state);
 }
 
-static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, void *userdata) {
-        PathSpec *s = userdata;
+static int path_dispatch_io(PathSpec *s, bool changed) {
         Path *p;
-        int changed;
 
         assert(s);
         assert(s->unit);
-        assert(fd >= 0);
 
         p = PATH(s->unit);
 
@@ -673,19 +862,6 @@ static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, v
 
         /* log_debug("inotify wakeup on %s.", u->id); */
 
-        LIST_FOREACH(spec, s, p->specs)
-                if (path_spec_owns_inotify_fd(s, fd))
-                        break;
-
-        if (!s) {
-                log_error("Got event on unknown fd.");
-                goto fail;
-        }
-
-        changed = path_spec_fd_event(s, revents);
-        if (changed < 0)
-                goto fail;
-
         /* If we are already running, then remember that one event was
          * dispatched so that we restart the service only if something
          * actually changed on disk */
@@ -697,10 +873,6 @@ static int path_dispatch_io(sd_event_source *source, int fd, uint32_t revents, v
                 path_enter_waiting(p, false, true);
 
         return 0;
-
-fail:
-        path_enter_dead(p, PATH_FAILURE_RESOURCES);
-        return 0;
 }
 
 static void path_trigger_notify(Unit *u, Unit *other) {
@@ -737,6 +909,17 @@ static void path_reset_failed(Unit *u) {
         p->result = PATH_SUCCESS;
 }
 
+static void path_shutdown(Manager *m) {
+        assert(m);
+
+        /* All specs are gone by now, hence so are all watches */
+        assert(!m->path_inotify_pending);
+        m->path_inotify_wd_specs = hashmap_free(m->path_inotify_wd_specs);
+
+        m->path_inotify_event_source = sd_event_source_unref(m->path_inotify_event_source);
+        m->path_inotify_fd = safe_close(m->path_inotify_fd);
+}
+
 static const char* const path_type_table[_PATH_TYPE_MAX] = {
         [PATH_EXISTS] = "PathExists",
         [PATH_EXISTS_GLOB] = "PathExistsGlob",
@@ -784,5 +967,7 @@ const UnitVTable path_vtable = {
 
         .reset_failed = path_reset_failed,
 
+        .shutdown = path_shutdown,
+
         .bus_vtable = bus_path_vtable
 };
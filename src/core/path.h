@@ -34,31 +34,41 @@ typedef enum PathType {
         _PATH_TYPE_INVALID = -1
 } PathType;
 
+/* Called with changed set if the watched path itself was written to (for PATH_CHANGED and PATH_MODIFIED),
+ * or with changed unset if something else happened that requires a recheck. */
+typedef int (*path_spec_handler_t)(PathSpec *s, bool changed);
+
 typedef struct PathSpec {
         Unit *unit;
 
         char *path;
 
-        sd_event_source *event_source;
-
         LIST_FIELDS(struct PathSpec, spec);
 
         PathType type;
-        int inotify_fd;
         int primary_wd;
 
+        /* The watches this spec holds on the manager's shared inotify fd, and the events we are interested
+         * in on each. Watches on the same inode are shared with other specs, hence their kernel-side mask
+         * might be wider than ours. */
+        int *wds;
+        uint32_t *masks;
+        size_t n_wds;
+
+        path_spec_handler_t handler;
+
+        /* Set if events were read for this spec that the handler still needs to see */
+        LIST_FIELDS(struct PathSpec, pending);
+        bool in_pending_queue;
+        bool pending_changed;
+
         bool previous_exists;
 } PathSpec;
 
-int path_spec_watch(PathSpec *s, sd_event_io_handler_t handler);
+int path_spec_watch(PathSpec *s, path_spec_handler_t handler);
 void path_spec_unwatch(PathSpec *s);
-int path_spec_fd_event(PathSpec *s, uint32_t events);
 void path_spec_done(PathSpec *s);
 
-static inline bool path_spec_owns_inotify_fd(PathSpec *s, int fd) {
-        return s->inotify_fd == fd;
-}
-
 typedef enum PathResult {
         PATH_SUCCESS,
         PATH_FAILURE_RESOURCES,
@@ -0,0 +1,856 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alloc-util.h"
+#include "escape.h"
+#include "fileio.h"
+#include "parse-util.h"
+#include "serialize.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "unaligned.h"
+
+/* The binary format starts with a NUL byte, which never starts the text format */
+#define SERIALIZE_MAGIC "\0SDSTATE"
+#define SERIALIZE_MAGIC_SIZE 8
+#define SERIALIZE_VERSION 1U
+
+/* All integers are little endian, all strings are prefixed by their length and followed by a NUL byte.
+ * Items refer to their key by the index of the SERIALIZE_RECORD_KEY record that defined it. */
+typedef enum SerializeRecord {
+        SERIALIZE_RECORD_KEY = 1,       /* string key */
+        SERIALIZE_RECORD_STRING,        /* uint32 key index, string value */
+        SERIALIZE_RECORD_BOOLEAN,       /* uint32 key index, uint8 value */
+        SERIALIZE_RECORD_UINT64,        /* uint32 key index, uint64 value */
+        SERIALIZE_RECORD_TIMESTAMP,     /* uint32 key index, uint64 realtime, uint64 monotonic */
+        SERIALIZE_RECORD_FD,            /* uint32 key index, int32 fd */
+        SERIALIZE_RECORD_SECTION,       /* string name */
+        SERIALIZE_RECORD_END,
+} SerializeRecord;
+
+struct Serializer {
+        Hashmap *keys;
+        unsigned n_keys;
+};
+
+typedef struct DeserializerKey {
+        const char *key;
+
+        /* The result of the last deserializer_lookup_key() call for this key */
+        int (*lookup)(const char *key);
+        int value;
+} DeserializerKey;
+
+struct Deserializer {
+        FILE *f;
+        bool binary;
+
+        /* Text format */
+        char line[LINE_MAX];
+
+        /* Binary format */
+        void *map;
+        size_t map_size;
+        char *buffer;
+        const uint8_t *p, *end;
+
+        DeserializerKey *keys;
+        size_t n_keys, n_allocated;
+};
+
+int serializer_new(Serializer **ret) {
+        Serializer *s;
+
+        assert(ret);
+
+        s = new0(Serializer, 1);
+        if (!s)
+                return -ENOMEM;
+
+        s->keys = hashmap_new(&string_hash_ops);
+        if (!s->keys) {
+                free(s);
+                return -ENOMEM;
+        }
+
+        *ret = s;
+        return 0;
+}
+
+Serializer* serializer_free(Serializer *s) {
+        char *k;
+
+        if (!s)
+                return NULL;
+
+        while ((k = hashmap_steal_first_key(s->keys)))
+                free(k);
+
+        hashmap_free(s->keys);
+
+        return mfree(s);
+}
+
+static void write_uint32(FILE *f, uint32_t u) {
+        uint8_t b[4];
+
+        unaligned_write_le32(b, u);
+        fwrite(b, 1, sizeof(b), f);
+}
+
+static void write_uint64(FILE *f, uint64_t u) {
+        uint8_t b[8];
+
+        unaligned_write_le64(b, u);
+        fwrite(b, 1, sizeof(b), f);
+}
+
+static void write_string(FILE *f, const char *s) {
+        size_t l;
+
+        l = strlen(s);
+        write_uint32(f, l);
+        fwrite(s, 1, l + 1, f);
+}
+
+static int serializer_write_key(Serializer *s, FILE *f, SerializeRecord record, const char *key) {
+        _cleanup_free_ char *k = NULL;
+        unsigned id;
+        void *p;
+        int r;
+
+        assert(s);
+        assert(f);
+        assert(key);
+
+        /* Writes the record type and the key index, and defines the key first if this is the first
+         * time it is used */
+
+        p = hashmap_get(s->keys, key);
+        if (p)
+                id = PTR_TO_UINT(p) - 1;
+        else {
+                k = strdup(key);
+                if (!k)
+                        return -ENOMEM;
+
+                id = s->n_keys;
+
+                r = hashmap_put(s->keys, k, UINT_TO_PTR(id + 1));
+                if (r < 0)
+                        return r;
+                k = NULL;
+
+                s->n_keys++;
+
+                fputc(SERIALIZE_RECORD_KEY, f);
+                write_string(f, key);
+        }
+
+        fputc(record, f);
+        write_uint32(f, id);
+
+        return 0;
+}
+
+int serialize_header(Serializer *s, FILE *f) {
+        assert(f);
+
+        if (!s)
+                return 0;
+
+        fwrite(SERIALIZE_MAGIC, 1, SERIALIZE_MAGIC_SIZE, f);
+        write_uint32(f, SERIALIZE_VERSION);
+
+        return 0;
+}
+
+int serialize_item(Serializer *s, FILE *f, const char *key, const char *value) {
+        int r;
+
+        assert(f);
+        assert(key);
+
+        if (!value)
+                return 0;
+
+        if (!s) {
+                fputs(key, f);
+                fputc('=', f);
+                fputs(value, f);
+                fputc('\n', f);
+
+                return 1;
+        }
+
+        r = serializer_write_key(s, f, SERIALIZE_RECORD_STRING, key);
+        if (r < 0)
+                return r;
+
+        write_string(f, value);
+
+        return 1;
+}
+
+int serialize_item_escaped(Serializer *s, FILE *f, const char *key, const char *value) {
+        _cleanup_free_ char *c = NULL;
+
+        assert(f);
+        assert(key);
+
+        if (!value)
+                return 0;
+
+        c = cescape(value);
+        if (!c)
+                return -ENOMEM;
+
+        return serialize_item(s, f, key, c);
+}
+
+int serialize_item_format(Serializer *s, FILE *f, const char *key, const char *format, ...) {
+        _cleanup_free_ char *v = NULL;
+        va_list ap;
+        int r;
+
+        assert(f);
+        assert(key);
+        assert(format);
+
+        if (!s) {
+                fputs(key, f);
+                fputc('=', f);
+
+                va_start(ap, format);
+                vfprintf(f, format, ap);
+                va_end(ap);
+
+                fputc('\n', f);
+
+                return 1;
+        }
+
+        va_start(ap, format);
+        r = vasprintf(&v, format, ap);
+        va_end(ap);
+        if (r < 0)
+                return -ENOMEM;
+
+        return serialize_item(s, f, key, v);
+}
+
+int serialize_item_boolean(Serializer *s, FILE *f, const char *key, bool b) {
+        int r;
+
+        assert(f);
+        assert(key);
+
+        if (!s)
+                return serialize_item(s, f, key, yes_no(b));
+
+        r = serializer_write_key(s, f, SERIALIZE_RECORD_BOOLEAN, key);
+        if (r < 0)
+                return r;
+
+        fputc(!!b, f);
+
+        return 1;
+}
+
+int serialize_item_uint64(Serializer *s, FILE *f, const char *key, uint64_t u) {
+        int r;
+
+        assert(f);
+        assert(key);
+
+        if (!s)
+                return serialize_item_format(s, f, key, "%" PRIu64, u);
+
+        r = serializer_write_key(s, f, SERIALIZE_RECORD_UINT64, key);
+        if (r < 0)
+                return r;
+
+        write_uint64(f, u);
+
+        return 1;
+}
+
+int serialize_item_fd(Serializer *s, FILE *f, const char *key, int fd) {
+        int r;
+
+        assert(f);
+        assert(key);
+
+        if (fd < 0)
+                return 0;
+
+        if (!s)
+                return serialize_item_format(s, f, key, "%i", fd);
+
+        r = serializer_write_key(s, f, SERIALIZE_RECORD_FD, key);
+        if (r < 0)
+                return r;
+
+        write_uint32(f, (uint32_t) fd);
+
+        return 1;
+}
+
+int serialize_dual_timestamp(Serializer *s, FILE *f, const char *key, dual_timestamp *t) {
+        int r;
+
+        assert(f);
+        assert(key);
+        assert(t);
+
+        if (!dual_timestamp_is_set(t))
+                return 0;
+
+        if (!s)
+                return serialize_item_format(s, f, key, USEC_FMT " " USEC_FMT, t->realtime, t->monotonic);
+
+        r = serializer_write_key(s, f, SERIALIZE_RECORD_TIMESTAMP, key);
+        if (r < 0)
+                return r;
+
+        write_uint64(f, t->realtime);
+        write_uint64(f, t->monotonic);
+
+        return 1;
+}
+
+int serialize_section(Serializer *s, FILE *f, const char *name) {
+        assert(f);
+        assert(name);
+
+        if (!s) {
+                fputs(name, f);
+                fputc('\n', f);
+                return 0;
+        }
+
+        fputc(SERIALIZE_RECORD_SECTION, f);
+        write_string(f, name);
+
+        return 0;
+}
+
+int serialize_end(Serializer *s, FILE *f) {
+        assert(f);
+
+        fputc(s ? SERIALIZE_RECORD_END : '\n', f);
+
+        return 0;
+}
+
+static int deserializer_read_uint8(Deserializer *d, uint8_t *ret) {
+        if (d->p >= d->end)
+                return -EBADMSG;
+
+        *ret = *(d->p++);
+        return 0;
+}
+
+static int deserializer_read_uint32(Deserializer *d, uint32_t *ret) {
+        if ((size_t) (d->end - d->p) < 4)
+                return -EBADMSG;
+
+        *ret = unaligned_read_le32(d->p);
+        d->p += 4;
+        return 0;
+}
+
+static int deserializer_read_uint64(Deserializer *d, uint64_t *ret) {
+        if ((size_t) (d->end - d->p) < 8)
+                return -EBADMSG;
+
+        *ret = unaligned_read_le64(d->p);
+        d->p += 8;
+        return 0;
+}
+
+static int deserializer_read_string(Deserializer *d, const char **ret) {
+        const char *s;
+        uint32_t l;
+        int r;
+
+        r = deserializer_read_uint32(d, &l);
+        if (r < 0)
+                return r;
+
+        if ((size_t) (d->end - d->p) <= l)
+                return -EBADMSG;
+
+        /* The string is used in place, hence verify it is properly terminated */
+        s = (const char*) d->p;
+        if (s[l] != 0 || strnlen(s, l) != l)
+                return -EBADMSG;
+
+        d->p += l + 1;
+
+        *ret = s;
+        return 0;
+}
+
+static int deserializer_open_binary(Deserializer *d) {
+        struct stat st;
+        size_t size;
+        off_t offset;
+        int r;
+
+        assert(d);
+
+        /* The first byte of the magic has been read already. Try to map the rest of the file, and read it
+         * into memory if that is not possible. */
+
+        offset = ftello(d->f);
+        if (offset >= 0 &&
+            fstat(fileno(d->f), &st) >= 0 &&
+            S_ISREG(st.st_mode) &&
+            st.st_size > offset &&
+            (uint64_t) st.st_size <= SIZE_MAX) {
+                void *map;
+
+                map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(d->f), 0);
+                if (map != MAP_FAILED) {
+                        d->map = map;
+                        d->map_size = st.st_size;
+                        d->p = (const uint8_t*) map + offset;
+                        d->end = (const uint8_t*) map + st.st_size;
+                }
+        }
+
+        if (!d->map) {
+                r = read_full_stream(d->f, &d->buffer, &size);
+                if (r < 0)
+                        return r;
+
+                d->p = (const uint8_t*) d->buffer;
+                d->end = d->p + size;
+        }
+
+        if ((size_t) (d->end - d->p) < SERIALIZE_MAGIC_SIZE - 1 + 4 ||
+            memcmp(d->p, SERIALIZE_MAGIC + 1, SERIALIZE_MAGIC_SIZE - 1) != 0)
+                return -EBADMSG;
+
+        d->p += SERIALIZE_MAGIC_SIZE - 1;
+
+        if (unaligned_read_le32(d->p) != SERIALIZE_VERSION)
+                return -EPROTONOSUPPORT;
+
+        d->p += 4;
+
+        return 0;
+}
+
+int deserializer_new(FILE *f, Deserializer **ret) {
+        _cleanup_(deserializer_freep) Deserializer *d = NULL;
+        int c, r;
+
+        assert(f);
+        assert(ret);
+
+        d = new0(Deserializer, 1);
+        if (!d)
+                return -ENOMEM;
+
+        d->f = f;
+
+        c = getc(f);
+        if (c == 0) {
+                d->binary = true;
+
+                r = deserializer_open_binary(d);
+                if (r < 0)
+                        return r;
+        } else if (c != EOF)
+                (void) ungetc(c, f);
+
+        *ret = d;
+        d = NULL;
+
+        return 0;
+}
+
+Deserializer* deserializer_free(Deserializer *d) {
+        if (!d)
+                return NULL;
+
+        if (d->map)
+                (void) munmap(d->map, d->map_size);
+
+        free(d->buffer);
+        free(d->keys);
+
+        return mfree(d);
+}
+
+bool deserializer_is_binary(Deserializer *d) {
+        assert(d);
+
+        return d->binary;
+}
+
+static int deserializer_read_line(Deserializer *d, char **ret) {
+        assert(d);
+        assert(ret);
+
+        if (!fgets(d->line, sizeof(d->line), d->f)) {
+                if (ferror(d->f))
+                        return errno > 0 ? -errno : -EIO;
+
+                return 0;
+        }
+
+        char_array_0(d->line);
+        *ret = strstrip(d->line);
+
+        return 1;
+}
+
+static int deserializer_define_key(Deserializer *d) {
+        const char *key;
+        int r;
+
+        r = deserializer_read_string(d, &key);
+        if (r < 0)
+                return r;
+
+        if (!GREEDY_REALLOC(d->keys, d->n_allocated, d->n_keys + 1))
+                return -ENOMEM;
+
+        d->keys[d->n_keys++] = (DeserializerKey) {
+                .key = key,
+        };
+
+        return 0;
+}
+
+int deserializer_read_section(Deserializer *d, const char **ret) {
+        uint8_t record;
+        char *l;
+        int r;
+
+        assert(d);
+        assert(ret);
+
+        /* Returns > 0 and the name of the next section, or 0 at the end of the serialization */
+
+        if (!d->binary) {
+                r = deserializer_read_line(d, &l);
+                if (r <= 0)
+                        return r;
+
+                *ret = l;
+                return 1;
+        }
+
+        for (;;) {
+                if (d->p >= d->end)
+                        return 0;
+
+                r = deserializer_read_uint8(d, &record);
+                if (r < 0)
+                        return r;
+
+                if (record == SERIALIZE_RECORD_KEY) {
+                        r = deserializer_define_key(d);
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                if (record != SERIALIZE_RECORD_SECTION)
+                        return -EBADMSG;
+
+                r = deserializer_read_string(d, ret);
+                if (r < 0)
+                        return r;
+
+                return 1;
+        }
+}
+
+static int deserializer_read_binary_item(Deserializer *d, uint8_t record, SerializedItem *i) {
+        uint32_t id, u;
+        uint8_t b;
+        int r;
+
+        r = deserializer_read_uint32(d, &id);
+        if (r < 0)
+                return r;
+
+        if (id >= d->n_keys)
+                return -EBADMSG;
+
+        i->key_id = id;
+        i->key = d->keys[id].key;
+
+        switch (record) {
+
+        case SERIALIZE_RECORD_STRING:
+                i->type = SERIALIZED_STRING;
+                return deserializer_read_string(d, &i->value);
+
+        case SERIALIZE_RECORD_BOOLEAN:
+                r = deserializer_read_uint8(d, &b);
+                if (r < 0)
+                        return r;
+
+                i->type = SERIALIZED_BOOLEAN;
+                i->boolean = b;
+                return 0;
+
+        case SERIALIZE_RECORD_UINT64:
+                i->type = SERIALIZED_UINT64;
+                return deserializer_read_uint64(d, &i->uint64);
+
+        case SERIALIZE_RECORD_TIMESTAMP:
+                r = deserializer_read_uint64(d, &i->timestamp.realtime);
+                if (r < 0)
+                        return r;
+
+                i->type = SERIALIZED_TIMESTAMP;
+                return deserializer_read_uint64(d, &i->timestamp.monotonic);
+
+        case SERIALIZE_RECORD_FD:
+                r = deserializer_read_uint32(d, &u);
+                if (r < 0)
+                        return r;
+
+                i->type = SERIALIZED_FD;
+                i->fd = (int) u;
+                return 0;
+
+        default:
+                return -EBADMSG;
+        }
+}
+
+int deserializer_read_item(Deserializer *d, SerializedItem *ret) {
+        uint8_t record;
+        char *l, *v;
+        size_t k;
+        int r;
+
+        assert(d);
+        assert(ret);
+
+        /* Returns > 0 and the next item, or 0 at the end of the current section */
+
+        *ret = (SerializedItem) {
+                .key_id = UINT_MAX,
+                .type = _SERIALIZED_TYPE_INVALID,
+        };
+
+        if (!d->binary) {
+                r = deserializer_read_line(d, &l);
+                if (r <= 0)
+                        return r;
+
+                /* End marker */
+                if (l[0] == 0)
+                        return 0;
+
+                k = strcspn(l, "=");
+
+                if (l[k] == '=') {
+                        l[k] = 0;
+                        v = l+k+1;
+                } else
+                        v = l+k;
+
+                ret->key = l;
+                ret->type = SERIALIZED_STRING;
+                ret->value = v;
+
+                return 1;
+        }
+
+        for (;;) {
+                if (d->p >= d->end)
+                        return 0;
+
+                r = deserializer_read_uint8(d, &record);
+                if (r < 0)
+                        return r;
+
+                switch (record) {
+
+                case SERIALIZE_RECORD_KEY:
+                        r = deserializer_define_key(d);
+                        if (r < 0)
+                                return r;
+
+                        break;
+
+                case SERIALIZE_RECORD_END:
+                        return 0;
+
+                case SERIALIZE_RECORD_STRING:
+                case SERIALIZE_RECORD_BOOLEAN:
+                case SERIALIZE_RECORD_UINT64:
+                case SERIALIZE_RECORD_TIMESTAMP:
+                case SERIALIZE_RECORD_FD:
+                        r = deserializer_read_binary_item(d, record, ret);
+                        if (r < 0)
+                                return r;
+
+                        return 1;
+
+                default:
+                        return -EBADMSG;
+                }
+        }
+}
+
+int deserializer_lookup_key(Deserializer *d, const SerializedItem *i, int (*lookup)(const char *key)) {
+        DeserializerKey *k;
+
+        assert(d);
+        assert(i);
+        assert(lookup);
+
+        /* Resolves the key of an item through the specified lookup function. In the binary format the
+         * result is remembered per key, hence the lookup is done only once for every distinct key. */
+
+        if (i->key_id >= d->n_keys)
+                return lookup(i->key);
+
+        k = d->keys + i->key_id;
+        if (k->lookup != lookup) {
+                k->value = lookup(k->key);
+                k->lookup = lookup;
+        }
+
+        return k->value;
+}
+
+const char* serialized_item_string(SerializedItem *i) {
+        assert(i);
+
+        if (i->value)
+                return i->value;
+
+        switch (i->type) {
+
+        case SERIALIZED_BOOLEAN:
+                i->value = yes_no(i->boolean);
+                break;
+
+        case SERIALIZED_UINT64:
+                xsprintf(i->buffer, "%" PRIu64, i->uint64);
+                i->value = i->buffer;
+                break;
+
+        case SERIALIZED_TIMESTAMP:
+                xsprintf(i->buffer, USEC_FMT " " USEC_FMT, i->timestamp.realtime, i->timestamp.monotonic);
+                i->value = i->buffer;
+                break;
+
+        case SERIALIZED_FD:
+                xsprintf(i->buffer, "%i", i->fd);
+                i->value = i->buffer;
+                break;
+
+        default:
+                i->value = "";
+        }
+
+        return i->value;
+}
+
+int serialized_item_get_boolean(const SerializedItem *i, bool *ret) {
+        int r;
+
+        assert(i);
+        assert(ret);
+
+        if (i->type == SERIALIZED_BOOLEAN) {
+                *ret = i->boolean;
+                return 0;
+        }
+
+        if (i->type != SERIALIZED_STRING)
+                return -EINVAL;
+
+        r = parse_boolean(i->value);
+        if (r < 0)
+                return r;
+
+        *ret = r;
+        return 0;
+}
+
+int serialized_item_get_uint64(const SerializedItem *i, uint64_t *ret) {
+        assert(i);
+        assert(ret);
+
+        if (i->type == SERIALIZED_UINT64) {
+                *ret = i->uint64;
+                return 0;
+        }
+
+        if (i->type != SERIALIZED_STRING)
+                return -EINVAL;
+
+        return safe_atou64(i->value, ret);
+}
+
+int serialized_item_get_timestamp(const SerializedItem *i, dual_timestamp *ret) {
+        assert(i);
+        assert(ret);
+
+        if (i->type == SERIALIZED_TIMESTAMP) {
+                *ret = i->timestamp;
+                return 0;
+        }
+
+        if (i->type != SERIALIZED_STRING)
+                return -EINVAL;
+
+        return dual_timestamp_deserialize(i->value, ret);
+}
+
+int serialized_item_get_fd(const SerializedItem *i, int *ret) {
+        int fd, r;
+
+        assert(i);
+        assert(ret);
+
+        if (i->type == SERIALIZED_FD)
+                fd = i->fd;
+        else if (i->type == SERIALIZED_STRING) {
+                r = safe_atoi(i->value, &fd);
+                if (r < 0)
+                        return r;
+        } else
+                return -EINVAL;
+
+        if (fd < 0)
+                return -EBADF;
+
+        *ret = fd;
+        return 0;
+}
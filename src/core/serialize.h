@@ -0,0 +1,95 @@
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hashmap.h"
+#include "macro.h"
+#include "time-util.h"
+
+/* The state serialization used across daemon-reload and daemon-reexec. It comes in two formats: the
+ * traditional text format of "key=value" lines, sections separated by empty lines, and a binary format
+ * of type-tagged records, in which each key is spelled out only once and referred to by its index
+ * afterwards. The binary format is read from a memory map of the serialization file, and the strings
+ * in it are NUL terminated, so that they may be handed out without copying. Both formats are read
+ * through the same Deserializer, which detects the format from the first byte. */
+
+typedef struct Serializer Serializer;
+typedef struct Deserializer Deserializer;
+
+typedef enum SerializedType {
+        SERIALIZED_STRING,
+        SERIALIZED_BOOLEAN,
+        SERIALIZED_UINT64,
+        SERIALIZED_TIMESTAMP,
+        SERIALIZED_FD,
+        _SERIALIZED_TYPE_MAX,
+        _SERIALIZED_TYPE_INVALID = -1,
+} SerializedType;
+
+typedef struct SerializedItem {
+        unsigned key_id;
+        const char *key;
+
+        SerializedType type;
+        union {
+                bool boolean;
+                uint64_t uint64;
+                dual_timestamp timestamp;
+                int fd;
+        };
+
+        /* Always valid for SERIALIZED_STRING, formatted on demand for all other types */
+        const char *value;
+        char buffer[DECIMAL_STR_MAX(uint64_t) * 2 + 1];
+} SerializedItem;
+
+int serializer_new(Serializer **ret);
+Serializer* serializer_free(Serializer *s);
+DEFINE_TRIVIAL_CLEANUP_FUNC(Serializer*, serializer_free);
+
+/* All serialize_*() calls write the text format if s is NULL */
+int serialize_header(Serializer *s, FILE *f);
+int serialize_item(Serializer *s, FILE *f, const char *key, const char *value);
+int serialize_item_escaped(Serializer *s, FILE *f, const char *key, const char *value);
+int serialize_item_format(Serializer *s, FILE *f, const char *key, const char *format, ...) _printf_(4,5);
+int serialize_item_boolean(Serializer *s, FILE *f, const char *key, bool b);
+int serialize_item_uint64(Serializer *s, FILE *f, const char *key, uint64_t u);
+int serialize_item_fd(Serializer *s, FILE *f, const char *key, int fd);
+int serialize_dual_timestamp(Serializer *s, FILE *f, const char *key, dual_timestamp *t);
+int serialize_section(Serializer *s, FILE *f, const char *name);
+int serialize_end(Serializer *s, FILE *f);
+
+int deserializer_new(FILE *f, Deserializer **ret);
+Deserializer* deserializer_free(Deserializer *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(Deserializer*, deserializer_free);
+
+bool deserializer_is_binary(Deserializer *d);
+
+int deserializer_read_section(Deserializer *d, const char **ret);
+int deserializer_read_item(Deserializer *d, SerializedItem *ret);
+int deserializer_lookup_key(Deserializer *d, const SerializedItem *i, int (*lookup)(const char *key));
+
+const char* serialized_item_string(SerializedItem *i);
+int serialized_item_get_boolean(const SerializedItem *i, bool *ret);
+int serialized_item_get_uint64(const SerializedItem *i, uint64_t *ret);
+int serialized_item_get_timestamp(const SerializedItem *i, dual_timestamp *ret);
+int serialized_item_get_fd(const SerializedItem *i, int *ret);
@@ -147,6 +147,115 @@ void socket_free_ports(Socket *s) {
         }
 }
 
+static int socket_fill_service_pool(Socket *s) {
+        _cleanup_free_ char *prefix = NULL;
+        int r;
+
+        assert(s);
+
+        if (!s->service_pool) {
+                s->service_pool = new0(UnitRef, s->accept_pool_size);
+                if (!s->service_pool)
+                        return -ENOMEM;
+        }
+
+        r = unit_name_to_prefix(UNIT(s)->id, &prefix);
+        if (r < 0)
+                return r;
+
+        while (s->n_service_pool < s->accept_pool_size) {
+                _cleanup_free_ char *name = NULL;
+                unsigned nr;
+                Unit *u;
+
+                /* The pool is handed out in order, and instances are
+                 * numbered after the connection they are spawned for,
+                 * hence continue after the ones loaded already. */
+                nr = s->n_accepted + (UNIT_ISSET(s->service) ? 1 : 0) + s->n_service_pool;
+
+                if (asprintf(&name, "%s@%u.service", prefix, nr) < 0)
+                        return -ENOMEM;
+
+                r = manager_load_unit(UNIT(s)->manager, name, NULL, NULL, &u);
+                if (r < 0)
+                        return r;
+
+                r = unit_add_two_dependencies(UNIT(s), UNIT_BEFORE, UNIT_TRIGGERS, u, false);
+                if (r < 0)
+                        return r;
+
+                unit_ref_set(&s->service_pool[(s->service_pool_head + s->n_service_pool) % s->accept_pool_size], u);
+                s->n_service_pool++;
+        }
+
+        return 0;
+}
+
+static int socket_dispatch_service_pool(sd_event_source *source, void *userdata) {
+        Socket *s = SOCKET(userdata);
+        int r;
+
+        assert(s);
+
+        if (s->state != SOCKET_LISTENING)
+                return 0;
+
+        r = socket_fill_service_pool(s);
+        if (r < 0)
+                log_unit_warning_errno(UNIT(s), r, "Failed to load service instances ahead of time, ignoring: %m");
+
+        return 0;
+}
+
+static void socket_fill_service_pool_later(Socket *s) {
+        int r;
+
+        assert(s);
+
+        if (!s->accept || s->accept_pool_size <= 0)
+                return;
+
+        if (s->n_service_pool >= s->accept_pool_size)
+                return;
+
+        /* Refill the pool only once everything else is done, in
+         * particular after the run queue (which has idle priority)
+         * started the services the pool was drained for. */
+
+        if (s->service_pool_event_source) {
+                r = sd_event_source_set_enabled(s->service_pool_event_source, SD_EVENT_ONESHOT);
+                if (r < 0)
+                        log_unit_warning_errno(UNIT(s), r, "Failed to enable service pool event source, ignoring: %m");
+                return;
+        }
+
+        r = sd_event_add_defer(UNIT(s)->manager->event, &s->service_pool_event_source, socket_dispatch_service_pool, s);
+        if (r < 0) {
+                log_unit_warning_errno(UNIT(s), r, "Failed to add service pool event source, ignoring: %m");
+                return;
+        }
+
+        (void) sd_event_source_set_priority(s->service_pool_event_source, SD_EVENT_PRIORITY_IDLE+1);
+        (void) sd_event_source_set_description(s->service_pool_event_source, "socket-service-pool");
+}
+
+static void socket_release_service_pool(Socket *s) {
+        unsigned i;
+
+        assert(s);
+
+        /* Forget about the instances loaded ahead of time, so that
+         * they can be garbage collected */
+
+        for (i = 0; i < s->n_service_pool; i++)
+                unit_ref_unset(s->service_pool + (s->service_pool_head + i) % s->accept_pool_size);
+
+        s->service_pool_head = s->n_service_pool = 0;
+
+        if (s->service_pool_event_source)
+                (void) sd_event_source_set_enabled(s->service_pool_event_source, SD_EVENT_OFF);
+}
+
 static void socket_done(Unit *u) {
         Socket *s = SOCKET(u);
         SocketPeer *p;
@@ -170,6 +279,10 @@ static void socket_done(Unit *u) {
 
         unit_ref_unset(&s->service);
 
+        socket_release_service_pool(s);
+        s->service_pool = mfree(s->service_pool);
+        s->service_pool_event_source = sd_event_source_unref(s->service_pool_event_source);
+
         s->tcp_congestion = mfree(s->tcp_congestion);
         s->bind_to_device = mfree(s->bind_to_device);
 
@@ -235,6 +348,22 @@ int socket_instantiate_service(Socket *s) {
         if (!s->accept)
                 return 0;
 
+        /* Take the oldest instance from the pool, if there's any */
+        while (s->n_service_pool > 0) {
+                UnitRef *ref = s->service_pool + s->service_pool_head;
+
+                s->service_pool_head = (s->service_pool_head + 1) % s->accept_pool_size;
+                s->n_service_pool--;
+
+                u = UNIT_DEREF(*ref);
+                if (!u)
+                        continue;
+
+                unit_ref_set(&s->service, u);
+                unit_ref_unset(ref);
+                return 0;
+        }
+
         r = unit_name_to_prefix(UNIT(s)->id, &prefix);
         if (r < 0)
                 return r;
@@ -463,6 +592,16 @@ static int socket_verify(Socket *s) {
                 return -EINVAL;
         }
 
+        if (s->accept_pool_size > 0 && !s->accept) {
+                log_unit_error(UNIT(s), "AcceptPoolSize= requires Accept=yes. Refusing.");
+                return -EINVAL;
+        }
+
+        if (s->accept_pool_size > s->max_connections) {
+                log_unit_error(UNIT(s), "AcceptPoolSize= setting larger than MaxConnections=. Refusing.");
+                return -EINVAL;
+        }
+
         if (s->accept && UNIT_DEREF(s->service)) {
                 log_unit_error(UNIT(s), "Explicit service configuration for accepting socket units not supported. Refusing.");
                 return -EINVAL;
@@ -717,6 +856,13 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                         prefix, s->n_connections,
                         prefix, s->max_connections);
 
+        if (s->accept_pool_size > 0)
+                fprintf(f,
+                        "%sAcceptPoolSize: %u\n"
+                        "%sNServicePool: %u\n",
+                        prefix, s->accept_pool_size,
+                        prefix, s->n_service_pool);
+
         if (s->priority >= 0)
                 fprintf(f,
                         "%sPriority: %i\n",
@@ -1670,8 +1816,11 @@ static void socket_set_state(Socket *s, SocketState state) {
                 s->control_command_id = _SOCKET_EXEC_COMMAND_INVALID;
         }
 
-        if (state != SOCKET_LISTENING)
+        if (state != SOCKET_LISTENING) {
                 socket_unwatch_fds(s);
+                socket_release_service_pool(s);
+        } else
+                socket_fill_service_pool_later(s);
 
         if (!IN_SET(state,
                     SOCKET_START_CHOWN,
@@ -2171,7 +2320,7 @@ static void socket_enter_running(Socket *s, int cfd) {
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                SET_FOREACH(other, UNIT(s)->dependencies[UNIT_TRIGGERS], i)
+                UNIT_FOREACH_DEPENDENCY(other, UNIT(s), UNIT_TRIGGERS, i)
                         if (unit_active_or_pending(other)) {
                                 pending = true;
                                 break;
@@ -2272,6 +2421,8 @@ static void socket_enter_running(Socket *s, int cfd) {
                         goto fail;
                 }
 
+                socket_fill_service_pool_later(s);
+
                 /* Notify clients about changed counters */
                 unit_add_to_dbus_queue(UNIT(s));
         }
@@ -86,6 +86,7 @@ struct Socket {
         unsigned n_connections;
         unsigned max_connections;
         unsigned max_connections_per_source;
+        unsigned accept_pool_size;
 
         unsigned backlog;
         unsigned keep_alive_cnt;
@@ -107,6 +108,13 @@ struct Socket {
         when the next service we spawn. */
         UnitRef service;
 
+        /* For Accept=yes sockets with AcceptPoolSize= set, the
+        services we spawn after that one, loaded ahead of time. A ring
+        of accept_pool_size entries, n_service_pool of them used. */
+        UnitRef *service_pool;
+        unsigned service_pool_head, n_service_pool;
+        sd_event_source *service_pool_event_source;
+
         SocketState state, deserialized_state;
 
         sd_event_source *timer_event_source;
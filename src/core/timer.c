@@ -24,7 +24,9 @@
 #include "bus-util.h"
 #include "dbus-timer.h"
 #include "fs-util.h"
+#include "hashmap.h"
 #include "parse-util.h"
+#include "prioq.h"
 #include "random-util.h"
 #include "special.h"
 #include "string-table.h"
@@ -43,7 +45,324 @@ static const UnitActiveState state_translation_table[_TIMER_STATE_MAX] = {
         [TIMER_FAILED] = UNIT_FAILED
 };
 
+/* Realtime timers with the same clock and accuracy are kept in one priority queue, ordered by their next
+ * elapse, and share a single event source that is armed for the earliest of them. */
+struct TimerQueue {
+        Manager *manager;
+
+        clockid_t clock;
+        usec_t accuracy;
+
+        Prioq *timers;
+        sd_event_source *event_source;
+};
+
 static int timer_dispatch(sd_event_source *s, uint64_t usec, void *userdata);
+static int timer_dispatch_monotonic(sd_event_source *s, uint64_t usec, void *userdata);
+
+static void timer_queue_hash_func(const void *p, struct siphash *state) {
+        const TimerQueue *q = p;
+
+        siphash24_compress(&q->clock, sizeof(q->clock), state);
+        siphash24_compress(&q->accuracy, sizeof(q->accuracy), state);
+}
+
+static int timer_queue_compare_func(const void *a, const void *b) {
+        const TimerQueue *x = a, *y = b;
+
+        if (x->clock != y->clock)
+                return x->clock < y->clock ? -1 : 1;
+
+        if (x->accuracy != y->accuracy)
+                return x->accuracy < y->accuracy ? -1 : 1;
+
+        return 0;
+}
+
+static const struct hash_ops timer_queue_hash_ops = {
+        .hash = timer_queue_hash_func,
+        .compare = timer_queue_compare_func,
+};
+
+static int timer_realtime_compare(const void *a, const void *b) {
+        const Timer *x = a, *y = b;
+
+        if (x->next_elapse_realtime < y->next_elapse_realtime)
+                return -1;
+        if (x->next_elapse_realtime > y->next_elapse_realtime)
+                return 1;
+
+        return 0;
+}
+
+TimerCalendar* timer_calendar_unref(TimerCalendar *c) {
+        if (!c)
+                return NULL;
+
+        assert(c->n_ref > 0);
+        c->n_ref--;
+
+        if (c->n_ref > 0)
+                return NULL;
+
+        hashmap_remove(c->manager->timer_calendars, c->spec);
+        free(c->spec);
+        free(c->zone[0]);
+        free(c->zone[1]);
+        return mfree(c);
+}
+
+int timer_calendar_ref(Manager *m, const CalendarSpec *spec, TimerCalendar **ret) {
+        _cleanup_free_ char *s = NULL;
+        TimerCalendar *c;
+        int r;
+
+        assert(m);
+        assert(spec);
+        assert(ret);
+
+        r = calendar_spec_to_string(spec, &s);
+        if (r < 0)
+                return r;
+
+        c = hashmap_get(m->timer_calendars, s);
+        if (c) {
+                c->n_ref++;
+                *ret = c;
+                return 0;
+        }
+
+        r = hashmap_ensure_allocated(&m->timer_calendars, &string_hash_ops);
+        if (r < 0)
+                return r;
+
+        c = new0(TimerCalendar, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->manager = m;
+        c->n_ref = 1;
+        c->spec = s;
+
+        r = hashmap_put(m->timer_calendars, c->spec, c);
+        if (r < 0) {
+                free(c);
+                return r;
+        }
+
+        s = NULL;
+        *ret = c;
+        return 0;
+}
+
+void timer_calendar_flush(TimerCalendar *c) {
+        if (!c)
+                return;
+
+        c->from = c->next = 0;
+}
+
+static bool timer_calendar_zone_changed(TimerCalendar *c, const CalendarSpec *spec) {
+        assert(c);
+        assert(spec);
+
+        if (spec->utc)
+                return false;
+
+        /* mktime() picks up changes of $TZ and /etc/localtime, so must we */
+        tzset();
+
+        return !streq_ptr(c->zone[0], tzname[0]) ||
+                !streq_ptr(c->zone[1], tzname[1]);
+}
+
+int timer_calendar_next(TimerCalendar *c, const CalendarSpec *spec, usec_t base, usec_t *ret) {
+        int r;
+
+        assert(c);
+        assert(spec);
+        assert(ret);
+
+        if (timer_calendar_zone_changed(c, spec)) {
+                timer_calendar_flush(c);
+
+                if (free_and_strdup(&c->zone[0], tzname[0]) < 0 ||
+                    free_and_strdup(&c->zone[1], tzname[1]) < 0) {
+                        /* Don't remember anything then, we couldn't tell when it becomes stale */
+                        c->zone[0] = mfree(c->zone[0]);
+                        c->zone[1] = mfree(c->zone[1]);
+
+                        return calendar_spec_next_usec(spec, base, ret);
+                }
+        }
+
+        if (c->from <= base && base < c->next) {
+                *ret = c->next;
+                return 0;
+        }
+
+        r = calendar_spec_next_usec(spec, base, ret);
+        if (r < 0)
+                return r;
+
+        if (c->next == *ret)
+                c->from = MIN(c->from, base);
+        else
+                c->from = base;
+
+        c->next = *ret;
+        return 0;
+}
+
+static int timer_value_next_calendar(Timer *t, TimerValue *v, usec_t base, usec_t *ret) {
+        assert(t);
+        assert(v);
+        assert(v->calendar_spec);
+        assert(ret);
+
+        /* If we can't share the calculation with others, just do it ourselves */
+        if (!v->calendar)
+                (void) timer_calendar_ref(UNIT(t)->manager, v->calendar_spec, &v->calendar);
+        if (!v->calendar)
+                return calendar_spec_next_usec(v->calendar_spec, base, ret);
+
+        return timer_calendar_next(v->calendar, v->calendar_spec, base, ret);
+}
+
+static int timer_queue_arm(TimerQueue *q) {
+        Timer *t;
+        int r;
+
+        assert(q);
+
+        t = prioq_peek(q->timers);
+        if (!t) {
+                if (!q->event_source)
+                        return 0;
+
+                return sd_event_source_set_enabled(q->event_source, SD_EVENT_OFF);
+        }
+
+        if (q->event_source) {
+                r = sd_event_source_set_time(q->event_source, t->next_elapse_realtime);
+                if (r < 0)
+                        return r;
+
+                return sd_event_source_set_enabled(q->event_source, SD_EVENT_ONESHOT);
+        }
+
+        r = sd_event_add_time(
+                        q->manager->event,
+                        &q->event_source,
+                        q->clock,
+                        t->next_elapse_realtime, q->accuracy,
+                        timer_dispatch, q);
+        if (r < 0)
+                return r;
+
+        (void) sd_event_source_set_description(q->event_source, "timer-realtime");
+        return 0;
+}
+
+static int timer_queue_get(Manager *m, clockid_t clock, usec_t accuracy, TimerQueue **ret) {
+        TimerQueue key = {
+                .clock = clock,
+                .accuracy = accuracy,
+        }, *q;
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        q = hashmap_get(m->timer_queues, &key);
+        if (q) {
+                *ret = q;
+                return 0;
+        }
+
+        r = hashmap_ensure_allocated(&m->timer_queues, &timer_queue_hash_ops);
+        if (r < 0)
+                return r;
+
+        q = new0(TimerQueue, 1);
+        if (!q)
+                return -ENOMEM;
+
+        q->manager = m;
+        q->clock = clock;
+        q->accuracy = accuracy;
+
+        q->timers = prioq_new(timer_realtime_compare);
+        if (!q->timers) {
+                free(q);
+                return -ENOMEM;
+        }
+
+        r = hashmap_put(m->timer_queues, q, q);
+        if (r < 0) {
+                prioq_free(q->timers);
+                free(q);
+                return r;
+        }
+
+        *ret = q;
+        return 0;
+}
+
+static TimerQueue* timer_queue_free(TimerQueue *q) {
+        if (!q)
+                return NULL;
+
+        assert(prioq_isempty(q->timers));
+
+        sd_event_source_unref(q->event_source);
+        prioq_free(q->timers);
+        return mfree(q);
+}
+
+static void timer_realtime_unqueue(Timer *t) {
+        assert(t);
+
+        if (!t->realtime_queue)
+                return;
+
+        /* We don't rearm the shared event source here: if it wakes up for nothing it'll simply rearm itself
+         * for whatever timer is due next. */
+        prioq_remove(t->realtime_queue->timers, t, &t->realtime_queue_idx);
+        t->realtime_queue = NULL;
+}
+
+static int timer_realtime_enqueue(Timer *t) {
+        clockid_t clock;
+        TimerQueue *q;
+        int r;
+
+        assert(t);
+
+        clock = t->wake_system ? CLOCK_REALTIME_ALARM : CLOCK_REALTIME;
+
+        q = t->realtime_queue;
+        if (q && (q->clock != clock || q->accuracy != t->accuracy_usec)) {
+                timer_realtime_unqueue(t);
+                q = NULL;
+        }
+
+        if (q)
+                r = prioq_reshuffle(q->timers, t, &t->realtime_queue_idx);
+        else {
+                r = timer_queue_get(UNIT(t)->manager, clock, t->accuracy_usec, &q);
+                if (r < 0)
+                        return r;
+
+                r = prioq_put(q->timers, t, &t->realtime_queue_idx);
+                if (r >= 0)
+                        t->realtime_queue = q;
+        }
+        if (r < 0)
+                return r;
+
+        return timer_queue_arm(q);
+}
 
 static void timer_init(Unit *u) {
         Timer *t = TIMER(u);
@@ -53,6 +372,7 @@ static void timer_init(Unit *u) {
 
         t->next_elapse_monotonic_or_boottime = USEC_INFINITY;
         t->next_elapse_realtime = USEC_INFINITY;
+        t->realtime_queue_idx = PRIOQ_IDX_NULL;
         t->accuracy_usec = u->manager->default_timer_accuracy_usec;
         t->remain_after_elapse = true;
 }
@@ -65,6 +385,7 @@ void timer_free_values(Timer *t) {
         while ((v = t->values)) {
                 LIST_REMOVE(value, t->values, v);
                 calendar_spec_free(v->calendar_spec);
+                timer_calendar_unref(v->calendar);
                 free(v);
         }
 }
@@ -77,7 +398,7 @@ static void timer_done(Unit *u) {
         timer_free_values(t);
 
         t->monotonic_event_source = sd_event_source_unref(t->monotonic_event_source);
-        t->realtime_event_source = sd_event_source_unref(t->realtime_event_source);
+        timer_realtime_unqueue(t);
 
         free(t->stamp_path);
 }
@@ -179,7 +500,7 @@ static int timer_load(Unit *u) {
 
         if (u->load_state == UNIT_LOADED) {
 
-                if (set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+                if (!UNIT_TRIGGER(u)) {
                         Unit *x;
 
                         r = unit_load_related_unit(u, ".service", &x);
@@ -260,7 +581,7 @@ static void timer_set_state(Timer *t, TimerState state) {
 
         if (state != TIMER_WAITING) {
                 t->monotonic_event_source = sd_event_source_unref(t->monotonic_event_source);
-                t->realtime_event_source = sd_event_source_unref(t->realtime_event_source);
+                timer_realtime_unqueue(t);
                 t->next_elapse_monotonic_or_boottime = USEC_INFINITY;
                 t->next_elapse_realtime = USEC_INFINITY;
         }
@@ -374,7 +695,7 @@ static void timer_enter_waiting(Timer *t, bool initial) {
 
                         b = t->last_trigger.realtime > 0 ? t->last_trigger.realtime : ts.realtime;
 
-                        r = calendar_spec_next_usec(v->calendar_spec, b, &v->next_elapse);
+                        r = timer_value_next_calendar(t, v, b, &v->next_elapse);
                         if (r < 0)
                                 continue;
 
@@ -487,7 +808,7 @@ static void timer_enter_waiting(Timer *t, bool initial) {
                                         &t->monotonic_event_source,
                                         t->wake_system ? CLOCK_BOOTTIME_ALARM : CLOCK_MONOTONIC,
                                         t->next_elapse_monotonic_or_boottime, t->accuracy_usec,
-                                        timer_dispatch, t);
+                                        timer_dispatch_monotonic, t);
                         if (r < 0)
                                 goto fail;
 
@@ -508,33 +829,12 @@ static void timer_enter_waiting(Timer *t, bool initial) {
 
                 log_unit_debug(UNIT(t), "Realtime timer elapses at %s.", format_timestamp(buf, sizeof(buf), t->next_elapse_realtime));
 
-                if (t->realtime_event_source) {
-                        r = sd_event_source_set_time(t->realtime_event_source, t->next_elapse_realtime);
-                        if (r < 0)
-                                goto fail;
-
-                        r = sd_event_source_set_enabled(t->realtime_event_source, SD_EVENT_ONESHOT);
-                        if (r < 0)
-                                goto fail;
-                } else {
-                        r = sd_event_add_time(
-                                        UNIT(t)->manager->event,
-                                        &t->realtime_event_source,
-                                        t->wake_system ? CLOCK_REALTIME_ALARM : CLOCK_REALTIME,
-                                        t->next_elapse_realtime, t->accuracy_usec,
-                                        timer_dispatch, t);
-                        if (r < 0)
-                                goto fail;
-
-                        (void) sd_event_source_set_description(t->realtime_event_source, "timer-realtime");
-                }
-
-        } else if (t->realtime_event_source) {
-
-                r = sd_event_source_set_enabled(t->realtime_event_source, SD_EVENT_OFF);
+                r = timer_realtime_enqueue(t);
                 if (r < 0)
                         goto fail;
-        }
+
+        } else
+                timer_realtime_unqueue(t);
 
         timer_set_state(t, TIMER_WAITING);
         return;
@@ -712,7 +1012,7 @@ _pure_ static const char *timer_sub_state_to_string(Unit *u) {
         return timer_state_to_string(TIMER(u)->state);
 }
 
-static int timer_dispatch(sd_event_source *s, uint64_t usec, void *userdata) {
+static int timer_dispatch_monotonic(sd_event_source *s, uint64_t usec, void *userdata) {
         Timer *t = TIMER(userdata);
 
         assert(t);
@@ -725,6 +1025,40 @@ static int timer_dispatch(sd_event_source *s, uint64_t usec, void *userdata) {
         return 0;
 }
 
+static int timer_dispatch(sd_event_source *s, uint64_t usec, void *userdata) {
+        TimerQueue *q = userdata;
+        usec_t n;
+        Timer *t;
+        int r;
+
+        assert(q);
+
+        /* Run all timers of this queue that are due now. Entering the running state takes them off the
+         * queue, and if they enter the waiting state right away again their next elapse lies in the
+         * future, hence this terminates. */
+
+        n = now(CLOCK_REALTIME);
+
+        while ((t = prioq_peek(q->timers))) {
+                if (t->next_elapse_realtime > n)
+                        break;
+
+                timer_realtime_unqueue(t);
+
+                if (t->state != TIMER_WAITING)
+                        continue;
+
+                log_unit_debug(UNIT(t), "Timer elapsed.");
+                timer_enter_running(t);
+        }
+
+        r = timer_queue_arm(q);
+        if (r < 0)
+                log_error_errno(r, "Failed to rearm realtime timer queue: %m");
+
+        return 0;
+}
+
 static void timer_trigger_notify(Unit *u, Unit *other) {
         Timer *t = TIMER(u);
         TimerValue *v;
@@ -780,16 +1114,34 @@ static void timer_reset_failed(Unit *u) {
 
 static void timer_time_change(Unit *u) {
         Timer *t = TIMER(u);
+        TimerValue *v;
 
         assert(u);
 
+        /* The calendars are shared with other timers, drop what they remember even if we are not waiting */
+        LIST_FOREACH(value, v, t->values)
+                timer_calendar_flush(v->calendar);
+
         if (t->state != TIMER_WAITING)
                 return;
 
         log_unit_debug(u, "Time change, recalculating next elapse.");
+
         timer_enter_waiting(t, false);
 }
 
+static void timer_shutdown(Manager *m) {
+        TimerQueue *q;
+
+        assert(m);
+
+        while ((q = hashmap_steal_first(m->timer_queues)))
+                timer_queue_free(q);
+
+        m->timer_queues = hashmap_free(m->timer_queues);
+        m->timer_calendars = hashmap_free(m->timer_calendars);
+}
+
 static const char* const timer_base_table[_TIMER_BASE_MAX] = {
         [TIMER_ACTIVE] = "OnActiveSec",
         [TIMER_BOOT] = "OnBootSec",
@@ -840,6 +1192,8 @@ const UnitVTable timer_vtable = {
         .reset_failed = timer_reset_failed,
         .time_change = timer_time_change,
 
+        .shutdown = timer_shutdown,
+
         .bus_vtable = bus_timer_vtable,
         .bus_set_property = bus_timer_set_property,
 
@@ -20,6 +20,8 @@
 ***/
 
 typedef struct Timer Timer;
+typedef struct TimerCalendar TimerCalendar;
+typedef struct TimerQueue TimerQueue;
 
 #include "calendarspec.h"
 
@@ -34,12 +36,27 @@ typedef enum TimerBase {
         _TIMER_BASE_INVALID = -1
 } TimerBase;
 
+/* Timers using the same calendar specification share the result of the last next elapse calculation: the
+ * next elapse computed from some base time is also the next elapse for any later base time before it. */
+struct TimerCalendar {
+        Manager *manager;
+        unsigned n_ref;
+
+        char *spec;
+
+        /* The last result, valid for base times in [from, next), and the time zone it was calculated in */
+        usec_t from;
+        usec_t next;
+        char *zone[2];
+};
+
 typedef struct TimerValue {
         TimerBase base;
         bool disabled;
 
         usec_t value; /* only for monotonic events */
         CalendarSpec *calendar_spec; /* only for calendar events */
+        TimerCalendar *calendar; /* shared with all timers using the same calendar spec */
         usec_t next_elapse;
 
         LIST_FIELDS(struct TimerValue, value);
@@ -67,7 +84,10 @@ struct Timer {
         TimerState state, deserialized_state;
 
         sd_event_source *monotonic_event_source;
-        sd_event_source *realtime_event_source;
+
+        /* Realtime timers don't get an event source of their own, but are queued in a shared one */
+        TimerQueue *realtime_queue;
+        unsigned realtime_queue_idx;
 
         TimerResult result;
 
@@ -82,6 +102,11 @@ struct Timer {
 
 void timer_free_values(Timer *t);
 
+int timer_calendar_ref(Manager *m, const CalendarSpec *spec, TimerCalendar **ret);
+TimerCalendar* timer_calendar_unref(TimerCalendar *c);
+void timer_calendar_flush(TimerCalendar *c);
+int timer_calendar_next(TimerCalendar *c, const CalendarSpec *spec, usec_t base, usec_t *ret);
+
 extern const UnitVTable timer_vtable;
 
 const char *timer_base_to_string(TimerBase i) _const_;
@@ -0,0 +1,942 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "log.h"
+#include "path-util.h"
+#include "string-util.h"
+#include "unit-cache.h"
+
+/* Bump this whenever the on-disk format changes */
+#define UNIT_CACHE_MAGIC "SDUCACHE"
+#define UNIT_CACHE_VERSION 1
+
+/* Files modified more recently than this are not cached: the file system timestamps are only updated at a
+ * coarse granularity, hence we might not be able to tell a later modification apart from the version we
+ * recorded. */
+#define UNIT_CACHE_RACY_USEC (2 * USEC_PER_SEC)
+
+/* Upper limit for the number of threads reading and tokenizing files in parallel */
+#define UNIT_CACHE_PREFETCH_WORKERS_MAX 16U
+
+/* Used to encode NULL strings */
+#define UNIT_CACHE_STRING_NULL UINT32_MAX
+
+typedef struct UnitCacheAssignment {
+        unsigned line;
+        unsigned section_line;
+        char *section;
+        char *lvalue;
+        char *rvalue;
+} UnitCacheAssignment;
+
+typedef struct UnitCacheEntry {
+        char *path;
+
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        nsec_t mtime;
+        nsec_t ctime;
+
+        UnitCacheAssignment *assignments;
+        size_t n_assignments, n_allocated;
+
+        /* Whether this entry was used since the last unit_cache_start() */
+        bool used;
+} UnitCacheEntry;
+
+struct UnitCache {
+        Hashmap *entries;
+        bool dirty;
+
+        UnitCacheStats stats;
+};
+
+typedef struct UnitCacheRecorder {
+        UnitCacheEntry *entry;
+        ConfigItemLookup lookup;
+        const void *table;
+        bool relaxed;
+
+        /* Set if the file cannot be cached, e.g. because it uses .include */
+        bool uncacheable;
+
+        /* The result of the real lookup for the assignment currently parsed */
+        int found;
+        ConfigParserCallback func;
+        int ltype;
+        void *data;
+} UnitCacheRecorder;
+
+static UnitCacheEntry* unit_cache_entry_free(UnitCacheEntry *e) {
+        size_t i;
+
+        if (!e)
+                return NULL;
+
+        for (i = 0; i < e->n_assignments; i++) {
+                free(e->assignments[i].section);
+                free(e->assignments[i].lvalue);
+                free(e->assignments[i].rvalue);
+        }
+
+        free(e->assignments);
+        free(e->path);
+
+        return mfree(e);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(UnitCacheEntry*, unit_cache_entry_free);
+
+static int unit_cache_entry_new(const char *path, const struct stat *st, UnitCacheEntry **ret) {
+        _cleanup_(unit_cache_entry_freep) UnitCacheEntry *e = NULL;
+
+        assert(path);
+        assert(ret);
+
+        e = new0(UnitCacheEntry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->path = strdup(path);
+        if (!e->path)
+                return -ENOMEM;
+
+        if (st) {
+                e->dev = st->st_dev;
+                e->ino = st->st_ino;
+                e->size = st->st_size;
+                e->mtime = timespec_load_nsec(&st->st_mtim);
+                e->ctime = timespec_load_nsec(&st->st_ctim);
+        }
+
+        *ret = e;
+        e = NULL;
+
+        return 0;
+}
+
+static bool unit_cache_entry_matches(const UnitCacheEntry *e, const struct stat *st) {
+        assert(e);
+        assert(st);
+
+        return e->dev == (uint64_t) st->st_dev &&
+                e->ino == (uint64_t) st->st_ino &&
+                e->size == (uint64_t) st->st_size &&
+                e->mtime == timespec_load_nsec(&st->st_mtim) &&
+                e->ctime == timespec_load_nsec(&st->st_ctim);
+}
+
+static int unit_cache_entry_add_assignment(
+                UnitCacheEntry *e,
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                const char *rvalue) {
+
+        UnitCacheAssignment *a;
+
+        assert(e);
+        assert(lvalue);
+        assert(rvalue);
+
+        if (!GREEDY_REALLOC0(e->assignments, e->n_allocated, e->n_assignments + 1))
+                return -ENOMEM;
+
+        a = e->assignments + e->n_assignments;
+
+        a->line = line;
+        a->section_line = section_line;
+
+        if (section) {
+                a->section = strdup(section);
+                if (!a->section)
+                        return -ENOMEM;
+        }
+
+        a->lvalue = strdup(lvalue);
+        a->rvalue = strdup(rvalue);
+        if (!a->lvalue || !a->rvalue) {
+                a->section = mfree(a->section);
+                a->lvalue = mfree(a->lvalue);
+                a->rvalue = mfree(a->rvalue);
+                return -ENOMEM;
+        }
+
+        e->n_assignments++;
+        return 0;
+}
+
+static int unit_cache_put(UnitCache *c, UnitCacheEntry *e) {
+        UnitCacheEntry *old;
+        int r;
+
+        assert(c);
+        assert(e);
+
+        old = hashmap_remove(c->entries, e->path);
+        unit_cache_entry_free(old);
+
+        r = hashmap_put(c->entries, e->path, e);
+        if (r < 0)
+                return r;
+
+        c->dirty = true;
+        return 0;
+}
+
+int unit_cache_new(UnitCache **ret) {
+        _cleanup_(unit_cache_freep) UnitCache *c = NULL;
+
+        assert(ret);
+
+        c = new0(UnitCache, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->entries = hashmap_new(&string_hash_ops);
+        if (!c->entries)
+                return -ENOMEM;
+
+        *ret = c;
+        c = NULL;
+
+        return 0;
+}
+
+UnitCache* unit_cache_free(UnitCache *c) {
+        UnitCacheEntry *e;
+
+        if (!c)
+                return NULL;
+
+        while ((e = hashmap_steal_first(c->entries)))
+                unit_cache_entry_free(e);
+
+        hashmap_free(c->entries);
+
+        return mfree(c);
+}
+
+static int read_uint32(const char **p, const char *end, uint32_t *ret) {
+        assert(p);
+        assert(ret);
+
+        if ((size_t) (end - *p) < sizeof(uint32_t))
+                return -EBADMSG;
+
+        memcpy(ret, *p, sizeof(uint32_t));
+        *p += sizeof(uint32_t);
+
+        return 0;
+}
+
+static int read_uint64(const char **p, const char *end, uint64_t *ret) {
+        assert(p);
+        assert(ret);
+
+        if ((size_t) (end - *p) < sizeof(uint64_t))
+                return -EBADMSG;
+
+        memcpy(ret, *p, sizeof(uint64_t));
+        *p += sizeof(uint64_t);
+
+        return 0;
+}
+
+static int read_string(const char **p, const char *end, char **ret) {
+        uint32_t n;
+        char *s;
+        int r;
+
+        assert(p);
+        assert(ret);
+
+        r = read_uint32(p, end, &n);
+        if (r < 0)
+                return r;
+
+        if (n == UNIT_CACHE_STRING_NULL) {
+                *ret = NULL;
+                return 0;
+        }
+
+        if ((size_t) (end - *p) < n)
+                return -EBADMSG;
+
+        s = strndup(*p, n);
+        if (!s)
+                return -ENOMEM;
+
+        *p += n;
+        *ret = s;
+
+        return 0;
+}
+
+static int unit_cache_read_entry(const char **p, const char *end, UnitCacheEntry **ret) {
+        _cleanup_(unit_cache_entry_freep) UnitCacheEntry *e = NULL;
+        uint32_t n, i;
+        int r;
+
+        assert(p);
+        assert(ret);
+
+        e = new0(UnitCacheEntry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        r = read_string(p, end, &e->path);
+        if (r < 0)
+                return r;
+        if (!e->path)
+                return -EBADMSG;
+
+        if (read_uint64(p, end, &e->dev) < 0 ||
+            read_uint64(p, end, &e->ino) < 0 ||
+            read_uint64(p, end, &e->size) < 0 ||
+            read_uint64(p, end, &e->mtime) < 0 ||
+            read_uint64(p, end, &e->ctime) < 0 ||
+            read_uint32(p, end, &n) < 0)
+                return -EBADMSG;
+
+        /* Each assignment takes at least 5 words, refuse bogus counts early */
+        if (n > (size_t) (end - *p) / (5 * sizeof(uint32_t)))
+                return -EBADMSG;
+
+        e->assignments = new0(UnitCacheAssignment, n);
+        if (!e->assignments && n > 0)
+                return -ENOMEM;
+        e->n_allocated = n;
+
+        for (i = 0; i < n; i++) {
+                UnitCacheAssignment *a = e->assignments + i;
+                uint32_t line, section_line;
+
+                r = read_uint32(p, end, &line);
+                if (r < 0)
+                        return r;
+                r = read_uint32(p, end, &section_line);
+                if (r < 0)
+                        return r;
+
+                a->line = line;
+                a->section_line = section_line;
+
+                /* Count the assignment already, so that it is freed on failure */
+                e->n_assignments++;
+
+                r = read_string(p, end, &a->section);
+                if (r < 0)
+                        return r;
+                r = read_string(p, end, &a->lvalue);
+                if (r < 0)
+                        return r;
+                r = read_string(p, end, &a->rvalue);
+                if (r < 0)
+                        return r;
+
+                if (!a->lvalue || !a->rvalue || line == 0)
+                        return -EBADMSG;
+        }
+
+        *ret = e;
+        e = NULL;
+
+        return 0;
+}
+
+int unit_cache_load(UnitCache *c, const char *path) {
+        _cleanup_free_ char *buf = NULL;
+        const char *p, *end;
+        uint32_t version, n, i;
+        size_t size;
+        int r;
+
+        assert(c);
+        assert(path);
+
+        r = read_full_file(path, &buf, &size);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return log_debug_errno(r, "Failed to read unit cache %s: %m", path);
+
+        p = buf;
+        end = buf + size;
+
+        if (size < strlen(UNIT_CACHE_MAGIC) || memcmp(p, UNIT_CACHE_MAGIC, strlen(UNIT_CACHE_MAGIC)) != 0) {
+                log_debug("Unit cache %s has invalid signature, ignoring.", path);
+                return 0;
+        }
+        p += strlen(UNIT_CACHE_MAGIC);
+
+        if (read_uint32(&p, end, &version) < 0 || version != UNIT_CACHE_VERSION) {
+                log_debug("Unit cache %s has unsupported version, ignoring.", path);
+                return 0;
+        }
+
+        r = read_uint32(&p, end, &n);
+        if (r < 0)
+                goto fail;
+
+        for (i = 0; i < n; i++) {
+                UnitCacheEntry *e;
+
+                r = unit_cache_read_entry(&p, end, &e);
+                if (r < 0)
+                        goto fail;
+
+                r = hashmap_put(c->entries, e->path, e);
+                if (r < 0) {
+                        unit_cache_entry_free(e);
+                        goto fail;
+                }
+        }
+
+        if (p != end) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        log_debug("Loaded %u entries from unit cache %s.", n, path);
+        return 0;
+
+fail:
+        /* Never trust half a cache */
+        {
+                UnitCacheEntry *e;
+
+                while ((e = hashmap_steal_first(c->entries)))
+                        unit_cache_entry_free(e);
+        }
+
+        if (r == -ENOMEM)
+                return r;
+
+        log_debug_errno(r, "Unit cache %s is corrupted, ignoring: %m", path);
+        return 0;
+}
+
+static void write_uint32(FILE *f, uint32_t u) {
+        fwrite(&u, sizeof(u), 1, f);
+}
+
+static void write_uint64(FILE *f, uint64_t u) {
+        fwrite(&u, sizeof(u), 1, f);
+}
+
+static void write_string(FILE *f, const char *s) {
+        size_t n;
+
+        if (!s) {
+                write_uint32(f, UNIT_CACHE_STRING_NULL);
+                return;
+        }
+
+        n = strlen(s);
+        write_uint32(f, (uint32_t) n);
+        fwrite(s, 1, n, f);
+}
+
+int unit_cache_save(UnitCache *c, const char *path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *t = NULL;
+        UnitCacheEntry *e;
+        Iterator i;
+        int r;
+
+        assert(c);
+        assert(path);
+
+        if (!c->dirty)
+                return 0;
+
+        r = fopen_temporary(path, &f, &t);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0600);
+
+        fwrite(UNIT_CACHE_MAGIC, 1, strlen(UNIT_CACHE_MAGIC), f);
+        write_uint32(f, UNIT_CACHE_VERSION);
+        write_uint32(f, hashmap_size(c->entries));
+
+        HASHMAP_FOREACH(e, c->entries, i) {
+                size_t k;
+
+                write_string(f, e->path);
+                write_uint64(f, e->dev);
+                write_uint64(f, e->ino);
+                write_uint64(f, e->size);
+                write_uint64(f, e->mtime);
+                write_uint64(f, e->ctime);
+                write_uint32(f, (uint32_t) e->n_assignments);
+
+                for (k = 0; k < e->n_assignments; k++) {
+                        UnitCacheAssignment *a = e->assignments + k;
+
+                        write_uint32(f, a->line);
+                        write_uint32(f, a->section_line);
+                        write_string(f, a->section);
+                        write_string(f, a->lvalue);
+                        write_string(f, a->rvalue);
+                }
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(t, path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        c->dirty = false;
+        return 0;
+
+fail:
+        (void) unlink(t);
+        return r;
+}
+
+void unit_cache_start(UnitCache *c) {
+        UnitCacheEntry *e;
+        Iterator i;
+
+        assert(c);
+
+        HASHMAP_FOREACH(e, c->entries, i)
+                e->used = false;
+
+        zero(c->stats);
+}
+
+void unit_cache_vacuum(UnitCache *c) {
+        UnitCacheEntry *e;
+        Iterator i;
+
+        assert(c);
+
+        /* Drop everything not used since unit_cache_start(), i.e. files that have been removed, or are not
+         * referenced anymore */
+
+        HASHMAP_FOREACH(e, c->entries, i) {
+                if (e->used)
+                        continue;
+
+                hashmap_remove(c->entries, e->path);
+                unit_cache_entry_free(e);
+                c->dirty = true;
+        }
+}
+
+const UnitCacheStats* unit_cache_get_stats(UnitCache *c) {
+        assert(c);
+
+        return &c->stats;
+}
+
+typedef struct UnitCachePrefetchWorker {
+        UnitCache *cache;
+        const UnitCachePrefetch *files;
+        size_t n_files;
+        usec_t now;
+
+        /* Worker n handles the files n, n + n_workers, n + 2 * n_workers, ... */
+        unsigned index;
+        unsigned n_workers;
+
+        pthread_t thread;
+        bool started;
+
+        UnitCacheEntry **entries;
+        size_t n_entries, n_allocated;
+} UnitCachePrefetchWorker;
+
+static bool unit_cache_mode_is_clean(mode_t mode) {
+        /* The access mode fd_warn_permissions() doesn't complain about */
+        return (mode & 0113) == 0 && (mode & 0044) == 0044;
+}
+
+static int unit_cache_add_token(
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                const char *rvalue,
+                void *userdata) {
+
+        return unit_cache_entry_add_assignment(userdata, line, section, section_line, lvalue, rvalue);
+}
+
+static int unit_cache_prefetch_file(UnitCachePrefetchWorker *w, const char *path, const char *sections, bool follow) {
+        _cleanup_(unit_cache_entry_freep) UnitCacheEntry *e = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_close_ int fd = -1;
+        UnitCacheEntry *old;
+        struct stat st;
+        int r;
+
+        assert(w);
+        assert(path);
+
+        /* Note that this runs in a worker thread: no logging, and no changes to the cache itself. Whenever
+         * something is off, the file is simply skipped, and parsed the usual way later on. */
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY|(follow ? 0 : O_NOFOLLOW));
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        /* config_parse() warns about these, leave that to it */
+        if (!unit_cache_mode_is_clean(st.st_mode))
+                return 0;
+
+        old = hashmap_get(w->cache->entries, path);
+        if (old && unit_cache_entry_matches(old, &st))
+                return 0;
+
+        if (timespec_load(&st.st_mtim) + UNIT_CACHE_RACY_USEC > w->now)
+                return 0;
+
+        f = fdopen(fd, "re");
+        if (!f)
+                return -errno;
+        fd = -1;
+
+        r = unit_cache_entry_new(path, &st, &e);
+        if (r < 0)
+                return r;
+
+        r = config_tokenize(f, sections, unit_cache_add_token, e);
+        if (r < 0)
+                return r;
+
+        if (!GREEDY_REALLOC(w->entries, w->n_allocated, w->n_entries + 1))
+                return -ENOMEM;
+
+        w->entries[w->n_entries++] = e;
+        e = NULL;
+
+        return 1;
+}
+
+static int unit_cache_prefetch_dropin_dir(UnitCachePrefetchWorker *w, const char *path, const char *sections) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+
+        assert(w);
+        assert(path);
+
+        d = opendir(path);
+        if (!d)
+                return -errno;
+
+        FOREACH_DIRENT(de, d, return -errno) {
+                _cleanup_free_ char *p = NULL;
+
+                if (!endswith(de->d_name, ".conf"))
+                        continue;
+
+                p = strjoin(path, "/", de->d_name);
+                if (!p)
+                        return -ENOMEM;
+
+                (void) unit_cache_prefetch_file(w, p, sections, true);
+        }
+
+        return 0;
+}
+
+static void* unit_cache_prefetch_thread(void *p) {
+        UnitCachePrefetchWorker *w = p;
+        size_t i;
+
+        for (i = w->index; i < w->n_files; i += w->n_workers) {
+                const UnitCachePrefetch *file = w->files + i;
+
+                if (file->dropin_dir)
+                        (void) unit_cache_prefetch_dropin_dir(w, file->path, file->sections);
+                else
+                        /* Unit files are loaded through their final path, hence skip symlinks */
+                        (void) unit_cache_prefetch_file(w, file->path, file->sections, false);
+        }
+
+        return NULL;
+}
+
+int unit_cache_prefetch(UnitCache *c, const UnitCachePrefetch *files, size_t n_files) {
+        _cleanup_free_ UnitCachePrefetchWorker *workers = NULL;
+        unsigned n_workers, k;
+        size_t i;
+        long ncpus;
+        usec_t ts;
+        int r = 0, n = 0;
+
+        assert(c);
+        assert(files || n_files == 0);
+
+        /* Reads and tokenizes the specified unit files and drop-in directories in worker threads, and puts the
+         * results into the cache, so that loading the units afterwards on the main thread only needs to apply
+         * the assignments. Returns the number of files prefetched. */
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus <= 1 || n_files == 0)
+                return 0;
+
+        n_workers = (unsigned) MIN3((size_t) ncpus, (size_t) UNIT_CACHE_PREFETCH_WORKERS_MAX, n_files);
+
+        workers = new0(UnitCachePrefetchWorker, n_workers);
+        if (!workers)
+                return -ENOMEM;
+
+        ts = now(CLOCK_REALTIME);
+
+        for (k = 0; k < n_workers; k++)
+                workers[k] = (UnitCachePrefetchWorker) {
+                        .cache = c,
+                        .files = files,
+                        .n_files = n_files,
+                        .now = ts,
+                        .index = k,
+                        .n_workers = n_workers,
+                };
+
+        /* The main thread takes the share of the first worker, and of all workers we failed to start */
+        for (k = 1; k < n_workers; k++)
+                workers[k].started = pthread_create(&workers[k].thread, NULL, unit_cache_prefetch_thread, workers + k) == 0;
+
+        for (k = 0; k < n_workers; k++)
+                if (!workers[k].started)
+                        (void) unit_cache_prefetch_thread(workers + k);
+
+        for (k = 1; k < n_workers; k++)
+                if (workers[k].started)
+                        assert_se(pthread_join(workers[k].thread, NULL) == 0);
+
+        /* All threads are gone, now the results may be added to the cache */
+        for (k = 0; k < n_workers; k++) {
+                for (i = 0; i < workers[k].n_entries; i++) {
+                        UnitCacheEntry *e = workers[k].entries[i];
+
+                        if (r >= 0) {
+                                r = unit_cache_put(c, e);
+                                if (r >= 0) {
+                                        n++;
+                                        continue;
+                                }
+                        }
+
+                        unit_cache_entry_free(e);
+                }
+
+                free(workers[k].entries);
+        }
+
+        if (r < 0)
+                return r;
+
+        return n;
+}
+
+static int unit_cache_record_assignment(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *data,
+                void *userdata) {
+
+        UnitCacheRecorder *rec = data;
+
+        assert(rec);
+
+        if (!path_equal(filename, rec->entry->path))
+                /* Pulled in via .include, we cannot validate that file with a simple stat() of the fragment */
+                rec->uncacheable = true;
+        else if (!rec->uncacheable &&
+                 unit_cache_entry_add_assignment(rec->entry, line, section, section_line, lvalue, rvalue) < 0)
+                rec->uncacheable = true;
+
+        if (rec->found > 0) {
+                if (rec->func)
+                        return rec->func(unit, filename, line, section, section_line,
+                                         lvalue, rec->ltype, rvalue, rec->data, userdata);
+
+                return 0;
+        }
+
+        /* Warn about unknown non-extension fields, the same way config_parse_assignment() does. */
+        if (!rec->relaxed && !startswith(lvalue, "X-"))
+                log_syntax(unit, LOG_WARNING, filename, line, 0, "Unknown lvalue '%s' in section '%s'", lvalue, section);
+
+        return 0;
+}
+
+static int unit_cache_record_lookup(
+                const void *table,
+                const char *section,
+                const char *lvalue,
+                ConfigParserCallback *func,
+                int *ltype,
+                void **data,
+                void *userdata) {
+
+        UnitCacheRecorder *rec = (UnitCacheRecorder*) table;
+        int r;
+
+        assert(rec);
+        assert(func);
+        assert(ltype);
+        assert(data);
+
+        /* Look up the real parser, but route the assignment through us first, so that we can record it */
+
+        rec->func = NULL;
+        rec->ltype = 0;
+        rec->data = NULL;
+
+        r = rec->lookup(rec->table, section, lvalue, &rec->func, &rec->ltype, &rec->data, userdata);
+        if (r < 0)
+                return r;
+
+        rec->found = r;
+
+        *func = unit_cache_record_assignment;
+        *ltype = 0;
+        *data = rec;
+
+        return 1;
+}
+
+int unit_cache_parse(
+                UnitCache *c,
+                const char *unit,
+                const char *filename,
+                FILE *f,
+                const char *sections,
+                ConfigItemLookup lookup,
+                const void *table,
+                bool relaxed,
+                bool allow_include,
+                bool warn,
+                void *userdata) {
+
+        _cleanup_(unit_cache_entry_freep) UnitCacheEntry *n = NULL;
+        UnitCacheRecorder rec;
+        UnitCacheEntry *e;
+        bool clean = false;
+        struct stat st;
+        usec_t ts;
+        int r;
+
+        assert(filename);
+        assert(lookup);
+
+        if (!c)
+                return config_parse(unit, filename, f, sections, lookup, table, relaxed, allow_include, warn, userdata);
+
+        if ((f ? fstat(fileno(f), &st) : stat(filename, &st)) < 0 || !S_ISREG(st.st_mode))
+                /* Let config_parse() deal with this, including logging */
+                return config_parse(unit, filename, f, sections, lookup, table, relaxed, allow_include, warn, userdata);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        e = hashmap_get(c->entries, filename);
+        if (e && unit_cache_entry_matches(e, &st)) {
+                size_t i;
+
+                e->used = true;
+
+                for (i = 0; i < e->n_assignments; i++) {
+                        UnitCacheAssignment *a = e->assignments + i;
+
+                        r = config_parse_assignment(unit, filename, a->line, lookup, table,
+                                                    a->section, a->section_line,
+                                                    a->lvalue, a->rvalue,
+                                                    relaxed, userdata);
+                        if (r < 0) {
+                                if (warn)
+                                        log_warning_errno(r, "Failed to parse file '%s': %m", filename);
+                                return r;
+                        }
+                }
+
+                c->stats.n_hits++;
+                c->stats.hit_usec += now(CLOCK_MONOTONIC) - ts;
+
+                return 0;
+        }
+
+        r = unit_cache_entry_new(filename, &st, &n);
+        if (r < 0)
+                return r;
+
+        rec = (UnitCacheRecorder) {
+                .entry = n,
+                .lookup = lookup,
+                .table = table,
+                .relaxed = relaxed,
+        };
+
+        r = config_parse_full(unit, filename, f, sections, unit_cache_record_lookup, &rec, relaxed, allow_include, warn, userdata, &clean);
+
+        c->stats.n_misses++;
+        c->stats.miss_usec += now(CLOCK_MONOTONIC) - ts;
+
+        if (r < 0)
+                return r;
+
+        /* On a cache hit only the assignments are replayed, hence the parsers emit their warnings again, but
+         * config_parse() itself doesn't get to complain about the file's access mode, unknown sections and
+         * such. Files it complained about are hence not cached. */
+        if (clean &&
+            !rec.uncacheable &&
+            unit_cache_mode_is_clean(st.st_mode) &&
+            timespec_load(&st.st_mtim) + UNIT_CACHE_RACY_USEC <= now(CLOCK_REALTIME)) {
+                n->used = true;
+
+                if (unit_cache_put(c, n) >= 0)
+                        n = NULL;
+        }
+
+        return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "conf-parser.h"
+#include "hashmap.h"
+#include "macro.h"
+#include "time-util.h"
+
+/* A cache of the assignments found in unit files and drop-ins, keyed
+ * by the file path and validated by inode, size and timestamps. On a
+ * cache hit the assignments are fed to the parsers directly, without
+ * reading and tokenizing the file again. The cache may be persisted
+ * to disk, so that it survives daemon-reexec. */
+
+typedef struct UnitCache UnitCache;
+
+typedef struct UnitCacheStats {
+        unsigned n_hits;
+        unsigned n_misses;
+        usec_t hit_usec;
+        usec_t miss_usec;
+} UnitCacheStats;
+
+int unit_cache_new(UnitCache **ret);
+UnitCache* unit_cache_free(UnitCache *c);
+DEFINE_TRIVIAL_CLEANUP_FUNC(UnitCache*, unit_cache_free);
+
+int unit_cache_load(UnitCache *c, const char *path);
+int unit_cache_save(UnitCache *c, const char *path);
+
+void unit_cache_start(UnitCache *c);
+void unit_cache_vacuum(UnitCache *c);
+
+const UnitCacheStats* unit_cache_get_stats(UnitCache *c);
+
+typedef struct UnitCachePrefetch {
+        const char *path;
+        const char *sections;
+
+        /* If set, path refers to a drop-in directory, and all .conf files in it are prefetched */
+        bool dropin_dir;
+} UnitCachePrefetch;
+
+int unit_cache_prefetch(UnitCache *c, const UnitCachePrefetch *files, size_t n_files);
+
+int unit_cache_parse(
+                UnitCache *c,
+                const char *unit,
+                const char *filename,
+                FILE *f,
+                const char *sections,
+                ConfigItemLookup lookup,
+                const void *table,
+                bool relaxed,
+                bool allow_include,
+                bool warn,
+                void *userdata);
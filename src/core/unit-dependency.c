@@ -0,0 +1,191 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "unit.h"
+#include "unit-dependency.h"
+
+assert_cc(_UNIT_DEPENDENCY_MAX <= 32);
+
+void unit_dependencies_clear(UnitDependencies *t) {
+        assert(t);
+
+        t->entries = mfree(t->entries);
+        t->n_entries = t->n_allocated = 0;
+}
+
+int unit_dependencies_reserve(UnitDependencies *t, size_t n) {
+        assert(t);
+
+        if (!GREEDY_REALLOC(t->entries, t->n_allocated, t->n_entries + n))
+                return -ENOMEM;
+
+        return 0;
+}
+
+static size_t unit_dependencies_bisect(const UnitDependencies *t, const Unit *other) {
+        size_t lower = 0, upper;
+
+        assert(t);
+
+        /* Returns the index of the first entry whose unit is not ordered before other */
+
+        upper = t->n_entries;
+
+        /* Units are usually allocated, and hence added, in ascending order, so check the end first */
+        if (upper == 0 || (uintptr_t) t->entries[upper - 1].other < (uintptr_t) other)
+                return upper;
+
+        while (lower < upper) {
+                size_t middle = lower + (upper - lower) / 2;
+
+                if ((uintptr_t) t->entries[middle].other < (uintptr_t) other)
+                        lower = middle + 1;
+                else
+                        upper = middle;
+        }
+
+        return lower;
+}
+
+int unit_dependencies_add(UnitDependencies *t, Unit *other, uint32_t mask) {
+        uint32_t added;
+        size_t k;
+
+        assert(t);
+        assert(other);
+        assert(mask != 0);
+
+        /* Returns the dependency types that were not set before */
+
+        k = unit_dependencies_bisect(t, other);
+        if (k < t->n_entries && t->entries[k].other == other) {
+                added = mask & ~t->entries[k].mask;
+                t->entries[k].mask |= mask;
+                return (int) added;
+        }
+
+        if (!GREEDY_REALLOC(t->entries, t->n_allocated, t->n_entries + 1))
+                return -ENOMEM;
+
+        memmove(t->entries + k + 1, t->entries + k, (t->n_entries - k) * sizeof(UnitDependencyEntry));
+        t->entries[k] = (UnitDependencyEntry) {
+                .other = other,
+                .mask = mask,
+        };
+        t->n_entries++;
+
+        return (int) mask;
+}
+
+uint32_t unit_dependencies_remove(UnitDependencies *t, Unit *other, uint32_t mask) {
+        uint32_t removed;
+        size_t k;
+
+        assert(t);
+        assert(other);
+
+        /* Returns the dependency types that were actually removed. The entry is dropped once no type is left. */
+
+        k = unit_dependencies_bisect(t, other);
+        if (k >= t->n_entries || t->entries[k].other != other)
+                return 0;
+
+        removed = t->entries[k].mask & mask;
+        t->entries[k].mask &= ~mask;
+
+        if (t->entries[k].mask == 0) {
+                memmove(t->entries + k, t->entries + k + 1, (t->n_entries - k - 1) * sizeof(UnitDependencyEntry));
+                t->n_entries--;
+        }
+
+        return removed;
+}
+
+uint32_t unit_dependencies_get(const UnitDependencies *t, const Unit *other) {
+        size_t k;
+
+        assert(t);
+
+        k = unit_dependencies_bisect(t, other);
+        if (k >= t->n_entries || t->entries[k].other != other)
+                return 0;
+
+        return t->entries[k].mask;
+}
+
+unsigned unit_dependencies_count(const UnitDependencies *t, uint32_t mask) {
+        unsigned n = 0;
+        size_t k;
+
+        assert(t);
+
+        for (k = 0; k < t->n_entries; k++)
+                if (t->entries[k].mask & mask)
+                        n++;
+
+        return n;
+}
+
+Unit* unit_dependencies_first(const UnitDependencies *t, uint32_t mask) {
+        size_t k;
+
+        assert(t);
+
+        for (k = 0; k < t->n_entries; k++)
+                if (t->entries[k].mask & mask)
+                        return t->entries[k].other;
+
+        return NULL;
+}
+
+bool unit_dependencies_next(const UnitDependencies *t, uint32_t mask, Iterator *i, Unit **ret) {
+        size_t k;
+
+        assert(t);
+        assert(i);
+        assert(ret);
+
+        /* i->next_key is the unit returned last, and i->idx the index right after it. If the table was
+         * modified in the meantime, the position is looked up again by the unit, so that iteration continues
+         * with the first unit ordered after it. */
+
+        if (i->idx == _IDX_ITERATOR_FIRST)
+                k = 0;
+        else if (i->idx > 0 && i->idx <= t->n_entries && t->entries[i->idx - 1].other == i->next_key)
+                k = i->idx;
+        else {
+                k = unit_dependencies_bisect(t, i->next_key);
+                if (k < t->n_entries && t->entries[k].other == i->next_key)
+                        k++;
+        }
+
+        for (; k < t->n_entries; k++)
+                if (t->entries[k].mask & mask) {
+                        i->idx = k + 1;
+                        i->next_key = *ret = t->entries[k].other;
+                        return true;
+                }
+
+        i->idx = t->n_entries;
+        i->next_key = NULL;
+        *ret = NULL;
+        return false;
+}
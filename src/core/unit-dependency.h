@@ -0,0 +1,66 @@
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hashmap.h"
+#include "macro.h"
+#include "unit-name.h"
+
+/* The dependencies of a unit, stored as one array of (unit, dependency mask) pairs sorted by the
+ * address of the other unit. Most units only have a handful of dependencies, and most pairs of units
+ * are linked by more than one dependency type at once (e.g. Wants= plus After= plus References=), hence
+ * this is much more compact than one Set per dependency type, and cheaper to iterate. */
+
+#define UNIT_DEPENDENCY_MASK(d) (UINT32_C(1) << (d))
+
+typedef struct UnitDependencyEntry {
+        Unit *other;
+        uint32_t mask;
+} UnitDependencyEntry;
+
+typedef struct UnitDependencies {
+        UnitDependencyEntry *entries;
+        size_t n_entries;
+        size_t n_allocated;
+} UnitDependencies;
+
+void unit_dependencies_clear(UnitDependencies *t);
+int unit_dependencies_reserve(UnitDependencies *t, size_t n);
+
+int unit_dependencies_add(UnitDependencies *t, Unit *other, uint32_t mask);
+uint32_t unit_dependencies_remove(UnitDependencies *t, Unit *other, uint32_t mask);
+uint32_t unit_dependencies_get(const UnitDependencies *t, const Unit *other);
+
+static inline bool unit_dependencies_contains(const UnitDependencies *t, const Unit *other, UnitDependency d) {
+        return unit_dependencies_get(t, other) & UNIT_DEPENDENCY_MASK(d);
+}
+
+unsigned unit_dependencies_count(const UnitDependencies *t, uint32_t mask);
+Unit* unit_dependencies_first(const UnitDependencies *t, uint32_t mask);
+
+bool unit_dependencies_next(const UnitDependencies *t, uint32_t mask, Iterator *i, Unit **ret);
+
+/* Like SET_FOREACH(), it is safe to add or remove dependencies while iterating, including the current one */
+#define UNIT_FOREACH_DEPENDENCY_MASK(other, u, mask, i)                 \
+        for ((i) = ITERATOR_FIRST; unit_dependencies_next(&(u)->dependencies, (mask), &(i), &(other)); )
+
+#define UNIT_FOREACH_DEPENDENCY(other, u, d, i)                         \
+        UNIT_FOREACH_DEPENDENCY_MASK(other, u, UNIT_DEPENDENCY_MASK(d), i)
@@ -0,0 +1,245 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "manager.h"
+#include "unit-order.h"
+
+static void unit_order_invalidate(Manager *m) {
+        assert(m);
+
+        if (!m->unit_order_cyclic)
+                log_debug("Unit ordering graph contains a cycle, or cannot be tracked, verifying transaction order explicitly.");
+
+        m->unit_order_cyclic = true;
+        m->unit_order_recheck = false;
+}
+
+void unit_order_add_unit(Unit *u) {
+        assert(u);
+
+        /* New units have no dependencies yet, hence may go anywhere. Put them at the end. */
+        u->order_index = u->manager->unit_order_next++;
+}
+
+void unit_order_remove_unit(Unit *u) {
+        assert(u);
+
+        /* Removing a unit never invalidates a valid order, but it might break a cycle */
+        if (u->manager->unit_order_cyclic)
+                u->manager->unit_order_recheck = true;
+}
+
+static int unit_order_collect(
+                Unit *start,
+                Unit *stop,
+                bool forward,
+                uint64_t bound,
+                unsigned marker,
+                Unit ***list,
+                size_t *n_list,
+                size_t *n_allocated) {
+
+        size_t k;
+
+        /* Collects all units reachable from start (following Before= if forward, After= otherwise) that
+         * are positioned in the affected region, i.e. before the bound if forward and after it otherwise.
+         * Returns -ELOOP if stop is reachable. */
+
+        if (!GREEDY_REALLOC(*list, *n_allocated, 1))
+                return -ENOMEM;
+
+        (*list)[0] = start;
+        *n_list = 1;
+        start->order_marker = marker;
+
+        for (k = 0; k < *n_list; k++) {
+                Iterator i;
+                Unit *other;
+
+                UNIT_FOREACH_DEPENDENCY(other, (*list)[k], forward ? UNIT_BEFORE : UNIT_AFTER, i) {
+                        if (other == stop)
+                                return -ELOOP;
+
+                        if (other->order_marker == marker)
+                                continue;
+
+                        if (forward ? other->order_index > bound : other->order_index < bound)
+                                continue;
+
+                        if (!GREEDY_REALLOC(*list, *n_allocated, *n_list + 1))
+                                return -ENOMEM;
+
+                        other->order_marker = marker;
+                        (*list)[(*n_list)++] = other;
+                }
+        }
+
+        return 0;
+}
+
+static int unit_order_compare(const void *a, const void *b) {
+        const Unit *x = *(const Unit**) a, *y = *(const Unit**) b;
+
+        if (x->order_index < y->order_index)
+                return -1;
+        if (x->order_index > y->order_index)
+                return 1;
+        return 0;
+}
+
+static int uint64_compare(const void *a, const void *b) {
+        const uint64_t *x = a, *y = b;
+
+        if (*x < *y)
+                return -1;
+        if (*x > *y)
+                return 1;
+        return 0;
+}
+
+void unit_order_add_edge(Unit *before, Unit *after) {
+        _cleanup_free_ Unit **forward = NULL, **backward = NULL;
+        size_t n_forward = 0, n_backward = 0, n_forward_allocated = 0, n_backward_allocated = 0, k, n;
+        _cleanup_free_ uint64_t *indexes = NULL;
+        Manager *m;
+        int r;
+
+        assert(before);
+        assert(after);
+        assert(before != after);
+
+        m = before->manager;
+
+        if (m->unit_order_cyclic)
+                return;
+
+        /* Nothing to do if the new edge agrees with the current order */
+        if (before->order_index < after->order_index)
+                return;
+
+        /* Find everything ordered after 'after' that is currently placed before 'before', and everything
+         * ordered before 'before' that is currently placed after 'after'. Only these units need to be
+         * moved. */
+        m->unit_order_generation += 2;
+
+        r = unit_order_collect(after, before, true, before->order_index, m->unit_order_generation, &forward, &n_forward, &n_forward_allocated);
+        if (r >= 0)
+                r = unit_order_collect(before, after, false, after->order_index, m->unit_order_generation + 1, &backward, &n_backward, &n_backward_allocated);
+        if (r < 0) {
+                if (r == -ELOOP)
+                        log_unit_debug(before, "Ordering cycle found between %s and %s.", before->id, after->id);
+                unit_order_invalidate(m);
+                return;
+        }
+
+        n = n_forward + n_backward;
+        indexes = new(uint64_t, n);
+        if (!indexes) {
+                unit_order_invalidate(m);
+                return;
+        }
+
+        /* Pool the positions of both sets, and hand them out again, first to everything that needs to go
+         * before the edge, then to everything that needs to go after it, keeping the relative order within
+         * each set. */
+        for (k = 0; k < n_backward; k++)
+                indexes[k] = backward[k]->order_index;
+        for (k = 0; k < n_forward; k++)
+                indexes[n_backward + k] = forward[k]->order_index;
+
+        qsort(indexes, n, sizeof(uint64_t), uint64_compare);
+        qsort(backward, n_backward, sizeof(Unit*), unit_order_compare);
+        qsort(forward, n_forward, sizeof(Unit*), unit_order_compare);
+
+        for (k = 0; k < n_backward; k++)
+                backward[k]->order_index = indexes[k];
+        for (k = 0; k < n_forward; k++)
+                forward[k]->order_index = indexes[n_backward + k];
+}
+
+static int unit_order_rebuild(Manager *m) {
+        _cleanup_free_ Unit **queue = NULL;
+        size_t n_queue = 0, n_allocated = 0, n_units = 0, k;
+        UnitType t;
+        Unit *u;
+
+        assert(m);
+
+        /* Recomputes the order from scratch with Kahn's algorithm, using the marker of each unit to count
+         * the units it is ordered after that have not been placed yet. Returns -ELOOP if there's a cycle. */
+
+        for (t = 0; t < _UNIT_TYPE_MAX; t++)
+                LIST_FOREACH(units_by_type, u, m->units_by_type[t]) {
+                        u->order_marker = unit_dependencies_count(&u->dependencies, UNIT_DEPENDENCY_MASK(UNIT_AFTER));
+                        n_units++;
+
+                        if (u->order_marker == 0) {
+                                if (!GREEDY_REALLOC(queue, n_allocated, n_queue + 1))
+                                        return -ENOMEM;
+
+                                queue[n_queue++] = u;
+                        }
+                }
+
+        m->unit_order_next = 0;
+
+        for (k = 0; k < n_queue; k++) {
+                Iterator i;
+                Unit *other;
+
+                queue[k]->order_index = m->unit_order_next++;
+
+                UNIT_FOREACH_DEPENDENCY(other, queue[k], UNIT_BEFORE, i) {
+                        assert(other->order_marker > 0);
+
+                        if (--other->order_marker > 0)
+                                continue;
+
+                        if (!GREEDY_REALLOC(queue, n_allocated, n_queue + 1))
+                                return -ENOMEM;
+
+                        queue[n_queue++] = other;
+                }
+        }
+
+        if (n_queue < n_units)
+                return -ELOOP;
+
+        return 0;
+}
+
+bool unit_order_is_acyclic(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->unit_order_cyclic && m->unit_order_recheck) {
+                r = unit_order_rebuild(m);
+                if (r >= 0) {
+                        log_debug("Unit ordering graph is acyclic again.");
+                        m->unit_order_cyclic = false;
+                }
+
+                m->unit_order_recheck = false;
+        }
+
+        return !m->unit_order_cyclic;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+
+#include "unit.h"
+
+/* Maintains a topological order of all units along their Before=/After= dependencies, which is updated
+ * incrementally as ordering dependencies are added (using the algorithm by Pearce and Kelly). As long as
+ * the unit ordering graph is acyclic, no transaction built on top of it can contain an ordering cycle, and
+ * verifying the transaction order may be skipped. Once a cycle is found the order is abandoned, and it is
+ * recomputed from scratch only after some unit has been removed. */
+
+void unit_order_add_unit(Unit *u);
+void unit_order_remove_unit(Unit *u);
+void unit_order_add_edge(Unit *before, Unit *after);
+
+bool unit_order_is_acyclic(Manager *m);
@@ -52,10 +52,12 @@
 #include "special.h"
 #include "stat-util.h"
 #include "stdio-util.h"
+#include "string-table.h"
 #include "string-util.h"
 #include "strv.h"
 #include "umask-util.h"
 #include "unit-name.h"
+#include "unit-order.h"
 #include "unit.h"
 #include "user-util.h"
 #include "virt.h"
@@ -93,16 +95,19 @@ Unit *unit_new(Manager *m, size_t size) {
 
         u->manager = m;
         u->type = _UNIT_TYPE_INVALID;
+        unit_order_add_unit(u);
         u->default_dependencies = true;
         u->unit_file_state = _UNIT_FILE_STATE_INVALID;
         u->unit_file_preset = -1;
         u->on_failure_job_mode = JOB_REPLACE;
         u->cgroup_inotify_wd = -1;
+        u->cgroup_fd = -1;
         u->job_timeout = USEC_INFINITY;
         u->job_running_timeout = USEC_INFINITY;
         u->ref_uid = UID_INVALID;
         u->ref_gid = GID_INVALID;
         u->cpu_usage_last = NSEC_INFINITY;
+        u->changed_generation = ++m->units_generation;
 
         RATELIMIT_INIT(u->start_limit, m->default_start_limit_interval, m->default_start_limit_burst);
         RATELIMIT_INIT(u->auto_stop_ratelimit, 10 * USEC_PER_SEC, 16);
@@ -394,10 +399,19 @@ void unit_add_to_gc_queue(Unit *u) {
         u->in_gc_queue = true;
 }
 
+void unit_bump_generation(Unit *u) {
+        assert(u);
+
+        u->changed_generation = ++u->manager->units_generation;
+}
+
 void unit_add_to_dbus_queue(Unit *u) {
         assert(u);
         assert(u->type != _UNIT_TYPE_INVALID);
 
+        /* Everything that is worth a change signal is also worth a new generation */
+        unit_bump_generation(u);
+
         if (u->load_state == UNIT_STUB || u->in_dbus_queue)
                 return;
 
@@ -413,25 +427,22 @@ void unit_add_to_dbus_queue(Unit *u) {
         u->in_dbus_queue = true;
 }
 
-static void bidi_set_free(Unit *u, Set *s) {
-        Iterator i;
-        Unit *other;
+static void unit_free_dependencies(Unit *u) {
+        size_t k;
 
         assert(u);
 
-        /* Frees the set and makes sure we are dropped from the
-         * inverse pointers */
-
-        SET_FOREACH(other, s, i) {
-                UnitDependency d;
+        /* Frees the dependency table and makes sure we are dropped
+         * from the inverse pointers */
 
-                for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        set_remove(other->dependencies[d], u);
+        for (k = 0; k < u->dependencies.n_entries; k++) {
+                Unit *other = u->dependencies.entries[k].other;
 
+                (void) unit_dependencies_remove(&other->dependencies, u, UINT32_MAX);
                 unit_add_to_gc_queue(other);
         }
 
-        set_free(s);
+        unit_dependencies_clear(&u->dependencies);
 }
 
 static void unit_remove_transient(Unit *u) {
@@ -442,7 +453,8 @@ static void unit_remove_transient(Unit *u) {
         if (!u->transient)
                 return;
 
-        if (u->fragment_path)
+        /* If the unit file was never written out there's nothing to remove */
+        if (u->fragment_path && !u->transient_data)
                 (void) unlink(u->fragment_path);
 
         STRV_FOREACH(i, u->dropin_paths) {
@@ -514,7 +526,6 @@ static void unit_done(Unit *u) {
 }
 
 void unit_free(Unit *u) {
-        UnitDependency d;
         Iterator i;
         char *t;
 
@@ -527,7 +538,10 @@ void unit_free(Unit *u) {
         if (!MANAGER_IS_RELOADING(u->manager))
                 unit_remove_transient(u);
 
+        free(u->transient_data);
+
         bus_unit_send_removed_signal(u);
+        u->manager->units_removed_generation = ++u->manager->units_generation;
 
         unit_done(u);
 
@@ -556,8 +570,8 @@ void unit_free(Unit *u) {
                 job_free(j);
         }
 
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                bidi_set_free(u, u->dependencies[d]);
+        unit_free_dependencies(u);
+        unit_order_remove_unit(u);
 
         if (u->type != _UNIT_TYPE_INVALID)
                 LIST_REMOVE(units_by_type, u->manager->units_by_type[u->type], u);
@@ -577,6 +591,12 @@ void unit_free(Unit *u) {
         if (u->in_cgroup_queue)
                 LIST_REMOVE(cgroup_queue, u->manager->cgroup_queue, u);
 
+        if (u->in_cgroup_empty_queue)
+                LIST_REMOVE(cgroup_empty_queue, u->manager->cgroup_empty_queue, u);
+
+        if (u->in_transient_queue)
+                LIST_REMOVE(transient_queue, u->manager->transient_queue, u);
+
         unit_release_cgroup(u);
 
         unit_unref_uid_gid(u, false);
@@ -672,68 +692,51 @@ static int merge_names(Unit *u, Unit *other) {
         return 0;
 }
 
-static int reserve_dependencies(Unit *u, Unit *other, UnitDependency d) {
-        unsigned n_reserve;
-
-        assert(u);
-        assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
-
-        /*
-         * If u does not have this dependency set allocated, there is no need
-         * to reserve anything. In that case other's set will be transferred
-         * as a whole to u by complete_move().
-         */
-        if (!u->dependencies[d])
-                return 0;
-
-        /* merge_dependencies() will skip a u-on-u dependency */
-        n_reserve = set_size(other->dependencies[d]) - !!set_get(other->dependencies[d], u);
+static void maybe_warn_about_dependencies(Unit *u, const char *other, uint32_t mask) {
+        UnitDependency d;
 
-        return set_reserve(u->dependencies[d], n_reserve);
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                if (mask & UNIT_DEPENDENCY_MASK(d))
+                        maybe_warn_about_dependency(u, other, d);
 }
 
-static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitDependency d) {
-        Iterator i;
-        Unit *back;
-        int r;
+static void merge_dependencies(Unit *u, Unit *other, const char *other_id) {
+        size_t k;
 
         assert(u);
         assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
-
-        /* Fix backwards pointers */
-        SET_FOREACH(back, other->dependencies[d], i) {
-                UnitDependency k;
-
-                for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++) {
-                        /* Do not add dependencies between u and itself */
-                        if (back == u) {
-                                if (set_remove(back->dependencies[k], other))
-                                        maybe_warn_about_dependency(u, other_id, k);
-                        } else {
-                                r = set_remove_and_put(back->dependencies[k], other, u);
-                                if (r == -EEXIST)
-                                        set_remove(back->dependencies[k], other);
-                                else
-                                        assert(r >= 0 || r == -ENOENT);
-                        }
+
+        for (k = 0; k < other->dependencies.n_entries; k++) {
+                Unit *back = other->dependencies.entries[k].other;
+                uint32_t mask;
+
+                /* Fix backwards pointers */
+                mask = unit_dependencies_remove(&back->dependencies, other, UINT32_MAX);
+
+                /* Do not add dependencies between u and itself */
+                if (back == u) {
+                        maybe_warn_about_dependencies(u, other_id, mask);
+                        maybe_warn_about_dependencies(u, other_id, other->dependencies.entries[k].mask);
+                        continue;
                 }
-        }
 
-        /* Also do not move dependencies on u to itself */
-        back = set_remove(other->dependencies[d], u);
-        if (back)
-                maybe_warn_about_dependency(u, other_id, d);
+                /* This cannot fail, we just made room for the entry by removing the old one */
+                if (mask != 0)
+                        assert_se(unit_dependencies_add(&back->dependencies, u, mask) >= 0);
 
-        /* The move cannot fail. The caller must have performed a reservation. */
-        assert_se(complete_move(&u->dependencies[d], &other->dependencies[d]) == 0);
+                /* The move cannot fail either. The caller must have performed a reservation. */
+                assert_se(unit_dependencies_add(&u->dependencies, back, other->dependencies.entries[k].mask) >= 0);
+
+                if (other->dependencies.entries[k].mask & UNIT_DEPENDENCY_MASK(UNIT_BEFORE))
+                        unit_order_add_edge(u, back);
+                if (other->dependencies.entries[k].mask & UNIT_DEPENDENCY_MASK(UNIT_AFTER))
+                        unit_order_add_edge(back, u);
+        }
 
-        other->dependencies[d] = set_free(other->dependencies[d]);
+        unit_dependencies_clear(&other->dependencies);
 }
 
 int unit_merge(Unit *u, Unit *other) {
-        UnitDependency d;
         const char *other_id = NULL;
         int r;
 
@@ -772,16 +775,12 @@ int unit_merge(Unit *u, Unit *other) {
         if (other->id)
                 other_id = strdupa(other->id);
 
-        /* Make reservations to ensure merge_dependencies() won't fail */
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
-                r = reserve_dependencies(u, other, d);
-                /*
-                 * We don't rollback reservations if we fail. We don't have
-                 * a way to undo reservations. A reservation is not a leak.
-                 */
-                if (r < 0)
-                        return r;
-        }
+        /* Make reservations to ensure merge_dependencies() won't fail.
+         * We don't rollback reservations if we fail. A reservation is
+         * not a leak. */
+        r = unit_dependencies_reserve(&u->dependencies, other->dependencies.n_entries);
+        if (r < 0)
+                return r;
 
         /* Merge names */
         r = merge_names(u, other);
@@ -793,8 +792,7 @@ int unit_merge(Unit *u, Unit *other) {
                 unit_ref_set(other->refs, u);
 
         /* Merge dependencies */
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                merge_dependencies(u, other, other_id, d);
+        merge_dependencies(u, other, other_id);
 
         other->load_state = UNIT_MERGED;
         other->merged_into = u;
@@ -1046,7 +1044,7 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
                 Unit *other;
 
-                SET_FOREACH(other, u->dependencies[d], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, d, i)
                         fprintf(f, "%s\t%s: %s\n", prefix, unit_dependency_to_string(d), other->id);
         }
 
@@ -1167,7 +1165,7 @@ int unit_add_default_target_dependency(Unit *u, Unit *target) {
                 return 0;
 
         /* Don't create loops */
-        if (set_get(target->dependencies[UNIT_BEFORE], u))
+        if (unit_dependencies_contains(&target->dependencies, u, UNIT_BEFORE))
                 return 0;
 
         return unit_add_dependency(target, UNIT_AFTER, u, true);
@@ -1190,7 +1188,7 @@ static int unit_add_target_dependencies(Unit *u) {
         assert(u);
 
         for (k = 0; k < ELEMENTSOF(deps); k++)
-                SET_FOREACH(target, u->dependencies[deps[k]], i) {
+                UNIT_FOREACH_DEPENDENCY(target, u, deps[k], i) {
                         r = unit_add_default_target_dependency(u, target);
                         if (r < 0)
                                 return r;
@@ -1306,6 +1304,12 @@ int unit_load(Unit *u) {
                 fclose(u->transient_file);
                 u->transient_file = NULL;
 
+                /* The unit file contents are now complete, but only live in memory. Since the settings have
+                 * already been applied directly we don't need the file for loading, hence write it out
+                 * later, so that units that come and go quickly never touch the disk. */
+                if (u->transient_data)
+                        unit_add_to_transient_queue(u);
+
                 u->fragment_mtime = now(CLOCK_REALTIME);
         }
 
@@ -1338,7 +1342,7 @@ int unit_load(Unit *u) {
                 if (r < 0)
                         goto fail;
 
-                if (u->on_failure_job_mode == JOB_ISOLATE && set_size(u->dependencies[UNIT_ON_FAILURE]) > 1) {
+                if (u->on_failure_job_mode == JOB_ISOLATE && unit_dependencies_count(&u->dependencies, UNIT_DEPENDENCY_MASK(UNIT_ON_FAILURE)) > 1) {
                         log_unit_error(u, "More than one OnFailure= dependencies specified but OnFailureJobMode=isolate set. Refusing.");
                         r = -EINVAL;
                         goto fail;
@@ -1560,9 +1564,9 @@ static bool unit_verify_deps(Unit *u) {
          * processing, but do not have any effect afterwards. We don't check BindsTo= dependencies that are not used in
          * conjunction with After= as for them any such check would make things entirely racy. */
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], j) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, j) {
 
-                if (!set_contains(u->dependencies[UNIT_AFTER], other))
+                if (!unit_dependencies_contains(&u->dependencies, other, UNIT_AFTER))
                         continue;
 
                 if (!UNIT_IS_ACTIVE_OR_RELOADING(unit_active_state(other))) {
@@ -1793,7 +1797,7 @@ static void unit_check_unneeded(Unit *u) {
                 return;
 
         for (j = 0; j < ELEMENTSOF(needed_dependencies); j++)
-                SET_FOREACH(other, u->dependencies[needed_dependencies[j]], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, needed_dependencies[j], i)
                         if (unit_active_or_pending(other))
                                 return;
 
@@ -1828,7 +1832,7 @@ static void unit_check_binds_to(Unit *u) {
         if (unit_active_state(u) != UNIT_ACTIVE)
                 return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i) {
                 if (other->job)
                         continue;
 
@@ -1866,26 +1870,26 @@ static void retroactively_start_dependencies(Unit *u) {
         assert(u);
         assert(UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)));
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
+                if (!unit_dependencies_contains(&u->dependencies, other, UNIT_AFTER) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
+                if (!unit_dependencies_contains(&u->dependencies, other, UNIT_AFTER) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
+                if (!unit_dependencies_contains(&u->dependencies, other, UNIT_AFTER) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 }
@@ -1898,7 +1902,7 @@ static void retroactively_stop_dependencies(Unit *u) {
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Pull down units which are bound to us recursively if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_BOUND_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, NULL, NULL);
 }
@@ -1911,16 +1915,16 @@ static void check_unneeded_dependencies(Unit *u) {
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Garbage collect services that might not be needed anymore, if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUISITE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
 }
@@ -1931,12 +1935,12 @@ void unit_start_on_failure(Unit *u) {
 
         assert(u);
 
-        if (set_size(u->dependencies[UNIT_ON_FAILURE]) <= 0)
+        if (!unit_dependencies_first(&u->dependencies, UNIT_DEPENDENCY_MASK(UNIT_ON_FAILURE)))
                 return;
 
         log_unit_info(u, "Triggering OnFailure= dependencies.");
 
-        SET_FOREACH(other, u->dependencies[UNIT_ON_FAILURE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_ON_FAILURE, i) {
                 int r;
 
                 r = manager_add_job(u->manager, JOB_START, other, u->on_failure_job_mode, NULL, NULL);
@@ -1951,7 +1955,7 @@ void unit_trigger_notify(Unit *u) {
 
         assert(u);
 
-        SET_FOREACH(other, u->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_TRIGGERED_BY, i)
                 if (UNIT_VTABLE(other)->trigger_notify)
                         UNIT_VTABLE(other)->trigger_notify(other, u);
 }
@@ -2316,8 +2320,9 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
                 [UNIT_RELOAD_PROPAGATED_FROM] = UNIT_PROPAGATES_RELOAD_TO,
                 [UNIT_JOINS_NAMESPACE_OF] = UNIT_JOINS_NAMESPACE_OF,
         };
-        int r, q = 0, v = 0, w = 0;
         Unit *orig_u = u, *orig_other = other;
+        uint32_t mask, inverse_mask, added;
+        int r;
 
         assert(u);
         assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
@@ -2338,64 +2343,37 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
                 return 0;
         }
 
-        r = set_ensure_allocated(&u->dependencies[d], NULL);
-        if (r < 0)
-                return r;
+        mask = UNIT_DEPENDENCY_MASK(d);
+        if (add_reference)
+                mask |= UNIT_DEPENDENCY_MASK(UNIT_REFERENCES);
 
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID) {
-                r = set_ensure_allocated(&other->dependencies[inverse_table[d]], NULL);
-                if (r < 0)
-                        return r;
-        }
+        inverse_mask = 0;
+        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d)
+                inverse_mask |= UNIT_DEPENDENCY_MASK(inverse_table[d]);
+        if (add_reference)
+                inverse_mask |= UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY);
 
-        if (add_reference) {
-                r = set_ensure_allocated(&u->dependencies[UNIT_REFERENCES], NULL);
-                if (r < 0)
-                        return r;
+        r = unit_dependencies_add(&u->dependencies, other, mask);
+        if (r < 0)
+                return r;
+        added = r;
 
-                r = set_ensure_allocated(&other->dependencies[UNIT_REFERENCED_BY], NULL);
-                if (r < 0)
+        if (inverse_mask != 0) {
+                r = unit_dependencies_add(&other->dependencies, u, inverse_mask);
+                if (r < 0) {
+                        if (added != 0)
+                                (void) unit_dependencies_remove(&u->dependencies, other, added);
                         return r;
-        }
-
-        q = set_put(u->dependencies[d], other);
-        if (q < 0)
-                return q;
-
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID && inverse_table[d] != d) {
-                v = set_put(other->dependencies[inverse_table[d]], u);
-                if (v < 0) {
-                        r = v;
-                        goto fail;
                 }
         }
 
-        if (add_reference) {
-                w = set_put(u->dependencies[UNIT_REFERENCES], other);
-                if (w < 0) {
-                        r = w;
-                        goto fail;
-                }
-
-                r = set_put(other->dependencies[UNIT_REFERENCED_BY], u);
-                if (r < 0)
-                        goto fail;
-        }
+        if (d == UNIT_BEFORE)
+                unit_order_add_edge(u, other);
+        else if (d == UNIT_AFTER)
+                unit_order_add_edge(other, u);
 
         unit_add_to_dbus_queue(u);
         return 0;
-
-fail:
-        if (q > 0)
-                set_remove(u->dependencies[d], other);
-
-        if (v > 0)
-                set_remove(other->dependencies[inverse_table[d]], u);
-
-        if (w > 0)
-                set_remove(u->dependencies[UNIT_REFERENCES], other);
-
-        return r;
 }
 
 int unit_add_two_dependencies(Unit *u, UnitDependency d, UnitDependency e, Unit *other, bool add_reference) {
@@ -2707,32 +2685,38 @@ bool unit_can_serialize(Unit *u) {
         return UNIT_VTABLE(u)->serialize && UNIT_VTABLE(u)->deserialize_item;
 }
 
-static int unit_serialize_cgroup_mask(FILE *f, const char *key, CGroupMask mask) {
+static int unit_serialize_cgroup_mask(Unit *u, FILE *f, const char *key, CGroupMask mask) {
         _cleanup_free_ char *s = NULL;
-        int r = 0;
+        int r;
 
+        assert(u);
         assert(f);
         assert(key);
 
-        if (mask != 0) {
-                r = cg_mask_to_string(mask, &s);
-                if (r >= 0) {
-                        fputs(key, f);
-                        fputc('=', f);
-                        fputs(s, f);
-                        fputc('\n', f);
-                }
-        }
-        return r;
+        if (mask == 0)
+                return 0;
+
+        /* The binary format carries the mask as is, the text format its string representation */
+        if (u->manager->serializer)
+                return serialize_item_uint64(u->manager->serializer, f, key, mask);
+
+        r = cg_mask_to_string(mask, &s);
+        if (r < 0)
+                return r;
+
+        return serialize_item(NULL, f, key, s);
 }
 
 int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
+        Serializer *s;
         int r;
 
         assert(u);
         assert(f);
         assert(fds);
 
+        s = u->manager->serializer;
+
         if (unit_can_serialize(u)) {
                 ExecRuntime *rt;
 
@@ -2748,97 +2732,75 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
                 }
         }
 
-        dual_timestamp_serialize(f, "state-change-timestamp", &u->state_change_timestamp);
+        (void) serialize_dual_timestamp(s, f, "state-change-timestamp", &u->state_change_timestamp);
+
+        (void) serialize_dual_timestamp(s, f, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
+        (void) serialize_dual_timestamp(s, f, "active-enter-timestamp", &u->active_enter_timestamp);
+        (void) serialize_dual_timestamp(s, f, "active-exit-timestamp", &u->active_exit_timestamp);
+        (void) serialize_dual_timestamp(s, f, "inactive-enter-timestamp", &u->inactive_enter_timestamp);
 
-        dual_timestamp_serialize(f, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
-        dual_timestamp_serialize(f, "active-enter-timestamp", &u->active_enter_timestamp);
-        dual_timestamp_serialize(f, "active-exit-timestamp", &u->active_exit_timestamp);
-        dual_timestamp_serialize(f, "inactive-enter-timestamp", &u->inactive_enter_timestamp);
+        (void) serialize_dual_timestamp(s, f, "job-queued-timestamp", &u->job_queued_timestamp);
+        (void) serialize_dual_timestamp(s, f, "job-running-timestamp", &u->job_running_timestamp);
+        (void) serialize_dual_timestamp(s, f, "first-fork-timestamp", &u->first_fork_timestamp);
+        (void) serialize_dual_timestamp(s, f, "ready-timestamp", &u->ready_timestamp);
 
-        dual_timestamp_serialize(f, "condition-timestamp", &u->condition_timestamp);
-        dual_timestamp_serialize(f, "assert-timestamp", &u->assert_timestamp);
+        (void) serialize_dual_timestamp(s, f, "condition-timestamp", &u->condition_timestamp);
+        (void) serialize_dual_timestamp(s, f, "assert-timestamp", &u->assert_timestamp);
 
         if (dual_timestamp_is_set(&u->condition_timestamp))
-                unit_serialize_item(u, f, "condition-result", yes_no(u->condition_result));
+                (void) serialize_item_boolean(s, f, "condition-result", u->condition_result);
 
         if (dual_timestamp_is_set(&u->assert_timestamp))
-                unit_serialize_item(u, f, "assert-result", yes_no(u->assert_result));
+                (void) serialize_item_boolean(s, f, "assert-result", u->assert_result);
 
-        unit_serialize_item(u, f, "transient", yes_no(u->transient));
+        (void) serialize_item_boolean(s, f, "transient", u->transient);
 
-        unit_serialize_item_format(u, f, "cpu-usage-base", "%" PRIu64, u->cpu_usage_base);
+        (void) serialize_item_uint64(s, f, "cpu-usage-base", u->cpu_usage_base);
         if (u->cpu_usage_last != NSEC_INFINITY)
-                unit_serialize_item_format(u, f, "cpu-usage-last", "%" PRIu64, u->cpu_usage_last);
+                (void) serialize_item_uint64(s, f, "cpu-usage-last", u->cpu_usage_last);
 
-        if (u->cgroup_path)
-                unit_serialize_item(u, f, "cgroup", u->cgroup_path);
-        unit_serialize_item(u, f, "cgroup-realized", yes_no(u->cgroup_realized));
-        (void) unit_serialize_cgroup_mask(f, "cgroup-realized-mask", u->cgroup_realized_mask);
-        (void) unit_serialize_cgroup_mask(f, "cgroup-enabled-mask", u->cgroup_enabled_mask);
+        (void) serialize_item(s, f, "cgroup", u->cgroup_path);
+        (void) serialize_item_boolean(s, f, "cgroup-realized", u->cgroup_realized);
+        (void) unit_serialize_cgroup_mask(u, f, "cgroup-realized-mask", u->cgroup_realized_mask);
+        (void) unit_serialize_cgroup_mask(u, f, "cgroup-enabled-mask", u->cgroup_enabled_mask);
 
         if (uid_is_valid(u->ref_uid))
-                unit_serialize_item_format(u, f, "ref-uid", UID_FMT, u->ref_uid);
+                (void) serialize_item_uint64(s, f, "ref-uid", u->ref_uid);
         if (gid_is_valid(u->ref_gid))
-                unit_serialize_item_format(u, f, "ref-gid", GID_FMT, u->ref_gid);
+                (void) serialize_item_uint64(s, f, "ref-gid", u->ref_gid);
 
         if (!sd_id128_is_null(u->invocation_id))
-                unit_serialize_item_format(u, f, "invocation-id", SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(u->invocation_id));
+                (void) serialize_item_format(s, f, "invocation-id", SD_ID128_FORMAT_STR, SD_ID128_FORMAT_VAL(u->invocation_id));
 
-        bus_track_serialize(u->bus_track, f, "ref");
+        bus_track_serialize(u->bus_track, s, f, "ref");
 
         if (serialize_jobs) {
                 if (u->job) {
-                        fprintf(f, "job\n");
+                        (void) serialize_item(s, f, "job", "");
                         job_serialize(u->job, f);
                 }
 
                 if (u->nop_job) {
-                        fprintf(f, "job\n");
+                        (void) serialize_item(s, f, "job", "");
                         job_serialize(u->nop_job, f);
                 }
         }
 
         /* End marker */
-        fputc('\n', f);
+        (void) serialize_end(s, f);
         return 0;
 }
 
 int unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value) {
         assert(u);
-        assert(f);
-        assert(key);
-
-        if (!value)
-                return 0;
 
-        fputs(key, f);
-        fputc('=', f);
-        fputs(value, f);
-        fputc('\n', f);
-
-        return 1;
+        return serialize_item(u->manager->serializer, f, key, value);
 }
 
 int unit_serialize_item_escaped(Unit *u, FILE *f, const char *key, const char *value) {
-        _cleanup_free_ char *c = NULL;
-
         assert(u);
-        assert(f);
-        assert(key);
-
-        if (!value)
-                return 0;
-
-        c = cescape(value);
-        if (!c)
-                return -ENOMEM;
 
-        fputs(key, f);
-        fputc('=', f);
-        fputs(c, f);
-        fputc('\n', f);
-
-        return 1;
+        return serialize_item_escaped(u->manager->serializer, f, key, value);
 }
 
 int unit_serialize_item_fd(Unit *u, FILE *f, FDSet *fds, const char *key, int fd) {
@@ -2855,35 +2817,161 @@ int unit_serialize_item_fd(Unit *u, FILE *f, FDSet *fds, const char *key, int fd
         if (copy < 0)
                 return copy;
 
-        fprintf(f, "%s=%i\n", key, copy);
-        return 1;
+        return serialize_item_fd(u->manager->serializer, f, key, copy);
 }
 
 void unit_serialize_item_format(Unit *u, FILE *f, const char *key, const char *format, ...) {
+        _cleanup_free_ char *v = NULL;
         va_list ap;
+        int r;
 
         assert(u);
         assert(f);
         assert(key);
         assert(format);
 
-        fputs(key, f);
-        fputc('=', f);
-
         va_start(ap, format);
-        vfprintf(f, format, ap);
+        r = vasprintf(&v, format, ap);
         va_end(ap);
+        if (r < 0) {
+                log_oom();
+                return;
+        }
+
+        (void) serialize_item(u->manager->serializer, f, key, v);
+}
+
+int unit_serialize_dual_timestamp(Unit *u, FILE *f, const char *key, dual_timestamp *t) {
+        assert(u);
+
+        return serialize_dual_timestamp(u->manager->serializer, f, key, t);
+}
+
+typedef enum UnitSerializeKey {
+        UNIT_SERIALIZE_JOB,
+        UNIT_SERIALIZE_STATE_CHANGE_TIMESTAMP,
+        UNIT_SERIALIZE_INACTIVE_EXIT_TIMESTAMP,
+        UNIT_SERIALIZE_ACTIVE_ENTER_TIMESTAMP,
+        UNIT_SERIALIZE_ACTIVE_EXIT_TIMESTAMP,
+        UNIT_SERIALIZE_INACTIVE_ENTER_TIMESTAMP,
+        UNIT_SERIALIZE_JOB_QUEUED_TIMESTAMP,
+        UNIT_SERIALIZE_JOB_RUNNING_TIMESTAMP,
+        UNIT_SERIALIZE_FIRST_FORK_TIMESTAMP,
+        UNIT_SERIALIZE_READY_TIMESTAMP,
+        UNIT_SERIALIZE_CONDITION_TIMESTAMP,
+        UNIT_SERIALIZE_ASSERT_TIMESTAMP,
+        UNIT_SERIALIZE_CONDITION_RESULT,
+        UNIT_SERIALIZE_ASSERT_RESULT,
+        UNIT_SERIALIZE_TRANSIENT,
+        UNIT_SERIALIZE_CPU_USAGE_BASE,
+        UNIT_SERIALIZE_CPU_USAGE_LAST,
+        UNIT_SERIALIZE_CGROUP,
+        UNIT_SERIALIZE_CGROUP_REALIZED,
+        UNIT_SERIALIZE_CGROUP_REALIZED_MASK,
+        UNIT_SERIALIZE_CGROUP_ENABLED_MASK,
+        UNIT_SERIALIZE_REF_UID,
+        UNIT_SERIALIZE_REF_GID,
+        UNIT_SERIALIZE_REF,
+        UNIT_SERIALIZE_INVOCATION_ID,
+        _UNIT_SERIALIZE_KEY_MAX,
+        _UNIT_SERIALIZE_KEY_INVALID = -1,
+} UnitSerializeKey;
+
+static const char* const unit_serialize_key_table[_UNIT_SERIALIZE_KEY_MAX] = {
+        [UNIT_SERIALIZE_JOB] = "job",
+        [UNIT_SERIALIZE_STATE_CHANGE_TIMESTAMP] = "state-change-timestamp",
+        [UNIT_SERIALIZE_INACTIVE_EXIT_TIMESTAMP] = "inactive-exit-timestamp",
+        [UNIT_SERIALIZE_ACTIVE_ENTER_TIMESTAMP] = "active-enter-timestamp",
+        [UNIT_SERIALIZE_ACTIVE_EXIT_TIMESTAMP] = "active-exit-timestamp",
+        [UNIT_SERIALIZE_INACTIVE_ENTER_TIMESTAMP] = "inactive-enter-timestamp",
+        [UNIT_SERIALIZE_JOB_QUEUED_TIMESTAMP] = "job-queued-timestamp",
+        [UNIT_SERIALIZE_JOB_RUNNING_TIMESTAMP] = "job-running-timestamp",
+        [UNIT_SERIALIZE_FIRST_FORK_TIMESTAMP] = "first-fork-timestamp",
+        [UNIT_SERIALIZE_READY_TIMESTAMP] = "ready-timestamp",
+        [UNIT_SERIALIZE_CONDITION_TIMESTAMP] = "condition-timestamp",
+        [UNIT_SERIALIZE_ASSERT_TIMESTAMP] = "assert-timestamp",
+        [UNIT_SERIALIZE_CONDITION_RESULT] = "condition-result",
+        [UNIT_SERIALIZE_ASSERT_RESULT] = "assert-result",
+        [UNIT_SERIALIZE_TRANSIENT] = "transient",
+        [UNIT_SERIALIZE_CPU_USAGE_BASE] = "cpu-usage-base",
+        [UNIT_SERIALIZE_CPU_USAGE_LAST] = "cpu-usage-last",
+        [UNIT_SERIALIZE_CGROUP] = "cgroup",
+        [UNIT_SERIALIZE_CGROUP_REALIZED] = "cgroup-realized",
+        [UNIT_SERIALIZE_CGROUP_REALIZED_MASK] = "cgroup-realized-mask",
+        [UNIT_SERIALIZE_CGROUP_ENABLED_MASK] = "cgroup-enabled-mask",
+        [UNIT_SERIALIZE_REF_UID] = "ref-uid",
+        [UNIT_SERIALIZE_REF_GID] = "ref-gid",
+        [UNIT_SERIALIZE_REF] = "ref",
+        [UNIT_SERIALIZE_INVOCATION_ID] = "invocation-id",
+};
 
-        fputc('\n', f);
+static int unit_serialize_key_lookup(const char *key) {
+
+        /* Older versions called this one differently */
+        if (streq(key, "cpuacct-usage-base"))
+                return UNIT_SERIALIZE_CPU_USAGE_BASE;
+
+        return string_table_lookup(unit_serialize_key_table, ELEMENTSOF(unit_serialize_key_table), key);
 }
 
-int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
+static int unit_deserialize_job(Unit *u, Deserializer *d, const char *v) {
+        Job *j;
+        int r;
+
+        if (v[0] != '\0') {
+                /* legacy for pre-44 */
+                log_unit_warning(u, "Update from too old systemd versions are unsupported, cannot deserialize job: %s", v);
+                return 0;
+        }
+
+        /* new-style serialized job */
+        j = job_new_raw(u);
+        if (!j)
+                return log_oom();
+
+        r = job_deserialize(j, d);
+        if (r < 0) {
+                job_free(j);
+                return r;
+        }
+
+        r = hashmap_put(u->manager->jobs, UINT32_TO_PTR(j->id), j);
+        if (r < 0) {
+                job_free(j);
+                return r;
+        }
+
+        r = job_install_deserialized(j);
+        if (r < 0) {
+                hashmap_remove(u->manager->jobs, UINT32_TO_PTR(j->id));
+                job_free(j);
+                return r;
+        }
+
+        return 0;
+}
+
+static int unit_deserialize_cgroup_mask(SerializedItem *i, CGroupMask *mask) {
+        uint64_t m;
+
+        if (i->type != SERIALIZED_UINT64)
+                return cg_mask_from_string(serialized_item_string(i), mask);
+
+        m = i->uint64;
+        if ((CGroupMask) m != m)
+                return -ERANGE;
+
+        *mask = m;
+        return 0;
+}
+
+int unit_deserialize(Unit *u, Deserializer *d, FDSet *fds) {
         ExecRuntime **rt = NULL;
         size_t offset;
         int r;
 
         assert(u);
-        assert(f);
+        assert(d);
         assert(fds);
 
         offset = UNIT_VTABLE(u)->exec_runtime_offset;
@@ -2891,194 +2979,176 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                 rt = (ExecRuntime**) ((uint8_t*) u + offset);
 
         for (;;) {
-                char line[LINE_MAX], *l, *v;
-                size_t k;
+                SerializedItem i;
+                const char *l;
+                bool b;
 
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                return 0;
-                        return -errno;
-                }
-
-                char_array_0(line);
-                l = strstrip(line);
+                r = deserializer_read_item(d, &i);
+                if (r < 0)
+                        return r;
 
                 /* End marker */
-                if (isempty(l))
+                if (r == 0)
                         break;
 
-                k = strcspn(l, "=");
+                l = i.key;
 
-                if (l[k] == '=') {
-                        l[k] = 0;
-                        v = l+k+1;
-                } else
-                        v = l+k;
+                /* In the binary format the key is resolved only once per serialization */
+                switch (deserializer_lookup_key(d, &i, unit_serialize_key_lookup)) {
 
-                if (streq(l, "job")) {
-                        if (v[0] == '\0') {
-                                /* new-style serialized job */
-                                Job *j;
+                case UNIT_SERIALIZE_JOB:
+                        r = unit_deserialize_job(u, d, serialized_item_string(&i));
+                        if (r < 0)
+                                return r;
 
-                                j = job_new_raw(u);
-                                if (!j)
-                                        return log_oom();
+                        continue;
 
-                                r = job_deserialize(j, f);
-                                if (r < 0) {
-                                        job_free(j);
-                                        return r;
-                                }
+                case UNIT_SERIALIZE_STATE_CHANGE_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->state_change_timestamp);
+                        continue;
 
-                                r = hashmap_put(u->manager->jobs, UINT32_TO_PTR(j->id), j);
-                                if (r < 0) {
-                                        job_free(j);
-                                        return r;
-                                }
+                case UNIT_SERIALIZE_INACTIVE_EXIT_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->inactive_exit_timestamp);
+                        continue;
 
-                                r = job_install_deserialized(j);
-                                if (r < 0) {
-                                        hashmap_remove(u->manager->jobs, UINT32_TO_PTR(j->id));
-                                        job_free(j);
-                                        return r;
-                                }
-                        } else  /* legacy for pre-44 */
-                                log_unit_warning(u, "Update from too old systemd versions are unsupported, cannot deserialize job: %s", v);
+                case UNIT_SERIALIZE_ACTIVE_ENTER_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->active_enter_timestamp);
                         continue;
-                } else if (streq(l, "state-change-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->state_change_timestamp);
+
+                case UNIT_SERIALIZE_ACTIVE_EXIT_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->active_exit_timestamp);
                         continue;
-                } else if (streq(l, "inactive-exit-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->inactive_exit_timestamp);
+
+                case UNIT_SERIALIZE_INACTIVE_ENTER_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->inactive_enter_timestamp);
                         continue;
-                } else if (streq(l, "active-enter-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->active_enter_timestamp);
+
+                case UNIT_SERIALIZE_JOB_QUEUED_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->job_queued_timestamp);
                         continue;
-                } else if (streq(l, "active-exit-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->active_exit_timestamp);
+
+                case UNIT_SERIALIZE_JOB_RUNNING_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->job_running_timestamp);
+                        continue;
+
+                case UNIT_SERIALIZE_FIRST_FORK_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->first_fork_timestamp);
                         continue;
-                } else if (streq(l, "inactive-enter-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->inactive_enter_timestamp);
+
+                case UNIT_SERIALIZE_READY_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->ready_timestamp);
                         continue;
-                } else if (streq(l, "condition-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->condition_timestamp);
+
+                case UNIT_SERIALIZE_CONDITION_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->condition_timestamp);
                         continue;
-                } else if (streq(l, "assert-timestamp")) {
-                        dual_timestamp_deserialize(v, &u->assert_timestamp);
+
+                case UNIT_SERIALIZE_ASSERT_TIMESTAMP:
+                        (void) serialized_item_get_timestamp(&i, &u->assert_timestamp);
                         continue;
-                } else if (streq(l, "condition-result")) {
 
-                        r = parse_boolean(v);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse condition result value %s, ignoring.", v);
+                case UNIT_SERIALIZE_CONDITION_RESULT:
+                        if (serialized_item_get_boolean(&i, &b) < 0)
+                                log_unit_debug(u, "Failed to parse condition result value %s, ignoring.", serialized_item_string(&i));
                         else
-                                u->condition_result = r;
+                                u->condition_result = b;
 
                         continue;
 
-                } else if (streq(l, "assert-result")) {
-
-                        r = parse_boolean(v);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse assert result value %s, ignoring.", v);
+                case UNIT_SERIALIZE_ASSERT_RESULT:
+                        if (serialized_item_get_boolean(&i, &b) < 0)
+                                log_unit_debug(u, "Failed to parse assert result value %s, ignoring.", serialized_item_string(&i));
                         else
-                                u->assert_result = r;
+                                u->assert_result = b;
 
                         continue;
 
-                } else if (streq(l, "transient")) {
-
-                        r = parse_boolean(v);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse transient bool %s, ignoring.", v);
+                case UNIT_SERIALIZE_TRANSIENT:
+                        if (serialized_item_get_boolean(&i, &b) < 0)
+                                log_unit_debug(u, "Failed to parse transient bool %s, ignoring.", serialized_item_string(&i));
                         else
-                                u->transient = r;
+                                u->transient = b;
 
                         continue;
 
-                } else if (STR_IN_SET(l, "cpu-usage-base", "cpuacct-usage-base")) {
-
-                        r = safe_atou64(v, &u->cpu_usage_base);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse CPU usage base %s, ignoring.", v);
+                case UNIT_SERIALIZE_CPU_USAGE_BASE:
+                        if (serialized_item_get_uint64(&i, &u->cpu_usage_base) < 0)
+                                log_unit_debug(u, "Failed to parse CPU usage base %s, ignoring.", serialized_item_string(&i));
 
                         continue;
 
-                } else if (streq(l, "cpu-usage-last")) {
-
-                        r = safe_atou64(v, &u->cpu_usage_last);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to read CPU usage last %s, ignoring.", v);
+                case UNIT_SERIALIZE_CPU_USAGE_LAST:
+                        if (serialized_item_get_uint64(&i, &u->cpu_usage_last) < 0)
+                                log_unit_debug(u, "Failed to read CPU usage last %s, ignoring.", serialized_item_string(&i));
 
                         continue;
 
-                } else if (streq(l, "cgroup")) {
-
-                        r = unit_set_cgroup_path(u, v);
+                case UNIT_SERIALIZE_CGROUP:
+                        r = unit_set_cgroup_path(u, serialized_item_string(&i));
                         if (r < 0)
-                                log_unit_debug_errno(u, r, "Failed to set cgroup path %s, ignoring: %m", v);
+                                log_unit_debug_errno(u, r, "Failed to set cgroup path %s, ignoring: %m", serialized_item_string(&i));
 
                         (void) unit_watch_cgroup(u);
 
                         continue;
-                } else if (streq(l, "cgroup-realized")) {
-                        int b;
 
-                        b = parse_boolean(v);
-                        if (b < 0)
-                                log_unit_debug(u, "Failed to parse cgroup-realized bool %s, ignoring.", v);
+                case UNIT_SERIALIZE_CGROUP_REALIZED:
+                        if (serialized_item_get_boolean(&i, &b) < 0)
+                                log_unit_debug(u, "Failed to parse cgroup-realized bool %s, ignoring.", serialized_item_string(&i));
                         else
                                 u->cgroup_realized = b;
 
                         continue;
 
-                } else if (streq(l, "cgroup-realized-mask")) {
+                case UNIT_SERIALIZE_CGROUP_REALIZED_MASK:
+                        if (unit_deserialize_cgroup_mask(&i, &u->cgroup_realized_mask) < 0)
+                                log_unit_debug(u, "Failed to parse cgroup-realized-mask %s, ignoring.", serialized_item_string(&i));
 
-                        r = cg_mask_from_string(v, &u->cgroup_realized_mask);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse cgroup-realized-mask %s, ignoring.", v);
                         continue;
 
-                } else if (streq(l, "cgroup-enabled-mask")) {
+                case UNIT_SERIALIZE_CGROUP_ENABLED_MASK:
+                        if (unit_deserialize_cgroup_mask(&i, &u->cgroup_enabled_mask) < 0)
+                                log_unit_debug(u, "Failed to parse cgroup-enabled-mask %s, ignoring.", serialized_item_string(&i));
 
-                        r = cg_mask_from_string(v, &u->cgroup_enabled_mask);
-                        if (r < 0)
-                                log_unit_debug(u, "Failed to parse cgroup-enabled-mask %s, ignoring.", v);
                         continue;
 
-                } else if (streq(l, "ref-uid")) {
+                case UNIT_SERIALIZE_REF_UID: {
                         uid_t uid;
 
-                        r = parse_uid(v, &uid);
+                        r = parse_uid(serialized_item_string(&i), &uid);
                         if (r < 0)
-                                log_unit_debug(u, "Failed to parse referenced UID %s, ignoring.", v);
+                                log_unit_debug(u, "Failed to parse referenced UID %s, ignoring.", serialized_item_string(&i));
                         else
                                 unit_ref_uid_gid(u, uid, GID_INVALID);
 
                         continue;
+                }
 
-                } else if (streq(l, "ref-gid")) {
+                case UNIT_SERIALIZE_REF_GID: {
                         gid_t gid;
 
-                        r = parse_gid(v, &gid);
+                        r = parse_gid(serialized_item_string(&i), &gid);
                         if (r < 0)
-                                log_unit_debug(u, "Failed to parse referenced GID %s, ignoring.", v);
+                                log_unit_debug(u, "Failed to parse referenced GID %s, ignoring.", serialized_item_string(&i));
                         else
                                 unit_ref_uid_gid(u, UID_INVALID, gid);
 
-                } else if (streq(l, "ref")) {
+                        continue;
+                }
 
-                        r = strv_extend(&u->deserialized_refs, v);
+                case UNIT_SERIALIZE_REF:
+                        r = strv_extend(&u->deserialized_refs, serialized_item_string(&i));
                         if (r < 0)
                                 log_oom();
 
                         continue;
-                } else if (streq(l, "invocation-id")) {
+
+                case UNIT_SERIALIZE_INVOCATION_ID: {
                         sd_id128_t id;
 
-                        r = sd_id128_from_string(v, &id);
+                        r = sd_id128_from_string(serialized_item_string(&i), &id);
                         if (r < 0)
-                                log_unit_debug(u, "Failed to parse invocation id %s, ignoring.", v);
+                                log_unit_debug(u, "Failed to parse invocation id %s, ignoring.", serialized_item_string(&i));
                         else {
                                 r = unit_set_invocation_id(u, id);
                                 if (r < 0)
@@ -3088,7 +3158,15 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                         continue;
                 }
 
+                default:
+                        break;
+                }
+
                 if (unit_can_serialize(u)) {
+                        const char *v;
+
+                        v = serialized_item_string(&i);
+
                         if (rt) {
                                 r = exec_runtime_deserialize_item(u, rt, l, v, fds);
                                 if (r < 0) {
@@ -3228,8 +3306,10 @@ bool unit_need_daemon_reload(Unit *u) {
 
         assert(u);
 
-        /* For unit files, we allow masking… */
-        if (fragment_mtime_newer(u->fragment_path, u->fragment_mtime,
+        /* For unit files, we allow masking… A transient unit file that is not written out yet cannot have been
+         * changed behind our back, but its drop-ins might have been. */
+        if (!u->transient_data &&
+            fragment_mtime_newer(u->fragment_path, u->fragment_mtime,
                                  u->load_state == UNIT_MASKED))
                 return true;
 
@@ -3778,19 +3858,23 @@ int unit_make_transient(Unit *u) {
         if (!path)
                 return -ENOMEM;
 
-        /* Let's open the file we'll write the transient settings into. This file is kept open as long as we are
-         * creating the transient, and is closed in unit_load(), as soon as we start loading the file. */
+        /* Let's open the stream we'll write the transient settings into. This stream is kept open as long as we
+         * are creating the transient, and is closed in unit_load(), as soon as we start loading the unit. The
+         * contents are kept in memory until unit_persist_transient() writes them to disk. */
 
-        RUN_WITH_UMASK(0022) {
-                f = fopen(path, "we");
-                if (!f) {
-                        free(path);
-                        return -errno;
-                }
+        if (u->transient_file) {
+                fclose(u->transient_file);
+                u->transient_file = NULL;
+        }
+        u->transient_data = mfree(u->transient_data);
+        u->transient_size = 0;
+
+        f = open_memstream(&u->transient_data, &u->transient_size);
+        if (!f) {
+                free(path);
+                return -errno;
         }
 
-        if (u->transient_file)
-                fclose(u->transient_file);
         u->transient_file = f;
 
         free(u->fragment_path);
@@ -3813,6 +3897,49 @@ int unit_make_transient(Unit *u) {
         return 0;
 }
 
+void unit_add_to_transient_queue(Unit *u) {
+        assert(u);
+
+        if (u->in_transient_queue)
+                return;
+
+        LIST_PREPEND(transient_queue, u->manager->transient_queue, u);
+        u->in_transient_queue = true;
+
+        manager_schedule_transient_persist(u->manager);
+}
+
+int unit_persist_transient(Unit *u) {
+        int r;
+
+        assert(u);
+
+        if (u->transient_data && u->fragment_path) {
+                /* If this fails the unit stays queued, so that we try again later, instead of losing its
+                 * definition. */
+                RUN_WITH_UMASK(0022)
+                        r = write_string_file(u->fragment_path, u->transient_data,
+                                              WRITE_STRING_FILE_CREATE|WRITE_STRING_FILE_ATOMIC|WRITE_STRING_FILE_AVOID_NEWLINE);
+                if (r < 0)
+                        return log_unit_warning_errno(u, r, "Failed to write transient unit file %s: %m", u->fragment_path);
+        }
+
+        if (u->in_transient_queue) {
+                LIST_REMOVE(transient_queue, u->manager->transient_queue, u);
+                u->in_transient_queue = false;
+        }
+
+        if (!u->transient_data || !u->fragment_path)
+                return 0;
+
+        u->transient_data = mfree(u->transient_data);
+        u->transient_size = 0;
+
+        u->fragment_mtime = now(CLOCK_REALTIME);
+
+        return 0;
+}
+
 static void log_kill(pid_t pid, int sig, void *userdata) {
         _cleanup_free_ char *comm = NULL;
 
@@ -4064,7 +4191,7 @@ int unit_setup_exec_runtime(Unit *u) {
                 return 0;
 
         /* Try to get it from somebody else */
-        SET_FOREACH(other, u->dependencies[UNIT_JOINS_NAMESPACE_OF], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_JOINS_NAMESPACE_OF, i) {
 
                 *rt = unit_get_exec_runtime(other);
                 if (*rt) {
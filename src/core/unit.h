@@ -32,8 +32,29 @@ typedef struct UnitStatusMessageFormats UnitStatusMessageFormats;
 #include "emergency-action.h"
 #include "install.h"
 #include "list.h"
+#include "unit-dependency.h"
 #include "unit-name.h"
 
+/* One sample of the accounting data of a unit, taken by unit_sample_accounting() in cgroup.c */
+typedef struct UnitAccountingSample {
+        usec_t timestamp;
+        nsec_t cpu_usage;  /* NSEC_INFINITY if not known */
+        uint64_t memory;   /* UINT64_MAX if not known */
+        uint64_t tasks;    /* UINT64_MAX if not known */
+} UnitAccountingSample;
+
+/* Summary of the accounting samples of a unit, see unit_get_accounting_stats(). Fields are UINT64_MAX if not known. */
+typedef struct UnitAccountingStats {
+        usec_t window;
+        uint64_t cpu_rate;      /* nsec of CPU time per second, averaged over the window */
+        uint64_t cpu_rate_p95;  /* 95th percentile of the rates between individual samples */
+        uint64_t memory_current;
+        uint64_t memory_p50;
+        uint64_t memory_p95;
+        uint64_t memory_max;
+        uint64_t tasks_current;
+} UnitAccountingStats;
+
 typedef enum KillOperation {
         KILL_TERMINATE,
         KILL_TERMINATE_AND_LOG,
@@ -81,7 +102,7 @@ struct Unit {
         char *instance;
 
         Set *names;
-        Set *dependencies[_UNIT_DEPENDENCY_MAX];
+        UnitDependencies dependencies;
 
         char **requires_mounts_for;
 
@@ -99,6 +120,10 @@ struct Unit {
         /* If this is a transient unit we are currently writing, this is where we are writing it to */
         FILE *transient_file;
 
+        /* The contents of the transient unit file, as long as they have not been written to disk yet */
+        char *transient_data;
+        size_t transient_size;
+
         /* If there is something to do with this unit, then this is the installed job for it */
         Job *job;
 
@@ -137,6 +162,14 @@ struct Unit {
         dual_timestamp active_exit_timestamp;
         dual_timestamp inactive_enter_timestamp;
 
+        /* Phases of the most recent start job, to see where the time goes between enqueuing it and the unit
+         * becoming active: when the job was installed, when it was dispatched (i.e. all ordering dependencies were
+         * done), when the first process for it was forked off and when the unit reported it was ready. */
+        dual_timestamp job_queued_timestamp;
+        dual_timestamp job_running_timestamp;
+        dual_timestamp first_fork_timestamp;
+        dual_timestamp ready_timestamp;
+
         UnitRef slice;
 
         /* Per type list */
@@ -160,6 +193,12 @@ struct Unit {
         /* CGroup realize members queue */
         LIST_FIELDS(Unit, cgroup_queue);
 
+        /* Units whose cgroup might have run empty */
+        LIST_FIELDS(Unit, cgroup_empty_queue);
+
+        /* Transient units whose unit file still needs to be written out */
+        LIST_FIELDS(Unit, transient_queue);
+
         /* Units with the same CGroup netclass */
         LIST_FIELDS(Unit, cgroup_netclass);
 
@@ -174,6 +213,14 @@ struct Unit {
         /* Used during GC sweeps */
         unsigned gc_marker;
 
+        /* Position in the topological order of all units, see unit-order.h */
+        uint64_t order_index;
+        unsigned order_marker;
+
+        /* Value of the manager's units generation counter when this unit last changed, see
+         * ListUnitsChangedSince() */
+        uint64_t changed_generation;
+
         /* Error code when we didn't manage to load the unit (negative) */
         int load_error;
 
@@ -197,6 +244,11 @@ struct Unit {
         nsec_t cpu_usage_base;
         nsec_t cpu_usage_last; /* the most recently read value */
 
+        /* Ring buffer of accounting samples taken periodically while the cgroup exists, allocated on first use */
+        UnitAccountingSample *accounting_samples;
+        unsigned accounting_samples_head;
+        unsigned n_accounting_samples;
+
         /* Counterparts in the cgroup filesystem */
         char *cgroup_path;
         CGroupMask cgroup_realized_mask;
@@ -205,6 +257,17 @@ struct Unit {
         CGroupMask cgroup_members_mask;
         int cgroup_inotify_wd;
 
+        /* The cgroup directory on the unified hierarchy, and the last
+         * value written to each attribute, so that re-applying an
+         * unchanged setting is a no-op */
+        int cgroup_fd;
+        Hashmap *cgroup_attributes;
+
+        /* For slices: the cgroup queue generation and members mask
+         * at the time the members were last queued for realization */
+        unsigned cgroup_members_queued_generation;
+        CGroupMask cgroup_members_queued_mask;
+
         /* How to start OnFailure units */
         JobMode on_failure_job_mode;
 
@@ -245,6 +308,8 @@ struct Unit {
         bool in_cleanup_queue:1;
         bool in_gc_queue:1;
         bool in_cgroup_queue:1;
+        bool in_cgroup_empty_queue:1;
+        bool in_transient_queue:1;
 
         bool sent_dbus_new_signal:1;
 
@@ -467,7 +532,7 @@ extern const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX];
 #define UNIT_HAS_CGROUP_CONTEXT(u) (UNIT_VTABLE(u)->cgroup_context_offset > 0)
 #define UNIT_HAS_KILL_CONTEXT(u) (UNIT_VTABLE(u)->kill_context_offset > 0)
 
-#define UNIT_TRIGGER(u) ((Unit*) set_first((u)->dependencies[UNIT_TRIGGERS]))
+#define UNIT_TRIGGER(u) unit_dependencies_first(&(u)->dependencies, UNIT_DEPENDENCY_MASK(UNIT_TRIGGERS))
 
 DEFINE_CAST(SERVICE, Service);
 DEFINE_CAST(SOCKET, Socket);
@@ -503,6 +568,7 @@ bool unit_check_gc(Unit *u);
 
 void unit_add_to_load_queue(Unit *u);
 void unit_add_to_dbus_queue(Unit *u);
+void unit_bump_generation(Unit *u);
 void unit_add_to_cleanup_queue(Unit *u);
 void unit_add_to_gc_queue(Unit *u);
 
@@ -564,12 +630,13 @@ int unit_load_related_unit(Unit *u, const char *type, Unit **_found);
 bool unit_can_serialize(Unit *u) _pure_;
 
 int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs);
-int unit_deserialize(Unit *u, FILE *f, FDSet *fds);
+int unit_deserialize(Unit *u, Deserializer *d, FDSet *fds);
 
 int unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value);
 int unit_serialize_item_escaped(Unit *u, FILE *f, const char *key, const char *value);
 int unit_serialize_item_fd(Unit *u, FILE *f, FDSet *fds, const char *key, int fd);
 void unit_serialize_item_format(Unit *u, FILE *f, const char *key, const char *value, ...) _printf_(4,5);
+int unit_serialize_dual_timestamp(Unit *u, FILE *f, const char *key, dual_timestamp *t);
 
 int unit_add_node_link(Unit *u, const char *what, bool wants, UnitDependency d);
 
@@ -625,6 +692,8 @@ int unit_write_drop_in_private_format(Unit *u, UnitSetPropertiesMode mode, const
 int unit_kill_context(Unit *u, KillContext *c, KillOperation k, pid_t main_pid, pid_t control_pid, bool main_pid_alien);
 
 int unit_make_transient(Unit *u);
+void unit_add_to_transient_queue(Unit *u);
+int unit_persist_transient(Unit *u);
 
 int unit_require_mounts_for(Unit *u, const char *path);
 
@@ -119,17 +119,18 @@ int config_item_perf_lookup(
 }
 
 /* Run the user supplied parser for an assignment */
-static int next_assignment(const char *unit,
-                           const char *filename,
-                           unsigned line,
-                           ConfigItemLookup lookup,
-                           const void *table,
-                           const char *section,
-                           unsigned section_line,
-                           const char *lvalue,
-                           const char *rvalue,
-                           bool relaxed,
-                           void *userdata) {
+int config_parse_assignment(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                ConfigItemLookup lookup,
+                const void *table,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                const char *rvalue,
+                bool relaxed,
+                void *userdata) {
 
         ConfigParserCallback func = NULL;
         int ltype = 0;
@@ -173,6 +174,7 @@ static int parse_line(const char* unit,
                       char **section,
                       unsigned *section_line,
                       bool *section_ignored,
+                      bool *clean,
                       char *l,
                       void *userdata) {
 
@@ -181,6 +183,7 @@ static int parse_line(const char* unit,
         assert(filename);
         assert(line > 0);
         assert(lookup);
+        assert(clean);
         assert(l);
 
         l = strstrip(l);
@@ -203,6 +206,8 @@ static int parse_line(const char* unit,
                  *
                  * Support for them should be eventually removed. */
 
+                *clean = false;
+
                 if (!allow_include) {
                         log_syntax(unit, LOG_ERR, filename, line, 0, ".include not allowed here. Ignoring.");
                         return 0;
@@ -233,8 +238,10 @@ static int parse_line(const char* unit,
 
                 if (sections && !nulstr_contains(sections, n)) {
 
-                        if (!relaxed && !startswith(n, "X-"))
+                        if (!relaxed && !startswith(n, "X-")) {
                                 log_syntax(unit, LOG_WARNING, filename, line, 0, "Unknown section '%s'. Ignoring.", n);
+                                *clean = false;
+                        }
 
                         free(n);
                         *section = mfree(*section);
@@ -252,8 +259,10 @@ static int parse_line(const char* unit,
 
         if (sections && !*section) {
 
-                if (!relaxed && !*section_ignored)
+                if (!relaxed && !*section_ignored) {
                         log_syntax(unit, LOG_WARNING, filename, line, 0, "Assignment outside of section. Ignoring.");
+                        *clean = false;
+                }
 
                 return 0;
         }
@@ -267,79 +276,53 @@ static int parse_line(const char* unit,
         *e = 0;
         e++;
 
-        return next_assignment(unit,
-                               filename,
-                               line,
-                               lookup,
-                               table,
-                               *section,
-                               *section_line,
-                               strstrip(l),
-                               strstrip(e),
-                               relaxed,
-                               userdata);
+        return config_parse_assignment(unit,
+                                       filename,
+                                       line,
+                                       lookup,
+                                       table,
+                                       *section,
+                                       *section_line,
+                                       strstrip(l),
+                                       strstrip(e),
+                                       relaxed,
+                                       userdata);
 }
 
-/* Go through the file and parse each line */
-int config_parse(const char *unit,
-                 const char *filename,
-                 FILE *f,
-                 const char *sections,
-                 ConfigItemLookup lookup,
-                 const void *table,
-                 bool relaxed,
-                 bool allow_include,
-                 bool warn,
-                 void *userdata) {
+/* Read the next logical line, i.e. with the byte order mark dropped and continuation lines joined. Returns 0 on
+ * EOF, and > 0 otherwise, in which case *ret points into buf or, if lines had to be joined, to *ret_joined, which
+ * the caller has to free. */
+static int config_read_line(FILE *f, char *buf, size_t size, bool *allow_bom, char **ret_joined, char **ret) {
+        _cleanup_free_ char *continuation = NULL;
 
-        _cleanup_free_ char *section = NULL, *continuation = NULL;
-        _cleanup_fclose_ FILE *ours = NULL;
-        unsigned line = 0, section_line = 0;
-        bool section_ignored = false, allow_bom = true;
-        int r;
-
-        assert(filename);
-        assert(lookup);
-
-        if (!f) {
-                f = ours = fopen(filename, "re");
-                if (!f) {
-                        /* Only log on request, except for ENOENT,
-                         * since we return 0 to the caller. */
-                        if (warn || errno == ENOENT)
-                                log_full(errno == ENOENT ? LOG_DEBUG : LOG_ERR,
-                                         "Failed to open configuration file '%s': %m", filename);
-                        return errno == ENOENT ? 0 : -errno;
-                }
-        }
-
-        fd_warn_permissions(filename, fileno(f));
+        assert(f);
+        assert(buf);
+        assert(allow_bom);
+        assert(ret_joined);
+        assert(ret);
 
         for (;;) {
-                char buf[LINE_MAX], *l, *p, *c = NULL, *e;
+                char *l, *p, *c = NULL, *e;
                 bool escaped = false;
 
-                if (!fgets(buf, sizeof buf, f)) {
+                if (!fgets(buf, size, f)) {
                         if (feof(f))
-                                break;
+                                return 0;
 
-                        return log_error_errno(errno, "Failed to read configuration file '%s': %m", filename);
+                        return errno > 0 ? -errno : -EIO;
                 }
 
                 l = buf;
-                if (allow_bom && startswith(l, UTF8_BYTE_ORDER_MARK))
+                if (*allow_bom && startswith(l, UTF8_BYTE_ORDER_MARK))
                         l += strlen(UTF8_BYTE_ORDER_MARK);
-                allow_bom = false;
+                *allow_bom = false;
 
                 truncate_nl(l);
 
                 if (continuation) {
                         c = strappend(continuation, l);
-                        if (!c) {
-                                if (warn)
-                                        log_oom();
+                        if (!c)
                                 return -ENOMEM;
-                        }
 
                         continuation = mfree(continuation);
                         p = c;
@@ -360,16 +343,71 @@ int config_parse(const char *unit,
                                 continuation = c;
                         else {
                                 continuation = strdup(l);
-                                if (!continuation) {
-                                        if (warn)
-                                                log_oom();
+                                if (!continuation)
                                         return -ENOMEM;
-                                }
                         }
 
                         continue;
                 }
 
+                *ret_joined = c;
+                *ret = p;
+                return 1;
+        }
+}
+
+/* Go through the file and parse each line */
+int config_parse_full(
+                const char *unit,
+                const char *filename,
+                FILE *f,
+                const char *sections,
+                ConfigItemLookup lookup,
+                const void *table,
+                bool relaxed,
+                bool allow_include,
+                bool warn,
+                void *userdata,
+                bool *ret_clean) {
+
+        _cleanup_free_ char *section = NULL;
+        _cleanup_fclose_ FILE *ours = NULL;
+        unsigned line = 0, section_line = 0;
+        bool section_ignored = false, allow_bom = true, clean = true;
+        int r;
+
+        assert(filename);
+        assert(lookup);
+
+        if (!f) {
+                f = ours = fopen(filename, "re");
+                if (!f) {
+                        /* Only log on request, except for ENOENT,
+                         * since we return 0 to the caller. */
+                        if (warn || errno == ENOENT)
+                                log_full(errno == ENOENT ? LOG_DEBUG : LOG_ERR,
+                                         "Failed to open configuration file '%s': %m", filename);
+                        return errno == ENOENT ? 0 : -errno;
+                }
+        }
+
+        fd_warn_permissions(filename, fileno(f));
+
+        for (;;) {
+                _cleanup_free_ char *joined = NULL;
+                char buf[LINE_MAX], *p;
+
+                r = config_read_line(f, buf, sizeof(buf), &allow_bom, &joined, &p);
+                if (r == -ENOMEM) {
+                        if (warn)
+                                log_oom();
+                        return r;
+                }
+                if (r < 0)
+                        return log_error_errno(r, "Failed to read configuration file '%s': %m", filename);
+                if (r == 0)
+                        break;
+
                 r = parse_line(unit,
                                filename,
                                ++line,
@@ -381,10 +419,9 @@ int config_parse(const char *unit,
                                &section,
                                &section_line,
                                &section_ignored,
+                               &clean,
                                p,
                                userdata);
-                free(c);
-
                 if (r < 0) {
                         if (warn)
                                 log_warning_errno(r, "Failed to parse file '%s': %m",
@@ -393,9 +430,122 @@ int config_parse(const char *unit,
                 }
         }
 
+        if (ret_clean)
+                *ret_clean = clean;
+
         return 0;
 }
 
+int config_parse(const char *unit,
+                 const char *filename,
+                 FILE *f,
+                 const char *sections,
+                 ConfigItemLookup lookup,
+                 const void *table,
+                 bool relaxed,
+                 bool allow_include,
+                 bool warn,
+                 void *userdata) {
+
+        return config_parse_full(unit, filename, f, sections, lookup, table, relaxed, allow_include, warn, userdata, NULL);
+}
+
+static int tokenize_line(
+                unsigned line,
+                const char *sections,
+                char **section,
+                unsigned *section_line,
+                char *l,
+                ConfigAssignmentCallback callback,
+                void *userdata) {
+
+        char *e;
+
+        assert(line > 0);
+        assert(l);
+
+        /* Mirrors parse_line(), but refuses everything that would be logged there */
+
+        l = strstrip(l);
+
+        if (!*l)
+                return 0;
+
+        if (strchr(COMMENTS "\n", *l))
+                return 0;
+
+        if (startswith(l, ".include "))
+                return -EBADMSG;
+
+        if (*l == '[') {
+                size_t k;
+                char *n;
+
+                k = strlen(l);
+                assert(k > 0);
+
+                if (l[k-1] != ']')
+                        return -EBADMSG;
+
+                n = strndup(l+1, k-2);
+                if (!n)
+                        return -ENOMEM;
+
+                if (sections && !nulstr_contains(sections, n)) {
+                        free(n);
+                        return -EBADMSG;
+                }
+
+                free(*section);
+                *section = n;
+                *section_line = line;
+
+                return 0;
+        }
+
+        if (sections && !*section)
+                return -EBADMSG;
+
+        e = strchr(l, '=');
+        if (!e)
+                return -EBADMSG;
+
+        *e = 0;
+        e++;
+
+        return callback(line, *section, *section_line, strstrip(l), strstrip(e), userdata);
+}
+
+int config_tokenize(
+                FILE *f,
+                const char *sections,
+                ConfigAssignmentCallback callback,
+                void *userdata) {
+
+        _cleanup_free_ char *section = NULL;
+        unsigned line = 0, section_line = 0;
+        bool allow_bom = true;
+        int r;
+
+        assert(f);
+        assert(callback);
+
+        /* Reads lines exactly like config_parse(), so that line numbers and continuations match */
+
+        for (;;) {
+                _cleanup_free_ char *joined = NULL;
+                char buf[LINE_MAX], *p;
+
+                r = config_read_line(f, buf, sizeof(buf), &allow_bom, &joined, &p);
+                if (r <= 0)
+                        return r;
+
+                r = tokenize_line(++line, sections, &section, &section_line, p, callback, userdata);
+                if (r < 0)
+                        return r;
+        }
+}
+
 static int config_parse_many_files(
                 const char *conf_file,
                 char **files,
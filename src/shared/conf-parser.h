@@ -96,6 +96,55 @@ int config_parse(
                 bool warn,
                 void *userdata);
 
+/* Like config_parse(), but also tells whether it didn't log anything
+ * about the file itself, i.e. about anything but the assignments
+ * handed to the parsers, and didn't follow any .include */
+int config_parse_full(
+                const char *unit,
+                const char *filename,
+                FILE *f,
+                const char *sections,  /* nulstr */
+                ConfigItemLookup lookup,
+                const void *table,
+                bool relaxed,
+                bool allow_include,
+                bool warn,
+                void *userdata,
+                bool *ret_clean);
+
+/* Looks up and runs the parser for a single, already split up
+ * assignment, the way config_parse() does it for each line */
+int config_parse_assignment(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                ConfigItemLookup lookup,
+                const void *table,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                const char *rvalue,
+                bool relaxed,
+                void *userdata);
+
+typedef int (*ConfigAssignmentCallback)(
+                unsigned line,
+                const char *section,
+                unsigned section_line,
+                const char *lvalue,
+                const char *rvalue,
+                void *userdata);
+
+/* Splits a file into its assignments, without logging and without
+ * running any parsers. Returns -EBADMSG for anything config_parse()
+ * would warn about or that is not a plain assignment (e.g. .include),
+ * in which case the caller should use config_parse() instead. */
+int config_tokenize(
+                FILE *f,
+                const char *sections,  /* nulstr */
+                ConfigAssignmentCallback callback,
+                void *userdata);
+
 int config_parse_many_nulstr(
                 const char *conf_file,      /* possibly NULL */
                 const char *conf_file_dirs, /* nulstr */
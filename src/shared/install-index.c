@@ -0,0 +1,999 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "hashmap.h"
+#include "install-index.h"
+#include "log.h"
+#include "path-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "unit-name.h"
+
+/* Bump this whenever the on-disk format changes */
+#define INSTALL_INDEX_MAGIC "SDINSTIX"
+#define INSTALL_INDEX_VERSION 1
+
+/* Directories and files modified more recently than this can't be trusted: the file system timestamps are
+ * only updated at a coarse granularity, hence we might not be able to tell a later modification apart from
+ * the version we recorded. An index built from such data is used once, but neither kept nor saved. */
+#define INSTALL_INDEX_RACY_USEC (2 * USEC_PER_SEC)
+
+/* Flags for the symlinks found below a search path directory, by unit name */
+#define INSTALL_INDEX_LINK_FOUND 1U     /* a symlink named after the unit, or pointing to it */
+#define INSTALL_INDEX_LINK_SAME_NAME 2U /* a symlink in the directory itself, named after and pointing to the unit */
+
+typedef struct InstallIndexDir {
+        char *path;
+
+        bool exists;
+        uint64_t ino;
+        nsec_t mtime;
+} InstallIndexDir;
+
+struct InstallIndex {
+        unsigned n_ref;
+
+        char **search_path;
+
+        InstallIndexDir *dirs;
+        size_t n_dirs, n_dirs_allocated;
+
+        InstallIndexEntry **entries;
+        size_t n_entries, n_entries_allocated;
+        Hashmap *by_name;
+
+        /* Only available after a scan and not persisted: search path directory => Hashmap of unit name =>
+         * INSTALL_INDEX_LINK_* flags */
+        Hashmap *links;
+
+        bool racy;
+        bool dirty;
+
+        /* The file the index was loaded from or is saved to */
+        char *file;
+};
+
+/* The index used last, so that long running processes (i.e. PID 1) don't read it from disk on every query */
+static InstallIndex *cached_index = NULL;
+
+static Hashmap* install_index_links_free(Hashmap *links) {
+        char *k;
+
+        while ((k = hashmap_steal_first_key(links)))
+                free(k);
+
+        return hashmap_free(links);
+}
+
+static InstallIndexEntry* install_index_entry_free(InstallIndexEntry *e) {
+        if (!e)
+                return NULL;
+
+        free(e->name);
+        free(e->path);
+
+        return mfree(e);
+}
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(InstallIndexEntry*, install_index_entry_free);
+
+static int install_index_new(char **search_path, InstallIndex **ret) {
+        _cleanup_(install_index_unrefp) InstallIndex *i = NULL;
+
+        assert(ret);
+
+        i = new0(InstallIndex, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->n_ref = 1;
+
+        i->search_path = strv_copy(search_path);
+        if (!i->search_path)
+                return -ENOMEM;
+
+        i->by_name = hashmap_new(&string_hash_ops);
+        if (!i->by_name)
+                return -ENOMEM;
+
+        *ret = i;
+        i = NULL;
+
+        return 0;
+}
+
+InstallIndex* install_index_ref(InstallIndex *i) {
+        if (!i)
+                return NULL;
+
+        assert(i->n_ref > 0);
+        i->n_ref++;
+
+        return i;
+}
+
+InstallIndex* install_index_unref(InstallIndex *i) {
+        Hashmap *h;
+        size_t k;
+
+        if (!i)
+                return NULL;
+
+        assert(i->n_ref > 0);
+        i->n_ref--;
+
+        if (i->n_ref > 0)
+                return NULL;
+
+        for (k = 0; k < i->n_dirs; k++)
+                free(i->dirs[k].path);
+        free(i->dirs);
+
+        for (k = 0; k < i->n_entries; k++)
+                install_index_entry_free(i->entries[k]);
+        free(i->entries);
+        hashmap_free(i->by_name);
+
+        while ((h = hashmap_steal_first(i->links)))
+                install_index_links_free(h);
+        hashmap_free(i->links);
+
+        strv_free(i->search_path);
+        free(i->file);
+
+        return mfree(i);
+}
+
+static bool install_index_is_racy(nsec_t mtime) {
+        return mtime + INSTALL_INDEX_RACY_USEC * NSEC_PER_USEC >= now_nsec(CLOCK_REALTIME);
+}
+
+static int install_index_add_dir(InstallIndex *i, const char *path, const struct stat *st) {
+        InstallIndexDir *d;
+        char *p;
+
+        assert(i);
+        assert(path);
+
+        p = strdup(path);
+        if (!p)
+                return -ENOMEM;
+
+        if (!GREEDY_REALLOC(i->dirs, i->n_dirs_allocated, i->n_dirs + 1)) {
+                free(p);
+                return -ENOMEM;
+        }
+
+        d = i->dirs + i->n_dirs++;
+        *d = (InstallIndexDir) {
+                .path = p,
+        };
+
+        if (st && S_ISDIR(st->st_mode)) {
+                d->exists = true;
+                d->ino = st->st_ino;
+                d->mtime = timespec_load_nsec(&st->st_mtim);
+
+                if (install_index_is_racy(d->mtime))
+                        i->racy = true;
+        }
+
+        return 0;
+}
+
+static void install_index_entry_set_stat(InstallIndexEntry *e, const struct stat *st) {
+        assert(e);
+
+        e->exists = !!st;
+        e->dev = e->ino = e->size = e->mtime = 0;
+
+        if (!st)
+                return;
+
+        e->dev = st->st_dev;
+        e->ino = st->st_ino;
+
+        /* Masked units point to /dev/null, whose timestamps we don't care about */
+        if (S_ISREG(st->st_mode)) {
+                e->size = st->st_size;
+                e->mtime = timespec_load_nsec(&st->st_mtim);
+        }
+}
+
+static bool install_index_entry_is_current(const InstallIndexEntry *e) {
+        struct stat st;
+        InstallIndexEntry copy;
+
+        assert(e);
+
+        copy = *e;
+        install_index_entry_set_stat(&copy, stat(e->path, &st) >= 0 ? &st : NULL);
+
+        return copy.exists == e->exists &&
+                copy.dev == e->dev &&
+                copy.ino == e->ino &&
+                copy.size == e->size &&
+                copy.mtime == e->mtime;
+}
+
+static int install_index_put(InstallIndex *i, InstallIndexEntry *e) {
+        int r;
+
+        assert(i);
+        assert(e);
+
+        if (!GREEDY_REALLOC(i->entries, i->n_entries_allocated, i->n_entries + 1))
+                return -ENOMEM;
+
+        r = hashmap_put(i->by_name, e->name, e);
+        if (r < 0)
+                return r;
+
+        i->entries[i->n_entries++] = e;
+        return 0;
+}
+
+static int install_index_add_entry(InstallIndex *i, const char *name, const char *path) {
+        _cleanup_(install_index_entry_freep) InstallIndexEntry *e = NULL;
+        struct stat st;
+        int r;
+
+        assert(i);
+        assert(name);
+        assert(path);
+
+        e = new0(InstallIndexEntry, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->name = strdup(name);
+        e->path = strdup(path);
+        if (!e->name || !e->path)
+                return -ENOMEM;
+
+        e->state = UNIT_FILE_BAD;
+        install_index_entry_set_stat(e, stat(path, &st) >= 0 ? &st : NULL);
+
+        if (e->mtime > 0 && install_index_is_racy(e->mtime))
+                i->racy = true;
+
+        r = install_index_put(i, e);
+        if (r < 0)
+                return r;
+
+        e = NULL;
+        return 0;
+}
+
+static int install_index_add_link(Hashmap *links, const char *name, unsigned flag) {
+        unsigned flags;
+        char *n;
+        int r;
+
+        assert(links);
+        assert(name);
+
+        flags = PTR_TO_UINT(hashmap_get(links, name));
+        if (flags & flag)
+                return 0;
+
+        if (flags != 0)
+                return hashmap_update(links, name, UINT_TO_PTR(flags | flag));
+
+        n = strdup(name);
+        if (!n)
+                return -ENOMEM;
+
+        r = hashmap_put(links, n, UINT_TO_PTR(flag));
+        if (r < 0) {
+                free(n);
+                return r;
+        }
+
+        return 0;
+}
+
+static int install_index_walk(InstallIndex *i, Hashmap *links, int fd, const char *path, bool top) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        struct stat st;
+        int r;
+
+        assert(i);
+        assert(links);
+        assert(fd >= 0);
+        assert(path);
+
+        /* This mirrors what find_symlinks_fd() in install.c looks at, i.e. all symlinks anywhere below the
+         * search path directory, and what unit_file_get_list() looks at, i.e. the unit files in the search
+         * path directory itself. */
+
+        d = fdopendir(fd);
+        if (!d) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        if (fstat(dirfd(d), &st) < 0)
+                return -errno;
+
+        r = install_index_add_dir(i, path, &st);
+        if (r < 0)
+                return r;
+
+        FOREACH_DIRENT(de, d, return -errno) {
+                _cleanup_free_ char *p = NULL;
+
+                dirent_ensure_type(d, de);
+
+                p = path_make_absolute(de->d_name, path);
+                if (!p)
+                        return -ENOMEM;
+
+                if (de->d_type == DT_DIR) {
+                        int nfd;
+
+                        nfd = openat(dirfd(d), de->d_name, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+                        if (nfd < 0) {
+                                if (errno == ENOENT)
+                                        continue;
+
+                                return -errno;
+                        }
+
+                        /* This will close nfd, regardless whether it succeeds or not */
+                        r = install_index_walk(i, links, nfd, p, false);
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                if (top &&
+                    IN_SET(de->d_type, DT_LNK, DT_REG) &&
+                    unit_name_is_valid(de->d_name, UNIT_NAME_ANY) &&
+                    !hashmap_get(i->by_name, de->d_name)) {
+
+                        r = install_index_add_entry(i, de->d_name, p);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (de->d_type == DT_LNK) {
+                        _cleanup_free_ char *dest = NULL;
+                        const char *b;
+
+                        r = readlinkat_malloc(dirfd(d), de->d_name, &dest);
+                        if (r == -ENOENT)
+                                continue;
+                        if (r < 0)
+                                return r;
+
+                        b = basename(dest);
+
+                        if (top && streq(de->d_name, b))
+                                r = install_index_add_link(links, de->d_name, INSTALL_INDEX_LINK_SAME_NAME);
+                        else {
+                                r = install_index_add_link(links, de->d_name, INSTALL_INDEX_LINK_FOUND);
+                                if (r >= 0 && !streq(de->d_name, b))
+                                        r = install_index_add_link(links, b, INSTALL_INDEX_LINK_FOUND);
+                        }
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        return 0;
+}
+
+int install_index_scan(char **search_path, InstallIndex **ret) {
+        _cleanup_(install_index_unrefp) InstallIndex *i = NULL;
+        char **p;
+        int r;
+
+        assert(ret);
+
+        r = install_index_new(search_path, &i);
+        if (r < 0)
+                return r;
+
+        i->links = hashmap_new(&string_hash_ops);
+        if (!i->links)
+                return -ENOMEM;
+
+        STRV_FOREACH(p, i->search_path) {
+                Hashmap *links;
+                struct stat st;
+                int fd;
+
+                if (hashmap_get(i->links, *p))
+                        continue;
+
+                links = hashmap_new(&string_hash_ops);
+                if (!links)
+                        return -ENOMEM;
+
+                r = hashmap_put(i->links, *p, links);
+                if (r < 0) {
+                        hashmap_free(links);
+                        return r;
+                }
+
+                fd = open(*p, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC);
+                if (fd < 0) {
+                        if (IN_SET(errno, ENOENT, ENOTDIR)) {
+                                /* Remember that it doesn't exist, so that we notice when it appears */
+                                r = install_index_add_dir(i, *p, NULL);
+                                if (r < 0)
+                                        return r;
+
+                                continue;
+                        }
+
+                        if (errno == EACCES && stat(*p, &st) >= 0) {
+                                r = install_index_add_dir(i, *p, &st);
+                                if (r < 0)
+                                        return r;
+
+                                continue;
+                        }
+
+                        return -errno;
+                }
+
+                /* This takes possession of fd and closes it */
+                r = install_index_walk(i, links, fd, *p, true);
+                if (r < 0)
+                        return r;
+        }
+
+        i->dirty = true;
+
+        *ret = i;
+        i = NULL;
+
+        return 0;
+}
+
+bool install_index_is_current(InstallIndex *i) {
+        size_t k;
+
+        assert(i);
+
+        for (k = 0; k < i->n_dirs; k++) {
+                InstallIndexDir *d = i->dirs + k;
+                struct stat st;
+                bool exists;
+
+                exists = stat(d->path, &st) >= 0 && S_ISDIR(st.st_mode);
+                if (exists != d->exists)
+                        return false;
+
+                if (exists &&
+                    (d->ino != (uint64_t) st.st_ino ||
+                     d->mtime != timespec_load_nsec(&st.st_mtim)))
+                        return false;
+        }
+
+        return true;
+}
+
+InstallIndexEntry* install_index_get(InstallIndex *i, const char *name) {
+        assert(i);
+        assert(name);
+
+        return hashmap_get(i->by_name, name);
+}
+
+InstallIndexEntry** install_index_entries(InstallIndex *i, size_t *n) {
+        assert(i);
+        assert(n);
+
+        *n = i->n_entries;
+        return i->entries;
+}
+
+bool install_index_has_symlinks(InstallIndex *i) {
+        return i && i->links;
+}
+
+int install_index_find_symlinks(InstallIndex *i, const char *dir, const char *name, bool *same_name_link) {
+        Hashmap *links;
+        unsigned flags;
+
+        assert(i);
+        assert(dir);
+        assert(name);
+        assert(same_name_link);
+
+        if (!i->links)
+                return -ENODATA;
+
+        links = hashmap_get(i->links, dir);
+        if (!links)
+                return -ENODATA;
+
+        flags = PTR_TO_UINT(hashmap_get(links, name));
+
+        if (flags & INSTALL_INDEX_LINK_FOUND)
+                return 1;
+
+        if (flags & INSTALL_INDEX_LINK_SAME_NAME)
+                *same_name_link = true;
+
+        return 0;
+}
+
+static int read_uint32(const char **p, const char *end, uint32_t *ret) {
+        assert(p);
+        assert(ret);
+
+        if ((size_t) (end - *p) < sizeof(uint32_t))
+                return -EBADMSG;
+
+        memcpy(ret, *p, sizeof(uint32_t));
+        *p += sizeof(uint32_t);
+
+        return 0;
+}
+
+static int read_uint64(const char **p, const char *end, uint64_t *ret) {
+        assert(p);
+        assert(ret);
+
+        if ((size_t) (end - *p) < sizeof(uint64_t))
+                return -EBADMSG;
+
+        memcpy(ret, *p, sizeof(uint64_t));
+        *p += sizeof(uint64_t);
+
+        return 0;
+}
+
+static int read_string(const char **p, const char *end, char **ret) {
+        uint32_t n;
+        char *s;
+        int r;
+
+        assert(p);
+        assert(ret);
+
+        r = read_uint32(p, end, &n);
+        if (r < 0)
+                return r;
+
+        if ((size_t) (end - *p) < n)
+                return -EBADMSG;
+
+        s = strndup(*p, n);
+        if (!s)
+                return -ENOMEM;
+
+        *p += n;
+        *ret = s;
+
+        return 0;
+}
+
+static int install_index_parse(const char *buf, size_t size, char **search_path, InstallIndex **ret) {
+        _cleanup_(install_index_unrefp) InstallIndex *i = NULL;
+        _cleanup_strv_free_ char **l = NULL;
+        const char *p = buf, *end = buf + size;
+        uint32_t version, n, k;
+        int r;
+
+        assert(buf);
+        assert(ret);
+
+        if (size < strlen(INSTALL_INDEX_MAGIC) || memcmp(p, INSTALL_INDEX_MAGIC, strlen(INSTALL_INDEX_MAGIC)) != 0)
+                return -EBADMSG;
+        p += strlen(INSTALL_INDEX_MAGIC);
+
+        if (read_uint32(&p, end, &version) < 0 || version != INSTALL_INDEX_VERSION)
+                return -EPROTONOSUPPORT;
+
+        r = read_uint32(&p, end, &n);
+        if (r < 0)
+                return r;
+
+        for (k = 0; k < n; k++) {
+                char *s;
+
+                r = read_string(&p, end, &s);
+                if (r < 0)
+                        return r;
+
+                r = strv_consume(&l, s);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Built for a different search path? Then it's of no use to us. */
+        if (!strv_equal(l, search_path))
+                return -ESTALE;
+
+        r = install_index_new(search_path, &i);
+        if (r < 0)
+                return r;
+
+        r = read_uint32(&p, end, &n);
+        if (r < 0)
+                return r;
+
+        for (k = 0; k < n; k++) {
+                InstallIndexDir d = {};
+                uint32_t exists;
+
+                r = read_string(&p, end, &d.path);
+                if (r < 0)
+                        return r;
+
+                if (read_uint32(&p, end, &exists) < 0 ||
+                    read_uint64(&p, end, &d.ino) < 0 ||
+                    read_uint64(&p, end, &d.mtime) < 0) {
+                        free(d.path);
+                        return -EBADMSG;
+                }
+
+                d.exists = exists;
+
+                if (!GREEDY_REALLOC(i->dirs, i->n_dirs_allocated, i->n_dirs + 1)) {
+                        free(d.path);
+                        return -ENOMEM;
+                }
+
+                i->dirs[i->n_dirs++] = d;
+        }
+
+        r = read_uint32(&p, end, &n);
+        if (r < 0)
+                return r;
+
+        for (k = 0; k < n; k++) {
+                _cleanup_(install_index_entry_freep) InstallIndexEntry *e = NULL;
+                uint32_t state, exists;
+
+                e = new0(InstallIndexEntry, 1);
+                if (!e)
+                        return -ENOMEM;
+
+                r = read_string(&p, end, &e->name);
+                if (r < 0)
+                        return r;
+                r = read_string(&p, end, &e->path);
+                if (r < 0)
+                        return r;
+
+                if (read_uint32(&p, end, &state) < 0 ||
+                    read_uint32(&p, end, &exists) < 0 ||
+                    read_uint64(&p, end, &e->dev) < 0 ||
+                    read_uint64(&p, end, &e->ino) < 0 ||
+                    read_uint64(&p, end, &e->size) < 0 ||
+                    read_uint64(&p, end, &e->mtime) < 0)
+                        return -EBADMSG;
+
+                if (state >= _UNIT_FILE_STATE_MAX)
+                        return -EBADMSG;
+
+                e->state = state;
+                e->exists = exists;
+
+                r = install_index_put(i, e);
+                if (r < 0)
+                        return r;
+                e = NULL;
+        }
+
+        if (p != end)
+                return -EBADMSG;
+
+        *ret = i;
+        i = NULL;
+
+        return 0;
+}
+
+int install_index_load(const char *path, uid_t owner, char **search_path, InstallIndex **ret) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *buf = NULL;
+        InstallIndex *i;
+        struct stat st;
+        size_t size;
+        int fd, r;
+
+        assert(path);
+        assert(ret);
+
+        /* Returns 0 and NULL if there's no usable index */
+
+        *ret = NULL;
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW|O_NOCTTY);
+        if (fd < 0) {
+                if (errno == ENOENT)
+                        return 0;
+
+                return log_debug_errno(errno, "Failed to open unit file index %s: %m", path);
+        }
+
+        if (fstat(fd, &st) < 0) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        /* Only trust what was written by somebody who could have written the unit files, too */
+        if (!S_ISREG(st.st_mode) || st.st_uid != owner) {
+                safe_close(fd);
+                log_debug("Unit file index %s is not a regular file owned by "UID_FMT", ignoring.", path, owner);
+                return 0;
+        }
+
+        f = fdopen(fd, "re");
+        if (!f) {
+                safe_close(fd);
+                return -errno;
+        }
+
+        r = read_full_stream(f, &buf, &size);
+        if (r < 0)
+                return log_debug_errno(r, "Failed to read unit file index %s: %m", path);
+
+        r = install_index_parse(buf, size, search_path, &i);
+        if (r == -ENOMEM)
+                return r;
+        if (r < 0) {
+                log_debug_errno(r, "Unit file index %s is not usable, ignoring: %m", path);
+                return 0;
+        }
+
+        i->file = strdup(path);
+        if (!i->file) {
+                install_index_unref(i);
+                return -ENOMEM;
+        }
+
+        *ret = i;
+        return 0;
+}
+
+static void write_uint32(FILE *f, uint32_t u) {
+        fwrite(&u, sizeof(u), 1, f);
+}
+
+static void write_uint64(FILE *f, uint64_t u) {
+        fwrite(&u, sizeof(u), 1, f);
+}
+
+static void write_string(FILE *f, const char *s) {
+        size_t n;
+
+        n = strlen(s);
+        write_uint32(f, (uint32_t) n);
+        fwrite(s, 1, n, f);
+}
+
+int install_index_save(InstallIndex *i, const char *path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *t = NULL;
+        char **s;
+        size_t k;
+        int r;
+
+        assert(i);
+        assert(path);
+
+        if (i->racy || !i->dirty)
+                return 0;
+
+        r = fopen_temporary(path, &f, &t);
+        if (r < 0)
+                return r;
+
+        (void) fchmod(fileno(f), 0644);
+
+        fwrite(INSTALL_INDEX_MAGIC, 1, strlen(INSTALL_INDEX_MAGIC), f);
+        write_uint32(f, INSTALL_INDEX_VERSION);
+
+        write_uint32(f, strv_length(i->search_path));
+        STRV_FOREACH(s, i->search_path)
+                write_string(f, *s);
+
+        write_uint32(f, i->n_dirs);
+        for (k = 0; k < i->n_dirs; k++) {
+                write_string(f, i->dirs[k].path);
+                write_uint32(f, i->dirs[k].exists);
+                write_uint64(f, i->dirs[k].ino);
+                write_uint64(f, i->dirs[k].mtime);
+        }
+
+        write_uint32(f, i->n_entries);
+        for (k = 0; k < i->n_entries; k++) {
+                InstallIndexEntry *e = i->entries[k];
+
+                write_string(f, e->name);
+                write_string(f, e->path);
+                write_uint32(f, e->state);
+                write_uint32(f, e->exists);
+                write_uint64(f, e->dev);
+                write_uint64(f, e->ino);
+                write_uint64(f, e->size);
+                write_uint64(f, e->mtime);
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto fail;
+
+        if (rename(t, path) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        i->dirty = false;
+
+        return 0;
+
+fail:
+        (void) unlink(t);
+        return r;
+}
+
+static int install_index_compute(InstallIndex *i, InstallIndexEntry *e, install_index_state_func_t func, void *userdata) {
+        int r;
+
+        assert(i);
+        assert(e);
+        assert(func);
+
+        r = func(i, e->name, &e->state, userdata);
+        if (r < 0)
+                e->state = UNIT_FILE_BAD;
+
+        i->dirty = true;
+        return 0;
+}
+
+static int install_index_refresh_entry(InstallIndex *i, InstallIndexEntry *e, install_index_state_func_t func, void *userdata) {
+        struct stat st;
+
+        assert(i);
+        assert(e);
+
+        if (install_index_entry_is_current(e))
+                return 0;
+
+        install_index_entry_set_stat(e, stat(e->path, &st) >= 0 ? &st : NULL);
+        if (e->mtime > 0 && install_index_is_racy(e->mtime))
+                i->racy = true;
+
+        return install_index_compute(i, e, func, userdata);
+}
+
+int install_index_refresh(InstallIndex *i, const char *name, install_index_state_func_t func, void *userdata) {
+        size_t k;
+        int r;
+
+        assert(i);
+        assert(func);
+
+        /* Recalculates the state of the specified unit file, or of all of them, if they were modified in
+         * place since the index was built. Added or removed files are caught by install_index_is_current(). */
+
+        if (name) {
+                InstallIndexEntry *e;
+
+                e = install_index_get(i, name);
+                if (e) {
+                        r = install_index_refresh_entry(i, e, func, userdata);
+                        if (r < 0)
+                                return r;
+                }
+        } else
+                for (k = 0; k < i->n_entries; k++) {
+                        r = install_index_refresh_entry(i, i->entries[k], func, userdata);
+                        if (r < 0)
+                                return r;
+                }
+
+        if (i->racy && i == cached_index)
+                cached_index = install_index_unref(cached_index);
+
+        if (i->file) {
+                r = install_index_save(i, i->file);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to update unit file index %s, ignoring: %m", i->file);
+        }
+
+        return 0;
+}
+
+int install_index_acquire(
+                const char *path,
+                uid_t owner,
+                char **search_path,
+                install_index_state_func_t func,
+                void *userdata,
+                InstallIndex **ret) {
+
+        _cleanup_(install_index_unrefp) InstallIndex *i = NULL;
+        size_t k;
+        int r;
+
+        assert(path);
+        assert(func);
+        assert(ret);
+
+        /* Returns a reference to an index that is current, as far as directories are concerned. Use
+         * install_index_refresh() to catch unit files modified in place. */
+
+        if (cached_index &&
+            path_equal_ptr(cached_index->file, path) &&
+            strv_equal(cached_index->search_path, search_path) &&
+            install_index_is_current(cached_index)) {
+                *ret = install_index_ref(cached_index);
+                return 0;
+        }
+
+        cached_index = install_index_unref(cached_index);
+
+        r = install_index_load(path, owner, search_path, &i);
+        if (r == -ENOMEM)
+                return r;
+
+        if (!i || !install_index_is_current(i)) {
+                /* No index or an outdated one, let's build it from scratch */
+                i = install_index_unref(i);
+
+                r = install_index_scan(search_path, &i);
+                if (r < 0)
+                        return r;
+
+                for (k = 0; k < i->n_entries; k++) {
+                        r = install_index_compute(i, i->entries[k], func, userdata);
+                        if (r < 0)
+                                return r;
+                }
+
+                i->file = strdup(path);
+                if (!i->file)
+                        return -ENOMEM;
+
+                r = install_index_save(i, path);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to write unit file index %s, ignoring: %m", path);
+        }
+
+        if (!i->racy)
+                cached_index = install_index_ref(i);
+
+        *ret = i;
+        i = NULL;
+
+        return 0;
+}
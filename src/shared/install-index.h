@@ -0,0 +1,75 @@
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "install.h"
+#include "macro.h"
+#include "time-util.h"
+
+/* An index of all unit files in the search path and their enablement state. It is validated by the
+ * modification times of all directories below the search path (which change whenever unit files or
+ * symlinks are added or removed), and of the unit files themselves (whose [Install] sections might be
+ * edited in place). The index may be persisted to disk, so that PID 1 and systemctl can share it. */
+
+typedef struct InstallIndex InstallIndex;
+
+typedef struct InstallIndexEntry {
+        char *name;
+        char *path;
+        UnitFileState state;
+
+        /* Identity of the unit file the name resolves to, following symlinks */
+        bool exists;
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        nsec_t mtime;
+} InstallIndexEntry;
+
+/* Determines the state of the specified unit file. The index is passed so that the symlinks collected
+ * while scanning can be used, see install_index_find_symlinks(). */
+typedef int (*install_index_state_func_t)(InstallIndex *i, const char *name, UnitFileState *ret, void *userdata);
+
+InstallIndex* install_index_ref(InstallIndex *i);
+InstallIndex* install_index_unref(InstallIndex *i);
+DEFINE_TRIVIAL_CLEANUP_FUNC(InstallIndex*, install_index_unref);
+
+int install_index_scan(char **search_path, InstallIndex **ret);
+int install_index_load(const char *path, uid_t owner, char **search_path, InstallIndex **ret);
+int install_index_save(InstallIndex *i, const char *path);
+
+bool install_index_is_current(InstallIndex *i);
+
+int install_index_acquire(
+                const char *path,
+                uid_t owner,
+                char **search_path,
+                install_index_state_func_t func,
+                void *userdata,
+                InstallIndex **ret);
+
+int install_index_refresh(InstallIndex *i, const char *name, install_index_state_func_t func, void *userdata);
+
+InstallIndexEntry* install_index_get(InstallIndex *i, const char *name);
+InstallIndexEntry** install_index_entries(InstallIndex *i, size_t *n);
+
+bool install_index_has_symlinks(InstallIndex *i);
+int install_index_find_symlinks(InstallIndex *i, const char *dir, const char *name, bool *same_name_link);
@@ -38,6 +38,7 @@
 #include "fileio.h"
 #include "fs-util.h"
 #include "hashmap.h"
+#include "install-index.h"
 #include "install-printf.h"
 #include "install.h"
 #include "locale-util.h"
@@ -96,7 +97,7 @@ static inline void presets_freep(Presets *p) {
         p->n_rules = 0;
 }
 
-static int unit_file_lookup_state(UnitFileScope scope, const LookupPaths *paths, const char *name, UnitFileState *ret);
+static int unit_file_lookup_state(UnitFileScope scope, const LookupPaths *paths, const char *name, InstallIndex *index, UnitFileState *ret);
 
 bool unit_type_may_alias(UnitType type) {
         return IN_SET(type,
@@ -834,6 +835,7 @@ static int find_symlinks(
 static int find_symlinks_in_scope(
                 const LookupPaths *paths,
                 const char *name,
+                InstallIndex *index,
                 UnitFileState *state) {
 
         bool same_name_link_runtime = false, same_name_link_config = false;
@@ -847,7 +849,12 @@ static int find_symlinks_in_scope(
         STRV_FOREACH(p, paths->search_path)  {
                 bool same_name_link = false;
 
-                r = find_symlinks(paths->root_dir, name, *p, &same_name_link);
+                /* If we have an index, it knows about all symlinks already */
+                r = -ENODATA;
+                if (index && !path_is_absolute(name))
+                        r = install_index_find_symlinks(index, *p, name, &same_name_link);
+                if (r == -ENODATA)
+                        r = find_symlinks(paths->root_dir, name, *p, &same_name_link);
                 if (r < 0)
                         return r;
                 if (r > 0) {
@@ -2540,6 +2547,7 @@ static int unit_file_lookup_state(
                 UnitFileScope scope,
                 const LookupPaths *paths,
                 const char *name,
+                InstallIndex *index,
                 UnitFileState *ret) {
 
         _cleanup_(install_context_done) InstallContext c = {};
@@ -2589,7 +2597,7 @@ static int unit_file_lookup_state(
                         break;
                 }
 
-                r = find_symlinks_in_scope(paths, i->name, &state);
+                r = find_symlinks_in_scope(paths, i->name, index, &state);
                 if (r < 0)
                         return r;
                 if (r == 0) {
@@ -2611,6 +2619,61 @@ static int unit_file_lookup_state(
         return 0;
 }
 
+typedef struct UnitFileIndexContext {
+        UnitFileScope scope;
+        const LookupPaths *paths;
+} UnitFileIndexContext;
+
+static int unit_file_index_state(InstallIndex *index, const char *name, UnitFileState *ret, void *userdata) {
+        UnitFileIndexContext *c = userdata;
+
+        assert(c);
+
+        return unit_file_lookup_state(c->scope, c->paths, name, install_index_has_symlinks(index) ? index : NULL, ret);
+}
+
+static int unit_file_index_acquire(UnitFileScope scope, const LookupPaths *paths, const char *name, InstallIndex **ret) {
+        _cleanup_free_ char *path = NULL, *dir = NULL;
+        UnitFileIndexContext c = {
+                .scope = scope,
+                .paths = paths,
+        };
+        int r;
+
+        assert(paths);
+        assert(ret);
+
+        /* The index is kept next to the transient unit directory, i.e. in /run/systemd/ or
+         * $XDG_RUNTIME_DIR/systemd/. We don't maintain one for the global scope or alternative roots. */
+
+        *ret = NULL;
+
+        if (!IN_SET(scope, UNIT_FILE_SYSTEM, UNIT_FILE_USER) || paths->root_dir || !paths->transient)
+                return 0;
+
+        dir = dirname_malloc(paths->transient);
+        if (!dir)
+                return -ENOMEM;
+
+        path = strappend(dir, "/unit-file-index");
+        if (!path)
+                return -ENOMEM;
+
+        r = install_index_acquire(path, scope == UNIT_FILE_SYSTEM ? 0 : getuid(), paths->search_path,
+                                  unit_file_index_state, &c, ret);
+        if (r < 0)
+                return r;
+
+        /* Also catch unit files whose [Install] section was edited in place */
+        r = install_index_refresh(*ret, name, unit_file_index_state, &c);
+        if (r < 0) {
+                *ret = install_index_unref(*ret);
+                return r;
+        }
+
+        return 0;
+}
+
 int unit_file_get_state(
                 UnitFileScope scope,
                 const char *root_dir,
@@ -2618,6 +2681,8 @@ int unit_file_get_state(
                 UnitFileState *ret) {
 
         _cleanup_lookup_paths_free_ LookupPaths paths = {};
+        _cleanup_(install_index_unrefp) InstallIndex *index = NULL;
+        InstallIndexEntry *e;
         int r;
 
         assert(scope >= 0);
@@ -2628,7 +2693,17 @@ int unit_file_get_state(
         if (r < 0)
                 return r;
 
-        return unit_file_lookup_state(scope, &paths, name, ret);
+        if (ret && unit_file_index_acquire(scope, &paths, name, &index) >= 0 && index) {
+                /* Names that aren't files in the search path (e.g. instances of templates) are not
+                 * indexed, and neither are failed lookups, let's look them up the slow way. */
+                e = install_index_get(index, name);
+                if (e && e->state != UNIT_FILE_BAD) {
+                        *ret = e->state;
+                        return 0;
+                }
+        }
+
+        return unit_file_lookup_state(scope, &paths, name, NULL, ret);
 }
 
 int unit_file_exists(UnitFileScope scope, const LookupPaths *paths, const char *name) {
@@ -3017,6 +3092,50 @@ Hashmap* unit_file_list_free(Hashmap *h) {
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(UnitFileList*, unit_file_list_free_one);
 
+static int unit_file_get_list_from_index(InstallIndex *index, Hashmap *h, char **states, char **patterns) {
+        InstallIndexEntry **entries;
+        size_t n, k;
+        int r;
+
+        assert(index);
+        assert(h);
+
+        entries = install_index_entries(index, &n);
+
+        for (k = 0; k < n; k++) {
+                _cleanup_(unit_file_list_free_onep) UnitFileList *f = NULL;
+                InstallIndexEntry *e = entries[k];
+
+                if (!strv_fnmatch_or_empty(patterns, e->name, FNM_NOESCAPE))
+                        continue;
+
+                if (hashmap_get(h, e->name))
+                        continue;
+
+                if (!strv_isempty(states) &&
+                    !strv_contains(states, unit_file_state_to_string(e->state)))
+                        continue;
+
+                f = new0(UnitFileList, 1);
+                if (!f)
+                        return -ENOMEM;
+
+                f->path = strdup(e->path);
+                if (!f->path)
+                        return -ENOMEM;
+
+                f->state = e->state;
+
+                r = hashmap_put(h, basename(f->path), f);
+                if (r < 0)
+                        return r;
+
+                f = NULL; /* prevent cleanup */
+        }
+
+        return 0;
+}
+
 int unit_file_get_list(
                 UnitFileScope scope,
                 const char *root_dir,
@@ -3025,6 +3144,7 @@ int unit_file_get_list(
                 char **patterns) {
 
         _cleanup_lookup_paths_free_ LookupPaths paths = {};
+        _cleanup_(install_index_unrefp) InstallIndex *index = NULL;
         char **i;
         int r;
 
@@ -3036,6 +3156,12 @@ int unit_file_get_list(
         if (r < 0)
                 return r;
 
+        r = unit_file_index_acquire(scope, &paths, NULL, &index);
+        if (r < 0)
+                log_debug_errno(r, "Failed to acquire unit file index, enumerating unit files directly: %m");
+        else if (index)
+                return unit_file_get_list_from_index(index, h, states, patterns);
+
         STRV_FOREACH(i, paths.search_path) {
                 _cleanup_closedir_ DIR *d = NULL;
                 struct dirent *de;
@@ -3077,7 +3203,7 @@ int unit_file_get_list(
                         if (!f->path)
                                 return -ENOMEM;
 
-                        r = unit_file_lookup_state(scope, &paths, de->d_name, &f->state);
+                        r = unit_file_lookup_state(scope, &paths, de->d_name, NULL, &f->state);
                         if (r < 0)
                                 f->state = UNIT_FILE_BAD;
 
@@ -78,6 +78,7 @@
 #include "spawn-polkit-agent.h"
 #include "special.h"
 #include "stat-util.h"
+#include "stdio-util.h"
 #include "strv.h"
 #include "terminal-util.h"
 #include "unit-name.h"
@@ -172,6 +173,8 @@ static BusTransport arg_transport = BUS_TRANSPORT_LOCAL;
 static const char *arg_host = NULL;
 static unsigned arg_lines = 10;
 static OutputMode arg_output = OUTPUT_SHORT;
+static uint64_t arg_changed_since_epoch = 0;
+static uint64_t arg_changed_since = (uint64_t) -1;
 static bool arg_plain = false;
 static bool arg_firmware_setup = false;
 static bool arg_now = false;
@@ -181,7 +184,6 @@ static bool arg_jobs_after = false;
 static int daemon_reload(int argc, char *argv[], void* userdata);
 static int trivial_method(int argc, char *argv[], void *userdata);
 static int halt_now(enum action a);
-static int get_state_one_unit(sd_bus *bus, const char *name, UnitActiveState *active_state);
 
 static bool original_stdout_is_tty;
 
@@ -598,25 +600,21 @@ static int output_units_list(const UnitInfo *unit_infos, unsigned c) {
         return 0;
 }
 
-static int get_unit_list(
+static int call_list_units(
                 sd_bus *bus,
-                const char *machine,
                 char **patterns,
-                UnitInfo **unit_infos,
-                int c,
-                sd_bus_message **_reply) {
+                sd_bus_message **_reply,
+                bool *_fallback) {
 
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
-        size_t size = c;
-        int r;
-        UnitInfo u;
         bool fallback = false;
+        int r;
 
         assert(bus);
-        assert(unit_infos);
         assert(_reply);
+        assert(_fallback);
 
         r = sd_bus_message_new_method_call(
                         bus,
@@ -664,6 +662,35 @@ static int get_unit_list(
         if (r < 0)
                 return log_error_errno(r, "Failed to list units: %s", bus_error_message(&error, r));
 
+        *_reply = reply;
+        reply = NULL;
+        *_fallback = fallback;
+
+        return 0;
+}
+
+static int get_unit_list(
+                sd_bus *bus,
+                const char *machine,
+                char **patterns,
+                UnitInfo **unit_infos,
+                int c,
+                sd_bus_message **_reply) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        size_t size = c;
+        int r;
+        UnitInfo u;
+        bool fallback;
+
+        assert(bus);
+        assert(unit_infos);
+        assert(_reply);
+
+        r = call_list_units(bus, patterns, &reply, &fallback);
+        if (r < 0)
+                return r;
+
         r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(ssssssouso)");
         if (r < 0)
                 return bus_log_parse_error(r);
@@ -777,6 +804,191 @@ static int get_unit_list_recursive(
         return c;
 }
 
+static bool output_is_machine_readable(void) {
+        return IN_SET(arg_output, OUTPUT_EXPORT, OUTPUT_JSON, OUTPUT_JSON_PRETTY, OUTPUT_JSON_SSE);
+}
+
+static void output_record(char **fields) {
+        bool first = true;
+        char **f;
+
+        /* Writes one record of field name/value pairs in the format selected with --output=. Fields with a
+         * NULL value are skipped. The format follows what journalctl generates for the same output modes. */
+
+        if (arg_output == OUTPUT_JSON_SSE)
+                fputs("data: ", stdout);
+
+        if (arg_output == OUTPUT_JSON_PRETTY)
+                fputs("{\n", stdout);
+        else if (arg_output != OUTPUT_EXPORT)
+                fputs("{ ", stdout);
+
+        for (f = fields; f[0]; f += 2) {
+                if (!f[1])
+                        continue;
+
+                if (arg_output == OUTPUT_EXPORT) {
+                        printf("%s=%s\n", f[0], f[1]);
+                        continue;
+                }
+
+                if (!first)
+                        fputs(arg_output == OUTPUT_JSON_PRETTY ? ",\n" : ", ", stdout);
+                first = false;
+
+                printf(arg_output == OUTPUT_JSON_PRETTY ? "\t\"%s\" : " : "\"%s\" : ", f[0]);
+                json_escape(stdout, f[1], strlen(f[1]), 0);
+        }
+
+        if (arg_output == OUTPUT_EXPORT)
+                fputc('\n', stdout);
+        else if (arg_output == OUTPUT_JSON_PRETTY)
+                fputs("\n}\n", stdout);
+        else if (arg_output == OUTPUT_JSON_SSE)
+                fputs(" }\n\n", stdout);
+        else
+                fputs(" }\n", stdout);
+}
+
+static void output_unit_info_record(const UnitInfo *u) {
+        char job_id[DECIMAL_STR_MAX(uint32_t)];
+
+        assert(u);
+
+        xsprintf(job_id, "%" PRIu32, u->job_id);
+
+        output_record(STRV_MAKE("UNIT", u->id,
+                                "LOAD", u->load_state,
+                                "ACTIVE", u->active_state,
+                                "SUB", u->sub_state,
+                                "DESCRIPTION", u->description,
+                                "FOLLOWING", empty_to_null(u->following),
+                                "JOB_ID", u->job_id > 0 ? job_id : NULL,
+                                "JOB_TYPE", u->job_id > 0 ? u->job_type : NULL,
+                                "MACHINE", u->machine));
+}
+
+static int stream_unit_list(sd_bus *bus, const char *machine, char **patterns) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        bool fallback = false, delta = false;
+        UnitInfo u;
+        int r;
+
+        assert(bus);
+
+        /* Unlike get_unit_list() this doesn't collect, sort and align the units first, but writes them out
+         * one by one, directly from the reply */
+
+        if (arg_changed_since != (uint64_t) -1) {
+                _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+                char generation[DECIMAL_STR_MAX(uint64_t) * 2 + 1];
+                uint64_t e, g;
+                int complete;
+
+                r = sd_bus_message_new_method_call(
+                                bus,
+                                &m,
+                                "org.freedesktop.systemd1",
+                                "/org/freedesktop/systemd1",
+                                "org.freedesktop.systemd1.Manager",
+                                "ListUnitsChangedSince");
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_append(m, "tt", arg_changed_since_epoch, arg_changed_since);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_append_strv(m, arg_states);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_message_append_strv(m, patterns);
+                if (r < 0)
+                        return bus_log_create_error(r);
+
+                r = sd_bus_call(bus, m, 0, &error, &reply);
+                if (r < 0)
+                        return log_error_errno(r, "Failed to list changed units: %s", bus_error_message(&error, r));
+
+                r = sd_bus_message_read(reply, "ttb", &e, &g, &complete);
+                if (r < 0)
+                        return bus_log_parse_error(r);
+
+                /* The epoch identifies the manager instance the generation belongs to, both are passed back
+                 * to us as one token */
+                xsprintf(generation, "%" PRIu64 ":%" PRIu64, e, g);
+                output_record(STRV_MAKE("GENERATION", generation,
+                                        "COMPLETE", yes_no(complete)));
+
+                delta = !complete;
+        } else {
+                r = call_list_units(bus, patterns, &reply, &fallback);
+                if (r < 0)
+                        return r;
+        }
+
+        r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "(ssssssouso)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = bus_parse_unit_info(reply, &u)) > 0) {
+                u.machine = machine;
+
+                if (delta) {
+                        /* Units that changed out of the view are listed too, so that the caller drops them. The
+                         * type is part of the name, and doesn't change. */
+                        if (arg_types && !strv_find(arg_types, unit_type_suffix(u.id)))
+                                continue;
+                } else if (!output_show_unit(&u, fallback ? patterns : NULL))
+                        continue;
+
+                output_unit_info_record(&u);
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        r = sd_bus_message_exit_container(reply);
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        return 0;
+}
+
+static int list_units_machine_readable(sd_bus *bus, char **patterns) {
+        _cleanup_strv_free_ char **machines = NULL;
+        char **i;
+        int r;
+
+        r = stream_unit_list(bus, NULL, patterns);
+        if (r < 0)
+                return r;
+
+        if (!arg_recursive)
+                return 0;
+
+        r = sd_get_machine_names(&machines);
+        if (r < 0)
+                return log_error_errno(r, "Failed to get machine names: %m");
+
+        STRV_FOREACH(i, machines) {
+                _cleanup_(sd_bus_flush_close_unrefp) sd_bus *container = NULL;
+
+                r = sd_bus_open_system_machine(&container, *i);
+                if (r < 0) {
+                        log_warning_errno(r, "Failed to connect to container %s, ignoring: %m", *i);
+                        continue;
+                }
+
+                r = stream_unit_list(container, *i, patterns);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int list_units(int argc, char *argv[], void *userdata) {
         _cleanup_free_ UnitInfo *unit_infos = NULL;
         _cleanup_(message_set_freep) Set *replies = NULL;
@@ -784,12 +996,27 @@ static int list_units(int argc, char *argv[], void *userdata) {
         sd_bus *bus;
         int r;
 
+        if (arg_changed_since != (uint64_t) -1) {
+                if (!output_is_machine_readable()) {
+                        log_error("--changed-since= requires --output=export, json, json-pretty or json-sse.");
+                        return -EINVAL;
+                }
+
+                if (arg_recursive) {
+                        log_error("--changed-since= cannot be combined with --recursive.");
+                        return -EINVAL;
+                }
+        }
+
         r = acquire_bus(BUS_MANAGER, &bus);
         if (r < 0)
                 return r;
 
         pager_open(arg_no_pager, false);
 
+        if (output_is_machine_readable())
+                return list_units_machine_readable(bus, strv_skip(argv, 1));
+
         r = get_unit_list_recursive(bus, strv_skip(argv, 1), &unit_infos, &replies, &machines);
         if (r < 0)
                 return r;
@@ -1611,6 +1838,132 @@ static int list_unit_files(int argc, char *argv[], void *userdata) {
         return 0;
 }
 
+/* How many GetAll() calls to have in flight at the same time */
+#define GET_PROPERTIES_WINDOW 64
+
+typedef int (*properties_handler_t)(sd_bus *bus, size_t idx, sd_bus_message *reply, const sd_bus_error *error, void *userdata);
+
+typedef struct PropertiesQuery {
+        sd_bus_slot *slot;
+        sd_bus_message *reply;
+        sd_bus_error error;
+        bool done;
+} PropertiesQuery;
+
+static void properties_query_done(PropertiesQuery *q) {
+        assert(q);
+
+        q->slot = sd_bus_slot_unref(q->slot);
+        q->reply = sd_bus_message_unref(q->reply);
+        sd_bus_error_free(&q->error);
+        q->done = false;
+}
+
+static int on_properties(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        PropertiesQuery *q = userdata;
+        const sd_bus_error *e;
+
+        assert(m);
+        assert(q);
+
+        e = sd_bus_message_get_error(m);
+        if (e)
+                sd_bus_error_copy(&q->error, e);
+        else
+                q->reply = sd_bus_message_ref(m);
+
+        q->done = true;
+        return 0;
+}
+
+static int get_properties_pipelined(
+                sd_bus *bus,
+                char **paths,
+                const char *interface,
+                properties_handler_t handler,
+                void *userdata) {
+
+        PropertiesQuery *queries;
+        size_t n, head = 0, tail = 0;
+        int r = 0;
+
+        assert(bus);
+        assert(handler);
+
+        /* Issues GetAll() for all specified objects, keeping up to GET_PROPERTIES_WINDOW calls in flight, and
+         * hands the replies to the handler in the order of the paths, as soon as they arrive. This avoids one
+         * full round trip per object, which adds up quickly if we look at thousands of units. */
+
+        n = strv_length(paths);
+        if (n == 0)
+                return 0;
+
+        queries = new0(PropertiesQuery, MIN(n, (size_t) GET_PROPERTIES_WINDOW));
+        if (!queries)
+                return log_oom();
+
+        while (head < n) {
+                PropertiesQuery *q;
+
+                while (tail < n && tail - head < GET_PROPERTIES_WINDOW) {
+                        q = queries + tail % GET_PROPERTIES_WINDOW;
+
+                        r = sd_bus_call_method_async(
+                                        bus,
+                                        &q->slot,
+                                        "org.freedesktop.systemd1",
+                                        paths[tail],
+                                        "org.freedesktop.DBus.Properties",
+                                        "GetAll",
+                                        on_properties,
+                                        q,
+                                        "s", strempty(interface));
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to issue GetAll() call: %m");
+                                goto finish;
+                        }
+
+                        tail++;
+                }
+
+                q = queries + head % GET_PROPERTIES_WINDOW;
+
+                if (!q->done) {
+                        r = sd_bus_process(bus, NULL);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to process bus: %m");
+                                goto finish;
+                        }
+                        if (r > 0)
+                                continue;
+
+                        r = sd_bus_wait(bus, (uint64_t) -1);
+                        if (r < 0) {
+                                log_error_errno(r, "Failed to wait for bus: %m");
+                                goto finish;
+                        }
+
+                        continue;
+                }
+
+                r = handler(bus, head, q->reply, &q->error, userdata);
+                properties_query_done(q);
+                if (r < 0)
+                        goto finish;
+
+                head++;
+        }
+
+        r = 0;
+
+finish:
+        for (; head < tail; head++)
+                properties_query_done(queries + head % GET_PROPERTIES_WINDOW);
+
+        free(queries);
+        return r;
+}
+
 static int list_dependencies_print(const char *name, int level, unsigned int branches, bool last) {
         _cleanup_free_ char *n = NULL;
         size_t max_len = MAX(columns(),20u);
@@ -1650,7 +2003,7 @@ static int list_dependencies_print(const char *name, int level, unsigned int bra
         return 0;
 }
 
-static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, char ***deps) {
+static int list_dependencies_parse(sd_bus_message *reply, char ***deps, UnitActiveState *active_state) {
 
         static const char *dependencies[_DEPENDENCY_MAX] = {
                 [DEPENDENCY_FORWARD] = "Requires\0"
@@ -1667,33 +2020,15 @@ static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, cha
                 [DEPENDENCY_BEFORE]  = "Before\0",
         };
 
-        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
         _cleanup_strv_free_ char **ret = NULL;
-        _cleanup_free_ char *path = NULL;
+        UnitActiveState state = _UNIT_ACTIVE_STATE_INVALID;
         int r;
 
-        assert(bus);
-        assert(name);
+        assert(reply);
         assert(deps);
+        assert(active_state);
         assert_cc(ELEMENTSOF(dependencies) == _DEPENDENCY_MAX);
 
-        path = unit_dbus_path_from_name(name);
-        if (!path)
-                return log_oom();
-
-        r = sd_bus_call_method(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &error,
-                        &reply,
-                        "s", "org.freedesktop.systemd1.Unit");
-        if (r < 0)
-                return log_error_errno(r, "Failed to get properties of %s: %s", name, bus_error_message(&error, r));
-
         r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
         if (r < 0)
                 return bus_log_parse_error(r);
@@ -1705,7 +2040,16 @@ static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, cha
                 if (r < 0)
                         return bus_log_parse_error(r);
 
-                if (!nulstr_contains(dependencies[arg_dependency], prop)) {
+                if (streq(prop, "ActiveState")) {
+                        const char *s;
+
+                        r = sd_bus_message_read(reply, "v", "s", &s);
+                        if (r < 0)
+                                return bus_log_parse_error(r);
+
+                        state = unit_active_state_from_string(s);
+
+                } else if (!nulstr_contains(dependencies[arg_dependency], prop)) {
                         r = sd_bus_message_skip(reply, "v");
                         if (r < 0)
                                 return bus_log_parse_error(r);
@@ -1738,10 +2082,63 @@ static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, cha
 
         *deps = strv_uniq(ret);
         ret = NULL;
+        *active_state = state;
 
         return 0;
 }
 
+static int list_dependencies_get_dependencies(sd_bus *bus, const char *name, char ***deps) {
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_free_ char *path = NULL;
+        UnitActiveState active_state;
+        int r;
+
+        assert(bus);
+        assert(name);
+        assert(deps);
+
+        path = unit_dbus_path_from_name(name);
+        if (!path)
+                return log_oom();
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &error,
+                        &reply,
+                        "s", "org.freedesktop.systemd1.Unit");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get properties of %s: %s", name, bus_error_message(&error, r));
+
+        return list_dependencies_parse(reply, deps, &active_state);
+}
+
+typedef struct DependencyInfo {
+        char **deps;
+        UnitActiveState active_state;
+        sd_bus_error error;
+} DependencyInfo;
+
+static int on_dependency_properties(sd_bus *bus, size_t idx, sd_bus_message *reply, const sd_bus_error *error, void *userdata) {
+        DependencyInfo **queue = userdata, *info;
+
+        assert(queue);
+
+        info = queue[idx];
+
+        if (!reply) {
+                /* Only fatal if we need to recurse into this unit */
+                (void) sd_bus_error_copy(&info->error, error);
+                return 0;
+        }
+
+        return list_dependencies_parse(reply, &info->deps, &info->active_state);
+}
+
 static int list_dependencies_compare(const void *_a, const void *_b) {
         const char **a = (const char**) _a, **b = (const char**) _b;
 
@@ -1756,11 +2153,15 @@ static int list_dependencies_compare(const void *_a, const void *_b) {
 static int list_dependencies_one(
                 sd_bus *bus,
                 const char *name,
+                char **deps,
                 int level,
                 char ***units,
                 unsigned int branches) {
 
-        _cleanup_strv_free_ char **deps = NULL;
+        _cleanup_strv_free_ char **paths = NULL;
+        _cleanup_free_ DependencyInfo **queue = NULL;
+        DependencyInfo *infos = NULL;
+        size_t n, n_queue = 0, k;
         char **c;
         int r = 0;
 
@@ -1772,19 +2173,53 @@ static int list_dependencies_one(
         if (r < 0)
                 return log_oom();
 
-        r = list_dependencies_get_dependencies(bus, name, &deps);
-        if (r < 0)
-                return r;
+        n = strv_length(deps);
+        qsort_safe(deps, n, sizeof (char*), list_dependencies_compare);
+
+        if (n > 0) {
+                infos = new0(DependencyInfo, n);
+                queue = new(DependencyInfo*, n);
+                if (!infos || !queue) {
+                        r = log_oom();
+                        goto finish;
+                }
+        }
+
+        /* Fetch the state and the dependencies of everything we are going to show in one go, instead of
+         * doing one round trip after the other */
+        for (k = 0; k < n; k++) {
+                char *path;
+
+                infos[k].active_state = _UNIT_ACTIVE_STATE_INVALID;
+
+                if (strv_contains(*units, deps[k]))
+                        continue;
 
-        qsort_safe(deps, strv_length(deps), sizeof (char*), list_dependencies_compare);
+                if (arg_plain && !arg_all && unit_name_to_type(deps[k]) != UNIT_TARGET)
+                        continue;
+
+                path = unit_dbus_path_from_name(deps[k]);
+                if (!path || strv_consume(&paths, path) < 0) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                queue[n_queue++] = infos + k;
+        }
+
+        r = get_properties_pipelined(bus, paths, "org.freedesktop.systemd1.Unit", on_dependency_properties, queue);
+        if (r < 0)
+                goto finish;
 
         STRV_FOREACH(c, deps) {
+                DependencyInfo *info = infos + (c - deps);
+
                 if (strv_contains(*units, *c)) {
                         if (!arg_plain) {
                                 printf("  ");
                                 r = list_dependencies_print("...", level + 1, (branches << 1) | (c[1] == NULL ? 0 : 1), 1);
                                 if (r < 0)
-                                        return r;
+                                        goto finish;
                         }
                         continue;
                 }
@@ -1792,12 +2227,9 @@ static int list_dependencies_one(
                 if (arg_plain)
                         printf("  ");
                 else {
-                        UnitActiveState active_state = _UNIT_ACTIVE_STATE_INVALID;
                         const char *on;
 
-                        (void) get_state_one_unit(bus, *c, &active_state);
-
-                        switch (active_state) {
+                        switch (info->active_state) {
                         case UNIT_ACTIVE:
                         case UNIT_RELOADING:
                         case UNIT_ACTIVATING:
@@ -1819,23 +2251,38 @@ static int list_dependencies_one(
 
                 r = list_dependencies_print(*c, level, branches, c[1] == NULL);
                 if (r < 0)
-                        return r;
+                        goto finish;
 
                 if (arg_all || unit_name_to_type(*c) == UNIT_TARGET) {
-                       r = list_dependencies_one(bus, *c, level + 1, units, (branches << 1) | (c[1] == NULL ? 0 : 1));
-                       if (r < 0)
-                               return r;
+                        if (sd_bus_error_is_set(&info->error)) {
+                                r = sd_bus_error_get_errno(&info->error);
+                                log_error_errno(r, "Failed to get properties of %s: %s", *c, bus_error_message(&info->error, r));
+                                goto finish;
+                        }
+
+                        r = list_dependencies_one(bus, *c, info->deps, level + 1, units, (branches << 1) | (c[1] == NULL ? 0 : 1));
+                        if (r < 0)
+                                goto finish;
                 }
         }
 
         if (!arg_plain)
                 strv_remove(*units, name);
 
-        return 0;
+        r = 0;
+
+finish:
+        for (k = 0; k < n; k++) {
+                strv_free(infos[k].deps);
+                sd_bus_error_free(&infos[k].error);
+        }
+        free(infos);
+
+        return r;
 }
 
 static int list_dependencies(int argc, char *argv[], void *userdata) {
-        _cleanup_strv_free_ char **units = NULL;
+        _cleanup_strv_free_ char **units = NULL, **deps = NULL;
         _cleanup_free_ char *unit = NULL;
         const char *u;
         sd_bus *bus;
@@ -1854,11 +2301,15 @@ static int list_dependencies(int argc, char *argv[], void *userdata) {
         if (r < 0)
                 return r;
 
+        r = list_dependencies_get_dependencies(bus, u, &deps);
+        if (r < 0)
+                return r;
+
         pager_open(arg_no_pager, false);
 
         puts(u);
 
-        return list_dependencies_one(bus, u, 0, &units, 0);
+        return list_dependencies_one(bus, u, deps, 0, &units, 0);
 }
 
 struct machine_info {
@@ -4911,11 +5362,12 @@ static int print_property(const char *name, sd_bus_message *m, const char *conte
         return 0;
 }
 
-static int show_one(
+static int show_one_reply(
                 const char *verb,
                 sd_bus *bus,
                 const char *path,
                 const char *unit,
+                sd_bus_message *reply,
                 bool show_properties,
                 bool *new_line,
                 bool *ellipsized) {
@@ -4926,7 +5378,6 @@ static int show_one(
                 {}
         };
 
-        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
         _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
         _cleanup_set_free_ Set *found_properties = NULL;
         _cleanup_(unit_status_info_free) UnitStatusInfo info = {
@@ -4942,22 +5393,11 @@ static int show_one(
         int r;
 
         assert(path);
+        assert(reply);
         assert(new_line);
 
         log_debug("Showing one %s", path);
 
-        r = sd_bus_call_method(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &error,
-                        &reply,
-                        "s", "");
-        if (r < 0)
-                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
-
         if (unit) {
                 r = bus_message_map_all_properties(reply, property_map, &error, &info);
                 if (r < 0)
@@ -5055,6 +5495,108 @@ static int show_one(
         return r;
 }
 
+static int show_one(
+                const char *verb,
+                sd_bus *bus,
+                const char *path,
+                const char *unit,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        assert(path);
+
+        r = sd_bus_call_method(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &error,
+                        &reply,
+                        "s", "");
+        if (r < 0)
+                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(&error, r));
+
+        return show_one_reply(verb, bus, path, unit, reply, show_properties, new_line, ellipsized);
+}
+
+typedef struct ShowContext {
+        const char *verb;
+        char **units;
+        char **paths;
+        bool show_properties;
+        bool *new_line;
+        bool *ellipsized;
+        int ret;
+} ShowContext;
+
+static int on_show_properties(sd_bus *bus, size_t idx, sd_bus_message *reply, const sd_bus_error *error, void *userdata) {
+        ShowContext *c = userdata;
+        int r;
+
+        assert(c);
+
+        if (!reply) {
+                r = sd_bus_error_get_errno(error);
+                return log_error_errno(r, "Failed to get properties: %s", bus_error_message(error, r));
+        }
+
+        r = show_one_reply(c->verb, bus, c->paths[idx], c->units[idx], reply, c->show_properties, c->new_line, c->ellipsized);
+        if (r < 0)
+                return r;
+        if (r > 0 && c->ret == 0)
+                c->ret = r;
+
+        return 0;
+}
+
+static int show_many(
+                const char *verb,
+                sd_bus *bus,
+                char **units,
+                bool show_properties,
+                bool *new_line,
+                bool *ellipsized) {
+
+        _cleanup_strv_free_ char **paths = NULL;
+        ShowContext c = {
+                .verb = verb,
+                .units = units,
+                .show_properties = show_properties,
+                .new_line = new_line,
+                .ellipsized = ellipsized,
+        };
+        char **name;
+        int r;
+
+        /* Like show_one() for each unit, but with the property calls pipelined, and the output generated in
+         * order as the replies come in */
+
+        STRV_FOREACH(name, units) {
+                char *path;
+
+                path = unit_dbus_path_from_name(*name);
+                if (!path)
+                        return log_oom();
+
+                if (strv_consume(&paths, path) < 0)
+                        return log_oom();
+        }
+
+        c.paths = paths;
+
+        r = get_properties_pipelined(bus, paths, NULL, on_show_properties, &c);
+        if (r < 0)
+                return r;
+
+        return c.ret;
+}
+
 static int get_unit_dbus_path_by_pid(
                 sd_bus *bus,
                 uint32_t pid,
@@ -5098,9 +5640,10 @@ static int show_all(
 
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
         _cleanup_free_ UnitInfo *unit_infos = NULL;
+        _cleanup_free_ char **names = NULL;
         const UnitInfo *u;
         unsigned c;
-        int r, ret = 0;
+        int r;
 
         r = get_unit_list(bus, NULL, NULL, &unit_infos, 0, &reply);
         if (r < 0)
@@ -5112,21 +5655,16 @@ static int show_all(
 
         qsort_safe(unit_infos, c, sizeof(UnitInfo), compare_unit_info);
 
-        for (u = unit_infos; u < unit_infos + c; u++) {
-                _cleanup_free_ char *p = NULL;
-
-                p = unit_dbus_path_from_name(u->id);
-                if (!p)
-                        return log_oom();
+        /* The names are owned by the reply message, hence only free the array */
+        names = new(char*, c + 1);
+        if (!names)
+                return log_oom();
 
-                r = show_one(verb, bus, p, u->id, show_properties, new_line, ellipsized);
-                if (r < 0)
-                        return r;
-                else if (r > 0 && ret == 0)
-                        ret = r;
-        }
+        for (u = unit_infos; u < unit_infos + c; u++)
+                names[u - unit_infos] = (char*) u->id;
+        names[c] = NULL;
 
-        return ret;
+        return show_many(verb, bus, names, show_properties, new_line, ellipsized);
 }
 
 static int show_system_status(sd_bus *bus) {
@@ -5270,19 +5808,11 @@ static int show(int argc, char *argv[], void *userdata) {
                         if (r < 0)
                                 return log_error_errno(r, "Failed to expand names: %m");
 
-                        STRV_FOREACH(name, names) {
-                                _cleanup_free_ char *path;
-
-                                path = unit_dbus_path_from_name(*name);
-                                if (!path)
-                                        return log_oom();
-
-                                r = show_one(argv[0], bus, path, *name, show_properties, &new_line, &ellipsized);
-                                if (r < 0)
-                                        return r;
-                                if (r > 0 && ret == 0)
-                                        ret = r;
-                        }
+                        r = show_many(argv[0], bus, names, show_properties, &new_line, &ellipsized);
+                        if (r < 0)
+                                return r;
+                        if (r > 0 && ret == 0)
+                                ret = r;
                 }
         }
 
@@ -7027,6 +7557,9 @@ static void systemctl_help(void) {
                "                             short-iso, short-iso-precise, short-full,\n"
                "                             short-monotonic, short-unix,\n"
                "                             verbose, export, json, json-pretty, json-sse, cat)\n"
+               "                      With list-units, export and json* write one record per unit\n"
+               "     --changed-since=GENERATION\n"
+               "                      With list-units, only show units changed since GENERATION\n"
                "     --firmware-setup Tell the firmware to show the setup menu on next boot\n"
                "     --plain          Print unit dependencies as a list instead of a tree\n\n"
                "Unit Commands:\n"
@@ -7249,6 +7782,44 @@ static void help_states(void) {
                 puts(timer_state_to_string(i));
 }
 
+static int parse_changed_since(const char *s, uint64_t *ret_epoch, uint64_t *ret_generation) {
+        _cleanup_free_ char *e = NULL;
+        uint64_t epoch = 0, generation;
+        const char *colon;
+        int r;
+
+        assert(s);
+        assert(ret_epoch);
+        assert(ret_generation);
+
+        /* Either 0 to list all units, or EPOCH:GENERATION as written by a previous invocation */
+
+        colon = strchr(s, ':');
+        if (colon) {
+                e = strndup(s, colon - s);
+                if (!e)
+                        return -ENOMEM;
+
+                r = safe_atou64(e, &epoch);
+                if (r < 0)
+                        return r;
+
+                s = colon + 1;
+        }
+
+        r = safe_atou64(s, &generation);
+        if (r < 0)
+                return r;
+        if (generation == (uint64_t) -1)
+                return -ERANGE;
+        if (!colon && generation != 0)
+                return -EINVAL;
+
+        *ret_epoch = epoch;
+        *ret_generation = generation;
+        return 0;
+}
+
 static int systemctl_parse_argv(int argc, char *argv[]) {
 
         enum {
@@ -7283,6 +7854,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 ARG_NOW,
                 ARG_MESSAGE,
                 ARG_WAIT,
+                ARG_CHANGED_SINCE,
         };
 
         static const struct option options[] = {
@@ -7323,6 +7895,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 { "runtime",             no_argument,       NULL, ARG_RUNTIME             },
                 { "lines",               required_argument, NULL, 'n'                     },
                 { "output",              required_argument, NULL, 'o'                     },
+                { "changed-since",       required_argument, NULL, ARG_CHANGED_SINCE       },
                 { "plain",               no_argument,       NULL, ARG_PLAIN               },
                 { "state",               required_argument, NULL, ARG_STATE               },
                 { "recursive",           no_argument,       NULL, 'r'                     },
@@ -7581,6 +8154,16 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                         }
                         break;
 
+                case ARG_CHANGED_SINCE:
+                        r = parse_changed_since(optarg, &arg_changed_since_epoch, &arg_changed_since);
+                        if (r == -ENOMEM)
+                                return log_oom();
+                        if (r < 0) {
+                                log_error("Failed to parse generation '%s'.", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
                 case 'i':
                         arg_ignore_inhibitors = true;
                         break;
@@ -19,13 +19,174 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #include "bus-util.h"
+#include "fd-util.h"
+#include "fileio.h"
 #include "manager.h"
+#include "parse-util.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
 #include "test-helper.h"
 #include "tests.h"
+#include "unit-order.h"
+
+static Unit *load_order_unit(Manager *m, const char *name) {
+        Unit *u = NULL;
+
+        /* The files don't exist, but that doesn't matter for the ordering graph */
+        assert_se(manager_load_unit(m, name, NULL, NULL, &u) >= 0);
+        assert_se(u);
+
+        return u;
+}
+
+static void test_unit_order(void) {
+        Manager *m = NULL;
+        Unit *a, *b, *c, *p, *q, *r, *s, *u, *v, *w;
+        uint64_t index_p, index_q, index_r, index_s;
+
+        assert_se(manager_new(UNIT_FILE_USER, true, &m) >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+        assert_se(unit_order_is_acyclic(m));
+
+        /* New units are appended to the order */
+        a = load_order_unit(m, "order-a.service");
+        b = load_order_unit(m, "order-b.service");
+        c = load_order_unit(m, "order-c.service");
+        assert_se(a->order_index < b->order_index);
+        assert_se(b->order_index < c->order_index);
+
+        /* An edge that contradicts the order swaps just the two ends, b is not affected */
+        assert_se(unit_add_dependency(c, UNIT_BEFORE, a, true) >= 0);
+        assert_se(unit_order_is_acyclic(m));
+        assert_se(c->order_index < b->order_index);
+        assert_se(b->order_index < a->order_index);
+
+        /* An edge that agrees with the order changes nothing */
+        assert_se(unit_add_dependency(b, UNIT_AFTER, c, true) >= 0);
+        assert_se(unit_order_is_acyclic(m));
+        assert_se(c->order_index < b->order_index);
+        assert_se(b->order_index < a->order_index);
+
+        /* Moving s before p drags q, which is ordered after p, along, and reuses the existing positions,
+         * leaving r, which is unrelated, in place */
+        p = load_order_unit(m, "order-p.service");
+        q = load_order_unit(m, "order-q.service");
+        r = load_order_unit(m, "order-r.service");
+        s = load_order_unit(m, "order-s.service");
+        assert_se(unit_add_dependency(p, UNIT_BEFORE, q, true) >= 0);
+
+        index_p = p->order_index;
+        index_q = q->order_index;
+        index_r = r->order_index;
+        index_s = s->order_index;
+        assert_se(index_p < index_q && index_q < index_r && index_r < index_s);
+
+        assert_se(unit_add_dependency(s, UNIT_BEFORE, p, true) >= 0);
+        assert_se(unit_order_is_acyclic(m));
+        assert_se(s->order_index == index_p);
+        assert_se(p->order_index == index_q);
+        assert_se(q->order_index == index_s);
+        assert_se(r->order_index == index_r);
+
+        /* Closing a cycle abandons the order, removing a unit on the cycle gets it rebuilt from scratch */
+        u = load_order_unit(m, "order-u.service");
+        v = load_order_unit(m, "order-v.service");
+        w = load_order_unit(m, "order-w.service");
+        assert_se(unit_add_dependency(w, UNIT_BEFORE, u, true) >= 0);
+        assert_se(unit_add_dependency(u, UNIT_BEFORE, v, true) >= 0);
+        assert_se(unit_add_dependency(v, UNIT_BEFORE, u, true) >= 0);
+        assert_se(!unit_order_is_acyclic(m));
+
+        unit_free(v);
+        assert_se(unit_order_is_acyclic(m));
+        assert_se(w->order_index < u->order_index);
+        assert_se(c->order_index < b->order_index);
+        assert_se(b->order_index < a->order_index);
+        assert_se(s->order_index < p->order_index);
+        assert_se(p->order_index < q->order_index);
+
+        manager_free(m);
+}
+
+static size_t max_rss(void) {
+        struct rusage ru;
+
+        assert_se(getrusage(RUSAGE_SELF, &ru) >= 0);
+
+        /* In kilobytes on Linux */
+        return (size_t) ru.ru_maxrss * 1024U;
+}
+
+static void write_tree_unit(const char *dir, unsigned i, unsigned n_units) {
+        char name[strlen("/synth-.target") + DECIMAL_STR_MAX(unsigned)];
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *p = NULL;
+        unsigned k;
+
+        xsprintf(name, "/synth-%u.target", i);
+        p = strappend(dir, name);
+        assert_se(p);
+
+        f = fopen(p, "we");
+        assert_se(f);
+
+        /* Every unit pulls in and is ordered before up to ten children */
+        fputs("[Unit]\nDefaultDependencies=no\n", f);
+        for (k = 10 * i + 1; k <= 10 * i + 10 && k < n_units; k++)
+                fprintf(f, "Wants=synth-%u.target\nBefore=synth-%u.target\n", k, k);
+
+        assert_se(fflush_and_check(f) >= 0);
+}
+
+static void test_synthetic_tree(unsigned n_units) {
+        char dir[] = "/tmp/test-engine-tree.XXXXXX";
+        char load[FORMAT_TIMESPAN_MAX], transaction[FORMAT_TIMESPAN_MAX], rss[FORMAT_BYTES_MAX];
+        Manager *m = NULL;
+        size_t rss_before;
+        usec_t ts, load_usec, transaction_usec;
+        Unit *root;
+        Job *j;
+        unsigned i;
+
+        /* Not so much a test as a benchmark: how much memory does a tree of n units take, and how long does
+         * it take to build the transaction that starts all of them? Pass the number of units as the first
+         * argument to try larger trees. */
+
+        assert_se(mkdtemp(dir));
+        for (i = 0; i < n_units; i++)
+                write_tree_unit(dir, i, n_units);
+
+        assert_se(set_unit_path(dir) >= 0);
+        assert_se(manager_new(UNIT_FILE_USER, true, &m) >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        rss_before = max_rss();
+
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(manager_load_unit(m, "synth-0.target", NULL, NULL, &root) >= 0);
+        load_usec = now(CLOCK_MONOTONIC) - ts;
+        assert_se(root->load_state == UNIT_LOADED);
+
+        ts = now(CLOCK_MONOTONIC);
+        assert_se(manager_add_job(m, JOB_START, root, JOB_REPLACE, NULL, &j) >= 0);
+        transaction_usec = now(CLOCK_MONOTONIC) - ts;
+        assert_se(hashmap_size(m->jobs) == n_units);
+
+        log_info("Loaded %u units in %s, maximum RSS grew by %s, starting all of them took %s to build the transaction.",
+                 n_units,
+                 format_timespan(load, sizeof(load), load_usec, 1),
+                 format_bytes(rss, sizeof(rss), max_rss() - rss_before),
+                 format_timespan(transaction, sizeof(transaction), transaction_usec, 1));
+
+        manager_free(m);
+
+        assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
 
 int main(int argc, char *argv[]) {
         _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
@@ -67,6 +228,9 @@ int main(int argc, char *argv[]) {
         assert_se(manager_load_unit(m, "e.service", NULL, NULL, &e) >= 0);
         manager_dump_units(m, stdout, "\t");
 
+        /* d.service and e.service are ordered after b.service and before a.service, which is ordered before b.service */
+        assert_se(!unit_order_is_acyclic(m));
+
         printf("Test2: (Cyclic Order, Unfixable)\n");
         assert_se(manager_add_job(m, JOB_START, d, JOB_REPLACE, NULL, &j) == -EDEADLK);
         manager_dump_jobs(m, stdout, "\t");
@@ -111,5 +275,8 @@ int main(int argc, char *argv[]) {
 
         manager_free(m);
 
+        test_unit_order();
+        test_synthetic_tree(argc > 1 ? (unsigned) atoi(argv[1]) : 1000);
+
         return 0;
 }
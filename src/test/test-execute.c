@@ -22,12 +22,14 @@
 #include <stdio.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include "fileio.h"
 #include "fs-util.h"
 #include "macro.h"
 #include "manager.h"
 #include "mkdir.h"
+#include "parse-util.h"
 #include "path-util.h"
 #include "rm-rf.h"
 #ifdef HAVE_SECCOMP
@@ -42,17 +44,10 @@
 
 typedef void (*test_function_t)(Manager *m);
 
-static void check(Manager *m, Unit *unit, int status_expected, int code_expected) {
-        Service *service = NULL;
+static void wait_for_service(Manager *m, Service *service) {
         usec_t ts;
         usec_t timeout = 2 * USEC_PER_SEC;
 
-        assert_se(m);
-        assert_se(unit);
-
-        service = SERVICE(unit);
-        printf("%s\n", unit->id);
-        exec_context_dump(&service->exec_context, stdout, "\t");
         ts = now(CLOCK_MONOTONIC);
         while (service->state != SERVICE_DEAD && service->state != SERVICE_FAILED) {
                 int r;
@@ -63,10 +58,22 @@ static void check(Manager *m, Unit *unit, int status_expected, int code_expected
 
                 n = now(CLOCK_MONOTONIC);
                 if (ts + timeout < n) {
-                        log_error("Test timeout when testing %s", unit->id);
+                        log_error("Test timeout when testing %s", UNIT(service)->id);
                         exit(EXIT_FAILURE);
                 }
         }
+}
+
+static void check(Manager *m, Unit *unit, int status_expected, int code_expected) {
+        Service *service = NULL;
+
+        assert_se(m);
+        assert_se(unit);
+
+        service = SERVICE(unit);
+        printf("%s\n", unit->id);
+        exec_context_dump(&service->exec_context, stdout, "\t");
+        wait_for_service(m, service);
         exec_status_dump(&service->main_exec_status, stdout, "\t");
         assert_se(service->main_exec_status.status == status_expected);
         assert_se(service->main_exec_status.code == code_expected);
@@ -453,6 +460,114 @@ static void test_exec_read_only_path_suceed(Manager *m) {
         test(m, "exec-read-only-path-succeed.service", 0, CLD_EXITED);
 }
 
+static usec_t spawn_repeatedly(Manager *m, Unit *unit, unsigned n) {
+        usec_t ts;
+        unsigned i;
+
+        ts = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                assert_se(UNIT_VTABLE(unit)->start(unit) >= 0);
+                wait_for_service(m, SERVICE(unit));
+                assert_se(SERVICE(unit)->main_exec_status.status == 0);
+        }
+
+        return now(CLOCK_MONOTONIC) - ts;
+}
+
+static void test_exec_spawn_rate(Manager *m) {
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX];
+        usec_t direct, helper;
+        unsigned n = 100;
+        Unit *unit;
+
+        /* Not so much a test as a benchmark: how long does it take to start a simple service, when we spawn it
+         * ourselves, and when the exec helper does it for us? */
+
+        assert_se(manager_load_unit(m, "exec-spawn-rate.service", NULL, NULL, &unit) >= 0);
+
+        direct = spawn_repeatedly(m, unit, n);
+
+        assert_se(exec_helper_new(&m->exec_helper) >= 0);
+        helper = spawn_repeatedly(m, unit, n);
+        m->exec_helper = exec_helper_free(m->exec_helper);
+
+        log_info("Spawned %s %u times in %s directly, in %s through the exec helper.",
+                 unit->id, n,
+                 format_timespan(a, sizeof(a), direct, USEC_PER_MSEC),
+                 format_timespan(b, sizeof(b), helper, USEC_PER_MSEC));
+}
+
+static void test_exec_helper_spawn(Manager *m) {
+        _cleanup_free_ char *line = NULL;
+        const char *p;
+        pid_t pid;
+        Unit *unit;
+
+        /* The service writes its PID and the environment variable it got, and exits with 42 */
+
+        (void) unlink("/tmp/test-exec-helper-spawn");
+
+        assert_se(manager_load_unit(m, "exec-helper-spawn.service", NULL, NULL, &unit) >= 0);
+        assert_se(UNIT_VTABLE(unit)->start(unit) >= 0);
+        check(m, unit, 42, CLD_EXITED);
+
+        assert_se(read_one_line_file("/tmp/test-exec-helper-spawn", &line) >= 0);
+        p = strchr(line, ' ');
+        assert_se(p);
+        assert_se(streq(p + 1, "word1"));
+        assert_se(parse_pid(strndupa(line, p - line), &pid) >= 0);
+        assert_se(pid == SERVICE(unit)->main_exec_status.pid);
+
+        (void) unlink("/tmp/test-exec-helper-spawn");
+}
+
+static int test_exec_helper_startup(void) {
+        Manager *m = NULL;
+        pid_t helper_pid;
+        siginfo_t si;
+        Unit *unit;
+        int r;
+
+        /* The system manager creates its exec helper in manager_new(), before manager_startup() runs. Make sure the
+         * latter leaves it alone, and that services are then spawned through it. */
+
+        r = manager_new(UNIT_FILE_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                log_notice_errno(r, "Skipping test: manager_new: %m");
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+
+        assert_se(exec_helper_new(&m->exec_helper) >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+        assert_se(m->exec_helper);
+
+        assert_se(manager_load_unit(m, "exec-spawn-rate.service", NULL, NULL, &unit) >= 0);
+        spawn_repeatedly(m, unit, 3);
+
+        /* A helper that stopped working would have been dropped by now */
+        assert_se(m->exec_helper);
+
+        test_exec_helper_spawn(m);
+        assert_se(m->exec_helper);
+
+        /* Kill the helper, but don't let the manager notice yet: the next request then runs into the closed
+         * socket, and the service has to be spawned directly. Wait until it is really gone, without reaping it,
+         * so that the request can't be queued before it dies. */
+        helper_pid = exec_helper_get_pid(m->exec_helper);
+        assert_se(helper_pid > 0);
+        assert_se(kill(helper_pid, SIGKILL) >= 0);
+        assert_se(waitid(P_PID, helper_pid, &si, WEXITED|WNOWAIT) >= 0);
+
+        test_exec_helper_spawn(m);
+        assert_se(!m->exec_helper);
+
+        manager_free(m);
+
+        return 0;
+}
+
 static int run_tests(UnitFileScope scope, const test_function_t *tests) {
         const test_function_t *test = NULL;
         Manager *m = NULL;
@@ -508,6 +623,7 @@ int main(int argc, char *argv[]) {
                 test_exec_ioschedulingclass,
                 test_exec_spec_interpolation,
                 test_exec_read_only_path_suceed,
+                test_exec_spawn_rate,
                 NULL,
         };
         static const test_function_t system_tests[] = {
@@ -539,6 +655,10 @@ int main(int argc, char *argv[]) {
         assert_se(unsetenv("VAR2") == 0);
         assert_se(unsetenv("VAR3") == 0);
 
+        r = test_exec_helper_startup();
+        if (r != 0)
+                return r;
+
         r = run_tests(UNIT_FILE_USER, user_tests);
         if (r != 0)
                 return r;
@@ -24,6 +24,7 @@
 #include "fd-util.h"
 #include "fileio.h"
 #include "macro.h"
+#include "process-util.h"
 
 static void test_close_many(void) {
         int fds[3];
@@ -103,11 +104,41 @@ static void test_open_serialization_fd(void) {
         write(fd, "test\n", 5);
 }
 
+static void test_close_all_fds_nomalloc(void) {
+        siginfo_t si;
+        pid_t pid;
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                int fds[3], i;
+
+                for (i = 0; i < 3; i++) {
+                        fds[i] = open("/dev/null", O_RDONLY|O_CLOEXEC);
+                        assert_se(fds[i] >= 0);
+                }
+
+                assert_se(close_all_fds_nomalloc(fds + 1, 1) >= 0);
+
+                assert_se(fcntl(fds[0], F_GETFD) < 0 && errno == EBADF);
+                assert_se(fcntl(fds[1], F_GETFD) >= 0);
+                assert_se(fcntl(fds[2], F_GETFD) < 0 && errno == EBADF);
+                assert_se(fcntl(STDERR_FILENO, F_GETFD) >= 0);
+
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(wait_for_terminate(pid, &si) >= 0);
+        assert_se(si.si_code == CLD_EXITED && si.si_status == EXIT_SUCCESS);
+}
+
 int main(int argc, char *argv[]) {
         test_close_many();
         test_close_nointr();
         test_same_fd();
         test_open_serialization_fd();
+        test_close_all_fds_nomalloc();
 
         return 0;
 }
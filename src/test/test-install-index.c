@@ -0,0 +1,150 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "install-index.h"
+#include "mkdir.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+
+static unsigned n_computed = 0;
+
+static int compute_state(InstallIndex *i, const char *name, UnitFileState *ret, void *userdata) {
+        bool same_name_link = false;
+        const char *dir = userdata;
+
+        n_computed++;
+
+        assert_se(install_index_has_symlinks(i));
+
+        if (install_index_find_symlinks(i, dir, name, &same_name_link) > 0)
+                *ret = UNIT_FILE_ENABLED;
+        else
+                *ret = UNIT_FILE_DISABLED;
+
+        return 0;
+}
+
+static void make_old(const char *path) {
+        const struct timespec ts[2] = {
+                { .tv_sec = 1000000000 },
+                { .tv_sec = 1000000000 },
+        };
+
+        /* Files created just now are "racy" and not persisted, hence backdate them */
+        assert_se(utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW) >= 0);
+}
+
+static void test_index(const char *root) {
+        _cleanup_(install_index_unrefp) InstallIndex *i = NULL, *j = NULL;
+        const char *dir, *wants, *p, *index_path;
+        _cleanup_strv_free_ char **search_path = NULL;
+        InstallIndexEntry *e;
+        size_t n;
+
+        dir = strjoina(root, "/system");
+        wants = strjoina(dir, "/multi-user.target.wants");
+        index_path = strjoina(root, "/unit-file-index");
+
+        search_path = strv_new(dir, strjoina(root, "/missing"), NULL);
+        assert_se(search_path);
+
+        assert_se(mkdir_p(wants, 0755) >= 0);
+
+        p = strjoina(dir, "/a.service");
+        assert_se(write_string_file(p, "[Install]\nWantedBy=multi-user.target\n", WRITE_STRING_FILE_CREATE) >= 0);
+        make_old(p);
+
+        p = strjoina(dir, "/b.service");
+        assert_se(write_string_file(p, "[Install]\nWantedBy=multi-user.target\n", WRITE_STRING_FILE_CREATE) >= 0);
+        make_old(p);
+
+        p = strjoina(wants, "/a.service");
+        assert_se(symlink("../a.service", p) >= 0);
+        make_old(p);
+
+        make_old(wants);
+        make_old(dir);
+
+        assert_se(install_index_acquire(index_path, getuid(), search_path, compute_state, (void*) dir, &i) >= 0);
+        assert_se(n_computed == 2);
+        assert_se(install_index_entries(i, &n) && n == 2);
+        assert_se(install_index_is_current(i));
+
+        e = install_index_get(i, "a.service");
+        assert_se(e && e->state == UNIT_FILE_ENABLED);
+        e = install_index_get(i, "b.service");
+        assert_se(e && e->state == UNIT_FILE_DISABLED);
+        assert_se(!install_index_get(i, "c.service"));
+
+        /* A second instance must read the index back from disk without recomputing anything */
+        assert_se(access(index_path, F_OK) >= 0);
+        assert_se(install_index_load(index_path, getuid(), search_path, &j) >= 0);
+        assert_se(j);
+        assert_se(!install_index_has_symlinks(j));
+        assert_se(install_index_is_current(j));
+        e = install_index_get(j, "a.service");
+        assert_se(e && e->state == UNIT_FILE_ENABLED);
+
+        /* An index for a different search path is not used */
+        j = install_index_unref(j);
+        assert_se(install_index_load(index_path, getuid(), STRV_MAKE(dir), &j) >= 0);
+        assert_se(!j);
+
+        /* Enabling b.service changes the mtime of the .wants directory */
+        p = strjoina(wants, "/b.service");
+        assert_se(symlink("../b.service", p) >= 0);
+        assert_se(!install_index_is_current(i));
+
+        i = install_index_unref(i);
+        n_computed = 0;
+        assert_se(install_index_acquire(index_path, getuid(), search_path, compute_state, (void*) dir, &i) >= 0);
+        assert_se(n_computed == 2);
+        e = install_index_get(i, "b.service");
+        assert_se(e && e->state == UNIT_FILE_ENABLED);
+
+        /* Editing a unit file in place is caught by refreshing */
+        p = strjoina(dir, "/a.service");
+        assert_se(write_string_file(p, "[Install]\nWantedBy=graphical.target\n", 0) >= 0);
+        n_computed = 0;
+        assert_se(install_index_refresh(i, "b.service", compute_state, (void*) dir) >= 0);
+        assert_se(n_computed == 0);
+        assert_se(install_index_refresh(i, NULL, compute_state, (void*) dir) >= 0);
+        assert_se(n_computed == 1);
+}
+
+int main(int argc, char *argv[]) {
+        char root[] = "/tmp/test-install-index.XXXXXX";
+
+        log_set_max_level(LOG_DEBUG);
+        log_parse_environment();
+        log_open();
+
+        assert_se(mkdtemp(root));
+
+        test_index(root);
+
+        assert_se(rm_rf(root, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return 0;
+}
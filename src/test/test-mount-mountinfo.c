@@ -0,0 +1,124 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "manager.h"
+#include "mount.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "test-helper.h"
+#include "tests.h"
+#include "unit-name.h"
+
+static Mount *get_mount(Manager *m, const char *path) {
+        _cleanup_free_ char *name = NULL;
+        Unit *u;
+
+        assert_se(unit_name_from_path(path, ".mount", &name) >= 0);
+
+        u = manager_get_unit(m, name);
+        return u ? MOUNT(u) : NULL;
+}
+
+static void test_mountinfo_incremental(Manager *m, const char *dir) {
+        _cleanup_free_ char *first = NULL, *second = NULL;
+        Mount *a, *b, *c;
+
+        first = strappend(dir, "/mountinfo-1");
+        second = strappend(dir, "/mountinfo-2");
+        assert_se(first && second);
+
+        assert_se(write_string_file(first,
+                                    "1001 1 0:40 / /test-mountinfo/a rw,relatime shared:1 - tmpfs tmpfs-a rw\n"
+                                    "1002 1 0:41 / /test-mountinfo/b rw,relatime shared:2 - tmpfs tmpfs-b rw\n",
+                                    WRITE_STRING_FILE_CREATE) >= 0);
+
+        /* a is unmounted, b is remounted read-only, c is mounted */
+        assert_se(write_string_file(second,
+                                    "1002 1 0:41 / /test-mountinfo/b ro,relatime shared:2 - tmpfs tmpfs-b ro\n"
+                                    "1003 1 0:42 / /test-mountinfo/c rw,relatime shared:3 - tmpfs tmpfs-c rw\n",
+                                    WRITE_STRING_FILE_CREATE) >= 0);
+
+        assert_se(mount_process_mountinfo(m, first) >= 0);
+        assert_se(hashmap_size(m->mountinfo_by_id) == 2);
+
+        a = get_mount(m, "/test-mountinfo/a");
+        b = get_mount(m, "/test-mountinfo/b");
+        assert_se(a && b);
+        assert_se(a->from_proc_self_mountinfo && a->state == MOUNT_MOUNTED);
+        assert_se(b->from_proc_self_mountinfo && b->state == MOUNT_MOUNTED);
+        assert_se(streq_ptr(b->parameters_proc_self_mountinfo.what, "tmpfs-b"));
+        assert_se(!get_mount(m, "/test-mountinfo/c"));
+
+        /* The snapshot is kept now, hence this goes through the incremental path */
+        assert_se(mount_process_mountinfo(m, second) >= 0);
+        assert_se(hashmap_size(m->mountinfo_by_id) == 2);
+        assert_se(hashmap_contains(m->mountinfo_by_id, INT_TO_PTR(1002)));
+        assert_se(hashmap_contains(m->mountinfo_by_id, INT_TO_PTR(1003)));
+
+        a = get_mount(m, "/test-mountinfo/a");
+        b = get_mount(m, "/test-mountinfo/b");
+        c = get_mount(m, "/test-mountinfo/c");
+        assert_se(b && c);
+        assert_se(!a || (!a->from_proc_self_mountinfo && a->state == MOUNT_DEAD));
+        assert_se(b->from_proc_self_mountinfo && b->state == MOUNT_MOUNTED);
+        assert_se(strstr(b->parameters_proc_self_mountinfo.options, "ro"));
+        assert_se(c->from_proc_self_mountinfo && c->state == MOUNT_MOUNTED);
+
+        /* The devices are only referenced by what is still mounted */
+        assert_se(!hashmap_contains(m->mountinfo_what_refs, "tmpfs-a"));
+        assert_se(hashmap_contains(m->mountinfo_what_refs, "tmpfs-b"));
+        assert_se(hashmap_contains(m->mountinfo_what_refs, "tmpfs-c"));
+
+        /* Feeding the same table again changes nothing */
+        assert_se(mount_process_mountinfo(m, second) >= 0);
+        assert_se(hashmap_size(m->mountinfo_by_id) == 2);
+        assert_se(b->state == MOUNT_MOUNTED && c->state == MOUNT_MOUNTED);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        char dir[] = "/tmp/test-mount-mountinfo.XXXXXX";
+        Manager *m = NULL;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+
+        r = manager_new(UNIT_FILE_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                log_notice_errno(r, "Skipping test: manager_new: %m");
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(mkdtemp(dir));
+
+        test_mountinfo_incremental(m, dir);
+
+        manager_free(m);
+
+        assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+
+        return EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@
 #include "namespace.h"
 #include "process-util.h"
 #include "string-util.h"
+#include "time-util.h"
 #include "util.h"
 
 static void test_tmpdir(const char *id, const char *A, const char *B) {
@@ -121,6 +122,52 @@ static void test_netns(void) {
         assert_se(n == 1);
 }
 
+static void test_namespace_plan(void) {
+        const char * const writable[] = {
+                "/var/lib/foo",
+                NULL
+        };
+
+        const char * const readonly[] = {
+                "/usr",
+                "/usr/share", /* covered by /usr, should be dropped */
+                NULL
+        };
+
+        const char * const inaccessible[] = {
+                "/home",
+                NULL
+        };
+
+        static const NameSpaceInfo ns_info = {};
+        _cleanup_(namespace_plan_freep) NamespacePlan *plan = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        unsigned i, n = 1000;
+        usec_t t;
+
+        assert_se(namespace_plan_new(NULL, NULL, &ns_info,
+                                     (char**) writable, (char**) readonly, (char**) inaccessible,
+                                     NULL, 0,
+                                     true, false,
+                                     PROTECT_HOME_YES, PROTECT_SYSTEM_STRICT,
+                                     &plan) >= 0);
+        assert_se(namespace_plan_n_mounts(plan) == 9);
+        plan = namespace_plan_free(plan);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < n; i++) {
+                assert_se(namespace_plan_new(NULL, NULL, &ns_info,
+                                             (char**) writable, (char**) readonly, (char**) inaccessible,
+                                             NULL, 0,
+                                             true, false,
+                                             PROTECT_HOME_YES, PROTECT_SYSTEM_STRICT,
+                                             &plan) >= 0);
+                plan = namespace_plan_free(plan);
+        }
+
+        log_info("Computed %u namespace plans in %s.", n, format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - t, 1));
+}
+
 int main(int argc, char *argv[]) {
         sd_id128_t bid;
         char boot_id[SD_ID128_STRING_MAX];
@@ -147,5 +194,7 @@ int main(int argc, char *argv[]) {
 
         test_netns();
 
+        test_namespace_plan();
+
         return 0;
 }
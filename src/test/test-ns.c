@@ -20,8 +20,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "alloc-util.h"
 #include "log.h"
 #include "namespace.h"
+#include "time-util.h"
 
 int main(int argc, char *argv[]) {
         const char * const writable[] = {
@@ -53,8 +55,11 @@ int main(int argc, char *argv[]) {
                 .protect_kernel_modules = true,
         };
 
+        _cleanup_(namespace_plan_freep) NamespacePlan *plan = NULL;
         char *root_directory;
         char *projects_directory;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t t;
         int r;
         char tmp_dir[] = "/tmp/systemd-private-XXXXXX",
              var_tmp_dir[] = "/var/tmp/systemd-private-XXXXXX";
@@ -76,6 +81,26 @@ int main(int argc, char *argv[]) {
         else
                 log_info("Not chrooted");
 
+        t = now(CLOCK_MONOTONIC);
+        r = namespace_plan_new(root_directory,
+                               NULL,
+                               &ns_info,
+                               (char **) writable,
+                               (char **) readonly,
+                               (char **) inaccessible,
+                               &(BindMount) { .source = (char*) "/usr/bin", .destination = (char*) "/etc/systemd", .read_only = true }, 1,
+                               true,
+                               true,
+                               PROTECT_HOME_NO,
+                               PROTECT_SYSTEM_NO,
+                               &plan);
+        if (r < 0)
+                return log_error_errno(r, "Failed to compute namespace plan: %m");
+
+        log_info("Computed namespace plan with %u mounts in %s.",
+                 namespace_plan_n_mounts(plan),
+                 format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - t, 1));
+
         r = setup_namespace(root_directory,
                             NULL,
                             &ns_info,
@@ -88,7 +113,8 @@ int main(int argc, char *argv[]) {
                             PROTECT_HOME_NO,
                             PROTECT_SYSTEM_NO,
                             0,
-                            0);
+                            0,
+                            plan);
         if (r < 0) {
                 log_error_errno(r, "Failed to setup namespace: %m");
 
@@ -0,0 +1,382 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "log.h"
+#include "macro.h"
+#include "serialize.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+
+#define N_SECTIONS 20
+#define N_ITEMS 30
+#define N_FUZZ 2000
+
+typedef struct TestItem {
+        char key[16];
+        SerializedType type;
+        char string[64];
+        bool boolean;
+        uint64_t uint64;
+        dual_timestamp timestamp;
+        int fd;
+} TestItem;
+
+typedef struct TestSection {
+        char name[32];
+        TestItem items[N_ITEMS];
+        unsigned n_items;
+} TestSection;
+
+static const char *keys[] = {
+        "state", "result", "control-pid", "main-pid", "cgroup", "socket",
+        "timestamp", "flag", "counter", "fd", "env", "ref",
+};
+
+static void random_string(char *s, size_t n) {
+        static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-_.@=\\ \t\"'";
+        size_t i, l;
+        char *p;
+
+        l = rand() % (n - 1);
+        for (i = 0; i < l; i++)
+                s[i] = chars[rand() % (sizeof(chars) - 1)];
+        s[l] = 0;
+
+        /* The text format strips whitespace around values */
+        p = strstrip(s);
+        memmove(s, p, strlen(p) + 1);
+}
+
+static void random_section(TestSection *t, unsigned n) {
+        unsigned i;
+
+        xsprintf(t->name, "unit-%u.service", n);
+
+        t->n_items = rand() % N_ITEMS;
+        for (i = 0; i < t->n_items; i++) {
+                TestItem *item = t->items + i;
+
+                strcpy(item->key, keys[rand() % ELEMENTSOF(keys)]);
+                item->type = rand() % _SERIALIZED_TYPE_MAX;
+
+                switch (item->type) {
+
+                case SERIALIZED_STRING:
+                        random_string(item->string, sizeof(item->string));
+                        break;
+
+                case SERIALIZED_BOOLEAN:
+                        item->boolean = rand() % 2;
+                        break;
+
+                case SERIALIZED_UINT64:
+                        item->uint64 = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+                        break;
+
+                case SERIALIZED_TIMESTAMP:
+                        item->timestamp.realtime = 1 + (uint64_t) rand();
+                        item->timestamp.monotonic = (uint64_t) rand();
+                        break;
+
+                case SERIALIZED_FD:
+                        item->fd = rand() % 1024;
+                        break;
+
+                default:
+                        assert_not_reached("Unexpected type");
+                }
+        }
+}
+
+static void write_section(Serializer *s, FILE *f, TestSection *t, bool named) {
+        unsigned i;
+
+        if (named)
+                assert_se(serialize_section(s, f, t->name) >= 0);
+
+        for (i = 0; i < t->n_items; i++) {
+                TestItem *item = t->items + i;
+
+                switch (item->type) {
+
+                case SERIALIZED_STRING:
+                        assert_se(serialize_item(s, f, item->key, item->string) > 0);
+                        break;
+
+                case SERIALIZED_BOOLEAN:
+                        assert_se(serialize_item_boolean(s, f, item->key, item->boolean) > 0);
+                        break;
+
+                case SERIALIZED_UINT64:
+                        assert_se(serialize_item_uint64(s, f, item->key, item->uint64) > 0);
+                        break;
+
+                case SERIALIZED_TIMESTAMP:
+                        assert_se(serialize_dual_timestamp(s, f, item->key, &item->timestamp) > 0);
+                        break;
+
+                case SERIALIZED_FD:
+                        assert_se(serialize_item_fd(s, f, item->key, item->fd) > 0);
+                        break;
+
+                default:
+                        assert_not_reached("Unexpected type");
+                }
+        }
+
+        assert_se(serialize_end(s, f) >= 0);
+}
+
+static void check_section(Deserializer *d, TestSection *t) {
+        SerializedItem i;
+        unsigned n;
+
+        for (n = 0; n < t->n_items; n++) {
+                TestItem *item = t->items + n;
+                dual_timestamp ts;
+                uint64_t u;
+                bool b;
+                int fd;
+
+                assert_se(deserializer_read_item(d, &i) > 0);
+                assert_se(streq(i.key, item->key));
+
+                switch (item->type) {
+
+                case SERIALIZED_STRING:
+                        assert_se(streq(serialized_item_string(&i), item->string));
+                        break;
+
+                case SERIALIZED_BOOLEAN:
+                        assert_se(serialized_item_get_boolean(&i, &b) >= 0);
+                        assert_se(b == item->boolean);
+                        assert_se(streq(serialized_item_string(&i), yes_no(item->boolean)));
+                        break;
+
+                case SERIALIZED_UINT64:
+                        assert_se(serialized_item_get_uint64(&i, &u) >= 0);
+                        assert_se(u == item->uint64);
+                        break;
+
+                case SERIALIZED_TIMESTAMP:
+                        assert_se(serialized_item_get_timestamp(&i, &ts) >= 0);
+                        assert_se(ts.realtime == item->timestamp.realtime);
+                        assert_se(ts.monotonic == item->timestamp.monotonic);
+                        break;
+
+                case SERIALIZED_FD:
+                        assert_se(serialized_item_get_fd(&i, &fd) >= 0);
+                        assert_se(fd == item->fd);
+                        break;
+
+                default:
+                        assert_not_reached("Unexpected type");
+                }
+        }
+
+        assert_se(deserializer_read_item(d, &i) == 0);
+}
+
+static FILE* open_stream(void) {
+        FILE *f;
+        int fd;
+
+        fd = open_serialization_fd("test-serialize");
+        assert_se(fd >= 0);
+
+        f = fdopen(fd, "w+");
+        assert_se(f);
+
+        return f;
+}
+
+static void test_round_trip(bool binary, TestSection *sections) {
+        _cleanup_(serializer_freep) Serializer *s = NULL;
+        _cleanup_(deserializer_freep) Deserializer *d = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        const char *name;
+        unsigned n;
+
+        if (binary)
+                assert_se(serializer_new(&s) >= 0);
+
+        f = open_stream();
+
+        assert_se(serialize_header(s, f) >= 0);
+        for (n = 0; n < N_SECTIONS; n++)
+                write_section(s, f, sections + n, n > 0);
+
+        assert_se(fflush(f) == 0);
+        assert_se(!ferror(f));
+        assert_se(fseeko(f, 0, SEEK_SET) == 0);
+
+        assert_se(deserializer_new(f, &d) >= 0);
+        assert_se(deserializer_is_binary(d) == binary);
+
+        check_section(d, sections);
+        for (n = 1; n < N_SECTIONS; n++) {
+                assert_se(deserializer_read_section(d, &name) > 0);
+                assert_se(streq(name, sections[n].name));
+
+                check_section(d, sections + n);
+        }
+
+        assert_se(deserializer_read_section(d, &name) == 0);
+}
+
+static int lookup_counter(const char *key) {
+        static unsigned n_calls = 0;
+
+        if (!key)
+                return n_calls;
+
+        n_calls++;
+        return streq(key, "counter");
+}
+
+static void test_lookup_key(void) {
+        _cleanup_(serializer_freep) Serializer *s = NULL;
+        _cleanup_(deserializer_freep) Deserializer *d = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        SerializedItem i;
+        unsigned n;
+
+        assert_se(serializer_new(&s) >= 0);
+        f = open_stream();
+
+        assert_se(serialize_header(s, f) >= 0);
+        for (n = 0; n < 10; n++) {
+                assert_se(serialize_item_uint64(s, f, "counter", n) > 0);
+                assert_se(serialize_item(s, f, "state", "running") > 0);
+        }
+        assert_se(serialize_end(s, f) >= 0);
+
+        assert_se(fflush(f) == 0);
+        assert_se(fseeko(f, 0, SEEK_SET) == 0);
+
+        assert_se(deserializer_new(f, &d) >= 0);
+
+        /* Every distinct key is resolved only once */
+        for (n = 0; n < 10; n++) {
+                assert_se(deserializer_read_item(d, &i) > 0);
+                assert_se(deserializer_lookup_key(d, &i, lookup_counter) == 1);
+                assert_se(deserializer_read_item(d, &i) > 0);
+                assert_se(deserializer_lookup_key(d, &i, lookup_counter) == 0);
+        }
+        assert_se(deserializer_read_item(d, &i) == 0);
+
+        assert_se(lookup_counter(NULL) == 2);
+}
+
+static void test_fuzz(const char *data, size_t size) {
+        _cleanup_free_ char *copy = NULL;
+        unsigned n;
+
+        /* Feed corrupted and truncated versions of a valid binary serialization to the deserializer,
+         * which must fail gracefully */
+
+        copy = malloc(size);
+        assert_se(copy);
+
+        for (n = 0; n < N_FUZZ; n++) {
+                _cleanup_(deserializer_freep) Deserializer *d = NULL;
+                _cleanup_fclose_ FILE *f = NULL;
+                size_t l, k, j;
+                const char *name;
+                SerializedItem i;
+                int r;
+
+                memcpy(copy, data, size);
+
+                l = 1 + rand() % size;
+                k = rand() % 8;
+                for (j = 0; j < k; j++)
+                        copy[rand() % l] = rand();
+
+                /* Keep the first byte sometimes, so that we get past the format detection */
+                if (rand() % 2)
+                        copy[0] = 0;
+
+                f = open_stream();
+                assert_se(fwrite(copy, 1, l, f) == l);
+                assert_se(fflush(f) == 0);
+                assert_se(fseeko(f, 0, SEEK_SET) == 0);
+
+                if (deserializer_new(f, &d) < 0)
+                        continue;
+
+                for (;;) {
+                        r = deserializer_read_item(d, &i);
+                        if (r > 0) {
+                                (void) serialized_item_string(&i);
+                                continue;
+                        }
+                        if (r < 0)
+                                break;
+
+                        r = deserializer_read_section(d, &name);
+                        if (r <= 0)
+                                break;
+                }
+        }
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(serializer_freep) Serializer *s = NULL;
+        _cleanup_free_ TestSection *sections = NULL;
+        _cleanup_free_ char *data = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        unsigned seed, n;
+        size_t size;
+
+        log_parse_environment();
+        log_open();
+
+        seed = argc > 1 ? (unsigned) atoi(argv[1]) : 4711;
+        srand(seed);
+        log_info("Using random seed %u", seed);
+
+        sections = new0(TestSection, N_SECTIONS);
+        assert_se(sections);
+
+        for (n = 0; n < N_SECTIONS; n++)
+                random_section(sections + n, n);
+
+        test_round_trip(false, sections);
+        test_round_trip(true, sections);
+        test_lookup_key();
+
+        /* Generate a valid binary serialization to corrupt */
+        assert_se(serializer_new(&s) >= 0);
+        f = open_stream();
+        assert_se(serialize_header(s, f) >= 0);
+        for (n = 0; n < N_SECTIONS; n++)
+                write_section(s, f, sections + n, n > 0);
+        assert_se(fflush(f) == 0);
+        assert_se(fseeko(f, 0, SEEK_SET) == 0);
+        assert_se(read_full_stream(f, &data, &size) >= 0);
+
+        test_fuzz(data, size);
+
+        return EXIT_SUCCESS;
+}
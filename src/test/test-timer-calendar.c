@@ -0,0 +1,186 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "alloc-util.h"
+#include "calendarspec.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "test-helper.h"
+#include "tests.h"
+#include "timer.h"
+#include "unit.h"
+
+/* 2017-01-01 00:00:00 UTC, in winter, so that CET is UTC+1 */
+#define DAY (24ULL * 3600ULL * USEC_PER_SEC)
+#define HOUR (3600ULL * USEC_PER_SEC)
+#define JAN1 (17167ULL * DAY)
+
+static void set_tz(const char *tz) {
+        if (tz)
+                assert_se(setenv("TZ", tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
+static void test_memoize(Manager *m) {
+        CalendarSpec *spec, *hourly;
+        TimerCalendar *a, *b;
+        usec_t u;
+
+        assert_se(calendar_spec_from_string("*-*-* 00:00:00 UTC", &spec) >= 0);
+        assert_se(calendar_spec_from_string("*-*-* *:00:00 UTC", &hourly) >= 0);
+
+        /* The same specification shares one calendar */
+        assert_se(timer_calendar_ref(m, spec, &a) >= 0);
+        assert_se(timer_calendar_ref(m, spec, &b) >= 0);
+        assert_se(a == b);
+        assert_se(a->n_ref == 2);
+
+        assert_se(timer_calendar_next(a, spec, JAN1 + HOUR, &u) >= 0);
+        assert_se(u == JAN1 + DAY);
+        assert_se(a->from == JAN1 + HOUR);
+        assert_se(a->next == JAN1 + DAY);
+
+        /* Inside [from, next) the result is reused without looking at the specification at all, hence a
+         * different one shows that nothing was calculated */
+        assert_se(timer_calendar_next(b, hourly, JAN1 + 5 * HOUR, &u) >= 0);
+        assert_se(u == JAN1 + DAY);
+        assert_se(timer_calendar_next(b, hourly, JAN1 + DAY - 1, &u) >= 0);
+        assert_se(u == JAN1 + DAY);
+
+        /* An earlier base time leading to the same result extends the range */
+        assert_se(timer_calendar_next(a, spec, JAN1 + 1, &u) >= 0);
+        assert_se(u == JAN1 + DAY);
+        assert_se(a->from == JAN1 + 1);
+        assert_se(a->next == JAN1 + DAY);
+
+        /* Once the base time reaches the elapse it is calculated anew */
+        assert_se(timer_calendar_next(a, spec, JAN1 + DAY, &u) >= 0);
+        assert_se(u == JAN1 + 2 * DAY);
+        assert_se(a->from == JAN1 + DAY);
+        assert_se(a->next == JAN1 + 2 * DAY);
+
+        assert_se(timer_calendar_next(a, hourly, JAN1 + 2 * DAY + HOUR, &u) >= 0);
+        assert_se(u == JAN1 + 2 * DAY + 2 * HOUR);
+        assert_se(a->from == JAN1 + 2 * DAY + HOUR);
+
+        /* After a flush nothing is reused */
+        timer_calendar_flush(a);
+        assert_se(a->from == 0 && a->next == 0);
+        assert_se(timer_calendar_next(a, spec, JAN1 + 2 * DAY + HOUR, &u) >= 0);
+        assert_se(u == JAN1 + 3 * DAY);
+
+        assert_se(!timer_calendar_unref(b));
+        assert_se(a->n_ref == 1);
+        assert_se(!timer_calendar_unref(a));
+        assert_se(!hashmap_contains(m->timer_calendars, "*-*-* 00:00:00 UTC"));
+
+        calendar_spec_free(spec);
+        calendar_spec_free(hourly);
+}
+
+static void test_flush_on_clock_change(Manager *m) {
+        TimerCalendar *c;
+        TimerValue *v;
+        Unit *u;
+        usec_t n;
+
+        /* A change of the system clock drops what the calendars of all timers remember, not only those of the
+         * timers currently waiting, as the calendars are shared */
+
+        assert_se(unit_new_for_name(m, sizeof(Timer), "test-timer-calendar.timer", &u) >= 0);
+        assert_se(TIMER(u)->state == TIMER_DEAD);
+
+        v = new0(TimerValue, 1);
+        assert_se(v);
+        v->base = TIMER_CALENDAR;
+        assert_se(calendar_spec_from_string("*-*-* 00:00:00 UTC", &v->calendar_spec) >= 0);
+        assert_se(timer_calendar_ref(m, v->calendar_spec, &v->calendar) >= 0);
+        LIST_PREPEND(value, TIMER(u)->values, v);
+
+        c = v->calendar;
+        assert_se(timer_calendar_next(c, v->calendar_spec, JAN1 + HOUR, &n) >= 0);
+        assert_se(n == JAN1 + DAY);
+        assert_se(c->next == JAN1 + DAY);
+
+        UNIT_VTABLE(u)->time_change(u);
+        assert_se(c->from == 0 && c->next == 0);
+
+        unit_free(u);
+}
+
+static void test_flush_on_timezone_change(Manager *m) {
+        _cleanup_free_ char *old_tz = NULL;
+        CalendarSpec *spec;
+        TimerCalendar *c;
+        usec_t u;
+
+        if (getenv("TZ"))
+                assert_se(old_tz = strdup(getenv("TZ")));
+
+        assert_se(calendar_spec_from_string("*-*-* 00:00:00", &spec) >= 0);
+        assert_se(timer_calendar_ref(m, spec, &c) >= 0);
+
+        set_tz("UTC");
+        assert_se(timer_calendar_next(c, spec, JAN1 + HOUR, &u) >= 0);
+        assert_se(u == JAN1 + DAY);
+
+        /* Midnight in CET is an hour earlier, the result for UTC must not be reused */
+        set_tz("CET");
+        assert_se(timer_calendar_next(c, spec, JAN1 + HOUR, &u) >= 0);
+        assert_se(u == JAN1 + DAY - HOUR);
+        assert_se(c->next == JAN1 + DAY - HOUR);
+
+        /* Same zone, same result */
+        assert_se(timer_calendar_next(c, spec, JAN1 + 2 * HOUR, &u) >= 0);
+        assert_se(u == JAN1 + DAY - HOUR);
+
+        assert_se(!timer_calendar_unref(c));
+        calendar_spec_free(spec);
+
+        set_tz(old_tz);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(rm_rf_physical_and_freep) char *runtime_dir = NULL;
+        Manager *m = NULL;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        assert_se(runtime_dir = setup_fake_runtime_dir());
+
+        r = manager_new(UNIT_FILE_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                log_notice_errno(r, "Skipping test: manager_new: %m");
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+
+        test_memoize(m);
+        test_flush_on_clock_change(m);
+        test_flush_on_timezone_change(m);
+
+        manager_free(m);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "alloc-util.h"
+#include "conf-parser.h"
+#include "fileio.h"
+#include "log.h"
+#include "macro.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "strv.h"
+#include "unit-cache.h"
+
+static char *setting_a = NULL;
+static char **setting_b = NULL;
+
+static const ConfigTableItem items[] = {
+        { "Section", "A", config_parse_string, 0, &setting_a },
+        { "Section", "B", config_parse_strv,   0, &setting_b },
+        {}
+};
+
+static void reset_settings(void) {
+        setting_a = mfree(setting_a);
+        setting_b = strv_free(setting_b);
+}
+
+static void backdate(const char *fn) {
+        struct timespec ts[2] = {
+                { .tv_sec = 1, .tv_nsec = 0 },
+                { .tv_sec = 1, .tv_nsec = 0 },
+        };
+
+        /* Files modified just now are never cached */
+        assert_se(utimensat(AT_FDCWD, fn, ts, 0) >= 0);
+}
+
+static int parse(UnitCache *c, const char *fn) {
+        reset_settings();
+
+        return unit_cache_parse(c, NULL, fn, NULL, "Section\0",
+                                config_item_table_lookup, items,
+                                false, false, true, NULL);
+}
+
+static void test_unit_cache(void) {
+        char dir[] = "/tmp/test-unit-cache.XXXXXX";
+        _cleanup_(unit_cache_freep) UnitCache *c = NULL, *d = NULL;
+        _cleanup_free_ char *fn = NULL, *cache = NULL;
+        const UnitCacheStats *s;
+
+        assert_se(mkdtemp(dir));
+        fn = strappend(dir, "/test.conf");
+        cache = strappend(dir, "/cache");
+        assert_se(fn && cache);
+
+        assert_se(write_string_file(fn,
+                                    "[Section]\n"
+                                    "# Comment\n"
+                                    "A=foo\n"
+                                    "B=one \\\n"
+                                    "  two\n"
+                                    "B=three\n",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+        backdate(fn);
+
+        assert_se(unit_cache_new(&c) >= 0);
+        unit_cache_start(c);
+
+        /* The first time the file is parsed and recorded */
+        assert_se(parse(c, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "foo"));
+        assert_se(strv_equal(setting_b, STRV_MAKE("one", "two", "three")));
+
+        s = unit_cache_get_stats(c);
+        assert_se(s->n_hits == 0);
+        assert_se(s->n_misses == 1);
+
+        /* The second time the assignments are replayed from the cache */
+        assert_se(parse(c, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "foo"));
+        assert_se(strv_equal(setting_b, STRV_MAKE("one", "two", "three")));
+        assert_se(s->n_hits == 1);
+        assert_se(s->n_misses == 1);
+
+        /* Round-trip through the on-disk format */
+        assert_se(unit_cache_save(c, cache) >= 0);
+        assert_se(unit_cache_new(&d) >= 0);
+        assert_se(unit_cache_load(d, cache) >= 0);
+        unit_cache_start(d);
+
+        assert_se(parse(d, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "foo"));
+        assert_se(strv_equal(setting_b, STRV_MAKE("one", "two", "three")));
+
+        s = unit_cache_get_stats(d);
+        assert_se(s->n_hits == 1);
+        assert_se(s->n_misses == 0);
+
+        /* Changing the file invalidates the entry */
+        assert_se(write_string_file(fn,
+                                    "[Section]\n"
+                                    "A=changed\n",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+        backdate(fn);
+
+        assert_se(parse(d, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "changed"));
+        assert_se(strv_isempty(setting_b));
+        assert_se(s->n_hits == 1);
+        assert_se(s->n_misses == 1);
+
+        /* Files config_parse() warns about are not cached, as the warnings would be lost on a cache hit */
+        assert_se(write_string_file(fn,
+                                    "[Section]\n"
+                                    "A=warned\n"
+                                    "[Other]\n"
+                                    "A=ignored\n",
+                                    WRITE_STRING_FILE_CREATE) == 0);
+        backdate(fn);
+
+        assert_se(parse(d, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "warned"));
+        assert_se(parse(d, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "warned"));
+        assert_se(s->n_hits == 1);
+        assert_se(s->n_misses == 3);
+
+        /* A truncated cache file is ignored */
+        assert_se(write_string_file(cache, "SDUCACHE", WRITE_STRING_FILE_CREATE) == 0);
+        d = unit_cache_free(d);
+        assert_se(unit_cache_new(&d) >= 0);
+        assert_se(unit_cache_load(d, cache) >= 0);
+        unit_cache_start(d);
+        assert_se(parse(d, fn) >= 0);
+        assert_se(streq_ptr(setting_a, "warned"));
+        assert_se(unit_cache_get_stats(d)->n_misses == 1);
+
+        reset_settings();
+        assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+static void test_unit_cache_prefetch(void) {
+        char dir[] = "/tmp/test-unit-cache.XXXXXX";
+        _cleanup_(unit_cache_freep) UnitCache *c = NULL;
+        _cleanup_free_ char *a = NULL, *b = NULL;
+        const UnitCacheStats *s;
+        UnitCachePrefetch files[2];
+        int r;
+
+        assert_se(mkdtemp(dir));
+        a = strappend(dir, "/a.conf");
+        b = strappend(dir, "/b.conf");
+        assert_se(a && b);
+
+        assert_se(write_string_file(a, "[Section]\nA=a\n", WRITE_STRING_FILE_CREATE) == 0);
+        /* Includes are left to the regular parser */
+        assert_se(write_string_file(b, ".include /dev/null\n[Section]\nA=b\n", WRITE_STRING_FILE_CREATE) == 0);
+        backdate(a);
+        backdate(b);
+
+        files[0] = (UnitCachePrefetch) { .path = a, .sections = "Section\0" };
+        files[1] = (UnitCachePrefetch) { .path = b, .sections = "Section\0" };
+
+        assert_se(unit_cache_new(&c) >= 0);
+        unit_cache_start(c);
+
+        r = unit_cache_prefetch(c, files, ELEMENTSOF(files));
+        assert_se(r >= 0);
+        if (r == 0) {
+                log_info("Prefetching is disabled on single CPU systems, skipping.");
+                assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+                return;
+        }
+        assert_se(r == 1);
+
+        s = unit_cache_get_stats(c);
+
+        assert_se(parse(c, a) >= 0);
+        assert_se(streq_ptr(setting_a, "a"));
+        assert_se(s->n_hits == 1);
+        assert_se(s->n_misses == 0);
+
+        assert_se(parse(c, b) >= 0);
+        assert_se(streq_ptr(setting_a, "b"));
+        assert_se(s->n_hits == 1);
+
+        reset_settings();
+        assert_se(rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+int main(int argc, char *argv[]) {
+        log_parse_environment();
+        log_open();
+
+        test_unit_cache();
+        test_unit_cache_prefetch();
+
+        return EXIT_SUCCESS;
+}
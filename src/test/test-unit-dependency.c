@@ -0,0 +1,116 @@
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "log.h"
+#include "macro.h"
+#include "unit.h"
+#include "unit-dependency.h"
+
+#define N_UNITS 64
+
+static Unit units[N_UNITS];
+
+static void test_add_remove(void) {
+        UnitDependencies t = {};
+        unsigned k;
+        size_t j;
+
+        /* Add in a scrambled order, the table must come out sorted */
+        for (k = 0; k < N_UNITS; k++) {
+                Unit *u = units + (k * 37) % N_UNITS;
+
+                assert_se(unit_dependencies_add(&t, u, UNIT_DEPENDENCY_MASK(UNIT_WANTS)) == (int) UNIT_DEPENDENCY_MASK(UNIT_WANTS));
+                if (k % 2 == 0)
+                        assert_se(unit_dependencies_add(&t, u, UNIT_DEPENDENCY_MASK(UNIT_WANTS)|UNIT_DEPENDENCY_MASK(UNIT_AFTER)) == (int) UNIT_DEPENDENCY_MASK(UNIT_AFTER));
+        }
+
+        assert_se(t.n_entries == N_UNITS);
+        for (j = 1; j < t.n_entries; j++)
+                assert_se(t.entries[j - 1].other < t.entries[j].other);
+
+        assert_se(unit_dependencies_count(&t, UNIT_DEPENDENCY_MASK(UNIT_WANTS)) == N_UNITS);
+        assert_se(unit_dependencies_count(&t, UNIT_DEPENDENCY_MASK(UNIT_AFTER)) == N_UNITS / 2);
+        assert_se(unit_dependencies_count(&t, UNIT_DEPENDENCY_MASK(UNIT_BEFORE)) == 0);
+        assert_se(!unit_dependencies_first(&t, UNIT_DEPENDENCY_MASK(UNIT_BEFORE)));
+        assert_se(unit_dependencies_first(&t, UNIT_DEPENDENCY_MASK(UNIT_WANTS)) == units);
+
+        assert_se(unit_dependencies_contains(&t, units, UNIT_AFTER));
+        assert_se(!unit_dependencies_contains(&t, units + 37, UNIT_AFTER));
+
+        /* Removing the last dependency type drops the entry */
+        assert_se(unit_dependencies_remove(&t, units, UNIT_DEPENDENCY_MASK(UNIT_AFTER)) == UNIT_DEPENDENCY_MASK(UNIT_AFTER));
+        assert_se(unit_dependencies_get(&t, units) == UNIT_DEPENDENCY_MASK(UNIT_WANTS));
+        assert_se(t.n_entries == N_UNITS);
+        assert_se(unit_dependencies_remove(&t, units, UINT32_MAX) == UNIT_DEPENDENCY_MASK(UNIT_WANTS));
+        assert_se(unit_dependencies_get(&t, units) == 0);
+        assert_se(t.n_entries == N_UNITS - 1);
+        assert_se(unit_dependencies_remove(&t, units, UINT32_MAX) == 0);
+
+        unit_dependencies_clear(&t);
+        assert_se(t.n_entries == 0);
+}
+
+static void test_iterate(void) {
+        Unit meta = {}, *other;
+        unsigned k, n;
+        Iterator i;
+
+        for (k = 0; k < N_UNITS; k++)
+                assert_se(unit_dependencies_add(&meta.dependencies, units + k,
+                                                UNIT_DEPENDENCY_MASK(k % 3 == 0 ? UNIT_REQUIRES : UNIT_WANTS)) > 0);
+
+        n = 0;
+        UNIT_FOREACH_DEPENDENCY(other, &meta, UNIT_REQUIRES, i) {
+                assert_se((other - units) % 3 == 0);
+                n++;
+        }
+        assert_se(n == (N_UNITS + 2) / 3);
+
+        n = 0;
+        UNIT_FOREACH_DEPENDENCY_MASK(other, &meta, UNIT_DEPENDENCY_MASK(UNIT_REQUIRES)|UNIT_DEPENDENCY_MASK(UNIT_WANTS), i)
+                n++;
+        assert_se(n == N_UNITS);
+
+        /* Removing the current entry, and adding entries before and after it, while iterating */
+        n = 0;
+        UNIT_FOREACH_DEPENDENCY(other, &meta, UNIT_WANTS, i) {
+                assert_se((other - units) % 3 != 0);
+                assert_se(unit_dependencies_remove(&meta.dependencies, other, UINT32_MAX) != 0);
+
+                if (other - units < N_UNITS - 1)
+                        assert_se(unit_dependencies_add(&meta.dependencies, other + 1, UNIT_DEPENDENCY_MASK(UNIT_BEFORE)) >= 0);
+                assert_se(unit_dependencies_add(&meta.dependencies, units, UNIT_DEPENDENCY_MASK(UNIT_WANTS)) >= 0);
+                n++;
+        }
+        assert_se(n == N_UNITS - (N_UNITS + 2) / 3);
+        assert_se(unit_dependencies_count(&meta.dependencies, UNIT_DEPENDENCY_MASK(UNIT_WANTS)) == 1);
+
+        unit_dependencies_clear(&meta.dependencies);
+}
+
+int main(int argc, char *argv[]) {
+        log_parse_environment();
+        log_open();
+
+        test_add_remove();
+        test_iterate();
+
+        return EXIT_SUCCESS;
+}